@@ -0,0 +1,435 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Synthetic directory tree generator for benchmarks. Trees are fully defined
+ * by shape, scale and seed, so the same tree is generated on every run and
+ * every machine (only file times differ).
+ */
+
+#define GENTREE_BUFFER_SIZE (1 << 16)
+#define GENTREE_PATH_SIZE 4096
+#define GENTREE_DEFAULT_SEED 1
+
+/* Totals of generated tree.
+ */
+struct tree_stats
+{
+    uint64_t directory_count;
+    uint64_t file_count;
+    uint64_t symlink_count;
+    uint64_t content_bytes;
+};
+
+/* Generator state.
+ */
+struct generator
+{
+    uint64_t random_state;
+    uint8_t buffer[GENTREE_BUFFER_SIZE];
+    struct tree_stats stats;
+};
+
+static const char* const WORDS[] = {
+    "archive", "anchor", "field",  "header", "content", "entry", "block",
+    "chunk",   "index",  "stream", "codec",  "offset",  "size",  "mode",
+    "time",    "name",   "path",   "file",   "data",    "tree"
+};
+
+static uint64_t
+next_random(struct generator* generator)
+{
+    uint64_t value = (generator->random_state += 0x9e3779b97f4a7c15ULL);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static void
+fail(const char* message, const char* path)
+{
+    fprintf(stderr, "gentree: %s %s: %s\n", message, path, strerror(errno));
+    exit(1);
+}
+
+static void
+make_directory(struct generator* generator, const char* path)
+{
+    if (mkdir(path, 0755) < 0)
+        fail("can not create directory", path);
+    generator->stats.directory_count++;
+}
+
+/* Fill size bytes of buffer: text-like data made of words (compressible) if
+ * is_text is set, random bytes otherwise.
+ */
+static void
+fill_buffer(struct generator* generator, size_t size, int is_text)
+{
+    size_t position = 0;
+    if (!is_text) {
+        while (position < size) {
+            const uint64_t value = next_random(generator);
+            const size_t portion =
+              (size - position < sizeof(value)) ? size - position
+                                                : sizeof(value);
+            memcpy(generator->buffer + position, &value, portion);
+            position += portion;
+        }
+        return;
+    }
+
+    while (position < size) {
+        const uint64_t value = next_random(generator);
+        const char* const word =
+          WORDS[value % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        size_t length = strlen(word);
+        if (length > size - position)
+            length = size - position;
+        memcpy(generator->buffer + position, word, length);
+        position += length;
+        if (position < size) {
+            generator->buffer[position] =
+              ((value >> 32) % 12 == 0) ? '\n' : ' ';
+            position++;
+        }
+    }
+}
+
+/* Create regular file at path with size bytes of generated content.
+ */
+static void
+make_file(struct generator* generator, const char* path, uint64_t size)
+{
+    const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        fail("can not create file", path);
+
+    const int is_text = (next_random(generator) % 2) == 0;
+    uint64_t remaining_size = size;
+    while (remaining_size > 0) {
+        const size_t portion = (remaining_size < GENTREE_BUFFER_SIZE)
+                                 ? (size_t)remaining_size
+                                 : GENTREE_BUFFER_SIZE;
+        fill_buffer(generator, portion, is_text);
+        size_t written = 0;
+        while (written < portion) {
+            const ssize_t result =
+              write(fd, generator->buffer + written, portion - written);
+            if (result < 0)
+                fail("can not write file", path);
+            written += (size_t)result;
+        }
+        remaining_size -= portion;
+    }
+
+    if (close(fd) < 0)
+        fail("can not close file", path);
+    generator->stats.file_count++;
+    generator->stats.content_bytes += size;
+}
+
+static void
+make_symlink(struct generator* generator, const char* target, const char* path)
+{
+    if (symlink(target, path) < 0)
+        fail("can not create symlink", path);
+    generator->stats.symlink_count++;
+    generator->stats.content_bytes += strlen(target) + 1;
+}
+
+/* Return file size with roughly log-uniform distribution from 0 to
+ * max_size.
+ */
+static uint64_t
+random_size(struct generator* generator, uint64_t max_size)
+{
+    const uint64_t value = next_random(generator);
+    unsigned int bits = 0;
+    while (((uint64_t)1 << bits) < max_size)
+        bits++;
+    const uint64_t limit = (uint64_t)1 << ((value >> 58) % (bits + 1));
+    const uint64_t size = (value & 0xffffffffULL) % (limit + 1);
+    return (size < max_size) ? size : max_size;
+}
+
+/* Millions of tiny files (0..512 bytes) in directories of 1000 files.
+ */
+static void
+generate_tiny(struct generator* generator, const char* root, uint64_t scale)
+{
+    const uint64_t file_count = scale * 1000000;
+    char path[GENTREE_PATH_SIZE];
+    uint64_t i;
+    for (i = 0; i < file_count; i++) {
+        if (i % 1000 == 0) {
+            snprintf(path, sizeof(path), "%s/d%06lu", root, i / 1000);
+            make_directory(generator, path);
+        }
+        snprintf(path,
+                 sizeof(path),
+                 "%s/d%06lu/f%03lu",
+                 root,
+                 i / 1000,
+                 i % 1000);
+        make_file(generator, path, random_size(generator, 512));
+    }
+}
+
+/* A few huge files (256 MiB each).
+ */
+static void
+generate_huge(struct generator* generator, const char* root, uint64_t scale)
+{
+    const uint64_t file_count = scale * 4;
+    char path[GENTREE_PATH_SIZE];
+    uint64_t i;
+    for (i = 0; i < file_count; i++) {
+        snprintf(path, sizeof(path), "%s/huge%03lu.bin", root, i);
+        make_file(generator, path, (uint64_t)256 << 20);
+    }
+}
+
+/* Deeply nested chains of directories with small file on every level.
+ */
+static void
+generate_deep(struct generator* generator, const char* root, uint64_t scale)
+{
+    const uint64_t chain_count = scale * 100;
+    const unsigned int depth = 1000;
+    char path[GENTREE_PATH_SIZE];
+    uint64_t i;
+    for (i = 0; i < chain_count; i++) {
+        size_t length =
+          (size_t)snprintf(path, sizeof(path), "%s/c%04lu", root, i);
+        make_directory(generator, path);
+        unsigned int level;
+        for (level = 0; level < depth; level++) {
+            snprintf(path + length, sizeof(path) - length, "/f");
+            make_file(generator, path, random_size(generator, 4096));
+            length += (size_t)snprintf(
+              path + length, sizeof(path) - length, "/d");
+            make_directory(generator, path);
+        }
+    }
+}
+
+/* Wide directories with hundreds of thousands of entries each.
+ */
+static void
+generate_wide(struct generator* generator, const char* root, uint64_t scale)
+{
+    const uint64_t directory_count = scale * 2;
+    const uint64_t file_count = 250000;
+    char path[GENTREE_PATH_SIZE];
+    uint64_t i;
+    for (i = 0; i < directory_count; i++) {
+        snprintf(path, sizeof(path), "%s/w%02lu", root, i);
+        make_directory(generator, path);
+        uint64_t j;
+        for (j = 0; j < file_count; j++) {
+            snprintf(path,
+                     sizeof(path),
+                     "%s/w%02lu/file_with_longer_name_%07lu",
+                     root,
+                     i,
+                     j);
+            make_file(generator, path, random_size(generator, 2048));
+        }
+    }
+}
+
+/* Trees where most entries are symlinks to files, directories and missing
+ * targets.
+ */
+static void
+generate_symlinks(struct generator* generator,
+                  const char* root,
+                  uint64_t scale)
+{
+    const uint64_t directory_count = scale * 100;
+    char path[GENTREE_PATH_SIZE];
+    char target[GENTREE_PATH_SIZE];
+    uint64_t i;
+    for (i = 0; i < directory_count; i++) {
+        snprintf(path, sizeof(path), "%s/s%04lu", root, i);
+        make_directory(generator, path);
+        snprintf(path, sizeof(path), "%s/s%04lu/target", root, i);
+        make_file(generator, path, random_size(generator, 65536));
+
+        unsigned int j;
+        for (j = 0; j < 1000; j++) {
+            const uint64_t kind = next_random(generator) % 4;
+            if (kind == 0)
+                snprintf(target, sizeof(target), "target");
+            else if (kind == 1)
+                snprintf(target,
+                         sizeof(target),
+                         "../s%04lu/target",
+                         next_random(generator) % directory_count);
+            else if (kind == 2)
+                snprintf(target,
+                         sizeof(target),
+                         "../s%04lu",
+                         next_random(generator) % directory_count);
+            else
+                snprintf(target, sizeof(target), "missing/%04u", j);
+            snprintf(path, sizeof(path), "%s/s%04lu/l%04u", root, i, j);
+            make_symlink(generator, target, path);
+        }
+    }
+}
+
+/* Source-tree-like mix: nested directories with files of log-uniform sizes
+ * up to 4 MiB and some symlinks.
+ */
+static void
+generate_mixed_directory(struct generator* generator,
+                         const char* path,
+                         unsigned int depth,
+                         uint64_t scale)
+{
+    char child_path[GENTREE_PATH_SIZE];
+    const unsigned int file_count =
+      (unsigned int)(next_random(generator) % (20 * scale) + 1);
+    unsigned int i;
+    for (i = 0; i < file_count; i++) {
+        snprintf(child_path, sizeof(child_path), "%s/file%03u.dat", path, i);
+        make_file(generator, child_path, random_size(generator, 4 << 20));
+    }
+    if (next_random(generator) % 4 == 0) {
+        snprintf(child_path, sizeof(child_path), "%s/link", path);
+        make_symlink(generator, "file000.dat", child_path);
+    }
+
+    if (depth == 0)
+        return;
+    const unsigned int directory_count =
+      (unsigned int)(next_random(generator) % 6);
+    for (i = 0; i < directory_count; i++) {
+        snprintf(child_path, sizeof(child_path), "%s/dir%02u", path, i);
+        make_directory(generator, child_path);
+        generate_mixed_directory(generator, child_path, depth - 1, scale);
+    }
+}
+
+/* Top level of mixed tree always has 10 subtrees, so tree size does not
+ * depend on seed much.
+ */
+static void
+generate_mixed(struct generator* generator, const char* root, uint64_t scale)
+{
+    char path[GENTREE_PATH_SIZE];
+    unsigned int i;
+    for (i = 0; i < 10; i++) {
+        snprintf(path, sizeof(path), "%s/top%02u", root, i);
+        make_directory(generator, path);
+        generate_mixed_directory(generator, path, 4, scale);
+    }
+}
+
+/* Tree shape with its generator function.
+ */
+struct tree_shape
+{
+    const char* name;
+    void (*generate)(struct generator* generator,
+                     const char* root,
+                     uint64_t scale);
+};
+
+static const struct tree_shape SHAPES[] = {
+    { "tiny", generate_tiny },         { "huge", generate_huge },
+    { "deep", generate_deep },         { "wide", generate_wide },
+    { "symlinks", generate_symlinks }, { "mixed", generate_mixed }
+};
+
+static void
+print_usage(const char* program_name)
+{
+    printf("Usage:\n");
+    printf("%s SHAPE DIRECTORY [SCALE [SEED]]\n", program_name);
+    printf("Create DIRECTORY with synthetic tree of given SHAPE (SCALE\n"
+           "multiplies number of entries or files, default is 1):\n");
+    printf(" tiny      1M files of 0..512 bytes, 1000 files per directory\n");
+    printf(" huge      4 files of 256 MiB\n");
+    printf(" deep      100 chains of 1000 nested directories\n");
+    printf(" wide      2 directories with 250K files each\n");
+    printf(" symlinks  100 directories with 1000 symlinks each\n");
+    printf(" mixed     nested directories with files up to 4 MiB\n");
+    printf("Totals are printed to standard output as JSON object.\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+    if ((argc < 3) || (argc > 5)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char* const shape = argv[1];
+    const char* const root = argv[2];
+    uint64_t scale = 1;
+    uint64_t seed = GENTREE_DEFAULT_SEED;
+    if (argc > 3) {
+        char* end_ptr;
+        scale = strtoull(argv[3], &end_ptr, 10);
+        if ((*end_ptr != '\0') || (scale == 0)) {
+            fprintf(stderr, "gentree: invalid scale %s\n", argv[3]);
+            return 1;
+        }
+    }
+    if (argc > 4) {
+        char* end_ptr;
+        seed = strtoull(argv[4], &end_ptr, 10);
+        if (*end_ptr != '\0') {
+            fprintf(stderr, "gentree: invalid seed %s\n", argv[4]);
+            return 1;
+        }
+    }
+
+    const struct tree_shape* tree_shape = NULL;
+    size_t i;
+    for (i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); i++) {
+        if (strcmp(SHAPES[i].name, shape) == 0)
+            tree_shape = SHAPES + i;
+    }
+    if (tree_shape == NULL) {
+        fprintf(stderr, "gentree: unknown shape %s\n", shape);
+        return 1;
+    }
+
+    struct generator* const generator = calloc(1, sizeof(struct generator));
+    if (generator == NULL) {
+        perror("calloc() failed");
+        return 1;
+    }
+    generator->random_state = seed;
+
+    make_directory(generator, root);
+    tree_shape->generate(generator, root, scale);
+
+    // Root directory is counted as entry too, like in archive
+    printf("{\"shape\":\"%s\",\"scale\":%lu,\"seed\":%lu,"
+           "\"entries\":%lu,\"directories\":%lu,\"files\":%lu,"
+           "\"symlinks\":%lu,\"bytes\":%lu}\n",
+           shape,
+           scale,
+           seed,
+           generator->stats.directory_count + generator->stats.file_count +
+             generator->stats.symlink_count,
+           generator->stats.directory_count,
+           generator->stats.file_count,
+           generator->stats.symlink_count,
+           generator->stats.content_bytes);
+
+    free(generator);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Run command and write its wall time, CPU time, peak resident set size and
+ * exit status to result file as JSON object fields (without braces), so
+ * benchmark script can merge them with its own fields.
+ */
+
+static double
+get_seconds(const struct timeval* time)
+{
+    return (double)time->tv_sec + (double)time->tv_usec / 1e6;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf("Usage:\n");
+        printf("%s RESULT_FILE COMMAND [ARGUMENTS...]\n", argv[0]);
+        return 1;
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork() failed");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        perror("execvp() failed");
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid() failed");
+        return 1;
+    }
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_CHILDREN, &usage) < 0) {
+        perror("getrusage() failed");
+        return 1;
+    }
+
+    FILE* const result_file = fopen(argv[1], "w");
+    if (result_file == NULL) {
+        perror("fopen() failed");
+        return 1;
+    }
+    const double wall_seconds =
+      (double)(end_time.tv_sec - start_time.tv_sec) +
+      (double)(end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    const int exit_status =
+      WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    fprintf(result_file,
+            "\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,"
+            "\"max_rss_kb\":%ld,\"exit_status\":%d",
+            wall_seconds,
+            get_seconds(&(usage.ru_utime)),
+            get_seconds(&(usage.ru_stime)),
+            usage.ru_maxrss,
+            exit_status);
+    if (fclose(result_file) != 0) {
+        perror("fclose() failed");
+        return 1;
+    }
+
+    return exit_status;
+}
@@ -0,0 +1,106 @@
+#!/bin/sh
+
+# Time pack, list and unpack of release build on synthetic trees (see
+# bench/gentree.c) and print one JSON object per shape and operation to
+# standard output. Settings are taken from environment:
+#   BIN_DIR          directory with anchorfield, gentree and runstat
+#                    (default bin/release, see "make benchmark")
+#   BENCH_DIR        work directory for trees and archives (default
+#                    /tmp/anchorfield-bench), generated trees are reused
+#   BENCH_SHAPES     shapes to run (default "tiny huge deep wide symlinks
+#                    mixed")
+#   BENCH_SCALE      scale of generated trees (default 1)
+#   BENCH_THREADS    value of --threads option (default 1)
+#   BENCH_OPTIONS    additional pack options (for example "--codec lz")
+# Page cache is not dropped, so numbers are for warm cache. Rates of failed
+# operations are null, and script exits with status 1 if any of them failed.
+
+set -e
+
+BIN_DIR=${BIN_DIR:-bin/release}
+BENCH_DIR=${BENCH_DIR:-/tmp/anchorfield-bench}
+BENCH_SHAPES=${BENCH_SHAPES:-"tiny huge deep wide symlinks mixed"}
+BENCH_SCALE=${BENCH_SCALE:-1}
+BENCH_THREADS=${BENCH_THREADS:-1}
+BENCH_OPTIONS=${BENCH_OPTIONS:-}
+
+ANCHORFIELD=$(realpath "$BIN_DIR/anchorfield")
+GENTREE=$(realpath "$BIN_DIR/gentree")
+RUNSTAT=$(realpath "$BIN_DIR/runstat")
+REVISION=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+mkdir -p "$BENCH_DIR/trees"
+RESULT="$BENCH_DIR/result.txt"
+ARCHIVE="$BENCH_DIR/archive.af"
+OUTPUT="$BENCH_DIR/output"
+FAILED_COUNT=0
+
+# Run operation with runstat and print its JSON line. Arguments are shape
+# name, tree totals (JSON object printed by gentree), operation name and
+# anchorfield arguments.
+run_operation() {
+    SHAPE=$1
+    TREE_STATS=$2
+    OPERATION=$3
+    shift 3
+
+    STATUS=0
+    "$RUNSTAT" "$RESULT" "$ANCHORFIELD" "$OPERATION" "$@" \
+        > /dev/null 2> "$BENCH_DIR/stderr.txt" || STATUS=$?
+    if [ "$STATUS" -ne 0 ]; then
+        echo "$SHAPE $OPERATION failed: $(head -1 "$BENCH_DIR/stderr.txt")" >&2
+        FAILED_COUNT=$((FAILED_COUNT + 1))
+    fi
+
+    ENTRIES=$(echo "$TREE_STATS" | sed 's/.*"entries":\([0-9]*\).*/\1/')
+    BYTES=$(echo "$TREE_STATS" | sed 's/.*"bytes":\([0-9]*\).*/\1/')
+    WALL=$(sed 's/.*"wall_s":\([0-9.]*\).*/\1/' "$RESULT")
+    ARCHIVE_BYTES=0
+    if [ -f "$ARCHIVE" ]; then
+        ARCHIVE_BYTES=$(stat -c %s "$ARCHIVE")
+    fi
+    # Wall time of failed run does not measure the operation
+    if [ "$STATUS" -ne 0 ]; then
+        RATES='"mb_per_s":null,"entries_per_s":null'
+    else
+        RATES=$(awk -v bytes="$BYTES" -v entries="$ENTRIES" -v wall="$WALL" \
+            'BEGIN {
+                 if (wall <= 0) wall = 0.000001;
+                 printf "\"mb_per_s\":%.2f,\"entries_per_s\":%.0f",
+                        bytes / wall / 1000000, entries / wall
+             }')
+    fi
+
+    printf '{"revision":"%s","shape":"%s","scale":%s,"operation":"%s",' \
+        "$REVISION" "$SHAPE" "$BENCH_SCALE" "$OPERATION"
+    printf '"threads":%s,"options":"%s","entries":%s,"bytes":%s,' \
+        "$BENCH_THREADS" "$BENCH_OPTIONS" "$ENTRIES" "$BYTES"
+    printf '"archive_bytes":%s,%s,%s}\n' \
+        "$ARCHIVE_BYTES" "$(cat "$RESULT")" "$RATES"
+}
+
+for SHAPE in $BENCH_SHAPES; do
+    TREE="$BENCH_DIR/trees/$SHAPE-$BENCH_SCALE"
+    if [ ! -f "$TREE.json" ]; then
+        rm -rf "$TREE"
+        "$GENTREE" "$SHAPE" "$TREE" "$BENCH_SCALE" > "$TREE.json.tmp"
+        mv "$TREE.json.tmp" "$TREE.json"
+    fi
+    TREE_STATS=$(cat "$TREE.json")
+
+    rm -rf "$ARCHIVE" "$OUTPUT"
+    mkdir -p "$OUTPUT"
+    # shellcheck disable=SC2086
+    run_operation "$SHAPE" "$TREE_STATS" pack --input "$TREE" \
+        --output "$ARCHIVE" --threads "$BENCH_THREADS" $BENCH_OPTIONS
+    run_operation "$SHAPE" "$TREE_STATS" list --input "$ARCHIVE"
+    run_operation "$SHAPE" "$TREE_STATS" unpack --input "$ARCHIVE" \
+        --output "$OUTPUT" --threads "$BENCH_THREADS"
+done
+
+rm -rf "$ARCHIVE" "$OUTPUT" "$RESULT" "$BENCH_DIR/stderr.txt"
+
+if [ "$FAILED_COUNT" -ne 0 ]; then
+    echo "$FAILED_COUNT operations failed" >&2
+    exit 1
+fi
@@ -12,19 +12,15 @@
  * recursively. First available position address in archive is stored in value
  * referenced by position_ptr.
  */
-void assign_archive_positions(
-  struct file_data* file_data,
-  archive_ptr_t* position_ptr,
-  const struct program_parameters* program_parameters);
+void assign_archive_positions(struct file_data* file_data,
+                              archive_ptr_t* position_ptr);
 
 /* Assign archive_content_position field to files in file_data and following
  * entries recursively (to files only). First available position address in
  * archive is stored in value referenced by position_ptr.
  */
-void assign_archive_content_positions(
-  struct file_data* file_data,
-  archive_ptr_t* position_ptr,
-  const struct program_parameters* program_parameters);
+void assign_archive_content_positions(struct file_data* file_data,
+                                      archive_ptr_t* position_ptr);
 
 /* Write archive entry, file and directory headers to output_file recursively.
  */
@@ -32,35 +28,132 @@ void write_archive_headers(struct file_data* file_data,
                            struct file_wrapper* output_file,
                            const struct program_parameters* program_parameters);
 
+/* If file_data is duplicate of other entry (content_original is set), copy
+ * content position, size and codec from that entry (it should be assigned
+ * before) and return 1, otherwise return 0.
+ */
+int assign_duplicate_content(struct file_data* file_data);
+
+/* Write content of one file or symlink to output_file at current position
+ * (nothing is written for directories), encoding it with content_codec of
+ * file_data or copying already encoded content from base_archive of
+ * file_data. archive_content_size of file_data is set to size of written
+ * data.
+ */
+void write_archive_entry_content(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
 /* Write archive file contents to output_file recursively.
  */
 void write_archive_content(struct file_data* file_data,
                            struct file_wrapper* output_file,
                            const struct program_parameters* program_parameters);
 
+/* Write archive file contents to output_file using thread pool of
+ * program_parameters->thread_count threads. Every file is written with
+ * positioned writes at its archive_content_position, so
+ * assign_archive_content_positions() should be called before.
+ */
+void write_archive_content_parallel(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Write archive file contents to output_file from one thread with io_uring
+ * requests, so many files are opened, read and closed at the same time
+ * (see uring.h). Like write_archive_content_parallel(), it uses positioned
+ * writes. Return 0 on success, -1 if io_uring is not supported (nothing is
+ * written then).
+ */
+int write_archive_content_uring(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Write archive file contents to output_file with io_uring (if
+ * program_parameters->use_io_uring is set and it is supported), thread pool
+ * (if program_parameters->thread_count is more than 1) or sequentially.
+ */
+void write_archive_content_by_options(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Calculate checksums of contents of files and symlinks in file_data and
+ * following entries (recursively) by reading them back from output_file
+ * (which should be opened for reading and writing) using thread pool of
+ * program_parameters->thread_count threads, and set content_checksum of
+ * entries. Content should be written before.
+ */
+void assign_content_checksums(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
 /* Write archive to to output_file.
  */
 void write_full_archive(struct file_data* file_data,
                         struct file_wrapper* output_file,
                         const struct program_parameters* program_parameters);
 
+/* Check that names of file_data and following entries differ from names of
+ * archive_data and following entries (root entries of existing archive), so
+ * they can be appended as new root entries. Return last entry of
+ * archive_data.
+ */
+struct file_data* check_appended_entries(
+  const struct file_data* file_data,
+  struct file_data* archive_data,
+  const struct program_parameters* program_parameters);
+
+/* Append file_data and following entries (and all their descendants) to
+ * existing archive_file (opened for reading and writing) as new root
+ * entries. New content and headers are written at the end of file, and
+ * existing headers are updated only after that, so interrupted append leaves
+ * archive in its previous state.
+ */
+void append_archive(struct file_data* file_data,
+                    struct file_wrapper* archive_file,
+                    const struct program_parameters* program_parameters);
+
 /* Return 0 if name is correct ext4 filename and is not "..", -1 otherwise.
  */
 int check_file_name(const char* name, size_t buffer_size);
 
+/* Check names of file_data, following entries and all their descendants
+ * with check_file_name() before archive is written (names of both v2 and v3
+ * entries are limited to ARCHIVE_V3_MAX_NAME_LENGTH bytes) and exit with
+ * error if any of them is invalid.
+ */
+void check_archive_entry_names(
+  const struct file_data* file_data,
+  const struct program_parameters* program_parameters);
+
 /* Return 0 if mode is correct ext4 file mode allowed in archive, -1 otherwise.
  */
 int check_file_mode(mode_t mode);
 
 /* Read archive entry, file and directory headers from input_file recursively
- * starting from position.
+ * starting from position. Entries are allocated from arena, and their parent
+ * is set to parent.
  */
 struct file_data* read_archive_headers(
-  const char* parent_path,
+  struct file_data* parent,
+  struct arena* arena,
   struct file_wrapper* input_file,
   archive_ptr_t position,
   const struct program_parameters* program_parameters);
 
+/* Open archive file for reading. If program_parameters->use_mmap is set,
+ * archive is mapped to memory, so headers are parsed and content is copied
+ * directly from mapping (if mapping fails, plain reading is used).
+ */
+struct file_wrapper* open_archive_file(
+  const char* pathname,
+  const struct program_parameters* program_parameters);
+
 /* Read archive main header and entry, file and directory headers and return
  * directory tree.
  */
@@ -75,5 +168,57 @@ void read_archive_content(struct file_data* file_data,
                           const char* output_directory_name,
                           const struct program_parameters* program_parameters);
 
+/* Extract archive using thread pool of program_parameters->thread_count
+ * threads. Directories are created first, then files and symlinks are
+ * extracted in parallel with positioned reads from input_file, then directory
+ * times are set.
+ */
+void read_archive_content_parallel(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters);
+
+/* Extract archive from one thread with io_uring requests, so many files are
+ * created, written and closed at the same time (see uring.h). Directories are
+ * created first and their times are set last like in
+ * read_archive_content_parallel(). Return 0 on success, -1 if io_uring is not
+ * supported (nothing is extracted then).
+ */
+int read_archive_content_uring(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters);
+
+/* Extract archive with io_uring (if program_parameters->use_io_uring is set
+ * and it is supported), thread pool (if program_parameters->thread_count is
+ * more than 1) or sequentially.
+ */
+void read_archive_content_by_options(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters);
+
+/* Find entry with given path (components separated by '/', first component is
+ * root entry name) in archive without reading whole directory tree. Return
+ * file_data of found entry (with all descendants for directories) with path
+ * relative to entry itself, or NULL if entry is not found.
+ */
+struct file_data* find_archive_member(
+  struct file_wrapper* input_file,
+  const char* path,
+  const struct program_parameters* program_parameters);
+
+/* Write content of regular file archive entry to output_file at current
+ * position (output_file can be pipe).
+ */
+void write_archive_member_content(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
 #endif
 
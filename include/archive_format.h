@@ -58,5 +58,217 @@ struct archive_directory_data
                                    // first child (file or subfolder)
 };
 
+/* Compact archive format (v3).
+ *
+ * All fields are packed little-endian integers, most of them are varints
+ * (see encoding.h). Archive file layout is:
+ *
+ *   main header        ARCHIVE_V3_HEADER_SIZE bytes at beginning of file
+ *   content            file contents and symlink targets
+ *   header block       all entry headers in depth-first order
+ *   central directory  optional table of all entries with fixed-size records
+ *   path index         optional hash index over central directory
+ *
+ * Entries appended to existing archive have their content written after old
+ * index regions, which become unused part of content region, followed by new
+ * index regions (main header is rewritten last).
+ *
+ * Main header fields:
+ *
+ *   u8[32]  header_sign              ARCHIVE_HEADER_SIGN_V3
+ *   u64     header_block_ptr         address of header block in archive file
+ *   u64     header_block_size        size of header block
+ *   u64     content_ptr              address of content region in archive
+ *                                    file
+ *   u64     content_size             size of content region
+ *   u64     central_directory_ptr    address of central directory (0 if
+ *                                    archive does not have it)
+ *   u64     central_directory_size   size of central directory
+ *   u64     path_index_ptr           address of path index (0 if archive
+ *                                    does not have it)
+ *   u64     path_index_size          size of path index
+ *   u32     header_flags             main header flags
+ *                                    (ARCHIVE_V3_HEADER_*)
+ *   u32     header_block_checksum    CRC32C of header block
+ *   u32     central_directory_checksum  CRC32C of central directory
+ *   u32     path_index_checksum      CRC32C of path index
+ *   ...     zero padding up to ARCHIVE_V3_HEADER_SIZE - 4
+ *   u32     header_checksum          CRC32C of all preceding main header
+ *                                    bytes
+ *
+ * Checksum fields are valid only if ARCHIVE_V3_HEADER_CHECKSUMS flag is set
+ * (they are zero in archives written without checksums). All checksums are
+ * CRC32C (see checksum.h).
+ *
+ * Header block starts with varint number of root entries, followed by
+ * entries. Every entry is:
+ *
+ *   u8      flags              entry flags (ARCHIVE_V3_ENTRY_*)
+ *   varint  mode               file mode
+ *   varint  name_length        length of name (1..255)
+ *   u8[]    name               file name (without NULL terminator)
+ *   svarint st_atim.tv_sec,    access time
+ *   varint  st_atim.tv_nsec
+ *   svarint st_mtim.tv_sec,    modification time
+ *   varint  st_mtim.tv_nsec
+ *   svarint st_ctim.tv_sec,    status change time
+ *   varint  st_ctim.tv_nsec
+ *
+ * followed by, for directories:
+ *
+ *   varint  child_count        number of children entries
+ *   varint  children_size      total size of all descendant entries (so
+ *                              subtree can be skipped without parsing)
+ *
+ * and children entries themselves, or for files and symlinks:
+ *
+ *   varint  content_offset     offset of content relative to content_ptr
+ *                              (several files with identical contents can
+ *                              share the same content)
+ *   varint  content_size       size of content (or symlink target path with
+ *                              NULL terminator)
+ *
+ * Files and symlinks with ARCHIVE_V3_ENTRY_INLINE flag have small content
+ * stored right in header block instead of content region, so it is read
+ * along with headers. content_offset is omitted for them, and content
+ * follows content_size:
+ *
+ *   u8[content_size]  content  content (up to ARCHIVE_V3_MAX_INLINE_SIZE
+ *                              bytes, ARCHIVE_V3_ENTRY_CODEC and
+ *                              ARCHIVE_V3_ENTRY_CHECKSUM flags are not set,
+ *                              header block checksum covers it)
+ *
+ * and, for regular files with ARCHIVE_V3_ENTRY_CODEC flag:
+ *
+ *   varint  codec              content codec (see codec.h)
+ *   varint  stored_size        size of encoded content stored in archive
+ *                              (content_size is size of decoded content)
+ *
+ * and, for files and symlinks with ARCHIVE_V3_ENTRY_CHECKSUM flag:
+ *
+ *   u32     content_checksum   CRC32C of content stored in archive
+ *
+ * and, for regular files with ARCHIVE_V3_ENTRY_HARDLINK flag:
+ *
+ *   u64     link_ptr           position of entry header of earlier regular
+ *                              file (without this flag) which this file is
+ *                              hard link to, relative to header block
+ *
+ * Hard link has the same content fields as its original, so it can be
+ * extracted as copy if original is not extracted. Archive with hard links has
+ * ARCHIVE_V3_HEADER_HARDLINKS flag, and it is read by header block (central
+ * directory does not describe links). link_ptr is 0 in inline headers of
+ * streamed archive. Central directory can not refer to inline content, so
+ * archives with central directory do not have it.
+ *
+ * Stored content of file with CODEC_CHUNKED codec is list of chunks (see
+ * chunking.h), and chunks can be shared between files.
+ */
+
+#define ARCHIVE_V3_ENTRY_CODEC 0x01
+#define ARCHIVE_V3_ENTRY_CHECKSUM 0x02
+#define ARCHIVE_V3_ENTRY_HARDLINK 0x04
+#define ARCHIVE_V3_ENTRY_INLINE 0x08
+#define ARCHIVE_V3_ENTRY_FLAGS                                                \
+    (ARCHIVE_V3_ENTRY_CODEC | ARCHIVE_V3_ENTRY_CHECKSUM |                     \
+     ARCHIVE_V3_ENTRY_HARDLINK | ARCHIVE_V3_ENTRY_INLINE)
+
+/* Default and maximum size of content stored in header block of v3 archive.
+ */
+#define ARCHIVE_V3_DEFAULT_INLINE_SIZE 256
+#define ARCHIVE_V3_MAX_INLINE_SIZE 4096
+
+static const char ARCHIVE_HEADER_SIGN_V3[ARCHIVE_HEADER_SIGN_SIZE] =
+  "ARC.AnchorField.v3";
+
+#define ARCHIVE_V3_HEADER_SIZE 128
+
+#define ARCHIVE_V3_HEADER_CHECKSUMS 0x01
+#define ARCHIVE_V3_HEADER_HARDLINKS 0x02
+#define ARCHIVE_V3_HEADER_FLAGS                                               \
+    (ARCHIVE_V3_HEADER_CHECKSUMS | ARCHIVE_V3_HEADER_HARDLINKS)
+#define ARCHIVE_V3_HEADER_CHECKSUM_OFFSET (ARCHIVE_V3_HEADER_SIZE - 4)
+
+/* Streamed v3 archive can be written to pipe (without seeking back), so its
+ * main header is located at the end of file. Layout is:
+ *
+ *   u8[32]             ARCHIVE_HEADER_SIGN_V3_STREAM
+ *   entries            every entry header in depth-first order, directly
+ *                      followed by content for files and symlinks
+ *   header block       trailing index, same as in v3 archive
+ *   central directory  optional, same as in v3 archive
+ *   path index         optional, same as in v3 archive
+ *   main header        ARCHIVE_V3_HEADER_SIZE bytes at end of file, same as
+ *                      in v3 archive
+ *
+ * Inline entry headers are encoded same as in header block, but
+ * children_size of directories and stored_size of encoded files are 0 (they
+ * are not known when header is written, encoded content is sequence of
+ * self-delimiting blocks). Content region spans all inline entries, so
+ * content_ptr is ARCHIVE_HEADER_SIGN_SIZE and content_offset of inline entry
+ * points right after that entry header (unless content is shared with
+ * earlier entry, then nothing follows header). Archive can be read by
+ * trailing main header as usual v3 archive, or sequentially by inline entry
+ * headers.
+ */
+static const char ARCHIVE_HEADER_SIGN_V3_STREAM[ARCHIVE_HEADER_SIGN_SIZE] =
+  "ARC.AnchorField.v3.stream";
+
+#define ARCHIVE_V3_MAX_NAME_LENGTH 255
+
+/* Central directory of v3 archive is one contiguous table of all entries, so
+ * it can be loaded with one read and entries can be accessed by index. It
+ * consists of:
+ *
+ *   u64     entry_count        number of entries
+ *   u64     string_pool_size   size of string pool
+ *   record[entry_count]        entry records in depth-first order
+ *   u8[string_pool_size]       string pool (names without NULL terminators)
+ *
+ * Every record has size ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE:
+ *
+ *   u32     parent_index       index of parent directory record (should be
+ *                              less than index of this record), or
+ *                              ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT for roots
+ *   u32     mode               file mode
+ *   u32     name_offset        offset of name in string pool
+ *   u32     name_length        length of name (1..255)
+ *   u64     content_offset     offset of content relative to content_ptr
+ *   u64     content_size       size of content
+ *   i64     st_atim.tv_sec     access time
+ *   u32     st_atim.tv_nsec
+ *   i64     st_mtim.tv_sec     modification time
+ *   u32     st_mtim.tv_nsec
+ *   i64     st_ctim.tv_sec     status change time
+ *   u32     st_ctim.tv_nsec
+ *   u32     flags              record flags (ARCHIVE_CENTRAL_DIRECTORY_*)
+ *   u32     codec              content codec (see codec.h)
+ *   u32     content_checksum   CRC32C of content stored in archive (0 if
+ *                              ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM flag is not
+ *                              set)
+ *   u64     stored_size        size of content stored in archive (same as
+ *                              content_size if codec is CODEC_NONE)
+ */
+
+#define ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE 16
+#define ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE 88
+#define ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT UINT32_MAX
+#define ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM 0x01
+
+/* Path index of v3 archive is hash table which maps pair of parent record
+ * index and name to central directory record index, so entry can be found by
+ * path with O(depth) reads. It consists of:
+ *
+ *   u64     bucket_count       number of buckets (power of 2)
+ *   u32[bucket_count]          index of first record in bucket chain
+ *   u32[entry_count]           index of next record in the same chain (chains
+ *                              are sorted by increasing index)
+ *
+ * Bucket of record is FNV-1a hash of u32 parent_index followed by name,
+ * modulo bucket_count. ARCHIVE_PATH_INDEX_NONE marks end of chain.
+ */
+
+#define ARCHIVE_PATH_INDEX_NONE UINT32_MAX
+
 #endif
 
@@ -0,0 +1,223 @@
+#ifndef ARCHIVE_V3_H_INCLUDED
+#define ARCHIVE_V3_H_INCLUDED
+
+#include "archive_format.h"
+#include "encoding.h"
+#include "file_wrapper.h"
+#include "listdir.h"
+#include "program_options.h"
+
+/* Main header of v3 archive (see archive_format.h), decoded.
+ */
+struct archive_header_v3
+{
+    archive_ptr_t header_block_ptr;  // address of header block
+    archive_ptr_t header_block_size; // size of header block
+    archive_ptr_t content_ptr;       // address of content region
+    archive_ptr_t content_size;      // size of content region
+    archive_ptr_t central_directory_ptr;  // address of central directory (0
+                                          // if archive does not have it)
+    archive_ptr_t central_directory_size; // size of central directory
+    archive_ptr_t path_index_ptr;  // address of path index (0 if archive does
+                                   // not have it)
+    archive_ptr_t path_index_size; // size of path index
+    uint32_t flags;                      // main header flags
+    uint32_t header_block_checksum;      // checksum of header block
+    uint32_t central_directory_checksum; // checksum of central directory
+    uint32_t path_index_checksum;        // checksum of path index
+};
+
+/* Entry header of v3 archive (see archive_format.h), decoded.
+ */
+struct archive_entry_v3
+{
+    uint8_t flags;                             // entry flags
+    mode_t mode;                               // file mode
+    char name[ARCHIVE_V3_MAX_NAME_LENGTH + 1]; // file name
+    struct timespec st_atim;                   // access time
+    struct timespec st_mtim;                   // modification time
+    struct timespec st_ctim;                   // status change time
+    uint64_t child_count;                      // number of children (for
+                                               // directories only)
+    uint64_t children_size;                    // size of descendant entries
+                                               // (for directories only)
+    uint64_t content_offset;                   // offset of content relative to
+                                               // content_ptr (for files and
+                                               // symlinks only)
+    uint64_t content_size;                     // size of content (for files and
+                                               // symlinks only)
+    unsigned int codec;                        // content codec (for files
+                                               // only)
+    uint64_t stored_size;                      // size of content stored in
+                                               // archive (for files and
+                                               // symlinks only)
+    uint32_t content_checksum;                 // checksum of stored content
+                                               // (with
+                                               // ARCHIVE_V3_ENTRY_CHECKSUM
+                                               // flag only)
+    const void* inline_content; // content in reader (with
+                                // ARCHIVE_V3_ENTRY_INLINE flag only,
+                                // otherwise NULL)
+    uint64_t link_ptr;      // position of header of hard link original
+                            // relative to header block (with
+                            // ARCHIVE_V3_ENTRY_HARDLINK flag only)
+    uint64_t header_offset; // position of entry header in reader
+};
+
+/* Create file_data for archive entry with given name and mode in arena.
+ * parent is data of parent directory (NULL for root entries).
+ */
+struct file_data* create_archive_file_data(
+  const char* name,
+  mode_t mode,
+  struct file_data* parent,
+  struct arena* arena,
+  const struct program_parameters* program_parameters);
+
+/* Return pointer to size bytes of input_file at given position. If file is
+ * mapped to memory, pointer to mapping is returned, otherwise data is read to
+ * dynamically allocated buffer, which is also stored to value referenced by
+ * copy_ptr and should be deallocated by caller.
+ */
+const void* load_archive_region(
+  struct file_wrapper* input_file,
+  archive_ptr_t position,
+  archive_ptr_t size,
+  void** copy_ptr,
+  const struct program_parameters* program_parameters);
+
+/* Calculate size of encoded v3 entry header of file_data (without its
+ * children). Content offsets are calculated relative to content_ptr. For
+ * directories, archive_children_size should be calculated before.
+ */
+size_t get_archive_entry_size_v3(const struct file_data* file_data,
+                                 archive_ptr_t content_ptr);
+
+/* Calculate archive_children_size field of directories in file_data and
+ * following entries recursively. Return total size of encoded v3 entry headers
+ * of file_data, following entries and all their descendants. Content
+ * positions should be assigned before.
+ */
+archive_ptr_t assign_archive_children_sizes_v3(struct file_data* file_data,
+                                               archive_ptr_t content_ptr);
+
+/* Append v3 entry headers of file_data, following entries and all their
+ * descendants to buffer, which should hold header block located at
+ * header_block_ptr from its beginning (archive_position of entries is set to
+ * their header positions, hard links refer to them). Content offsets are
+ * calculated relative to content_ptr. Return 1 if hard links are encoded, 0
+ * otherwise.
+ */
+int encode_archive_entries_v3(
+  struct file_data* file_data,
+  archive_ptr_t content_ptr,
+  archive_ptr_t header_block_ptr,
+  struct byte_buffer* buffer,
+  const struct program_parameters* program_parameters);
+
+/* Write v3 archive main header to output_file at current position.
+ */
+void write_archive_header_v3(
+  const struct archive_header_v3* header,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Write v3 archive to output_file. Content positions are assigned by this
+ * function.
+ */
+void write_full_archive_v3(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Append file_data and following entries (and all their descendants) to
+ * existing non-streamed v3 archive_file (see append_archive()). New content
+ * and new index are written at the end of file (content region is extended
+ * over old index, which becomes unused), then main header is rewritten.
+ */
+void append_archive_v3(struct file_data* file_data,
+                       struct file_wrapper* archive_file,
+                       const struct program_parameters* program_parameters);
+
+/* Write streamed v3 archive (see archive_format.h) to output_file. Output
+ * file is written sequentially, so it can be pipe. Content positions are
+ * assigned by this function.
+ */
+void write_stream_archive_v3(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters);
+
+/* Read v3 archive main header from input_file at current position (which
+ * should be beginning of file). For streamed archives, main header is read
+ * from the end of file.
+ */
+void read_archive_header_v3(
+  struct archive_header_v3* header,
+  struct file_wrapper* input_file,
+  const struct program_parameters* program_parameters);
+
+/* Check checksum of size bytes of index region data loaded from archive
+ * against checksum from main header (if archive has checksums). region_name
+ * is used in error message.
+ */
+void check_region_checksum_v3(
+  const struct archive_header_v3* header,
+  const void* data,
+  archive_ptr_t size,
+  uint32_t checksum,
+  const char* region_name,
+  const struct program_parameters* program_parameters);
+
+/* Decode one v3 entry header (without children) from reader to entry and
+ * check it. Content range is checked against content region from header.
+ */
+void decode_archive_entry_v3(
+  struct byte_reader* reader,
+  struct archive_entry_v3* entry,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters);
+
+/* Create file_data (without children) from decoded v3 entry header in arena.
+ * Hard link is not resolved (link_original is NULL).
+ */
+struct file_data* create_file_data_from_entry_v3(
+  const struct archive_entry_v3* entry,
+  struct file_data* parent,
+  struct arena* arena,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters);
+
+/* Decode count v3 entry headers (and their descendants) from reader (over
+ * whole header block) to arena and return directory tree. parent is data of
+ * parent directory of these entries, depth is their nesting level. Hard links
+ * to decoded entries are resolved.
+ */
+struct file_data* decode_archive_entries_v3(
+  struct byte_reader* reader,
+  uint64_t count,
+  struct file_data* parent,
+  struct arena* arena,
+  unsigned int depth,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters);
+
+/* Read v3 archive main header and header block (or central directory if
+ * archive has it) and return directory tree.
+ */
+struct file_data* read_full_archive_v3(
+  struct file_wrapper* input_file,
+  const struct program_parameters* program_parameters);
+
+/* Find entry with given path (components separated by '/') in v3 archive
+ * without decoding whole tree. Path index is used if archive has it,
+ * otherwise header block is searched skipping subtrees of other entries.
+ * Return file_data of found entry (with all descendants for directories)
+ * with path relative to entry itself, or NULL if entry is not found.
+ */
+struct file_data* find_archive_member_v3(
+  struct file_wrapper* input_file,
+  const char* path,
+  const struct program_parameters* program_parameters);
+
+#endif
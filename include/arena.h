@@ -0,0 +1,50 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stddef.h>
+
+/* Size of memory blocks taken by arena from malloc() (bigger allocations get
+ * their own blocks).
+ */
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+/* Alignment of memory returned by arena_alloc().
+ */
+#define ARENA_ALIGNMENT 16
+
+struct arena_block;
+
+/* Bump allocator: memory is taken sequentially from big blocks and all of it
+ * is deallocated at once. It is not thread-safe.
+ */
+struct arena
+{
+    struct arena_block* block; // current block (NULL if nothing was
+                               // allocated yet), blocks are linked to
+                               // previous ones
+};
+
+/* Create empty arena and return pointer to it. Return NULL on error.
+ */
+struct arena* arena_create(void);
+
+/* Deallocate arena and all memory allocated from it.
+ */
+void arena_free(struct arena* arena);
+
+/* Move all memory allocated from other arena to arena and deallocate other
+ * arena (memory is not copied, it is deallocated with arena then).
+ */
+void arena_merge(struct arena* arena, struct arena* other);
+
+/* Allocate size bytes aligned to ARENA_ALIGNMENT from arena. Return NULL on
+ * error.
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+/* Create copy of null-terminated string in arena (not aligned) and return it.
+ * Return NULL on error.
+ */
+char* arena_copy_string(struct arena* arena, const char* string);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef BASE_ARCHIVE_H_INCLUDED
+#define BASE_ARCHIVE_H_INCLUDED
+
+#include "file_wrapper.h"
+#include "listdir.h"
+#include "program_options.h"
+
+/* Find regular files of file_data, following entries and all their
+ * descendants, which are unchanged since base archive (read from base_file
+ * to base_data) was created: entry with the same path in base archive should
+ * be regular file with the same size, modification and status change times,
+ * and its content should be stored with the same codec. Content of such files
+ * is copied from base_file instead of reading them (base_archive and
+ * base_content_* fields of file_data are set), so base_file should be open
+ * until archive is written. Files with CODEC_CHUNKED codec are always read,
+ * because their chunks can be shared with other files.
+ */
+void match_base_archive(struct file_data* file_data,
+                        const struct file_data* base_data,
+                        struct file_wrapper* base_file,
+                        const struct program_parameters* program_parameters);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CENTRAL_DIRECTORY_H_INCLUDED
+#define CENTRAL_DIRECTORY_H_INCLUDED
+
+#include "archive_format.h"
+#include "archive_v3.h"
+#include "encoding.h"
+#include "file_wrapper.h"
+#include "listdir.h"
+#include "program_options.h"
+
+/* Append central directory of file_data, following entries and all their
+ * descendants to buffer. Content positions should be assigned before, content
+ * offsets are calculated relative to content_ptr.
+ */
+void encode_central_directory(
+  const struct file_data* file_data,
+  archive_ptr_t content_ptr,
+  struct byte_buffer* buffer,
+  const struct program_parameters* program_parameters);
+
+/* Decode central directory from data of given size and return directory tree.
+ */
+struct file_data* decode_central_directory(
+  const void* data,
+  archive_ptr_t size,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters);
+
+/* Read central directory of v3 archive with one read and return directory
+ * tree.
+ */
+struct file_data* read_central_directory(
+  struct file_wrapper* input_file,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters);
+
+/* Append path index for encoded central directory to buffer.
+ */
+void encode_path_index(const void* central_directory,
+                       archive_ptr_t central_directory_size,
+                       struct byte_buffer* buffer,
+                       const struct program_parameters* program_parameters);
+
+/* Find entry with given path (components separated by '/') using path index
+ * and central directory of v3 archive. Only records on path are read. Return
+ * file_data of found entry (with all descendants for directories) with path
+ * relative to entry itself, or NULL if entry is not found.
+ */
+struct file_data* find_central_directory_member(
+  struct file_wrapper* input_file,
+  const struct archive_header_v3* header,
+  const char* path,
+  const struct program_parameters* program_parameters);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CHECKSUM_H_INCLUDED
+#define CHECKSUM_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "archive_format.h"
+#include "file_wrapper.h"
+
+/* Update CRC32C (Castagnoli) checksum with size bytes of data and return new
+ * checksum. Checksum of empty data is 0, so it is initial value, and
+ * checksum of concatenated data can be calculated by pieces. SSE4.2 crc32
+ * instruction is used if processor supports it, with table-driven fallback.
+ */
+uint32_t crc32c_update(uint32_t checksum, const void* data, size_t size);
+
+/* Calculate CRC32C checksum of size bytes of file at position (used in place
+ * if file is mapped to memory, read with positioned reads otherwise) to value
+ * referenced by checksum. Return 0 on success, -1 on error.
+ */
+int file_checksum_at(struct file_wrapper* file,
+                     off_t position,
+                     archive_ptr_t size,
+                     uint32_t* checksum);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef CHUNKING_H_INCLUDED
+#define CHUNKING_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "archive_format.h"
+#include "codec.h"
+#include "file_wrapper.h"
+#include "listdir.h"
+#include "program_options.h"
+
+/* Content of file with CODEC_CHUNKED codec is split into chunks at positions
+ * defined by content itself (with rolling gear hash), so insertions and
+ * deletions change only nearby chunks. Every unique chunk is stored in
+ * content region once, and stored content of file is chunk list:
+ *
+ *   varint  chunk_count
+ *
+ * followed by chunk_count records:
+ *
+ *   varint  distance           distance from chunk list back to stored chunk
+ *                              data (chunks are stored before chunk lists
+ *                              referencing them)
+ *   varint  size               size of chunk (1..CHUNK_MAX_SIZE)
+ *   varint  codec              block codec of chunk (CODEC_NONE if chunk is
+ *                              stored as is)
+ *   varint  stored_size        size of stored chunk data
+ *   u32     checksum           CRC32C of stored chunk data
+ *
+ * Sum of chunk sizes is content size of file.
+ */
+
+#define CHUNK_MIN_SIZE (1 << 14)
+#define CHUNK_AVERAGE_SIZE (1 << 16)
+#define CHUNK_MAX_SIZE (1 << 18)
+
+/* Unique chunk stored in archive.
+ */
+struct chunk_record
+{
+    uint64_t hash;              // content hash of chunk
+    archive_ptr_t position;     // position of stored chunk data in archive
+    archive_ptr_t stored_size;  // size of stored chunk data
+    uint32_t size;              // size of chunk
+    uint32_t codec;             // block codec of chunk
+    uint32_t checksum;          // checksum of stored chunk data
+    const struct file_data* source; // file with first occurrence of chunk
+    off_t source_offset;            // offset of chunk in source file
+};
+
+/* Chunks stored in created archive, with hash table for finding duplicates.
+ */
+struct chunk_index
+{
+    uint64_t gear[256];            // gear hash values for every byte value
+    struct chunk_record* records;  // unique chunks in order of writing
+    size_t record_count;
+    size_t record_capacity;
+    size_t* slots;      // hash table of record indices plus 1 (0 for empty
+                        // slot), with linear probing
+    size_t slot_count;  // number of slots (power of 2)
+    size_t* file_chunks; // records of chunks of current file
+    size_t file_chunk_capacity;
+    uint8_t* read_buffer;    // buffer for reading files
+    uint8_t* compare_buffer; // buffer for comparing chunks with duplicates
+    unsigned int codec;      // block codec of written chunks
+    struct codec_encoder encoder; // encoder of codec (if it is not
+                                  // CODEC_NONE)
+    size_t chunk_count;        // total number of chunks in all files
+    archive_ptr_t chunk_bytes; // total size of chunks in all files
+    archive_ptr_t unique_bytes; // total size of unique chunks
+};
+
+/* Initialize empty chunk_index. Chunks are encoded with block codec (or
+ * stored as is for CODEC_NONE). Errors are reported with print_perror().
+ */
+void chunk_index_init(struct chunk_index* index,
+                      unsigned int codec,
+                      const struct program_parameters* program_parameters);
+
+/* Deallocate memory used by chunk_index.
+ */
+void chunk_index_free(struct chunk_index* index);
+
+/* Split content of regular file_data into chunks, write chunks which are not
+ * in index yet and then chunk list of file to output_file at position (which
+ * is updated). archive_content_position and archive_content_size of
+ * file_data are set to position and size of chunk list.
+ */
+void write_chunked_content(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  archive_ptr_t* position,
+  struct chunk_index* index,
+  const struct program_parameters* program_parameters);
+
+/* Read chunk list of list_size bytes from input_file at list_position and
+ * write size bytes of reassembled content to output_file at current
+ * position. Only positioned reads are used for input_file. Return 0 on
+ * success, -1 on error (errno is set to EIO if data is corrupted).
+ */
+int read_chunked_content(struct file_wrapper* input_file,
+                         off_t list_position,
+                         archive_ptr_t list_size,
+                         struct file_wrapper* output_file,
+                         size_t size);
+
+/* Check chunk list of list_size bytes at list_position in input_file and
+ * checksums of all chunks referenced by it (content size should be size).
+ * Only positioned reads are used for input_file. Return 0 if chunk list and
+ * chunks are correct, -1 on error (errno is set to EIO if data is
+ * corrupted).
+ */
+int verify_chunked_content(struct file_wrapper* input_file,
+                           off_t list_position,
+                           archive_ptr_t list_size,
+                           size_t size);
+
+#endif
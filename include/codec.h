@@ -0,0 +1,132 @@
+#ifndef CODEC_H_INCLUDED
+#define CODEC_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "archive_format.h"
+#include "file_wrapper.h"
+
+/* Content codec identifiers. They are stored in archive, so existing values
+ * should not be changed.
+ */
+enum content_codec
+{
+    CODEC_NONE = 0, // content is stored as is
+    CODEC_LZ = 1,   // built-in LZ77 codec (see codec_lz.h)
+    CODEC_COUNT,    // number of block codecs
+    CODEC_CHUNKED = 64, // content is list of deduplicated chunks (see
+                        // chunking.h), it is not block codec
+    CODEC_SPARSE = 65   // content is sparse file without holes (see sparse.h),
+                        // it is not block codec
+};
+
+/* Encoded content is split into blocks of CODEC_BLOCK_SIZE bytes (last block
+ * can be smaller), which are compressed independently. Every block is stored
+ * as:
+ *
+ *   u32     block_header       size of stored block data, with
+ *                              CODEC_BLOCK_RAW bit set if block is stored
+ *                              uncompressed (when compression does not
+ *                              reduce its size)
+ *   u8[]    block_data         stored block data
+ */
+
+#define CODEC_BLOCK_SIZE (1 << 18)
+#define CODEC_BLOCK_HEADER_SIZE 4
+#define CODEC_BLOCK_RAW 0x80000000U
+
+/* Block codec interface.
+ */
+struct codec_ops
+{
+    const char* name;          // codec name for command line
+    size_t work_memory_size;   // size of work memory for compress
+    size_t (*compress_bound)(size_t size); // maximum size of compressed
+                                           // block for input of given size
+    size_t (*compress)(const uint8_t* input,
+                       size_t size,
+                       uint8_t* output,
+                       void* work_memory); // compress block, return
+                                           // compressed size
+    int (*decompress)(const uint8_t* input,
+                      size_t input_size,
+                      uint8_t* output,
+                      size_t output_size); // decompress block of known size,
+                                           // return 0 on success, -1 on
+                                           // error
+};
+
+/* Return interface of codec, or NULL for CODEC_NONE, CODEC_CHUNKED,
+ * CODEC_SPARSE and unknown codecs.
+ */
+const struct codec_ops* get_codec(unsigned int codec);
+
+/* Return 1 if codec is block codec, CODEC_CHUNKED or CODEC_SPARSE, 0 for
+ * CODEC_NONE and unknown codecs.
+ */
+int is_known_codec(unsigned int codec);
+
+/* Return codec identifier by its name, or -1 if there is no such codec.
+ */
+int find_codec(const char* name);
+
+/* Encoder state with buffers, which can be reused for encoding many pieces
+ * of data.
+ */
+struct codec_encoder
+{
+    const struct codec_ops* ops; // codec interface
+    uint8_t* output_buffer;      // buffer for encoded block with header
+    void* work_memory;           // work memory for compress
+    uint32_t output_checksum;    // CRC32C of all data written by encoder
+                                 // (can be reset by caller)
+};
+
+/* Initialize encoder for block codec and allocate its buffers. Return 0 on
+ * success, -1 on error.
+ */
+int codec_encoder_init(struct codec_encoder* encoder, unsigned int codec);
+
+/* Deallocate buffers of encoder.
+ */
+void codec_encoder_free(struct codec_encoder* encoder);
+
+/* Encode size bytes of data with encoder and write them to output_file at
+ * current position. Size of encoded data is stored to value referenced by
+ * stored_size. Return 0 on success, -1 on error.
+ */
+int codec_encode_data(struct codec_encoder* encoder,
+                      const uint8_t* data,
+                      size_t size,
+                      struct file_wrapper* output_file,
+                      archive_ptr_t* stored_size);
+
+/* Read size bytes from input_file at current position, encode them with
+ * codec (block codec or CODEC_SPARSE) and write to output_file at current
+ * position. Size of encoded data
+ * is stored to value referenced by stored_size. Return 0 on success, -1 on
+ * error.
+ */
+int codec_write_content(struct file_wrapper* input_file,
+                        struct file_wrapper* output_file,
+                        size_t size,
+                        unsigned int codec,
+                        archive_ptr_t* stored_size);
+
+/* Decode stored_size bytes of data encoded with codec (block codec,
+ * CODEC_CHUNKED or CODEC_SPARSE) from input_file at input_position and write
+ * size decoded bytes to output_file at current position. Only positioned
+ * reads are used for input_file. Return 0 on success, -1 on error (errno is
+ * set to EIO if data is corrupted).
+ */
+int codec_read_content(struct file_wrapper* input_file,
+                       off_t input_position,
+                       archive_ptr_t stored_size,
+                       struct file_wrapper* output_file,
+                       size_t size,
+                       unsigned int codec);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef CODEC_LZ_H_INCLUDED
+#define CODEC_LZ_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Built-in LZ77 codec for content blocks. Compressed block is sequence of
+ * sequences, every sequence is:
+ *
+ *   u8      token              high 4 bits are literal count, low 4 bits are
+ *                              match length minus LZ_MIN_MATCH (15 means that
+ *                              value is continued in extra bytes)
+ *   u8[]    literal_count      extra bytes (255 means that next byte is also
+ *                              added) for literal count of 15 or more
+ *   u8[]    literals           literal bytes
+ *   u16     match_offset       distance back to match beginning in output
+ *   u8[]    match_length       extra bytes for match length (like for
+ *                              literal count)
+ *
+ * Last sequence has only token, literal count and literals, block ends
+ * after them.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+/* Size of work memory needed by lz_compress().
+ */
+#define LZ_WORK_MEMORY_SIZE (sizeof(uint32_t) << LZ_HASH_BITS)
+
+/* Return maximum size of compressed block for input of given size.
+ */
+size_t lz_compress_bound(size_t size);
+
+/* Compress size bytes from input to output (which should have at least
+ * lz_compress_bound(size) bytes). work_memory should have
+ * LZ_WORK_MEMORY_SIZE bytes. Return size of compressed data.
+ */
+size_t lz_compress(const uint8_t* input,
+                   size_t size,
+                   uint8_t* output,
+                   void* work_memory);
+
+/* Decompress input_size bytes from input to output, which should be exactly
+ * output_size bytes after decompression. Return 0 on success, -1 if data is
+ * corrupted (errno is set to EIO).
+ */
+int lz_decompress(const uint8_t* input,
+                  size_t input_size,
+                  uint8_t* output,
+                  size_t output_size);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef DEDUP_H_INCLUDED
+#define DEDUP_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "listdir.h"
+#include "program_options.h"
+
+/* Initial value of content hash.
+ */
+#define CONTENT_HASH_SEED 0xcbf29ce484222325ULL
+
+/* Update content hash with size bytes of data and return new hash value.
+ * Hash is used only to find candidates for byte comparison, so fast
+ * word-wise mixing is enough.
+ */
+uint64_t update_content_hash(uint64_t hash, const uint8_t* data, size_t size);
+
+/* Find regular files with identical contents in file_data, following entries
+ * and all their descendants, and set content_original of every duplicate to
+ * the first (in depth-first order) entry with the same content. Only files
+ * having the same size as some other file are hashed, and files with equal
+ * hashes are compared byte by byte before they are treated as duplicates.
+ */
+void deduplicate_content(struct file_data* file_data,
+                         const struct program_parameters* program_parameters);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef ENCODING_H_INCLUDED
+#define ENCODING_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum size of encoded varint (for 64-bit values).
+ */
+#define VARINT_MAX_SIZE 10
+
+/* Growable memory buffer for encoding packed little-endian data.
+ */
+struct byte_buffer
+{
+    uint8_t* data;   // buffer data (NULL if nothing was allocated yet)
+    size_t size;     // number of used bytes
+    size_t capacity; // number of allocated bytes
+};
+
+/* Read cursor over packed little-endian data in memory.
+ */
+struct byte_reader
+{
+    const uint8_t* data; // data beginning
+    size_t size;         // data size in bytes
+    size_t position;     // current position in bytes from beginning
+};
+
+/* Initialize empty byte_buffer.
+ */
+void byte_buffer_init(struct byte_buffer* buffer);
+
+/* Deallocate memory used by byte_buffer and make it empty.
+ */
+void byte_buffer_free(struct byte_buffer* buffer);
+
+/* Make sure that at least size more bytes can be added to byte_buffer without
+ * reallocation. Return 0 on success, -1 on error.
+ */
+int byte_buffer_reserve(struct byte_buffer* buffer, size_t size);
+
+/* Append size bytes from data to byte_buffer. Return 0 on success, -1 on
+ * error.
+ */
+int byte_buffer_put(struct byte_buffer* buffer, const void* data, size_t size);
+
+/* Append 8-bit value to byte_buffer. Return 0 on success, -1 on error.
+ */
+int byte_buffer_put_u8(struct byte_buffer* buffer, uint8_t value);
+
+/* Append 32-bit value to byte_buffer in little-endian order. Return 0 on
+ * success, -1 on error.
+ */
+int byte_buffer_put_u32(struct byte_buffer* buffer, uint32_t value);
+
+/* Append 64-bit value to byte_buffer in little-endian order. Return 0 on
+ * success, -1 on error.
+ */
+int byte_buffer_put_u64(struct byte_buffer* buffer, uint64_t value);
+
+/* Append unsigned value to byte_buffer as varint (7 bits per byte, least
+ * significant group first, high bit set on all bytes except last). Return 0
+ * on success, -1 on error.
+ */
+int byte_buffer_put_varint(struct byte_buffer* buffer, uint64_t value);
+
+/* Append signed value to byte_buffer as zigzag-encoded varint. Return 0 on
+ * success, -1 on error.
+ */
+int byte_buffer_put_svarint(struct byte_buffer* buffer, int64_t value);
+
+/* Return number of bytes used by value encoded as varint.
+ */
+size_t varint_size(uint64_t value);
+
+/* Store 32-bit value at ptr in little-endian order.
+ */
+void store_u32(void* ptr, uint32_t value);
+
+/* Store 64-bit value at ptr in little-endian order.
+ */
+void store_u64(void* ptr, uint64_t value);
+
+/* Load 32-bit little-endian value from ptr.
+ */
+uint32_t load_u32(const void* ptr);
+
+/* Load 64-bit little-endian value from ptr.
+ */
+uint64_t load_u64(const void* ptr);
+
+/* Initialize byte_reader for data of given size.
+ */
+void byte_reader_init(struct byte_reader* reader,
+                      const void* data,
+                      size_t size);
+
+/* Return pointer to next size bytes in byte_reader and skip them. Return NULL
+ * if there is not enough data.
+ */
+const void* byte_reader_get(struct byte_reader* reader, size_t size);
+
+/* Read 8-bit value from byte_reader. Return 0 on success, -1 on error.
+ */
+int byte_reader_get_u8(struct byte_reader* reader, uint8_t* value);
+
+/* Read 32-bit little-endian value from byte_reader. Return 0 on success, -1 on
+ * error.
+ */
+int byte_reader_get_u32(struct byte_reader* reader, uint32_t* value);
+
+/* Read 64-bit little-endian value from byte_reader. Return 0 on success, -1 on
+ * error.
+ */
+int byte_reader_get_u64(struct byte_reader* reader, uint64_t* value);
+
+/* Read varint from byte_reader. Return 0 on success, -1 on error (if data
+ * ends or varint is longer than VARINT_MAX_SIZE).
+ */
+int byte_reader_get_varint(struct byte_reader* reader, uint64_t* value);
+
+/* Read zigzag-encoded signed varint from byte_reader. Return 0 on success, -1
+ * on error.
+ */
+int byte_reader_get_svarint(struct byte_reader* reader, int64_t* value);
+
+#endif
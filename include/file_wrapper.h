@@ -2,8 +2,13 @@
 #define FILE_WRAPPER_H_INCLUDED
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+/* Maximum number of segments written by one file_writev() call.
+ */
+#define FILE_WRITEV_MAX_SEGMENTS 16
+
 /* Custom wrapper for Linux files, alternative to FILE from C standard library.
  */
 struct file_wrapper
@@ -12,6 +17,19 @@ struct file_wrapper
     int flags;       // file open flags
     off_t size;      // file size in bytes
     off_t position;  // current position in file in bytes from beginning
+    void* mapping;   // file data mapped to memory by file_map() (NULL if
+                     // file is not mapped)
+    char* write_buffer; // data written by file_write() and not passed to
+                        // kernel yet (NULL if writes are not buffered)
+    size_t write_buffer_capacity; // size of write_buffer in bytes
+    size_t write_buffer_size;     // number of bytes in write_buffer
+    char* read_buffer; // data read ahead by file_read() (NULL if reads are
+                       // not buffered)
+    size_t read_buffer_capacity; // size of read_buffer in bytes
+    size_t read_buffer_size;     // number of bytes in read_buffer
+    off_t read_buffer_position;  // position of read_buffer data in file (file
+                                 // descriptor position is at its end while
+                                 // read_buffer is not empty)
 };
 
 /* Open file with flags, create file_wrapper structure for that file and return
@@ -26,12 +44,43 @@ struct file_wrapper* file_open_with_mode(const char* pathname,
                                          int flags,
                                          mode_t mode);
 
+/* Create file_wrapper structure for already open file descriptor fd (which
+ * can also be pipe or terminal, for example standard output) and return pointer
+ * to it. If file can not be accessed, return NULL.
+ */
+struct file_wrapper* file_from_fd(int fd, int flags);
+
 /* Create file with mode, create file_wrapper structure for that file and return
  * pointer to it. If file can not be created, return NULL.
  */
 struct file_wrapper* file_creat(const char* pathname, mode_t mode);
 
-/* Close file related to file_wrapper structure and deallocate this structure.
+/* Buffer data written by file_write() and file_writev() in memory buffer of
+ * capacity bytes, so many small writes are passed to kernel as one (capacity
+ * 0 turns buffering off). Position and size in file_wrapper include buffered
+ * data. It is flushed by file_flush() and before other operations using
+ * file descriptor (positioned operations can be called from different
+ * threads only when buffer is empty). Return 0 on success, -1 on error.
+ */
+int file_set_write_buffer(struct file_wrapper* file, size_t capacity);
+
+/* Read file by portions of capacity bytes to memory buffer, so small
+ * file_read() calls and file_seek() calls inside data read ahead are served
+ * without system calls (capacity 0 turns buffering off). It is useful when
+ * file is not mapped by file_map(). Read ahead data is discarded by
+ * file_flush() and before other operations using file descriptor. Return 0 on
+ * success, -1 on error.
+ */
+int file_set_read_buffer(struct file_wrapper* file, size_t capacity);
+
+/* Write buffered data to file and discard data read ahead, so file descriptor
+ * position matches position in file_wrapper. Return 0 on success, -1 on
+ * error.
+ */
+int file_flush(struct file_wrapper* file);
+
+/* Close file related to file_wrapper structure (writing buffered data first)
+ * and deallocate this structure.
  */
 int file_close(struct file_wrapper* file);
 
@@ -40,13 +89,44 @@ int file_close(struct file_wrapper* file);
  */
 int file_write(struct file_wrapper* file, const void* buf, size_t size);
 
+/* Write count segments (not more than FILE_WRITEV_MAX_SEGMENTS) to file
+ * related to file_wrapper structure one after another. Segments are copied to
+ * write buffer if they fit into it, otherwise buffered data and segments are
+ * written together by writev(). Return 0 on success, -1 on error.
+ */
+int file_writev(struct file_wrapper* file,
+                const struct iovec* segments,
+                int count);
+
 /* Read data to pointer buf, of size bytes to file related to file_wrapper
- * structure. Return 0 on success, -1 on error.
+ * structure (through read buffer if it is set and data is smaller than it).
+ * Return 0 on success, -1 on error.
  */
 int file_read(struct file_wrapper* file, void* buf, size_t size);
 
-/* Seek position in file related to file_wrapper. Return 0 on success, -1 on
- * error.
+/* Write data from pointer buf, of size bytes to file related to file_wrapper
+ * structure at given position. Current position in file_wrapper is not used
+ * and not changed, so this function can be called from different threads for
+ * the same file. Return 0 on success, -1 on error.
+ */
+int file_pwrite(struct file_wrapper* file,
+                const void* buf,
+                size_t size,
+                off_t position);
+
+/* Read data to pointer buf, of size bytes from file related to file_wrapper
+ * structure at given position (data is copied from read buffer if it is
+ * there). Current position in file_wrapper is not used and not changed, so
+ * this function can be called from different threads for the same file
+ * (when its buffers are empty). Return 0 on success, -1 on error.
+ */
+int file_pread(struct file_wrapper* file,
+               void* buf,
+               size_t size,
+               off_t position);
+
+/* Seek position in file related to file_wrapper (without system call if
+ * position is inside read buffer). Return 0 on success, -1 on error.
  */
 int file_seek(struct file_wrapper* file, off_t position);
 
@@ -54,7 +134,42 @@ int file_seek(struct file_wrapper* file, off_t position);
  */
 int file_fetch_position(struct file_wrapper* file);
 
-/* Write data of given size from input_file to output_file using buffer of size
+/* Find first range of file data at or after position, skipping holes (ranges
+ * of sparse file which are not stored on disk and are read as zeros). Start
+ * and end of found range are stored to values referenced by data_start and
+ * data_end, and position in file_wrapper is set to its end. Return 1 if data
+ * is found, 0 if there is only hole after position, -1 on error.
+ */
+int file_find_data(struct file_wrapper* file,
+                   off_t position,
+                   off_t* data_start,
+                   off_t* data_end);
+
+/* Change size of file related to file_wrapper (file is cut or extended with
+ * hole). Return 0 on success, -1 on error (for example, if file is pipe).
+ */
+int file_truncate(struct file_wrapper* file, off_t size);
+
+/* Map whole file related to file_wrapper to memory (file should be opened
+ * read-only). After that, file_read(), file_pread(), file_seek() and copying
+ * from this file are served from mapping without system calls, and file
+ * descriptor position is not used anymore. Return 0 on success, -1 on error
+ * (file_wrapper is still usable without mapping in that case).
+ */
+int file_map(struct file_wrapper* file);
+
+/* Return pointer to size bytes of file data at given position in mapping
+ * created by file_map(). Return NULL if file is not mapped or range is
+ * exceeding file size.
+ */
+const void* file_get_data(const struct file_wrapper* file,
+                          off_t position,
+                          size_t size);
+
+/* Write data of given size from input_file to output_file. Data up to half
+ * of write buffer of output_file is read directly to that buffer. Bigger data
+ * is copied by kernel with copy_file_range(), sendfile() or splice() if
+ * possible, otherwise it is copied through user space using buffer of size
  * buffer_size. Return 0 on success, -1 on error.
  */
 int file_cat(struct file_wrapper* input_file,
@@ -62,5 +177,18 @@ int file_cat(struct file_wrapper* input_file,
              size_t size,
              size_t buffer_size);
 
+/* Write data of given size from input_file starting at input_position to
+ * output_file starting at output_position. Data is copied by kernel with
+ * copy_file_range() if possible, otherwise it is copied through user space
+ * using buffer of size buffer_size. Current positions in file_wrapper
+ * structures are not used and not changed. Return 0 on success, -1 on error.
+ */
+int file_cat_at(struct file_wrapper* input_file,
+                off_t input_position,
+                struct file_wrapper* output_file,
+                off_t output_position,
+                size_t size,
+                size_t buffer_size);
+
 #endif
 
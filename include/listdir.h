@@ -3,17 +3,22 @@
 
 #include <sys/types.h>
 
-#include <fts.h>
+#include <limits.h>
+#include <stdint.h>
 
+#include "arena.h"
 #include "archive_format.h"
+#include "file_wrapper.h"
 #include "program_options.h"
 
 /* File or directory data.
  */
 struct file_data
 {
-    char* file_access_path; // full path related to current directory
     char* file_name;        // name of file or directory
+    char* root_path; // path of root entry related to current directory if it
+                     // differs from file_name (for root entries only,
+                     // otherwise it should be set to NULL)
     mode_t file_mode;       // file mode (can be used to determine whether it is
                             // file or directory)
     off_t file_size; // size (for files and symlinks only, otherwise it should
@@ -24,6 +29,8 @@ struct file_data
     char* symlink_target; // symlink target path (for symlinks only, otherwise
                           // it should be set to NULL)
 
+    struct file_data* parent; // pointer to parent directory data (NULL for
+                              // root entries)
     struct file_data* next; // pointer to next sibling file or directory data
     struct file_data*
       first_child; // pointer to data of first file or subdirectory in
@@ -35,27 +42,132 @@ struct file_data
     archive_ptr_t
       archive_content_position; // position of file content data in
                                 // archive file (for files and symlinks only)
+    archive_ptr_t
+      archive_children_size; // total size of descendant entry headers (for
+                             // directories in v3 archive format only)
+    unsigned int content_codec; // codec of content in archive file (see
+                                // codec.h, for files only)
+    archive_ptr_t archive_content_size; // size of content stored in archive
+                                        // file (for files and symlinks only)
+    struct file_data* content_original; // entry with the same content which
+                                        // is stored in archive (NULL if
+                                        // content of this entry is stored)
+    struct file_data* link_original; // earlier entry which this file is hard
+                                     // link to (NULL if it is not link or
+                                     // link is not preserved)
+    char* inline_content; // content stored in entry header instead of
+                          // content region (for small files and symlinks
+                          // in v3 archive only, otherwise it should be set
+                          // to NULL)
+    struct file_wrapper* base_archive; // base archive to copy stored content
+                                       // from (NULL if content is read from
+                                       // file)
+    archive_ptr_t base_content_position; // position of stored content in
+                                         // base_archive
+    archive_ptr_t base_content_size; // size of stored content in
+                                     // base_archive
+    int has_content_checksum; // 1 if content_checksum is set, 0 otherwise
+    uint32_t content_checksum; // CRC32C of content stored in archive file
+    struct arena* arena; // arena which owns all entries and strings of
+                         // directory tree (for first root entry only,
+                         // otherwise it should be set to NULL)
 };
 
-/* Populate directory tree recursively using FTS.
+/* Size of buffer for paths of entries (longer paths can not be opened).
+ */
+#define FILE_PATH_BUFFER_SIZE PATH_MAX
+
+/* Allocate file_data from arena with given name (copied to arena) and parent,
+ * all other fields are set to zero or NULL.
  */
-struct file_data* list_directory_by_fts(
-  FTS* ftsp,
+struct file_data* create_file_data(
+  const char* name,
+  struct file_data* parent,
+  struct arena* arena,
   const struct program_parameters* program_parameters);
 
+/* Make arena owned by directory tree with first root entry file_data, so it
+ * is deallocated by free_directory_tree(). Arena is deallocated at once if
+ * tree is empty. Return file_data.
+ */
+struct file_data* set_directory_tree_arena(struct file_data* file_data,
+                                           struct arena* arena);
+
+/* Write path of file_data to buffer of buffer_size bytes: prefix and '/' (if
+ * prefix is not NULL), then path of root entry and names of descendants
+ * separated by '/'. Return length of path. If it is not less than
+ * buffer_size, path does not fit and only file name (truncated if needed)
+ * is written, so buffer is still usable in messages.
+ */
+size_t get_file_path(const struct file_data* file_data,
+                     const char* prefix,
+                     char* buffer,
+                     size_t buffer_size);
+
+/* Open file at path of file_data with flags, create file_wrapper structure
+ * for that file and return pointer to it. If file can not be opened, return
+ * NULL.
+ */
+struct file_wrapper* open_file_data(const struct file_data* file_data,
+                                    int flags);
+
+/* Print information message with path of file_data (message should have one
+ * %s conversion for it).
+ */
+void print_file_info(const struct program_parameters* program_parameters,
+                     const char* message,
+                     const struct file_data* file_data);
+
+/* Print error message with path of file_data (message should have one %s
+ * conversion for it) and exit program with non-zero code.
+ */
+void print_file_error(const struct program_parameters* program_parameters,
+                      const char* message,
+                      const struct file_data* file_data);
+
+/* State of depth-first walk over directory tree, which uses parent pointers
+ * instead of recursion, so it needs no memory beyond this structure.
+ * Directories are visited twice: before their children (is_leaving is 0) and
+ * after them (is_leaving is 1), other entries are visited once.
+ */
+struct directory_walk
+{
+    struct file_data* file_data; // current entry (NULL when walk is finished)
+    unsigned int depth; // nesting level of current entry (0 for entry walk
+                        // is started from and its following siblings)
+    int is_leaving;     // 1 on second visit of directory, 0 otherwise
+};
+
+/* Start walk over file_data, following entries and all their descendants.
+ * Like strchr(), it accepts constant tree, and caller should not modify
+ * entries of such tree through walk->file_data.
+ */
+void directory_walk_start(struct directory_walk* walk,
+                          const struct file_data* file_data);
+
+/* Move walk to next visit (walk->file_data is set to NULL after last one).
+ */
+void directory_walk_next(struct directory_walk* walk);
+
 /* Build directory tree with given root pathes recursively and return it. Only
- * files and directories will be added to directory tree, symlinks, block
- * devices and others will be ignored.
+ * files, directories and symlinks (unless they are ignored) will be added to
+ * directory tree, block devices and others will be ignored. Directories are
+ * read by program_parameters->thread_count threads, children are in order
+ * returned by system, which does not depend on number of threads. If
+ * program_parameters->preserve_hardlinks is 1, regular files which are hard
+ * links to the same inode have link_original and content_original set to the
+ * first of them (in depth-first order), so their content is stored once.
  */
 struct file_data* list_directory(
   char* const* root_paths,
   const struct program_parameters* program_parameters);
 
-/* Deallocate memory used for directory tree.
+/* Deallocate memory used for directory tree (ptr should be its first root
+ * entry). All entries are deallocated at once with their arena.
  */
 void free_directory_tree(struct file_data* ptr);
 
-/* Print directory tree recursively.
+/* Print directory tree with descendants indented by two spaces per level.
  */
 void print_directory_tree(struct file_data* ptr, unsigned int identation);
 
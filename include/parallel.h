@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <stddef.h>
+
+/* Task function for run_parallel(). It is called once for every task index
+ * from 0 to task_count - 1, possibly from different threads at the same time.
+ */
+typedef void (*parallel_task_function)(size_t task_index, void* context);
+
+/* Run task_count tasks using pool of thread_count worker threads (calling
+ * thread is used as one of workers). Tasks are taken by workers in increasing
+ * index order. Return after all tasks are finished.
+ */
+void run_parallel(size_t task_count,
+                  unsigned int thread_count,
+                  parallel_task_function task_function,
+                  void* context);
+
+#endif
@@ -8,8 +8,12 @@
 enum program_mode
 {
     MODE_PACK,   // create archive
+    MODE_ADD,    // add directories and files to existing archive
     MODE_LIST,   // list directories and files in archive
     MODE_UNPACK, // extract archive
+    MODE_EXTRACT, // extract one file or directory from archive
+    MODE_CAT,     // write content of one file from archive to standard output
+    MODE_VERIFY,  // check archive structure and checksums
     MODE_HELP,   // print help message
     MODE_UNKNOWN // invalid mode or option or no mode given
 };
@@ -31,7 +35,27 @@ enum symlink_mode
     SYMLINK_MODE_UNKNOWN // no mode given
 };
 
+/* Archive format version for created archives.
+ */
+enum archive_format
+{
+    ARCHIVE_FORMAT_V2, // fixed-size entry headers linked by pointers
+    ARCHIVE_FORMAT_V3  // compact varint-encoded entry headers
+};
+
+/* Format of statistics printed at exit.
+ */
+enum stats_format
+{
+    STATS_FORMAT_NONE, // statistics are not printed
+    STATS_FORMAT_TEXT, // human-readable table
+    STATS_FORMAT_JSON  // one JSON object
+};
+
 #define FILE_CAT_DEFAULT_BUFFER_SIZE 4096
+#define FILE_WRITE_DEFAULT_BUFFER_SIZE (1 << 20)
+#define FILE_READ_DEFAULT_BUFFER_SIZE (1 << 20)
+#define MAX_THREAD_COUNT 1024
 
 /* Program parameters (parsed from command line).
  */
@@ -41,8 +65,43 @@ struct program_parameters
     enum program_verbosity verbosity;
     char* input_name;
     char* output_name;
+    char* member_path; // path of archive entry for extract and cat modes
+    char* base_name; // name of base archive for pack mode (NULL if not given)
     size_t file_cat_buffer_size;
+    size_t write_buffer_size; // size of buffer for writes to created archive
+                              // (0 if writes are not buffered)
+    size_t read_buffer_size; // size of buffer for reads from archive when it
+                             // is not mapped (0 if reads are not buffered)
     enum symlink_mode symlink_mode;
+    enum archive_format archive_format;
+    int write_central_directory; // 1 if central directory should be added to
+                                 // created archive, 0 otherwise
+    unsigned int content_codec; // codec for file contents in created archive
+                                // (see codec.h)
+    int deduplicate; // 1 if files with identical contents should be stored
+                     // once in created archive, 0 otherwise
+    int chunk_content; // 1 if file contents should be split into chunks
+                       // stored once in created archive, 0 otherwise
+    int checksum_content; // 1 if checksums of file contents should be stored
+                          // in created archive, 0 otherwise
+    int stream_archive; // 1 if created archive should be streamed (written
+                        // sequentially with inline headers), 0 otherwise
+    int skip_holes; // 1 if holes of sparse files should not be stored in
+                    // created archive (v3 format only), 0 otherwise
+    size_t inline_size; // maximum size of file content and symlink target
+                        // stored in entry header of created archive (v3
+                        // format without central directory only, 0 if
+                        // contents should not be stored there)
+    int preserve_hardlinks; // 1 if hard links should be stored once in
+                            // created archive (and recreated on extraction
+                            // from v3 archive), 0 otherwise
+    unsigned int thread_count; // number of threads for directory scanning
+                               // and file content copying
+    int use_io_uring; // 1 if file contents should be copied with io_uring
+                      // (if supported), 0 otherwise
+    int use_mmap; // 1 if archive file should be mapped to memory for reading,
+                  // 0 otherwise
+    enum stats_format stats_format; // format of statistics printed at exit
 };
 
 /* Parse size input string. It can be in bytes (512), kilobytes (256K),
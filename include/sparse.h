@@ -0,0 +1,51 @@
+#ifndef SPARSE_H_INCLUDED
+#define SPARSE_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+#include "archive_format.h"
+#include "file_wrapper.h"
+
+/* Content of file with CODEC_SPARSE codec is stored without holes (ranges of
+ * sparse file which are not stored on disk and are read as zeros), so only
+ * data extents are read when archive is created and written when it is
+ * extracted. Stored content is extent list:
+ *
+ *   varint  extent_count
+ *
+ * followed by extent_count records:
+ *
+ *   varint  hole_size          size of hole before extent (from end of
+ *                              previous extent or beginning of file)
+ *   varint  size               size of extent (at least 1)
+ *
+ * and then data of all extents one after another. Content after last extent
+ * up to content size of file is hole.
+ */
+
+/* Find data extents of size bytes of input_file (from the beginning of file)
+ * and write extent list and their data to output_file at current position.
+ * Size of stored content is stored to value referenced by stored_size.
+ * Return 0 on success, -1 on error.
+ */
+int write_sparse_content(struct file_wrapper* input_file,
+                         struct file_wrapper* output_file,
+                         size_t size,
+                         archive_ptr_t* stored_size);
+
+/* Read stored content of stored_size bytes from input_file at
+ * input_position and write size bytes of file content to output_file at
+ * current position. Holes are created by extending output_file if it is
+ * regular file which ends at current position, otherwise zeros are written.
+ * Only positioned reads are used for input_file. Return 0 on success, -1 on
+ * error (errno is set to EIO if data is corrupted).
+ */
+int read_sparse_content(struct file_wrapper* input_file,
+                        off_t input_position,
+                        archive_ptr_t stored_size,
+                        struct file_wrapper* output_file,
+                        size_t size);
+
+#endif
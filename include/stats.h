@@ -0,0 +1,84 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdint.h>
+
+#include "listdir.h"
+#include "program_options.h"
+
+/* Runtime statistics for --stats option. I/O counters are always updated
+ * (one relaxed atomic addition per system call), time of phases and files
+ * is measured only after stats_start() is called.
+ */
+
+/* Program phase, time and I/O are accounted to current phase.
+ */
+enum stats_phase
+{
+    STATS_PHASE_SCAN,       // listing input directories
+    STATS_PHASE_BASE,       // reading base archive and matching files
+    STATS_PHASE_DEDUP,      // finding duplicate contents
+    STATS_PHASE_READ_INDEX, // reading archive headers
+    STATS_PHASE_ASSIGN,     // assigning positions in created archive
+    STATS_PHASE_HEADERS,    // encoding and writing archive headers
+    STATS_PHASE_CONTENT,    // writing file contents to archive
+    STATS_PHASE_CHECKSUM,   // calculating checksums of written contents
+    STATS_PHASE_EXTRACT,    // extracting file contents from archive
+    STATS_PHASE_VERIFY,     // checking archive
+    STATS_PHASE_PRINT,      // printing archive listing
+    STATS_PHASE_CLEANUP,    // closing files and freeing memory
+    STATS_PHASE_COUNT
+};
+
+/* I/O counter.
+ */
+enum stats_counter
+{
+    STATS_READ_CALLS,   // read() and pread() calls
+    STATS_READ_BYTES,   // bytes read by read() and pread()
+    STATS_WRITE_CALLS,  // write() and pwrite() calls
+    STATS_WRITE_BYTES,  // bytes written by write() and pwrite() (or put to
+                        // write buffer of file_wrapper)
+    STATS_COPY_CALLS,   // copy_file_range(), sendfile() and splice() calls
+    STATS_COPY_BYTES,   // bytes copied by kernel
+    STATS_MAPPED_BYTES, // bytes read from memory mapped files
+    STATS_OPEN_CALLS,   // open() calls
+    STATS_OTHER_CALLS,  // close(), stat(), lseek(), mkdir() and other calls
+    STATS_COUNTER_COUNT
+};
+
+/* Add value to counter. It can be called from different threads at the same
+ * time.
+ */
+void stats_add(enum stats_counter counter, uint64_t value);
+
+/* Start measuring time of phases and files.
+ */
+void stats_start(void);
+
+/* Finish current phase and start phase (phases can be repeated, their time
+ * is summed).
+ */
+void stats_set_phase(enum stats_phase phase);
+
+/* Return start time of processing of one file to be passed to
+ * stats_finish_file() (0 if statistics are not started).
+ */
+uint64_t stats_start_file(void);
+
+/* Record time of processing file_data if it is one of slowest files. It can
+ * be called from different threads at the same time.
+ */
+void stats_finish_file(uint64_t start_time, const struct file_data* file_data);
+
+/* Count entries by type and find largest files in file_data, following
+ * entries and all their descendants.
+ */
+void stats_add_tree(const struct file_data* file_data);
+
+/* Finish current phase and print statistics to standard error in format
+ * given by program_parameters->stats_format.
+ */
+void stats_print(const struct program_parameters* program_parameters);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_wrapper.h"
+
+/* Copying of many small files between their own files and archive with
+ * io_uring: files are opened, read, written and closed by asynchronous
+ * requests submitted from one thread, so up to URING_SLOT_COUNT files are
+ * copied at the same time and one system call submits requests and waits for
+ * results of many of them. Files are created by openat() directly, since
+ * io_uring can not create them without handing request off to its worker
+ * thread. System calls are used directly, so liburing is not needed.
+ */
+
+/* Number of files copied at the same time.
+ */
+#define URING_SLOT_COUNT 64
+
+/* Size of buffer of every file copied at the same time (bigger files are
+ * copied by portions of this size).
+ */
+#define URING_BUFFER_SIZE (64 * 1024)
+
+struct uring;
+
+/* File to copy, filled by uring_prepare_function.
+ */
+struct uring_job
+{
+    char path[PATH_MAX]; // path of file to open (not used if data is not
+                         // NULL)
+    int flags;  // flags to open file with: content is copied from file to
+                // archive if access mode is O_RDONLY, from archive to file
+                // otherwise
+    mode_t mode;            // mode of created file
+    const void* data;       // content to write to archive instead of file
+                            // or to file instead of archive content (NULL
+                            // if file or archive should be read)
+    off_t archive_position; // position of content in archive file
+    size_t size;            // size of content in bytes
+    uint64_t start_time; // value passed from uring_prepare_function to
+                         // uring_finish_function (like start time for
+                         // stats_finish_file())
+};
+
+/* Fill job for job_index. Return 1 if job should be run, 0 if it should be
+ * skipped (for example if it is processed by function itself).
+ */
+typedef int (*uring_prepare_function)(size_t job_index,
+                                      void* context,
+                                      struct uring_job* job);
+
+/* Called after job for job_index is finished and its file is closed.
+ */
+typedef void (*uring_finish_function)(size_t job_index,
+                                      void* context,
+                                      const struct uring_job* job);
+
+/* Create io_uring instance and return pointer to it. Return NULL if io_uring
+ * or requests needed for copying are not supported by kernel (or io_uring is
+ * disabled) or on error.
+ */
+struct uring* uring_create(void);
+
+/* Destroy io_uring instance.
+ */
+void uring_free(struct uring* ring);
+
+/* Run jobs from 0 to job_count - 1 copying contents between files and
+ * archive_file at positions given by jobs (archive is read from its mapping
+ * if it is mapped by file_map()). Jobs are prepared in order, but they can be
+ * finished in any order. Current position in archive_file is not used and
+ * not changed. Return 0 on success, -1 on error (all started requests are
+ * completed and opened files are closed before return).
+ */
+int uring_copy_files(struct uring* ring,
+                     struct file_wrapper* archive_file,
+                     size_t job_count,
+                     uring_prepare_function prepare_function,
+                     uring_finish_function finish_function,
+                     void* context);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef VERIFY_H_INCLUDED
+#define VERIFY_H_INCLUDED
+
+#include "file_wrapper.h"
+#include "program_options.h"
+
+/* Check structure of archive in input_file and checksums stored in it (for
+ * v3 archives: main header, index regions, contents of files and symlinks
+ * with checksums and chunks of chunked files). Contents are checked using
+ * thread pool of program_parameters->thread_count threads with positioned
+ * reads, and nothing is extracted. Every corrupted entry is reported, then
+ * program exits with error if any were found. v2 archives do not have
+ * checksums, so only their headers and content bounds are checked.
+ */
+void verify_archive(struct file_wrapper* input_file,
+                    const struct program_parameters* program_parameters);
+
+#endif
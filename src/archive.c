@@ -9,48 +9,63 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "archive_v3.h"
+#include "checksum.h"
+#include "codec.h"
+#include "parallel.h"
+#include "stats.h"
+#include "uring.h"
 #include "util.h"
 
 void
 assign_archive_positions(struct file_data* file_data,
-                         archive_ptr_t* position_ptr,
-                         const struct program_parameters* program_parameters)
+                         archive_ptr_t* position_ptr)
 {
-    struct file_data* current_file_data;
-
-    for (current_file_data = file_data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
+    // Headers are written in depth-first order, so directory is followed by
+    // its descendants
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        struct file_data* const current_file_data = walk.file_data;
         current_file_data->archive_position = *position_ptr;
         *position_ptr += sizeof(struct archive_entry_data);
-        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
+        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR)
             *position_ptr += sizeof(struct archive_directory_data);
-            if (current_file_data->first_child != NULL)
-                assign_archive_positions(current_file_data->first_child,
-                                         position_ptr,
-                                         program_parameters);
-        } else {
+        else
             *position_ptr += sizeof(struct archive_file_data);
-        }
     }
 }
 
-void
-assign_archive_content_positions(
-  struct file_data* file_data,
-  archive_ptr_t* position_ptr,
-  const struct program_parameters* program_parameters)
+int
+assign_duplicate_content(struct file_data* file_data)
 {
-    struct file_data* current_file_data;
+    const struct file_data* const original = file_data->content_original;
+    if (original == NULL)
+        return 0;
 
-    for (current_file_data = file_data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
-        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
-            if (current_file_data->first_child != NULL)
-                assign_archive_content_positions(current_file_data->first_child,
-                                                 position_ptr,
-                                                 program_parameters);
-        } else {
+    file_data->archive_content_position = original->archive_content_position;
+    file_data->archive_content_size = original->archive_content_size;
+    file_data->content_codec = original->content_codec;
+    return 1;
+}
+
+void
+assign_archive_content_positions(struct file_data* file_data,
+                                 archive_ptr_t* position_ptr)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (((current_file_data->file_mode & S_IFMT) == S_IFDIR) ||
+            (current_file_data->inline_content != NULL))
+            continue;
+        if (!assign_duplicate_content(current_file_data)) {
             current_file_data->archive_content_position = *position_ptr;
+            current_file_data->archive_content_size =
+              (archive_ptr_t)current_file_data->file_size;
             *position_ptr += current_file_data->file_size;
         }
     }
@@ -61,9 +76,12 @@ write_archive_headers(struct file_data* file_data,
                       struct file_wrapper* output_file,
                       const struct program_parameters* program_parameters)
 {
-    struct file_data* current_file_data;
-    for (current_file_data = file_data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        const struct file_data* const current_file_data = walk.file_data;
         struct archive_entry_data entry_data;
         entry_data.mode = current_file_data->file_mode;
 
@@ -79,21 +97,27 @@ write_archive_headers(struct file_data* file_data,
         entry_data.st_mtim = current_file_data->st_mtim;
         entry_data.st_ctim = current_file_data->st_ctim;
 
+        if ((current_file_data->file_name[0] == '\0') ||
+            (check_file_name(current_file_data->file_name,
+                             sizeof(entry_data.name)) < 0))
+            print_file_error(program_parameters,
+                             "Error: invalid file name %s\n",
+                             current_file_data);
         memset(&(entry_data.name), 0, 256);
         strcpy(entry_data.name, current_file_data->file_name);
 
-        if (file_write(output_file,
-                       &entry_data,
-                       sizeof(struct archive_entry_data)) < 0) {
-            print_perror(program_parameters, "file_write() failed");
-        }
+        // Entry data and following directory or file data are written by
+        // one call
+        struct iovec segments[2];
+        segments[0].iov_base = &entry_data;
+        segments[0].iov_len = sizeof(struct archive_entry_data);
 
+        struct archive_directory_data archive_directory_data;
+        struct archive_file_data archive_file_data;
         if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
-            print_info(program_parameters,
-                       "Adding directory %s..\n",
-                       current_file_data->file_access_path);
-
-            struct archive_directory_data archive_directory_data;
+            print_file_info(program_parameters,
+                            "Adding directory %s..\n",
+                            current_file_data);
 
             if (current_file_data->first_child != NULL) {
                 archive_directory_data.is_empty = 0;
@@ -103,33 +127,76 @@ write_archive_headers(struct file_data* file_data,
                 archive_directory_data.is_empty = 1;
                 archive_directory_data.first_child_ptr = 0;
             }
-            if (file_write(output_file,
-                           &archive_directory_data,
-                           sizeof(struct archive_directory_data)) < 0) {
-                print_perror(program_parameters, "file_write() failed");
-            }
-
-            if (current_file_data->first_child != NULL) {
-                write_archive_headers(current_file_data->first_child,
-                                      output_file,
-                                      program_parameters);
-            }
+            segments[1].iov_base = &archive_directory_data;
+            segments[1].iov_len = sizeof(struct archive_directory_data);
         } else {
-            print_info(program_parameters,
-                       "Adding file %s...\n",
-                       current_file_data->file_access_path);
+            print_file_info(program_parameters,
+                            "Adding file %s...\n",
+                            current_file_data);
 
-            struct archive_file_data archive_file_data;
             archive_file_data.content_ptr =
               current_file_data->archive_content_position;
             archive_file_data.content_size = current_file_data->file_size;
-
-            if (file_write(output_file,
-                           &archive_file_data,
-                           sizeof(struct archive_file_data)) < 0) {
-                print_perror(program_parameters, "file_write() failed");
-            }
+            segments[1].iov_base = &archive_file_data;
+            segments[1].iov_len = sizeof(struct archive_file_data);
         }
+
+        if (file_writev(output_file, segments, 2) < 0)
+            print_perror(program_parameters, "file_writev() failed");
+    }
+}
+
+void
+write_archive_entry_content(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters)
+{
+    if (file_data->base_archive != NULL) {
+        // Stored content is copied as is, without decoding
+        if (file_seek(file_data->base_archive,
+                      (off_t)file_data->base_content_position) < 0)
+            print_perror(program_parameters, "file_seek() failed");
+        if (file_cat(file_data->base_archive,
+                     output_file,
+                     file_data->base_content_size,
+                     program_parameters->file_cat_buffer_size) < 0)
+            print_perror(program_parameters, "file_cat() failed");
+        file_data->archive_content_size = file_data->base_content_size;
+        return;
+    }
+
+    file_data->archive_content_size = (archive_ptr_t)file_data->file_size;
+
+    if ((file_data->file_mode & S_IFMT) == S_IFREG) {
+        const uint64_t start_time = stats_start_file();
+        struct file_wrapper* const current_file =
+          open_file_data(file_data, O_RDONLY);
+        if (current_file == NULL)
+            print_perror(program_parameters, "open_file_data() failed");
+
+        if (file_data->content_codec != CODEC_NONE) {
+            if (codec_write_content(current_file,
+                                    output_file,
+                                    file_data->file_size,
+                                    file_data->content_codec,
+                                    &(file_data->archive_content_size)) < 0)
+                print_perror(program_parameters,
+                             "codec_write_content() failed");
+        } else if (file_cat(current_file,
+                            output_file,
+                            file_data->file_size,
+                            program_parameters->file_cat_buffer_size) < 0)
+            print_perror(program_parameters, "file_cat() failed");
+
+        if (file_close(current_file) < 0)
+            print_perror(program_parameters, "file_close() failed");
+        stats_finish_file(start_time, file_data);
+    } else if ((file_data->file_mode & S_IFMT) == S_IFLNK) {
+        if (file_write(output_file,
+                       file_data->symlink_target,
+                       file_data->file_size) < 0)
+            print_perror(program_parameters, "file_write() failed");
     }
 }
 
@@ -138,35 +205,346 @@ write_archive_content(struct file_data* file_data,
                       struct file_wrapper* output_file,
                       const struct program_parameters* program_parameters)
 {
-    struct file_data* current_file_data;
-    for (current_file_data = file_data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
-        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
-            if (current_file_data->first_child != NULL)
-                write_archive_content(current_file_data->first_child,
-                                      output_file,
-                                      program_parameters);
-        } else if ((current_file_data->file_mode & S_IFMT) == S_IFREG) {
-            struct file_wrapper* const current_file =
-              file_open(current_file_data->file_access_path, O_RDONLY);
-            if (current_file == NULL)
-                print_perror(program_parameters, "file_open() failed");
-
-            if (file_cat(current_file,
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (((current_file_data->file_mode & S_IFMT) != S_IFDIR) &&
+            (current_file_data->content_original == NULL) &&
+            (current_file_data->inline_content == NULL))
+            write_archive_entry_content(
+              current_file_data, output_file, program_parameters);
+    }
+}
+
+/* Array of pointers to file_data entries having content in archive.
+ */
+struct content_entry_list
+{
+    struct file_data** entries;
+    size_t count;
+    size_t capacity;
+};
+
+/* Append files and symlinks from file_data, following entries and all their
+ * descendants to list.
+ */
+static void
+collect_content_entries(struct file_data* file_data,
+                        struct content_entry_list* list,
+                        const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR)
+            continue;
+
+        if (list->count == list->capacity) {
+            const size_t new_capacity =
+              (list->capacity == 0) ? 64 : list->capacity * 2;
+            struct file_data** const new_entries = realloc(
+              list->entries, sizeof(struct file_data*) * new_capacity);
+            if (new_entries == NULL)
+                print_perror(program_parameters, "realloc() failed");
+            list->entries = new_entries;
+            list->capacity = new_capacity;
+        }
+        list->entries[list->count] = current_file_data;
+        list->count++;
+    }
+}
+
+/* Shared data of content writing tasks.
+ */
+struct content_write_context
+{
+    struct content_entry_list list;
+    struct file_wrapper* output_file;
+    const struct program_parameters* program_parameters;
+};
+
+/* Set size and position of output_file to end of contents of entries in
+ * list, which are written with positioned writes (they do not update
+ * file_wrapper).
+ */
+static void
+seek_archive_content_end(const struct content_entry_list* list,
+                         struct file_wrapper* output_file,
+                         const struct program_parameters* program_parameters)
+{
+    off_t end_position = output_file->position;
+    size_t i;
+    for (i = 0; i < list->count; i++) {
+        const off_t content_end =
+          (off_t)(list->entries[i]->archive_content_position +
+                  list->entries[i]->file_size);
+        if (content_end > end_position)
+            end_position = content_end;
+    }
+    if (end_position > output_file->size)
+        output_file->size = end_position;
+    if (file_seek(output_file, end_position) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+}
+
+/* Write content of one file or symlink to its archive_content_position.
+ */
+static void
+write_archive_content_task(size_t task_index, void* context)
+{
+    const struct content_write_context* const write_context = context;
+    const struct program_parameters* const program_parameters =
+      write_context->program_parameters;
+    const struct file_data* const current_file_data =
+      write_context->list.entries[task_index];
+
+    // Duplicate content is already written for original entry, inline
+    // content is written with entry header
+    if ((current_file_data->content_original != NULL) ||
+        (current_file_data->inline_content != NULL))
+        return;
+
+    if (current_file_data->base_archive != NULL) {
+        if (file_cat_at(current_file_data->base_archive,
+                        (off_t)current_file_data->base_content_position,
+                        write_context->output_file,
+                        (off_t)current_file_data->archive_content_position,
+                        current_file_data->base_content_size,
+                        program_parameters->file_cat_buffer_size) < 0)
+            print_perror(program_parameters, "file_cat_at() failed");
+    } else if ((current_file_data->file_mode & S_IFMT) == S_IFREG) {
+        const uint64_t start_time = stats_start_file();
+        struct file_wrapper* const current_file =
+          open_file_data(current_file_data, O_RDONLY);
+        if (current_file == NULL)
+            print_perror(program_parameters, "open_file_data() failed");
+
+        if (file_cat_at(current_file,
+                        0,
+                        write_context->output_file,
+                        (off_t)current_file_data->archive_content_position,
+                        current_file_data->file_size,
+                        program_parameters->file_cat_buffer_size) < 0)
+            print_perror(program_parameters, "file_cat_at() failed");
+
+        if (file_close(current_file) < 0)
+            print_perror(program_parameters, "file_close() failed");
+        stats_finish_file(start_time, current_file_data);
+    } else if ((current_file_data->file_mode & S_IFMT) == S_IFLNK) {
+        if (file_pwrite(write_context->output_file,
+                        current_file_data->symlink_target,
+                        current_file_data->file_size,
+                        (off_t)current_file_data->archive_content_position) <
+            0)
+            print_perror(program_parameters, "file_pwrite() failed");
+    }
+}
+
+void
+write_archive_content_parallel(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters)
+{
+    // Buffered data is written before content is written by positions
+    if (file_flush(output_file) < 0)
+        print_perror(program_parameters, "file_flush() failed");
+
+    struct content_write_context context;
+    context.list.entries = NULL;
+    context.list.count = 0;
+    context.list.capacity = 0;
+    context.output_file = output_file;
+    context.program_parameters = program_parameters;
+
+    collect_content_entries(file_data, &(context.list), program_parameters);
+
+    run_parallel(context.list.count,
+                 program_parameters->thread_count,
+                 write_archive_content_task,
+                 &context);
+
+    seek_archive_content_end(&(context.list), output_file, program_parameters);
+    free(context.list.entries);
+}
+
+/* Prepare io_uring job writing content of one file or symlink. Contents
+ * copied from base archive are written at once (by kernel).
+ */
+static int
+prepare_content_write_job(size_t job_index,
+                          void* context,
+                          struct uring_job* job)
+{
+    const struct content_write_context* const write_context = context;
+    const struct program_parameters* const program_parameters =
+      write_context->program_parameters;
+    const struct file_data* const current_file_data =
+      write_context->list.entries[job_index];
+
+    if ((current_file_data->content_original != NULL) ||
+        (current_file_data->inline_content != NULL))
+        return 0;
+    if (current_file_data->base_archive != NULL) {
+        write_archive_content_task(job_index, context);
+        return 0;
+    }
+    // Empty files have no content, so they are not opened at all
+    if (current_file_data->file_size == 0)
+        return 0;
+
+    job->flags = O_RDONLY;
+    job->mode = 0;
+    job->archive_position = (off_t)current_file_data->archive_content_position;
+    job->size = (size_t)current_file_data->file_size;
+    if ((current_file_data->file_mode & S_IFMT) == S_IFLNK) {
+        job->data = current_file_data->symlink_target;
+        return 1;
+    }
+    job->data = NULL;
+    if (get_file_path(current_file_data, NULL, job->path, sizeof(job->path)) >=
+        sizeof(job->path)) {
+        errno = ENAMETOOLONG;
+        print_perror(program_parameters, "get_file_path() failed");
+    }
+    job->start_time = stats_start_file();
+    return 1;
+}
+
+/* Finish io_uring job writing content of one file or symlink.
+ */
+static void
+finish_content_write_job(size_t job_index,
+                         void* context,
+                         const struct uring_job* job)
+{
+    const struct content_write_context* const write_context = context;
+    if (job->data == NULL)
+        stats_finish_file(job->start_time,
+                          write_context->list.entries[job_index]);
+}
+
+int
+write_archive_content_uring(struct file_data* file_data,
+                            struct file_wrapper* output_file,
+                            const struct program_parameters* program_parameters)
+{
+    // Buffered data is written before content is written by positions
+    if (file_flush(output_file) < 0)
+        print_perror(program_parameters, "file_flush() failed");
+
+    struct uring* const ring = uring_create();
+    if (ring == NULL)
+        return -1;
+
+    struct content_write_context context;
+    context.list.entries = NULL;
+    context.list.count = 0;
+    context.list.capacity = 0;
+    context.output_file = output_file;
+    context.program_parameters = program_parameters;
+
+    collect_content_entries(file_data, &(context.list), program_parameters);
+
+    if (uring_copy_files(ring,
                          output_file,
-                         current_file_data->file_size,
-                         program_parameters->file_cat_buffer_size) < 0)
-                print_perror(program_parameters, "file_cat() failed");
-
-            if (file_close(current_file) < 0)
-                print_perror(program_parameters, "file_close() failed");
-        } else if ((current_file_data->file_mode & S_IFMT) == S_IFLNK) {
-            if (file_write(output_file,
-                           current_file_data->symlink_target,
-                           current_file_data->file_size) < 0)
-                print_perror(program_parameters, "file_write() failed");
+                         context.list.count,
+                         prepare_content_write_job,
+                         finish_content_write_job,
+                         &context) < 0)
+        print_perror(program_parameters, "uring_copy_files() failed");
+    uring_free(ring);
+
+    seek_archive_content_end(&(context.list), output_file, program_parameters);
+    free(context.list.entries);
+    return 0;
+}
+
+void
+write_archive_content_by_options(
+  struct file_data* file_data,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters)
+{
+    if (program_parameters->use_io_uring) {
+        if (write_archive_content_uring(
+              file_data, output_file, program_parameters) == 0)
+            return;
+        print_info(program_parameters,
+                   "Can not use io_uring (%s), using read() and write()\n",
+                   strerror(errno));
+        errno = 0;
+    }
+
+    if (program_parameters->thread_count > 1)
+        write_archive_content_parallel(
+          file_data, output_file, program_parameters);
+    else
+        write_archive_content(file_data, output_file, program_parameters);
+}
+
+/* Calculate checksum of written content of one file or symlink.
+ */
+static void
+assign_content_checksum_task(size_t task_index, void* context)
+{
+    const struct content_write_context* const write_context = context;
+    struct file_data* const current_file_data =
+      write_context->list.entries[task_index];
+
+    // Duplicate content has the same checksum as original content, inline
+    // content is covered by checksum of header block
+    if ((current_file_data->content_original != NULL) ||
+        (current_file_data->inline_content != NULL))
+        return;
+
+    if (file_checksum_at(write_context->output_file,
+                         (off_t)current_file_data->archive_content_position,
+                         current_file_data->archive_content_size,
+                         &(current_file_data->content_checksum)) < 0)
+        print_perror(write_context->program_parameters,
+                     "file_checksum_at() failed");
+    current_file_data->has_content_checksum = 1;
+}
+
+void
+assign_content_checksums(struct file_data* file_data,
+                         struct file_wrapper* output_file,
+                         const struct program_parameters* program_parameters)
+{
+    // Content is read by positions from several threads, so buffered data
+    // has to be written before
+    if (file_flush(output_file) < 0)
+        print_perror(program_parameters, "file_flush() failed");
+
+    struct content_write_context context;
+    context.list.entries = NULL;
+    context.list.count = 0;
+    context.list.capacity = 0;
+    context.output_file = output_file;
+    context.program_parameters = program_parameters;
+
+    collect_content_entries(file_data, &(context.list), program_parameters);
+
+    run_parallel(context.list.count,
+                 program_parameters->thread_count,
+                 assign_content_checksum_task,
+                 &context);
+
+    // Originals are always stored in archive, so they already have checksums
+    size_t i;
+    for (i = 0; i < context.list.count; i++) {
+        struct file_data* const current_file_data = context.list.entries[i];
+        if (current_file_data->content_original != NULL) {
+            current_file_data->content_checksum =
+              current_file_data->content_original->content_checksum;
+            current_file_data->has_content_checksum = 1;
         }
     }
+
+    free(context.list.entries);
 }
 
 void
@@ -179,12 +557,127 @@ write_full_archive(struct file_data* file_data,
 
     header.root_directory_ptr = file_data->archive_position;
 
+    stats_set_phase(STATS_PHASE_HEADERS);
     if (file_write(output_file, &header, sizeof(struct archive_header)) < 0) {
         print_perror(program_parameters, "file_write() failed");
     }
 
     write_archive_headers(file_data, output_file, program_parameters);
-    write_archive_content(file_data, output_file, program_parameters);
+    stats_set_phase(STATS_PHASE_CONTENT);
+    write_archive_content_by_options(
+      file_data, output_file, program_parameters);
+}
+
+struct file_data*
+check_appended_entries(const struct file_data* file_data,
+                       struct file_data* archive_data,
+                       const struct program_parameters* program_parameters)
+{
+    struct file_data* last_archive_data = archive_data;
+    while (last_archive_data->next != NULL)
+        last_archive_data = last_archive_data->next;
+
+    const struct file_data* current_file_data;
+    for (current_file_data = file_data; current_file_data != NULL;
+         current_file_data = current_file_data->next) {
+        const struct file_data* current_archive_data;
+        for (current_archive_data = archive_data; current_archive_data != NULL;
+             current_archive_data = current_archive_data->next) {
+            if (strcmp(current_file_data->file_name,
+                       current_archive_data->file_name) == 0)
+                print_error(program_parameters,
+                            "Error: %s already exists in archive\n",
+                            current_file_data->file_name);
+        }
+    }
+
+    return last_archive_data;
+}
+
+/* Append file_data entries to v2 archive_file (see append_archive()).
+ */
+static void
+append_archive_v2(struct file_data* file_data,
+                  struct file_wrapper* archive_file,
+                  const struct program_parameters* program_parameters)
+{
+    if ((program_parameters->content_codec != CODEC_NONE) ||
+        program_parameters->chunk_content ||
+        program_parameters->checksum_content ||
+        program_parameters->write_central_directory)
+        print_error(program_parameters,
+                    "Error: codecs, chunking, checksums and central "
+                    "directory are supported in v3 format only\n");
+
+    // v2 format has no codecs, so sparse files are stored with holes
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.file_data->content_codec == CODEC_SPARSE)
+            walk.file_data->content_codec = CODEC_NONE;
+    }
+
+    stats_set_phase(STATS_PHASE_READ_INDEX);
+    struct file_data* const archive_data =
+      read_full_archive(archive_file, program_parameters);
+    struct file_data* const last_archive_data =
+      check_appended_entries(file_data, archive_data, program_parameters);
+
+    // Header positions only grow along sibling and child pointers, so
+    // entries appended at the end of file pass the circular pointer check
+    stats_set_phase(STATS_PHASE_ASSIGN);
+    archive_ptr_t current_position = (archive_ptr_t)archive_file->size;
+    assign_archive_positions(file_data, &current_position);
+    assign_archive_content_positions(file_data, &current_position);
+
+    stats_set_phase(STATS_PHASE_HEADERS);
+    if (file_seek(archive_file, archive_file->size) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    write_archive_headers(file_data, archive_file, program_parameters);
+    stats_set_phase(STATS_PHASE_CONTENT);
+    write_archive_content_by_options(
+      file_data, archive_file, program_parameters);
+
+    // Last root entry is linked to new entries
+    stats_set_phase(STATS_PHASE_HEADERS);
+    struct archive_entry_data entry_data;
+    if (file_pread(archive_file,
+                   &entry_data,
+                   sizeof(struct archive_entry_data),
+                   (off_t)last_archive_data->archive_position) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+    entry_data.is_last = 0;
+    entry_data.next_ptr = file_data->archive_position;
+    if (file_pwrite(archive_file,
+                    &entry_data,
+                    sizeof(struct archive_entry_data),
+                    (off_t)last_archive_data->archive_position) < 0)
+        print_perror(program_parameters, "file_pwrite() failed");
+
+    free_directory_tree(archive_data);
+}
+
+void
+append_archive(struct file_data* file_data,
+               struct file_wrapper* archive_file,
+               const struct program_parameters* program_parameters)
+{
+    uint8_t header_sign[ARCHIVE_HEADER_SIGN_SIZE];
+    if (file_pread(archive_file, header_sign, ARCHIVE_HEADER_SIGN_SIZE, 0) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+
+    if (memcmp(header_sign,
+               ARCHIVE_HEADER_SIGN_V3_STREAM,
+               ARCHIVE_HEADER_SIGN_SIZE) == 0)
+        print_error(program_parameters,
+                    "Error: streamed archive can not be appended to\n");
+    if (memcmp(header_sign, ARCHIVE_HEADER_SIGN_V3, ARCHIVE_HEADER_SIGN_SIZE) ==
+        0) {
+        append_archive_v3(file_data, archive_file, program_parameters);
+        return;
+    }
+
+    append_archive_v2(file_data, archive_file, program_parameters);
 }
 
 int
@@ -199,6 +692,24 @@ check_file_name(const char* name, size_t buffer_size)
     return 0;
 }
 
+void
+check_archive_entry_names(const struct file_data* file_data,
+                          const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        const char* const name = walk.file_data->file_name;
+        if ((name[0] == '\0') ||
+            (check_file_name(name, ARCHIVE_V3_MAX_NAME_LENGTH + 1) < 0))
+            print_file_error(program_parameters,
+                             "Error: invalid file name %s\n",
+                             walk.file_data);
+    }
+}
+
 int
 check_file_mode(mode_t mode)
 {
@@ -210,13 +721,85 @@ check_file_mode(mode_t mode)
     return 0;
 }
 
+/* Read one v2 archive entry header at given position to entry_header (and
+ * directory header to directory_header for directories, their children are
+ * not read) and return file_data allocated from arena.
+ */
+static struct file_data*
+read_archive_entry(struct file_data* parent,
+                   struct arena* arena,
+                   struct file_wrapper* input_file,
+                   archive_ptr_t position,
+                   struct archive_entry_data* entry_header,
+                   struct archive_directory_data* directory_header,
+                   const struct program_parameters* program_parameters)
+{
+    if (file_seek(input_file, (off_t)position) < 0) {
+        print_perror(program_parameters, "file_seek() failed");
+    }
+
+    if (file_read(
+          input_file, entry_header, sizeof(struct archive_entry_data)) < 0)
+        print_perror(program_parameters, "file_read() failed");
+
+    if (check_file_name(entry_header->name, sizeof(entry_header->name)) < 0) {
+        entry_header->name[sizeof(entry_header->name) - 1] = '\0';
+        print_error(program_parameters,
+                    "Error: invalid file name %s\n",
+                    entry_header->name);
+    }
+
+    if (check_file_mode((mode_t)entry_header->mode) < 0)
+        print_error(program_parameters,
+                    "Error: invalid file mode %x\n",
+                    entry_header->mode);
+
+    struct file_data* const data = create_file_data(
+      entry_header->name, parent, arena, program_parameters);
+    data->file_mode = (mode_t)entry_header->mode;
+    data->st_atim = entry_header->st_atim;
+    data->st_mtim = entry_header->st_mtim;
+    data->st_ctim = entry_header->st_ctim;
+    data->archive_position = position;
+
+    if ((data->file_mode & S_IFMT) == S_IFDIR) {
+        if (file_read(input_file,
+                      directory_header,
+                      sizeof(struct archive_directory_data)) < 0) {
+            print_perror(program_parameters, "file_read() failed");
+        }
+    } else if (((data->file_mode & S_IFMT) == S_IFREG) ||
+               (data->file_mode & S_IFMT) == S_IFLNK) {
+        struct archive_file_data file_header;
+        if (file_read(input_file,
+                      &file_header,
+                      sizeof(struct archive_file_data)) < 0) {
+            print_perror(program_parameters, "file_read() failed");
+        }
+
+        data->file_size = file_header.content_size;
+        data->archive_content_position = file_header.content_ptr;
+        data->archive_content_size = file_header.content_size;
+    } else {
+        // TODO
+        print_error(program_parameters,
+                    "Error: invalid archive entry type "
+                    "(should be either directory, symlink or file)\n");
+    }
+
+    return data;
+}
+
 struct file_data*
-read_archive_headers(const char* parent_path,
+read_archive_headers(struct file_data* parent,
+                     struct arena* arena,
                      struct file_wrapper* input_file,
                      archive_ptr_t position,
                      const struct program_parameters* program_parameters)
 {
     struct file_data* first_file_data = NULL;
+    // Directory which entries are currently read and its last read entry
+    struct file_data* current_parent = parent;
     struct file_data* current_file_data = NULL;
 
     archive_ptr_t current_position = position;
@@ -235,104 +818,296 @@ read_archive_headers(const char* parent_path,
             print_error(program_parameters, "Error: invalid header position\n");
         }
 
-        if (file_seek(input_file, (off_t)current_position) < 0) {
-            print_perror(program_parameters, "file_seek() failed");
-        }
-
         struct archive_entry_data entry_header;
-        if (file_read(
-              input_file, &entry_header, sizeof(struct archive_entry_data)) < 0)
-            print_perror(program_parameters, "file_read() failed");
+        struct archive_directory_data directory_header;
+        struct file_data* const data = read_archive_entry(current_parent,
+                                                          arena,
+                                                          input_file,
+                                                          current_position,
+                                                          &entry_header,
+                                                          &directory_header,
+                                                          program_parameters);
 
-        if (check_file_name(entry_header.name, sizeof(entry_header.name)) < 0) {
-            entry_header.name[sizeof(entry_header.name) - 1] = '\0';
-            print_error(program_parameters,
-                        "Error: invalid file name %s\n",
-                        entry_header.name);
+        if (current_file_data != NULL)
+            current_file_data->next = data;
+        else if (current_parent != parent)
+            current_parent->first_child = data;
+        else
+            first_file_data = data;
+        current_file_data = data;
+
+        if (((data->file_mode & S_IFMT) == S_IFDIR) &&
+            (directory_header.is_empty == 0)) {
+            current_parent = data;
+            current_file_data = NULL;
+            current_position = directory_header.first_child_ptr;
+            continue;
         }
 
-        if (check_file_mode((mode_t)entry_header.mode) < 0)
-            print_error(program_parameters,
-                        "Error: invalid file mode %x\n",
-                        entry_header.mode);
+        // After last entry of directory, reading continues from next sibling
+        // of nearest ancestor having it. Headers of ancestors are read again
+        // instead of being kept for every level.
+        while ((entry_header.is_last != 0) && (current_parent != parent)) {
+            current_file_data = current_parent;
+            current_parent = current_parent->parent;
+            if (file_pread(input_file,
+                           &entry_header,
+                           sizeof(struct archive_entry_data),
+                           (off_t)current_file_data->archive_position) < 0)
+                print_perror(program_parameters, "file_pread() failed");
+        }
+        if (entry_header.is_last != 0)
+            break;
+        current_position = entry_header.next_ptr;
+    }
 
-        struct file_data* const data = malloc(sizeof(struct file_data));
-        if (data == NULL)
-            print_perror(program_parameters, "malloc() failed");
+    return first_file_data;
+}
+
+/* Check that content of file or symlink is located inside input_file.
+ */
+static void
+check_archive_content_bounds(
+  const struct file_data* file_data,
+  const struct file_wrapper* input_file,
+  const struct program_parameters* program_parameters)
+{
+    if (file_data->archive_content_position >=
+        (archive_ptr_t)input_file->size) {
+        print_error(program_parameters,
+                    "Error: file content "
+                    "position %lu is "
+                    "exceeding file "
+                    "size %ld\n",
+                    file_data->archive_content_position,
+                    input_file->size);
+    }
+    if (file_data->archive_content_size >
+        (archive_ptr_t)input_file->size - file_data->archive_content_position) {
+        print_error(program_parameters,
+                    "Error: file content end "
+                    "position %lu is "
+                    "exceeding file "
+                    "size %ld\n",
+                    file_data->archive_content_position +
+                      file_data->archive_content_size,
+                    input_file->size);
+    }
+}
 
-        data->first_child = NULL;
-        data->next = NULL;
-        data->file_size = 0;
-        data->file_name = str_create_copy(entry_header.name);
-        if (data->file_name == NULL)
-            print_perror(program_parameters, "str_create_copy() failed");
-        if (parent_path != NULL) {
-            data->file_access_path =
-              str_create_concat3(parent_path, "/", data->file_name);
-            if (data->file_access_path == NULL)
-                print_perror(program_parameters, "str_create_concat3() failed");
+/* Return permission bits of archive entry mode.
+ */
+static mode_t
+get_permission_mode(mode_t mode)
+{
+    return mode & (S_IRWXU | S_IRWXG | S_IRWXO | S_ISUID | S_ISGID | S_ISVTX);
+}
+
+/* Write path of file_data in output directory to buffer of
+ * FILE_PATH_BUFFER_SIZE bytes.
+ */
+static void
+get_output_path(const struct file_data* file_data,
+                const char* output_directory_name,
+                char* buffer,
+                const struct program_parameters* program_parameters)
+{
+    if (get_file_path(file_data,
+                      output_directory_name,
+                      buffer,
+                      FILE_PATH_BUFFER_SIZE) >= FILE_PATH_BUFFER_SIZE)
+        print_error(
+          program_parameters, "Error: output path of %s is too long\n", buffer);
+}
+
+/* Set access and modification time of file at file_path from file_data.
+ */
+static void
+set_file_times(const struct file_data* file_data,
+               const char* file_path,
+               const struct program_parameters* program_parameters)
+{
+    struct timespec file_times[2];
+    file_times[0] = file_data->st_atim;
+    file_times[1] = file_data->st_mtim;
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (utimensat(AT_FDCWD, file_path, file_times, 0) < 0) {
+        print_perror(program_parameters, "utimensat() failed");
+    }
+}
+
+/* Set access and modification time of file_data in output directory.
+ */
+static void
+set_output_file_times(const struct file_data* file_data,
+                      const char* output_directory_name,
+                      const struct program_parameters* program_parameters)
+{
+    char file_path[FILE_PATH_BUFFER_SIZE];
+    get_output_path(
+      file_data, output_directory_name, file_path, program_parameters);
+    set_file_times(file_data, file_path, program_parameters);
+}
+
+/* Create directory of file_data in output directory.
+ */
+static void
+extract_directory(const struct file_data* file_data,
+                  const char* output_directory_name,
+                  const struct program_parameters* program_parameters)
+{
+    char file_path[FILE_PATH_BUFFER_SIZE];
+    get_output_path(
+      file_data, output_directory_name, file_path, program_parameters);
+    print_info(
+      program_parameters, "Extracting directory to %s...\n", file_path);
+
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (mkdir(file_path, get_permission_mode(file_data->file_mode)) < 0) {
+        if (errno == EEXIST) {
+            errno = 0; // TODO
         } else {
-            data->file_access_path = str_create_copy(data->file_name);
-            if (data->file_access_path == NULL)
-                print_perror(program_parameters, "str_create_copy() failed");
+            print_perror(program_parameters, "mkdir() failed");
         }
-        data->file_mode = (mode_t)entry_header.mode;
-        data->symlink_target = NULL;
-        data->st_atim = entry_header.st_atim;
-        data->st_mtim = entry_header.st_mtim;
-        data->st_ctim = entry_header.st_ctim;
-        data->archive_position = current_position;
-
-        if ((data->file_mode & S_IFMT) == S_IFDIR) {
-            struct archive_directory_data directory_header;
-            if (file_read(input_file,
-                          &directory_header,
-                          sizeof(struct archive_directory_data)) < 0) {
-                print_perror(program_parameters, "file_read() failed");
-            }
+    }
+}
 
-            if (directory_header.is_empty == 0) {
-                data->first_child =
-                  read_archive_headers(data->file_access_path,
-                                       input_file,
-                                       directory_header.first_child_ptr,
-                                       program_parameters);
-            }
-        } else if (((data->file_mode & S_IFMT) == S_IFREG) ||
-                   (data->file_mode & S_IFMT) == S_IFLNK) {
-            struct archive_file_data file_header;
-            if (file_read(input_file,
-                          &file_header,
-                          sizeof(struct archive_file_data)) < 0) {
-                print_perror(program_parameters, "file_read() failed");
-            }
+/* Create hard link of file_data to its link_original in output directory
+ * (which should be already extracted). Return 0 on success, -1 if file
+ * system does not allow one more link and file should be extracted as copy.
+ */
+static int
+extract_hardlink(const struct file_data* file_data,
+                 const char* file_path,
+                 const char* output_directory_name,
+                 const struct program_parameters* program_parameters)
+{
+    char original_path[FILE_PATH_BUFFER_SIZE];
+    get_output_path(file_data->link_original,
+                    output_directory_name,
+                    original_path,
+                    program_parameters);
+    print_info(
+      program_parameters, "Extracting hard link to %s...\n", file_path);
 
-            data->file_size = file_header.content_size;
-            data->archive_content_position = file_header.content_ptr;
-        } else {
-            // TODO
-            print_error(program_parameters,
-                        "Error: invalid archive entry type "
-                        "(should be either directory, symlink or file)\n");
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (link(original_path, file_path) < 0) {
+        // File system can have no hard links or limit their number
+        if ((errno == EPERM) || (errno == EMLINK)) {
+            errno = 0;
+            return -1;
         }
+        print_perror(program_parameters, "link() failed");
+    }
+    return 0;
+}
 
-        if (first_file_data == NULL) {
-            first_file_data = data;
-            current_file_data = data;
-        } else {
-            if (current_file_data != NULL) {
-                current_file_data->next = data;
-            }
-            current_file_data = data;
+/* Extract file or symlink content from input_file to output directory (hard
+ * links are created by link() if their originals are extracted). Only
+ * positioned reads are used for input_file, so this function can be called
+ * from different threads for the same input_file.
+ */
+static void
+extract_file_content(const struct file_data* file_data,
+                     struct file_wrapper* input_file,
+                     const char* output_directory_name,
+                     const struct program_parameters* program_parameters)
+{
+    char file_path[FILE_PATH_BUFFER_SIZE];
+    get_output_path(
+      file_data, output_directory_name, file_path, program_parameters);
+
+    if ((file_data->link_original != NULL) &&
+        (extract_hardlink(file_data,
+                          file_path,
+                          output_directory_name,
+                          program_parameters) == 0))
+        return;
+
+    if ((file_data->file_mode & S_IFMT) == S_IFREG) {
+        print_info(program_parameters, "Extracting file to %s...\n", file_path);
+
+        if (file_data->inline_content == NULL)
+            check_archive_content_bounds(
+              file_data, input_file, program_parameters);
+
+        const uint64_t start_time = stats_start_file();
+        struct file_wrapper* const current_file =
+          file_creat(file_path, get_permission_mode(file_data->file_mode));
+        if (current_file == NULL) {
+            print_perror(program_parameters, "file_creat() failed");
         }
 
-        if (entry_header.is_last == 0) {
-            current_position = entry_header.next_ptr;
-        } else
-            break;
-    }
+        if (file_data->inline_content != NULL) {
+            if (file_write(current_file,
+                           file_data->inline_content,
+                           (size_t)file_data->file_size) < 0)
+                print_perror(program_parameters, "file_write() failed");
+        } else if (file_data->content_codec != CODEC_NONE) {
+            if (codec_read_content(input_file,
+                                   (off_t)file_data->archive_content_position,
+                                   file_data->archive_content_size,
+                                   current_file,
+                                   file_data->file_size,
+                                   file_data->content_codec) < 0)
+                print_perror(program_parameters, "codec_read_content() failed");
+        } else if (file_cat_at(input_file,
+                               (off_t)file_data->archive_content_position,
+                               current_file,
+                               0,
+                               file_data->file_size,
+                               program_parameters->file_cat_buffer_size) < 0) {
+            print_perror(program_parameters, "file_cat_at() failed");
+        }
 
-    return first_file_data;
+        if (file_close(current_file) < 0) {
+            print_perror(program_parameters, "file_close() failed");
+        }
+
+        set_file_times(file_data, file_path, program_parameters);
+        stats_finish_file(start_time, file_data);
+    } else if ((file_data->file_mode & S_IFMT) == S_IFLNK) {
+        print_info(
+          program_parameters, "Extracting symlink to %s...\n", file_path);
+
+        if (file_data->inline_content == NULL)
+            check_archive_content_bounds(
+              file_data, input_file, program_parameters);
+
+        if (file_data->file_size == 0)
+            print_error(program_parameters,
+                        "Error: symlink target of %s is empty\n",
+                        file_path);
+
+        // Entries can be extracted from different threads, so target is
+        // not stored in directory tree arena
+        char* const symlink_target = malloc(file_data->file_size);
+        if (symlink_target == NULL)
+            print_perror(program_parameters, "malloc() failed");
+
+        if (file_data->inline_content != NULL)
+            memcpy(symlink_target,
+                   file_data->inline_content,
+                   (size_t)file_data->file_size);
+        else if (file_pread(input_file,
+                            symlink_target,
+                            file_data->file_size,
+                            (off_t)file_data->archive_content_position) < 0)
+            print_perror(program_parameters, "file_pread() failed");
+
+        if (symlink_target[file_data->file_size - 1] != 0) {
+            symlink_target[file_data->file_size - 1] = 0;
+            print_error(program_parameters,
+                        "Error: symlink target %s is not NULL-terminated\n",
+                        symlink_target);
+        }
+
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (symlink(symlink_target, file_path) < 0) {
+            print_perror(program_parameters, "symlink() failed");
+        }
+        free(symlink_target);
+    }
 }
 
 void
@@ -341,158 +1116,466 @@ read_archive_content(struct file_data* file_data,
                      const char* output_directory_name,
                      const struct program_parameters* program_parameters)
 {
-    struct file_data* current_file_data;
-    for (current_file_data = file_data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
-        const mode_t file_mode =
-          current_file_data->file_mode &
-          (S_IRWXU | S_IRWXG | S_IRWXO | S_ISUID | S_ISGID | S_ISVTX);
-        int need_time_change =
-          ((current_file_data->file_mode & S_IFMT) == S_IFDIR) ||
-          ((current_file_data->file_mode & S_IFMT) == S_IFREG);
-        char* const file_path = str_create_concat3(
-          output_directory_name, "/", current_file_data->file_access_path);
-        if (file_path == NULL)
-            print_perror(program_parameters, "str_create_concat3() failed");
-
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        const struct file_data* const current_file_data = walk.file_data;
         if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
-            print_info(
-              program_parameters, "Extracting directory to %s...\n", file_path);
-
-            if (mkdir(file_path, file_mode) < 0) {
-                if (errno == EEXIST) {
-                    errno = 0; // TODO
-                } else {
-                    print_perror(program_parameters, "mkdir() failed");
-                }
-            }
+            // Creating children changes directory modification time, so
+            // times are set when directory is left
+            if (walk.is_leaving)
+                set_output_file_times(
+                  current_file_data, output_directory_name, program_parameters);
+            else
+                extract_directory(
+                  current_file_data, output_directory_name, program_parameters);
+        } else {
+            extract_file_content(current_file_data,
+                                 input_file,
+                                 output_directory_name,
+                                 program_parameters);
+        }
+    }
+}
 
-            if (current_file_data->first_child != NULL)
-                read_archive_content(current_file_data->first_child,
-                                     input_file,
-                                     output_directory_name,
-                                     program_parameters);
+/* Create directories from file_data, following entries and all their
+ * descendants, parent directories are created before their children.
+ */
+static void
+create_archive_directories(struct file_data* file_data,
+                           const char* output_directory_name,
+                           const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (((walk.file_data->file_mode & S_IFMT) == S_IFDIR) &&
+            !walk.is_leaving)
+            extract_directory(
+              walk.file_data, output_directory_name, program_parameters);
+    }
+}
 
-        } else if ((current_file_data->file_mode & S_IFMT) == S_IFREG) {
-            print_info(
-              program_parameters, "Extracting file to %s...\n", file_path);
+/* Set times of directories from file_data, following entries and all their
+ * descendants, children directories are processed before their parents.
+ */
+static void
+set_archive_directory_times(
+  const struct file_data* file_data,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (((walk.file_data->file_mode & S_IFMT) == S_IFDIR) &&
+            walk.is_leaving)
+            set_output_file_times(
+              walk.file_data, output_directory_name, program_parameters);
+    }
+}
 
-            if (current_file_data->archive_content_position >=
-                (archive_ptr_t)input_file->size) {
-                print_error(program_parameters,
-                            "Error: file content "
-                            "position %lu is "
-                            "exceeding file "
-                            "size %ld\n",
-                            current_file_data->archive_content_position,
-                            input_file->size);
-            }
-            if ((current_file_data->archive_content_position +
-                 current_file_data->file_size) >
-                (archive_ptr_t)input_file->size) {
-                print_error(program_parameters,
-                            "Error: file content end "
-                            "position %lu is "
-                            "exceeding file "
-                            "size %ld\n",
-                            current_file_data->archive_content_position +
-                              current_file_data->file_size,
-                            input_file->size);
-            }
+/* Extract hard links from file_data, following entries and all their
+ * descendants, after contents of their originals are extracted.
+ */
+static void
+extract_archive_hardlinks(struct file_data* file_data,
+                          struct file_wrapper* input_file,
+                          const char* output_directory_name,
+                          const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.file_data->link_original != NULL)
+            extract_file_content(walk.file_data,
+                                 input_file,
+                                 output_directory_name,
+                                 program_parameters);
+    }
+}
 
-            struct file_wrapper* const current_file =
-              file_creat(file_path, file_mode);
-            if (current_file == NULL) {
-                print_perror(program_parameters, "file_creat() failed");
-            }
+/* Shared data of content extracting tasks.
+ */
+struct content_read_context
+{
+    struct content_entry_list list;
+    struct file_wrapper* input_file;
+    const char* output_directory_name;
+    const struct program_parameters* program_parameters;
+};
 
-            if (file_seek(input_file,
-                          (off_t)current_file_data->archive_content_position) <
-                0) {
-                print_perror(program_parameters, "file_seek() failed");
-            }
-            if (file_cat(input_file,
-                         current_file,
-                         current_file_data->file_size,
-                         program_parameters->file_cat_buffer_size) < 0) {
-                print_perror(program_parameters, "file_cat() failed");
-            }
+/* Extract content of one file or symlink.
+ */
+static void
+read_archive_content_task(size_t task_index, void* context)
+{
+    const struct content_read_context* const read_context = context;
+    struct file_data* const current_file_data =
+      read_context->list.entries[task_index];
 
-            if (file_close(current_file) < 0) {
-                print_perror(program_parameters, "file_close() failed");
-            }
-        } else if ((current_file_data->file_mode & S_IFMT) == S_IFLNK) {
-            print_info(
-              program_parameters, "Extracting symlink to %s...\n", file_path);
+    // Hard links are created after their originals are extracted
+    if (current_file_data->link_original != NULL)
+        return;
 
-            if (current_file_data->archive_content_position >=
-                (archive_ptr_t)input_file->size) {
-                print_error(program_parameters,
-                            "Error: file content "
-                            "position %lu is "
-                            "exceeding file "
-                            "size %ld\n",
-                            current_file_data->archive_content_position,
-                            input_file->size);
-            }
-            if ((current_file_data->archive_content_position +
-                 current_file_data->file_size) >
-                (archive_ptr_t)input_file->size) {
+    extract_file_content(current_file_data,
+                         read_context->input_file,
+                         read_context->output_directory_name,
+                         read_context->program_parameters);
+}
+
+void
+read_archive_content_parallel(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters)
+{
+    create_archive_directories(
+      file_data, output_directory_name, program_parameters);
+
+    struct content_read_context context;
+    context.list.entries = NULL;
+    context.list.count = 0;
+    context.list.capacity = 0;
+    context.input_file = input_file;
+    context.output_directory_name = output_directory_name;
+    context.program_parameters = program_parameters;
+
+    collect_content_entries(file_data, &(context.list), program_parameters);
+
+    run_parallel(context.list.count,
+                 program_parameters->thread_count,
+                 read_archive_content_task,
+                 &context);
+
+    free(context.list.entries);
+
+    extract_archive_hardlinks(
+      file_data, input_file, output_directory_name, program_parameters);
+
+    // Creating files changes directory modification times, so directory
+    // times are set after all content is extracted
+    set_archive_directory_times(
+      file_data, output_directory_name, program_parameters);
+}
+
+/* Prepare io_uring job extracting content of one file. Symlinks and encoded
+ * contents are extracted at once.
+ */
+static int
+prepare_content_read_job(size_t job_index, void* context, struct uring_job* job)
+{
+    const struct content_read_context* const read_context = context;
+    const struct program_parameters* const program_parameters =
+      read_context->program_parameters;
+    const struct file_data* const current_file_data =
+      read_context->list.entries[job_index];
+
+    if (current_file_data->link_original != NULL)
+        return 0;
+    if (((current_file_data->file_mode & S_IFMT) != S_IFREG) ||
+        (current_file_data->content_codec != CODEC_NONE)) {
+        read_archive_content_task(job_index, context);
+        return 0;
+    }
+
+    get_output_path(current_file_data,
+                    read_context->output_directory_name,
+                    job->path,
+                    program_parameters);
+    print_info(program_parameters, "Extracting file to %s...\n", job->path);
+    if (current_file_data->inline_content == NULL)
+        check_archive_content_bounds(
+          current_file_data, read_context->input_file, program_parameters);
+
+    job->flags = O_WRONLY | O_CREAT | O_TRUNC;
+    job->mode = get_permission_mode(current_file_data->file_mode);
+    job->data = current_file_data->inline_content;
+    job->archive_position = (off_t)current_file_data->archive_content_position;
+    job->size = (size_t)current_file_data->file_size;
+    job->start_time = stats_start_file();
+    return 1;
+}
+
+/* Finish io_uring job extracting content of one file.
+ */
+static void
+finish_content_read_job(size_t job_index,
+                        void* context,
+                        const struct uring_job* job)
+{
+    const struct content_read_context* const read_context = context;
+    const struct file_data* const current_file_data =
+      read_context->list.entries[job_index];
+
+    set_file_times(
+      current_file_data, job->path, read_context->program_parameters);
+    stats_finish_file(job->start_time, current_file_data);
+}
+
+int
+read_archive_content_uring(struct file_data* file_data,
+                           struct file_wrapper* input_file,
+                           const char* output_directory_name,
+                           const struct program_parameters* program_parameters)
+{
+    struct uring* const ring = uring_create();
+    if (ring == NULL)
+        return -1;
+
+    create_archive_directories(
+      file_data, output_directory_name, program_parameters);
+
+    struct content_read_context context;
+    context.list.entries = NULL;
+    context.list.count = 0;
+    context.list.capacity = 0;
+    context.input_file = input_file;
+    context.output_directory_name = output_directory_name;
+    context.program_parameters = program_parameters;
+
+    collect_content_entries(file_data, &(context.list), program_parameters);
+
+    if (uring_copy_files(ring,
+                         input_file,
+                         context.list.count,
+                         prepare_content_read_job,
+                         finish_content_read_job,
+                         &context) < 0)
+        print_perror(program_parameters, "uring_copy_files() failed");
+    uring_free(ring);
+
+    free(context.list.entries);
+
+    extract_archive_hardlinks(
+      file_data, input_file, output_directory_name, program_parameters);
+
+    set_archive_directory_times(
+      file_data, output_directory_name, program_parameters);
+    return 0;
+}
+
+void
+read_archive_content_by_options(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  const char* output_directory_name,
+  const struct program_parameters* program_parameters)
+{
+    if (program_parameters->use_io_uring) {
+        if (read_archive_content_uring(file_data,
+                                       input_file,
+                                       output_directory_name,
+                                       program_parameters) == 0)
+            return;
+        print_info(program_parameters,
+                   "Can not use io_uring (%s), using read() and write()\n",
+                   strerror(errno));
+        errno = 0;
+    }
+
+    if (program_parameters->thread_count > 1)
+        read_archive_content_parallel(
+          file_data, input_file, output_directory_name, program_parameters);
+    else
+        read_archive_content(
+          file_data, input_file, output_directory_name, program_parameters);
+}
+
+struct file_wrapper*
+open_archive_file(const char* pathname,
+                  const struct program_parameters* program_parameters)
+{
+    struct file_wrapper* const input_file = file_open(pathname, O_RDONLY);
+    if (input_file == NULL) {
+        print_perror(program_parameters, "file_open() failed");
+    }
+
+    if (program_parameters->use_mmap) {
+        if (file_map(input_file) < 0) {
+            print_info(program_parameters,
+                       "Can not map archive to memory (%s), using read()\n",
+                       strerror(errno));
+            errno = 0;
+        }
+    }
+    // Without mapping, headers are read by big portions, since they are
+    // mostly located one after another
+    if (input_file->mapping == NULL) {
+        if (file_set_read_buffer(input_file,
+                                 program_parameters->read_buffer_size) < 0)
+            print_perror(program_parameters, "file_set_read_buffer() failed");
+    }
+
+    return input_file;
+}
+
+struct file_data*
+read_full_archive(struct file_wrapper* input_file,
+                  const struct program_parameters* program_parameters)
+{
+    uint8_t header_sign[ARCHIVE_HEADER_SIGN_SIZE];
+
+    if (file_read(input_file, header_sign, ARCHIVE_HEADER_SIGN_SIZE) < 0) {
+        print_perror(program_parameters, "file_read() failed");
+    }
+    if (file_seek(input_file, 0) < 0) {
+        print_perror(program_parameters, "file_seek() failed");
+    }
+
+    if ((memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0) ||
+        (memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3_STREAM,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0)) {
+        return read_full_archive_v3(input_file, program_parameters);
+    }
+
+    struct archive_header header;
+
+    if (file_read(input_file, &header, sizeof(struct archive_header)) < 0) {
+        print_perror(program_parameters, "file_read() failed");
+    }
+    if (memcmp(header.header_sign,
+               ARCHIVE_HEADER_SIGN,
+               ARCHIVE_HEADER_SIGN_SIZE) != 0) {
+        print_error(program_parameters, "Error: invalid archive header\n");
+    }
+
+    struct arena* const arena = arena_create();
+    if (arena == NULL)
+        print_perror(program_parameters, "arena_create() failed");
+    return set_directory_tree_arena(
+      read_archive_headers(
+        NULL, arena, input_file, header.root_directory_ptr, program_parameters),
+      arena);
+}
+
+/* Find entry with given path in v2 archive following next_ptr and
+ * first_child_ptr pointers from root_directory_ptr.
+ */
+static struct file_data*
+find_archive_member_v2(struct file_wrapper* input_file,
+                       archive_ptr_t position,
+                       const char* path,
+                       const struct program_parameters* program_parameters)
+{
+    const char* component = path;
+    archive_ptr_t previous_position = 0;
+
+    while (1) {
+        while (*component == '/')
+            component++;
+        const size_t component_length = strcspn(component, "/");
+        if ((component_length == 0) || (component_length >= 256))
+            return NULL;
+
+        struct archive_entry_data entry_header;
+        while (1) {
+            // Entries are laid out in depth-first order, so pointers on
+            // lookup path always increase (this also avoids circular
+            // pointers)
+            if ((position >= (archive_ptr_t)input_file->size) ||
+                (position <= previous_position)) {
                 print_error(program_parameters,
-                            "Error: file content end "
-                            "position %lu is "
-                            "exceeding file "
-                            "size %ld\n",
-                            current_file_data->archive_content_position +
-                              current_file_data->file_size,
-                            input_file->size);
+                            "Error: invalid header position %lu\n",
+                            position);
             }
+            previous_position = position;
 
-            current_file_data->symlink_target =
-              malloc(current_file_data->file_size);
-            if (current_file_data->symlink_target == NULL)
-                print_perror(program_parameters, "malloc() failed");
-
-            if (file_seek(input_file,
-                          (off_t)current_file_data->archive_content_position) <
-                0)
-                print_perror(program_parameters, "file_seek() failed");
-            if (file_read(input_file,
-                          current_file_data->symlink_target,
-                          current_file_data->file_size) < 0)
-                print_perror(program_parameters, "file_read() failed");
-
-            if (current_file_data
-                  ->symlink_target[current_file_data->file_size - 1] != 0) {
-                current_file_data
-                  ->symlink_target[current_file_data->file_size - 1] = 0;
+            if (file_pread(input_file,
+                           &entry_header,
+                           sizeof(struct archive_entry_data),
+                           (off_t)position) < 0)
+                print_perror(program_parameters, "file_pread() failed");
+            if (check_file_name(entry_header.name, sizeof(entry_header.name)) <
+                0) {
+                entry_header.name[sizeof(entry_header.name) - 1] = '\0';
                 print_error(program_parameters,
-                            "Error: symlink target %s is not NULL-terminated\n",
-                            current_file_data->symlink_target);
+                            "Error: invalid file name %s\n",
+                            entry_header.name);
             }
 
-            if (symlink(current_file_data->symlink_target, file_path) < 0) {
-                print_perror(program_parameters, "symlink() failed");
-            }
-        }
+            if ((strlen(entry_header.name) == component_length) &&
+                (memcmp(entry_header.name, component, component_length) == 0))
+                break;
 
-        if (need_time_change) {
-            struct timespec file_times[2];
-            file_times[0] = current_file_data->st_atim;
-            file_times[1] = current_file_data->st_mtim;
-            if (utimensat(AT_FDCWD, file_path, file_times, 0) < 0) {
-                print_perror(program_parameters, "utimensat() failed");
-            }
+            if (entry_header.is_last != 0)
+                return NULL;
+            position = entry_header.next_ptr;
         }
 
-        free(file_path);
+        component += component_length;
+        while (*component == '/')
+            component++;
+        if (*component == '\0')
+            break;
+
+        // Entry is not last path component, so it should be non-empty
+        // directory
+        if ((entry_header.mode & S_IFMT) != S_IFDIR)
+            return NULL;
+        struct archive_directory_data directory_header;
+        if (file_pread(input_file,
+                       &directory_header,
+                       sizeof(struct archive_directory_data),
+                       (off_t)(position + sizeof(struct archive_entry_data))) <
+            0)
+            print_perror(program_parameters, "file_pread() failed");
+        if (directory_header.is_empty != 0)
+            return NULL;
+        position = directory_header.first_child_ptr;
     }
+
+    // Found entry is read without its next siblings
+    struct archive_entry_data entry_header;
+    struct archive_directory_data directory_header;
+    struct arena* const arena = arena_create();
+    if (arena == NULL)
+        print_perror(program_parameters, "arena_create() failed");
+    struct file_data* const data = read_archive_entry(NULL,
+                                                      arena,
+                                                      input_file,
+                                                      position,
+                                                      &entry_header,
+                                                      &directory_header,
+                                                      program_parameters);
+    if (((data->file_mode & S_IFMT) == S_IFDIR) &&
+        (directory_header.is_empty == 0))
+        data->first_child =
+          read_archive_headers(data,
+                               arena,
+                               input_file,
+                               directory_header.first_child_ptr,
+                               program_parameters);
+    return set_directory_tree_arena(data, arena);
 }
 
 struct file_data*
-read_full_archive(struct file_wrapper* input_file,
-                  const struct program_parameters* program_parameters)
+find_archive_member(struct file_wrapper* input_file,
+                    const char* path,
+                    const struct program_parameters* program_parameters)
 {
+    uint8_t header_sign[ARCHIVE_HEADER_SIGN_SIZE];
+
+    if (file_read(input_file, header_sign, ARCHIVE_HEADER_SIGN_SIZE) < 0) {
+        print_perror(program_parameters, "file_read() failed");
+    }
+    if (file_seek(input_file, 0) < 0) {
+        print_perror(program_parameters, "file_seek() failed");
+    }
+
+    if ((memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0) ||
+        (memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3_STREAM,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0)) {
+        return find_archive_member_v3(input_file, path, program_parameters);
+    }
+
     struct archive_header header;
 
     if (file_read(input_file, &header, sizeof(struct archive_header)) < 0) {
@@ -504,7 +1587,47 @@ read_full_archive(struct file_wrapper* input_file,
         print_error(program_parameters, "Error: invalid archive header\n");
     }
 
-    return read_archive_headers(
-      NULL, input_file, header.root_directory_ptr, program_parameters);
+    return find_archive_member_v2(
+      input_file, header.root_directory_ptr, path, program_parameters);
 }
 
+void
+write_archive_member_content(
+  struct file_data* file_data,
+  struct file_wrapper* input_file,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters)
+{
+    if ((file_data->file_mode & S_IFMT) != S_IFREG)
+        print_file_error(
+          program_parameters, "Error: %s is not regular file\n", file_data);
+
+    if (file_data->inline_content != NULL) {
+        if (file_write(output_file,
+                       file_data->inline_content,
+                       (size_t)file_data->file_size) < 0)
+            print_perror(program_parameters, "file_write() failed");
+        return;
+    }
+
+    check_archive_content_bounds(file_data, input_file, program_parameters);
+
+    if (file_data->content_codec != CODEC_NONE) {
+        if (codec_read_content(input_file,
+                               (off_t)file_data->archive_content_position,
+                               file_data->archive_content_size,
+                               output_file,
+                               file_data->file_size,
+                               file_data->content_codec) < 0)
+            print_perror(program_parameters, "codec_read_content() failed");
+        return;
+    }
+
+    if (file_seek(input_file, (off_t)file_data->archive_content_position) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    if (file_cat(input_file,
+                 output_file,
+                 file_data->file_size,
+                 program_parameters->file_cat_buffer_size) < 0)
+        print_perror(program_parameters, "file_cat() failed");
+}
@@ -0,0 +1,1541 @@
+#include "archive_v3.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "central_directory.h"
+#include "checksum.h"
+#include "chunking.h"
+#include "codec.h"
+#include "parallel.h"
+#include "stats.h"
+#include "util.h"
+
+/* Maximum nesting level of entries in archive (deeper trees can not be
+ * extracted anyway because of path length limit).
+ */
+#define ARCHIVE_MAX_DEPTH 2048
+
+/* Return 1 if file_data is directory, 0 otherwise.
+ */
+static int
+is_directory(const struct file_data* file_data)
+{
+    return (file_data->file_mode & S_IFMT) == S_IFDIR;
+}
+
+/* Return size of encoded time.
+ */
+static size_t
+get_time_size(const struct timespec* time)
+{
+    const int64_t seconds = (int64_t)time->tv_sec;
+    const uint64_t zigzag_seconds =
+      (((uint64_t)seconds) << 1) ^ ((seconds < 0) ? UINT64_MAX : 0);
+    return varint_size(zigzag_seconds) + varint_size((uint64_t)time->tv_nsec);
+}
+
+size_t
+get_archive_entry_size_v3(const struct file_data* file_data,
+                          archive_ptr_t content_ptr)
+{
+    const size_t name_length = strlen(file_data->file_name);
+    size_t size = 1 + varint_size(file_data->file_mode) +
+                  varint_size(name_length) + name_length +
+                  get_time_size(&(file_data->st_atim)) +
+                  get_time_size(&(file_data->st_mtim)) +
+                  get_time_size(&(file_data->st_ctim));
+
+    if (is_directory(file_data)) {
+        uint64_t child_count = 0;
+        const struct file_data* child;
+        for (child = file_data->first_child; child != NULL; child = child->next)
+            child_count++;
+        size += varint_size(child_count) +
+                varint_size(file_data->archive_children_size);
+    } else if (file_data->inline_content != NULL) {
+        size += varint_size((uint64_t)file_data->file_size) +
+                (size_t)file_data->file_size;
+        if (file_data->link_original != NULL)
+            size += sizeof(uint64_t);
+    } else {
+        size +=
+          varint_size(file_data->archive_content_position - content_ptr) +
+          varint_size((uint64_t)file_data->file_size);
+        if (file_data->content_codec != CODEC_NONE)
+            size += varint_size(file_data->content_codec) +
+                    varint_size(file_data->archive_content_size);
+        if (file_data->has_content_checksum)
+            size += sizeof(uint32_t);
+        if (file_data->link_original != NULL)
+            size += sizeof(uint64_t);
+    }
+
+    return size;
+}
+
+archive_ptr_t
+assign_archive_children_sizes_v3(struct file_data* file_data,
+                                 archive_ptr_t content_ptr)
+{
+    archive_ptr_t total_size = 0;
+
+    // Size of entry is known after its children are visited, then it is
+    // added to children size of its parent
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (is_directory(current_file_data) && !walk.is_leaving) {
+            current_file_data->archive_children_size = 0;
+            continue;
+        }
+
+        archive_ptr_t size =
+          get_archive_entry_size_v3(current_file_data, content_ptr);
+        if (is_directory(current_file_data))
+            size += current_file_data->archive_children_size;
+        if (walk.depth == 0)
+            total_size += size;
+        else
+            current_file_data->parent->archive_children_size += size;
+    }
+
+    return total_size;
+}
+
+/* Append encoded time to buffer. Return 0 on success, -1 on error.
+ */
+static int
+put_time(struct byte_buffer* buffer, const struct timespec* time)
+{
+    if (byte_buffer_put_svarint(buffer, (int64_t)time->tv_sec) < 0)
+        return -1;
+    return byte_buffer_put_varint(buffer, (uint64_t)time->tv_nsec);
+}
+
+/* Append v3 entry header of file_data (without its children) to buffer.
+ * link_ptr is stored for hard links.
+ */
+static void
+encode_archive_entry_v3(const struct file_data* file_data,
+                        archive_ptr_t content_ptr,
+                        archive_ptr_t link_ptr,
+                        struct byte_buffer* buffer,
+                        const struct program_parameters* program_parameters)
+{
+    const size_t name_length = strlen(file_data->file_name);
+    if ((name_length == 0) || (name_length > ARCHIVE_V3_MAX_NAME_LENGTH))
+        print_file_error(program_parameters,
+                         "Error: invalid file name length of %s\n",
+                         file_data);
+
+    uint8_t flags = 0;
+    if (!is_directory(file_data) && (file_data->inline_content != NULL)) {
+        flags |= ARCHIVE_V3_ENTRY_INLINE;
+    } else if (!is_directory(file_data)) {
+        if (file_data->content_codec != CODEC_NONE)
+            flags |= ARCHIVE_V3_ENTRY_CODEC;
+        if (file_data->has_content_checksum)
+            flags |= ARCHIVE_V3_ENTRY_CHECKSUM;
+    }
+    if (file_data->link_original != NULL)
+        flags |= ARCHIVE_V3_ENTRY_HARDLINK;
+
+    if ((byte_buffer_put_u8(buffer, flags) < 0) ||
+        (byte_buffer_put_varint(buffer, file_data->file_mode) < 0) ||
+        (byte_buffer_put_varint(buffer, name_length) < 0) ||
+        (byte_buffer_put(buffer, file_data->file_name, name_length) < 0) ||
+        (put_time(buffer, &(file_data->st_atim)) < 0) ||
+        (put_time(buffer, &(file_data->st_mtim)) < 0) ||
+        (put_time(buffer, &(file_data->st_ctim)) < 0))
+        print_perror(program_parameters, "byte_buffer_put() failed");
+
+    if (is_directory(file_data)) {
+        uint64_t child_count = 0;
+        const struct file_data* child;
+        for (child = file_data->first_child; child != NULL; child = child->next)
+            child_count++;
+
+        if ((byte_buffer_put_varint(buffer, child_count) < 0) ||
+            (byte_buffer_put_varint(buffer, file_data->archive_children_size) <
+             0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+    } else if (flags & ARCHIVE_V3_ENTRY_INLINE) {
+        if ((byte_buffer_put_varint(buffer, (uint64_t)file_data->file_size) <
+             0) ||
+            (byte_buffer_put(buffer,
+                             file_data->inline_content,
+                             (size_t)file_data->file_size) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+        if ((flags & ARCHIVE_V3_ENTRY_HARDLINK) &&
+            (byte_buffer_put_u64(buffer, link_ptr) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+    } else {
+        if ((byte_buffer_put_varint(
+               buffer, file_data->archive_content_position - content_ptr) <
+             0) ||
+            (byte_buffer_put_varint(buffer, (uint64_t)file_data->file_size) <
+             0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+        if ((flags & ARCHIVE_V3_ENTRY_CODEC) &&
+            ((byte_buffer_put_varint(buffer, file_data->content_codec) < 0) ||
+             (byte_buffer_put_varint(buffer, file_data->archive_content_size) <
+              0)))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+        if ((flags & ARCHIVE_V3_ENTRY_CHECKSUM) &&
+            (byte_buffer_put_u32(buffer, file_data->content_checksum) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+        if ((flags & ARCHIVE_V3_ENTRY_HARDLINK) &&
+            (byte_buffer_put_u64(buffer, link_ptr) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+    }
+}
+
+int
+encode_archive_entries_v3(struct file_data* file_data,
+                          archive_ptr_t content_ptr,
+                          archive_ptr_t header_block_ptr,
+                          struct byte_buffer* buffer,
+                          const struct program_parameters* program_parameters)
+{
+    int has_hardlinks = 0;
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        struct file_data* const current_file_data = walk.file_data;
+        if (is_directory(current_file_data))
+            print_file_info(program_parameters,
+                            "Adding directory %s..\n",
+                            current_file_data);
+        else
+            print_file_info(program_parameters,
+                            "Adding file %s...\n",
+                            current_file_data);
+
+        // Originals precede their hard links, so their positions are
+        // already assigned
+        current_file_data->archive_position = header_block_ptr + buffer->size;
+        archive_ptr_t link_ptr = 0;
+        if (current_file_data->link_original != NULL) {
+            link_ptr = current_file_data->link_original->archive_position -
+                       header_block_ptr;
+            has_hardlinks = 1;
+        }
+        encode_archive_entry_v3(current_file_data,
+                                content_ptr,
+                                link_ptr,
+                                buffer,
+                                program_parameters);
+    }
+
+    return has_hardlinks;
+}
+
+void
+write_archive_header_v3(const struct archive_header_v3* header,
+                        struct file_wrapper* output_file,
+                        const struct program_parameters* program_parameters)
+{
+    uint8_t data[ARCHIVE_V3_HEADER_SIZE];
+    memset(data, 0, ARCHIVE_V3_HEADER_SIZE);
+    memcpy(data, ARCHIVE_HEADER_SIGN_V3, ARCHIVE_HEADER_SIGN_SIZE);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE, header->header_block_ptr);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 8, header->header_block_size);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 16, header->content_ptr);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 24, header->content_size);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 32,
+              header->central_directory_ptr);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 40,
+              header->central_directory_size);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 48, header->path_index_ptr);
+    store_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 56, header->path_index_size);
+    store_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 64, header->flags);
+    store_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 68,
+              header->header_block_checksum);
+    store_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 72,
+              header->central_directory_checksum);
+    store_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 76,
+              header->path_index_checksum);
+    if (header->flags & ARCHIVE_V3_HEADER_CHECKSUMS)
+        store_u32(data + ARCHIVE_V3_HEADER_CHECKSUM_OFFSET,
+                  crc32c_update(0, data, ARCHIVE_V3_HEADER_CHECKSUM_OFFSET));
+
+    if (file_write(output_file, data, ARCHIVE_V3_HEADER_SIZE) < 0)
+        print_perror(program_parameters, "file_write() failed");
+}
+
+/* Reserve space for main header, which is written by
+ * write_archive_header_v3() after seeking back to beginning of output_file.
+ */
+static void
+write_empty_header_v3(struct file_wrapper* output_file,
+                      const struct program_parameters* program_parameters)
+{
+    uint8_t empty_header[ARCHIVE_V3_HEADER_SIZE];
+    memset(empty_header, 0, ARCHIVE_V3_HEADER_SIZE);
+    if (file_write(output_file, empty_header, ARCHIVE_V3_HEADER_SIZE) < 0)
+        print_perror(program_parameters, "file_write() failed");
+}
+
+/* Encode header block of file_data to header_block, and central directory
+ * and path index (if they are enabled by program_parameters) to
+ * central_directory and path_index. Content positions should be assigned
+ * and header->content_ptr and header->header_block_ptr should be set before,
+ * other header fields are set by this function. Index regions are located
+ * one after another starting from header_block_ptr.
+ */
+static void
+encode_archive_index_v3(struct file_data* file_data,
+                        struct archive_header_v3* header,
+                        struct byte_buffer* header_block,
+                        struct byte_buffer* central_directory,
+                        struct byte_buffer* path_index,
+                        const struct program_parameters* program_parameters)
+{
+    uint64_t root_count = 0;
+    const struct file_data* current_file_data;
+    for (current_file_data = file_data; current_file_data != NULL;
+         current_file_data = current_file_data->next)
+        root_count++;
+
+    const archive_ptr_t entries_size =
+      assign_archive_children_sizes_v3(file_data, header->content_ptr);
+    if ((byte_buffer_reserve(header_block,
+                             VARINT_MAX_SIZE + (size_t)entries_size) < 0) ||
+        (byte_buffer_put_varint(header_block, root_count) < 0))
+        print_perror(program_parameters, "byte_buffer_put() failed");
+    const int has_hardlinks =
+      encode_archive_entries_v3(file_data,
+                                header->content_ptr,
+                                header->header_block_ptr,
+                                header_block,
+                                program_parameters);
+
+    header->header_block_size = header_block->size;
+
+    header->central_directory_ptr = 0;
+    header->central_directory_size = 0;
+    header->path_index_ptr = 0;
+    header->path_index_size = 0;
+    if (program_parameters->write_central_directory) {
+        encode_central_directory(file_data,
+                                 header->content_ptr,
+                                 central_directory,
+                                 program_parameters);
+        encode_path_index(central_directory->data,
+                          central_directory->size,
+                          path_index,
+                          program_parameters);
+        header->central_directory_ptr =
+          header->header_block_ptr + header->header_block_size;
+        header->central_directory_size = central_directory->size;
+        header->path_index_ptr =
+          header->central_directory_ptr + header->central_directory_size;
+        header->path_index_size = path_index->size;
+    }
+
+    // Index regions are small, so their checksums are always stored
+    header->flags = ARCHIVE_V3_HEADER_CHECKSUMS;
+    if (has_hardlinks)
+        header->flags |= ARCHIVE_V3_HEADER_HARDLINKS;
+    header->header_block_checksum =
+      crc32c_update(0, header_block->data, header_block->size);
+    header->central_directory_checksum =
+      crc32c_update(0, central_directory->data, central_directory->size);
+    header->path_index_checksum =
+      crc32c_update(0, path_index->data, path_index->size);
+}
+
+/* Write encoded index regions (see encode_archive_index_v3()) to output_file
+ * at current position and deallocate them.
+ */
+static void
+write_archive_index_v3(struct byte_buffer* header_block,
+                       struct byte_buffer* central_directory,
+                       struct byte_buffer* path_index,
+                       struct file_wrapper* output_file,
+                       const struct program_parameters* program_parameters)
+{
+    struct iovec segments[3];
+    segments[0].iov_base = header_block->data;
+    segments[0].iov_len = header_block->size;
+    segments[1].iov_base = central_directory->data;
+    segments[1].iov_len = central_directory->size;
+    segments[2].iov_base = path_index->data;
+    segments[2].iov_len = path_index->size;
+    if (file_writev(output_file, segments, 3) < 0)
+        print_perror(program_parameters, "file_writev() failed");
+
+    byte_buffer_free(header_block);
+    byte_buffer_free(central_directory);
+    byte_buffer_free(path_index);
+}
+
+/* Regular files which contents are loaded to be stored in entry headers.
+ */
+struct inline_load_context
+{
+    struct file_data** entries;
+    size_t count;
+    size_t capacity;
+    const struct program_parameters* program_parameters;
+};
+
+/* Set inline_content of symlinks and allocate it in arena for regular files
+ * from file_data, following entries and all their descendants which have
+ * content of 1..inline_size bytes. Regular files which content should be
+ * read are appended to context.
+ */
+static void
+collect_inline_entries(struct file_data* file_data,
+                       size_t inline_size,
+                       struct arena* arena,
+                       struct inline_load_context* context)
+{
+    const struct program_parameters* const program_parameters =
+      context->program_parameters;
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (is_directory(current_file_data) ||
+            (current_file_data->file_size == 0) ||
+            ((size_t)current_file_data->file_size > inline_size))
+            continue;
+
+        if ((current_file_data->file_mode & S_IFMT) == S_IFLNK) {
+            current_file_data->inline_content =
+              current_file_data->symlink_target;
+            continue;
+        }
+
+        // Content is not encoded in header block, and it is read from file
+        // even if it could be copied from base archive
+        current_file_data->content_codec = CODEC_NONE;
+        current_file_data->base_archive = NULL;
+
+        // Duplicate has the same size as its original (which is earlier in
+        // depth-first order), so it shares already allocated content
+        const struct file_data* const original =
+          current_file_data->content_original;
+        if ((original != NULL) && (original->inline_content != NULL)) {
+            current_file_data->inline_content = original->inline_content;
+            current_file_data->content_original = NULL;
+            continue;
+        }
+
+        current_file_data->inline_content =
+          arena_alloc(arena, (size_t)current_file_data->file_size);
+        if (current_file_data->inline_content == NULL)
+            print_perror(program_parameters, "arena_alloc() failed");
+        current_file_data->content_original = NULL;
+
+        if (context->count == context->capacity) {
+            const size_t new_capacity =
+              (context->capacity == 0) ? 64 : context->capacity * 2;
+            struct file_data** const new_entries = realloc(
+              context->entries, sizeof(struct file_data*) * new_capacity);
+            if (new_entries == NULL)
+                print_perror(program_parameters, "realloc() failed");
+            context->entries = new_entries;
+            context->capacity = new_capacity;
+        }
+        context->entries[context->count] = current_file_data;
+        context->count++;
+    }
+}
+
+/* Read content of one regular file to its inline_content.
+ */
+static void
+load_inline_content_task(size_t task_index, void* context)
+{
+    const struct inline_load_context* const load_context = context;
+    const struct program_parameters* const program_parameters =
+      load_context->program_parameters;
+    const struct file_data* const current_file_data =
+      load_context->entries[task_index];
+
+    const uint64_t start_time = stats_start_file();
+    struct file_wrapper* const current_file =
+      open_file_data(current_file_data, O_RDONLY);
+    if (current_file == NULL)
+        print_perror(program_parameters, "open_file_data() failed");
+
+    if (file_read(current_file,
+                  current_file_data->inline_content,
+                  (size_t)current_file_data->file_size) < 0)
+        print_perror(program_parameters, "file_read() failed");
+
+    if (file_close(current_file) < 0)
+        print_perror(program_parameters, "file_close() failed");
+    stats_finish_file(start_time, current_file_data);
+}
+
+/* Load contents of files and symlinks from file_data, following entries and
+ * all their descendants which are not bigger than inline_size, so they are
+ * stored in entry headers instead of content region (see archive_format.h).
+ * Contents are allocated in arena of directory tree.
+ */
+static void
+load_inline_contents(struct file_data* file_data,
+                     size_t inline_size,
+                     const struct program_parameters* program_parameters)
+{
+    if ((file_data == NULL) || (inline_size == 0))
+        return;
+
+    struct inline_load_context context;
+    context.entries = NULL;
+    context.count = 0;
+    context.capacity = 0;
+    context.program_parameters = program_parameters;
+    collect_inline_entries(file_data, inline_size, file_data->arena, &context);
+
+    // Small files take one read each, so they are read by several threads
+    // as their contents are copied otherwise
+    run_parallel(context.count,
+                 program_parameters->thread_count,
+                 load_inline_content_task,
+                 &context);
+
+    free(context.entries);
+}
+
+/* Write content of file_data and following entries (and all their
+ * descendants) to output_file sequentially, assigning content positions
+ * starting from position (which is updated). Chunks of files with
+ * CODEC_CHUNKED codec are added to chunk_index.
+ */
+static void
+write_archive_content_v3(struct file_data* file_data,
+                         struct file_wrapper* output_file,
+                         archive_ptr_t* position,
+                         struct chunk_index* chunk_index,
+                         const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (is_directory(current_file_data) ||
+            (current_file_data->inline_content != NULL))
+            continue;
+
+        if (assign_duplicate_content(current_file_data))
+            continue;
+
+        if (current_file_data->content_codec == CODEC_CHUNKED) {
+            write_chunked_content(current_file_data,
+                                  output_file,
+                                  position,
+                                  chunk_index,
+                                  program_parameters);
+            continue;
+        }
+
+        current_file_data->archive_content_position = *position;
+        write_archive_entry_content(
+          current_file_data, output_file, program_parameters);
+        *position += current_file_data->archive_content_size;
+    }
+}
+
+/* Return 1 if file_data, following entries or their descendants have
+ * content with CODEC_SPARSE codec, 0 otherwise.
+ */
+static int
+has_sparse_content(const struct file_data* file_data)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.file_data->content_codec == CODEC_SPARSE)
+            return 1;
+    }
+    return 0;
+}
+
+void
+write_full_archive_v3(struct file_data* file_data,
+                      struct file_wrapper* output_file,
+                      const struct program_parameters* program_parameters)
+{
+    struct archive_header_v3 header;
+    header.content_ptr = ARCHIVE_V3_HEADER_SIZE;
+
+    struct byte_buffer header_block;
+    struct byte_buffer central_directory;
+    struct byte_buffer path_index;
+    byte_buffer_init(&header_block);
+    byte_buffer_init(&central_directory);
+    byte_buffer_init(&path_index);
+
+    stats_set_phase(STATS_PHASE_CONTENT);
+    load_inline_contents(
+      file_data, program_parameters->inline_size, program_parameters);
+
+    if ((program_parameters->content_codec != CODEC_NONE) ||
+        program_parameters->chunk_content || has_sparse_content(file_data)) {
+        // Size of encoded content is known only after it is written, so
+        // space for main header is reserved and it is written last
+        stats_set_phase(STATS_PHASE_HEADERS);
+        write_empty_header_v3(output_file, program_parameters);
+
+        stats_set_phase(STATS_PHASE_CONTENT);
+        struct chunk_index chunk_index;
+        chunk_index_init(
+          &chunk_index, program_parameters->content_codec, program_parameters);
+        archive_ptr_t current_position = header.content_ptr;
+        write_archive_content_v3(file_data,
+                                 output_file,
+                                 &current_position,
+                                 &chunk_index,
+                                 program_parameters);
+        if (program_parameters->chunk_content)
+            print_info(program_parameters,
+                       "Stored %lu unique chunks of %lu (%lu of %lu bytes)\n",
+                       chunk_index.record_count,
+                       chunk_index.chunk_count,
+                       chunk_index.unique_bytes,
+                       chunk_index.chunk_bytes);
+        chunk_index_free(&chunk_index);
+        header.content_size = current_position - header.content_ptr;
+        header.header_block_ptr = current_position;
+        if (program_parameters->checksum_content) {
+            stats_set_phase(STATS_PHASE_CHECKSUM);
+            assign_content_checksums(
+              file_data, output_file, program_parameters);
+        }
+
+        stats_set_phase(STATS_PHASE_HEADERS);
+        encode_archive_index_v3(file_data,
+                                &header,
+                                &header_block,
+                                &central_directory,
+                                &path_index,
+                                program_parameters);
+        write_archive_index_v3(&header_block,
+                               &central_directory,
+                               &path_index,
+                               output_file,
+                               program_parameters);
+
+        if (file_seek(output_file, 0) < 0)
+            print_perror(program_parameters, "file_seek() failed");
+        write_archive_header_v3(&header, output_file, program_parameters);
+        return;
+    }
+
+    stats_set_phase(STATS_PHASE_ASSIGN);
+    archive_ptr_t current_position = header.content_ptr;
+    assign_archive_content_positions(file_data, &current_position);
+    header.content_size = current_position - header.content_ptr;
+    header.header_block_ptr = current_position;
+
+    stats_set_phase(STATS_PHASE_HEADERS);
+    if (program_parameters->checksum_content) {
+        // Content checksums are known only after content is written, so
+        // index and main header are written last
+        write_empty_header_v3(output_file, program_parameters);
+    } else {
+        // Index is encoded first, so main header can be written before
+        // content
+        encode_archive_index_v3(file_data,
+                                &header,
+                                &header_block,
+                                &central_directory,
+                                &path_index,
+                                program_parameters);
+        write_archive_header_v3(&header, output_file, program_parameters);
+    }
+
+    stats_set_phase(STATS_PHASE_CONTENT);
+    write_archive_content_by_options(
+      file_data, output_file, program_parameters);
+
+    if (program_parameters->checksum_content) {
+        stats_set_phase(STATS_PHASE_CHECKSUM);
+        assign_content_checksums(file_data, output_file, program_parameters);
+        stats_set_phase(STATS_PHASE_HEADERS);
+        encode_archive_index_v3(file_data,
+                                &header,
+                                &header_block,
+                                &central_directory,
+                                &path_index,
+                                program_parameters);
+    }
+
+    stats_set_phase(STATS_PHASE_HEADERS);
+    write_archive_index_v3(&header_block,
+                           &central_directory,
+                           &path_index,
+                           output_file,
+                           program_parameters);
+
+    if (program_parameters->checksum_content) {
+        if (file_seek(output_file, 0) < 0)
+            print_perror(program_parameters, "file_seek() failed");
+        write_archive_header_v3(&header, output_file, program_parameters);
+    }
+}
+
+void
+append_archive_v3(struct file_data* file_data,
+                  struct file_wrapper* archive_file,
+                  const struct program_parameters* program_parameters)
+{
+    stats_set_phase(STATS_PHASE_READ_INDEX);
+    struct archive_header_v3 header;
+    if (file_seek(archive_file, 0) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    read_archive_header_v3(&header, archive_file, program_parameters);
+    if (file_seek(archive_file, 0) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    struct file_data* const archive_data =
+      read_full_archive_v3(archive_file, program_parameters);
+    struct file_data* const last_archive_data =
+      check_appended_entries(file_data, archive_data, program_parameters);
+
+    // Central directory is kept if archive already has it
+    struct program_parameters index_parameters = *program_parameters;
+    if (header.central_directory_ptr != 0) {
+        index_parameters.write_central_directory = 1;
+        index_parameters.inline_size = 0;
+    }
+
+    stats_set_phase(STATS_PHASE_CONTENT);
+    load_inline_contents(
+      file_data, index_parameters.inline_size, program_parameters);
+    if (file_seek(archive_file, archive_file->size) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    struct chunk_index chunk_index;
+    chunk_index_init(
+      &chunk_index, program_parameters->content_codec, program_parameters);
+    archive_ptr_t current_position = (archive_ptr_t)archive_file->size;
+    write_archive_content_v3(file_data,
+                             archive_file,
+                             &current_position,
+                             &chunk_index,
+                             program_parameters);
+    chunk_index_free(&chunk_index);
+    header.content_size = current_position - header.content_ptr;
+    header.header_block_ptr = current_position;
+    if (program_parameters->checksum_content) {
+        stats_set_phase(STATS_PHASE_CHECKSUM);
+        assign_content_checksums(file_data, archive_file, program_parameters);
+    }
+
+    stats_set_phase(STATS_PHASE_HEADERS);
+    last_archive_data->next = file_data;
+    struct byte_buffer header_block;
+    struct byte_buffer central_directory;
+    struct byte_buffer path_index;
+    byte_buffer_init(&header_block);
+    byte_buffer_init(&central_directory);
+    byte_buffer_init(&path_index);
+    encode_archive_index_v3(archive_data,
+                            &header,
+                            &header_block,
+                            &central_directory,
+                            &path_index,
+                            &index_parameters);
+    last_archive_data->next = NULL;
+    write_archive_index_v3(&header_block,
+                           &central_directory,
+                           &path_index,
+                           archive_file,
+                           program_parameters);
+
+    if (file_seek(archive_file, 0) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+    write_archive_header_v3(&header, archive_file, program_parameters);
+
+    free_directory_tree(archive_data);
+}
+
+/* Write inline entry headers and content of file_data and following entries
+ * (and all their descendants) to output_file, assigning content positions
+ * starting from position (which is updated). Buffer is used for encoding.
+ */
+static void
+write_archive_stream_entries_v3(
+  struct file_data* file_data,
+  archive_ptr_t content_ptr,
+  archive_ptr_t* position,
+  struct byte_buffer* buffer,
+  struct file_wrapper* output_file,
+  const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        struct file_data* const current_file_data = walk.file_data;
+        const int is_duplicate = assign_duplicate_content(current_file_data);
+        if (!is_directory(current_file_data) && !is_duplicate) {
+            // Size of encoded content is not known before it is written, so
+            // it is 0 in inline header
+            current_file_data->archive_content_size =
+              (current_file_data->content_codec == CODEC_NONE)
+                ? (archive_ptr_t)current_file_data->file_size
+                : 0;
+
+            // Entry header size depends on content offset stored in it, so
+            // offset is increased until it points right after header (it
+            // can only grow, so it takes few iterations)
+            current_file_data->archive_content_position = *position;
+            while (1) {
+                const archive_ptr_t content_position =
+                  *position +
+                  get_archive_entry_size_v3(current_file_data, content_ptr);
+                if (content_position ==
+                    current_file_data->archive_content_position)
+                    break;
+                current_file_data->archive_content_position = content_position;
+            }
+        }
+
+        buffer->size = 0;
+        encode_archive_entry_v3(
+          current_file_data, content_ptr, 0, buffer, program_parameters);
+        if (file_write(output_file, buffer->data, buffer->size) < 0)
+            print_perror(program_parameters, "file_write() failed");
+        *position += buffer->size;
+
+        if (!is_directory(current_file_data) && !is_duplicate) {
+            write_archive_entry_content(
+              current_file_data, output_file, program_parameters);
+            *position += current_file_data->archive_content_size;
+        }
+    }
+}
+
+void
+write_stream_archive_v3(struct file_data* file_data,
+                        struct file_wrapper* output_file,
+                        const struct program_parameters* program_parameters)
+{
+    struct archive_header_v3 header;
+    header.content_ptr = ARCHIVE_HEADER_SIGN_SIZE;
+
+    // Inline entry headers are written along with content
+    stats_set_phase(STATS_PHASE_CONTENT);
+    if (file_write(output_file,
+                   ARCHIVE_HEADER_SIGN_V3_STREAM,
+                   ARCHIVE_HEADER_SIGN_SIZE) < 0)
+        print_perror(program_parameters, "file_write() failed");
+
+    // Directories do not have children_size in inline headers
+    archive_ptr_t current_position = header.content_ptr;
+    struct byte_buffer buffer;
+    byte_buffer_init(&buffer);
+    write_archive_stream_entries_v3(file_data,
+                                    header.content_ptr,
+                                    &current_position,
+                                    &buffer,
+                                    output_file,
+                                    program_parameters);
+    byte_buffer_free(&buffer);
+    header.content_size = current_position - header.content_ptr;
+    header.header_block_ptr = current_position;
+
+    stats_set_phase(STATS_PHASE_HEADERS);
+    struct byte_buffer header_block;
+    struct byte_buffer central_directory;
+    struct byte_buffer path_index;
+    byte_buffer_init(&header_block);
+    byte_buffer_init(&central_directory);
+    byte_buffer_init(&path_index);
+    encode_archive_index_v3(file_data,
+                            &header,
+                            &header_block,
+                            &central_directory,
+                            &path_index,
+                            program_parameters);
+    write_archive_index_v3(&header_block,
+                           &central_directory,
+                           &path_index,
+                           output_file,
+                           program_parameters);
+
+    write_archive_header_v3(&header, output_file, program_parameters);
+}
+
+void
+read_archive_header_v3(struct archive_header_v3* header,
+                       struct file_wrapper* input_file,
+                       const struct program_parameters* program_parameters)
+{
+    uint8_t data[ARCHIVE_V3_HEADER_SIZE];
+    if (file_read(input_file, data, ARCHIVE_V3_HEADER_SIZE) < 0)
+        print_perror(program_parameters, "file_read() failed");
+
+    // Streamed archive has main header at the end of file
+    if (memcmp(data, ARCHIVE_HEADER_SIGN_V3_STREAM, ARCHIVE_HEADER_SIGN_SIZE) ==
+        0) {
+        if (file_pread(input_file,
+                       data,
+                       ARCHIVE_V3_HEADER_SIZE,
+                       input_file->size - ARCHIVE_V3_HEADER_SIZE) < 0)
+            print_perror(program_parameters, "file_pread() failed");
+    }
+
+    if (memcmp(data, ARCHIVE_HEADER_SIGN_V3, ARCHIVE_HEADER_SIGN_SIZE) != 0)
+        print_error(program_parameters, "Error: invalid archive header\n");
+
+    header->header_block_ptr = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE);
+    header->header_block_size = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 8);
+    header->content_ptr = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 16);
+    header->content_size = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 24);
+    header->central_directory_ptr =
+      load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 32);
+    header->central_directory_size =
+      load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 40);
+    header->path_index_ptr = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 48);
+    header->path_index_size = load_u64(data + ARCHIVE_HEADER_SIGN_SIZE + 56);
+    header->flags = load_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 64);
+    header->header_block_checksum =
+      load_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 68);
+    header->central_directory_checksum =
+      load_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 72);
+    header->path_index_checksum =
+      load_u32(data + ARCHIVE_HEADER_SIGN_SIZE + 76);
+
+    if ((header->flags & ~ARCHIVE_V3_HEADER_FLAGS) != 0)
+        print_error(program_parameters,
+                    "Error: unsupported header flags %x\n",
+                    header->flags);
+    if ((header->flags & ARCHIVE_V3_HEADER_CHECKSUMS) &&
+        (load_u32(data + ARCHIVE_V3_HEADER_CHECKSUM_OFFSET) !=
+         crc32c_update(0, data, ARCHIVE_V3_HEADER_CHECKSUM_OFFSET)))
+        print_error(program_parameters,
+                    "Error: main header checksum mismatch\n");
+
+    const archive_ptr_t file_size = (archive_ptr_t)input_file->size;
+    if ((header->header_block_ptr > file_size) ||
+        (header->header_block_size > file_size - header->header_block_ptr))
+        print_error(program_parameters,
+                    "Error: header block is exceeding file size %ld\n",
+                    input_file->size);
+    if ((header->content_ptr > file_size) ||
+        (header->content_size > file_size - header->content_ptr))
+        print_error(program_parameters,
+                    "Error: content region is exceeding file size %ld\n",
+                    input_file->size);
+    if ((header->central_directory_ptr > file_size) ||
+        (header->central_directory_size >
+         file_size - header->central_directory_ptr))
+        print_error(program_parameters,
+                    "Error: central directory is exceeding file size %ld\n",
+                    input_file->size);
+    if ((header->path_index_ptr > file_size) ||
+        (header->path_index_size > file_size - header->path_index_ptr))
+        print_error(program_parameters,
+                    "Error: path index is exceeding file size %ld\n",
+                    input_file->size);
+}
+
+struct file_data*
+create_archive_file_data(const char* name,
+                         mode_t mode,
+                         struct file_data* parent,
+                         struct arena* arena,
+                         const struct program_parameters* program_parameters)
+{
+    struct file_data* const data =
+      create_file_data(name, parent, arena, program_parameters);
+    data->file_mode = mode;
+    return data;
+}
+
+const void*
+load_archive_region(struct file_wrapper* input_file,
+                    archive_ptr_t position,
+                    archive_ptr_t size,
+                    void** copy_ptr,
+                    const struct program_parameters* program_parameters)
+{
+    *copy_ptr = NULL;
+
+    const void* const data = file_get_data(input_file, (off_t)position, size);
+    if (data != NULL)
+        return data;
+
+    void* const copy = malloc(size);
+    if ((copy == NULL) && (size > 0))
+        print_perror(program_parameters, "malloc() failed");
+    if (file_pread(input_file, copy, size, (off_t)position) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+
+    *copy_ptr = copy;
+    return copy;
+}
+
+void
+check_region_checksum_v3(const struct archive_header_v3* header,
+                         const void* data,
+                         archive_ptr_t size,
+                         uint32_t checksum,
+                         const char* region_name,
+                         const struct program_parameters* program_parameters)
+{
+    if ((header->flags & ARCHIVE_V3_HEADER_CHECKSUMS) &&
+        (crc32c_update(0, data, size) != checksum))
+        print_error(
+          program_parameters, "Error: %s checksum mismatch\n", region_name);
+}
+
+/* Decode time from reader. Return 0 on success, -1 on error.
+ */
+static int
+get_time(struct byte_reader* reader, struct timespec* time)
+{
+    int64_t seconds;
+    uint64_t nanoseconds;
+    if ((byte_reader_get_svarint(reader, &seconds) < 0) ||
+        (byte_reader_get_varint(reader, &nanoseconds) < 0))
+        return -1;
+    if (nanoseconds >= 1000000000) {
+        errno = EIO;
+        return -1;
+    }
+    time->tv_sec = (time_t)seconds;
+    time->tv_nsec = (long)nanoseconds;
+    return 0;
+}
+
+void
+decode_archive_entry_v3(struct byte_reader* reader,
+                        struct archive_entry_v3* entry,
+                        const struct archive_header_v3* header,
+                        const struct program_parameters* program_parameters)
+{
+    uint64_t mode;
+    uint64_t name_length;
+    entry->header_offset = reader->position;
+    if ((byte_reader_get_u8(reader, &(entry->flags)) < 0) ||
+        (byte_reader_get_varint(reader, &mode) < 0) ||
+        (byte_reader_get_varint(reader, &name_length) < 0))
+        print_error(program_parameters, "Error: truncated entry header\n");
+
+    if ((entry->flags & ~ARCHIVE_V3_ENTRY_FLAGS) != 0)
+        print_error(program_parameters,
+                    "Error: unsupported entry flags %x\n",
+                    entry->flags);
+    if ((mode > UINT32_MAX) || (check_file_mode((mode_t)mode) < 0))
+        print_error(program_parameters, "Error: invalid file mode %lx\n", mode);
+    if ((name_length == 0) || (name_length > ARCHIVE_V3_MAX_NAME_LENGTH))
+        print_error(program_parameters, "Error: invalid file name length\n");
+    entry->mode = (mode_t)mode;
+
+    const char* const name_data = byte_reader_get(reader, name_length);
+    if (name_data == NULL)
+        print_error(program_parameters, "Error: truncated entry header\n");
+
+    memcpy(entry->name, name_data, name_length);
+    entry->name[name_length] = '\0';
+    if ((strlen(entry->name) != name_length) ||
+        (check_file_name(entry->name, sizeof(entry->name)) < 0))
+        print_error(
+          program_parameters, "Error: invalid file name %s\n", entry->name);
+
+    if ((get_time(reader, &(entry->st_atim)) < 0) ||
+        (get_time(reader, &(entry->st_mtim)) < 0) ||
+        (get_time(reader, &(entry->st_ctim)) < 0))
+        print_error(program_parameters, "Error: invalid entry times\n");
+
+    entry->child_count = 0;
+    entry->children_size = 0;
+    entry->content_offset = 0;
+    entry->content_size = 0;
+    entry->codec = CODEC_NONE;
+    entry->stored_size = 0;
+    entry->content_checksum = 0;
+    entry->inline_content = NULL;
+    entry->link_ptr = 0;
+
+    if ((entry->flags & ARCHIVE_V3_ENTRY_HARDLINK) &&
+        ((entry->mode & S_IFMT) != S_IFREG))
+        print_error(program_parameters,
+                    "Error: hard link flag is set for non-regular file %s\n",
+                    entry->name);
+    if ((entry->flags & ARCHIVE_V3_ENTRY_INLINE) &&
+        (((entry->mode & S_IFMT) == S_IFDIR) ||
+         (entry->flags & (ARCHIVE_V3_ENTRY_CODEC | ARCHIVE_V3_ENTRY_CHECKSUM))))
+        print_error(program_parameters,
+                    "Error: invalid inline content flags of %s\n",
+                    entry->name);
+    if ((entry->flags & ARCHIVE_V3_ENTRY_CODEC) &&
+        ((entry->mode & S_IFMT) != S_IFREG))
+        print_error(program_parameters,
+                    "Error: codec is set for non-regular file %s\n",
+                    entry->name);
+    if ((entry->flags & ARCHIVE_V3_ENTRY_CHECKSUM) &&
+        ((entry->mode & S_IFMT) == S_IFDIR))
+        print_error(program_parameters,
+                    "Error: checksum is set for directory %s\n",
+                    entry->name);
+
+    if ((entry->mode & S_IFMT) == S_IFDIR) {
+        if ((byte_reader_get_varint(reader, &(entry->child_count)) < 0) ||
+            (byte_reader_get_varint(reader, &(entry->children_size)) < 0))
+            print_error(program_parameters, "Error: truncated entry header\n");
+
+        if (entry->children_size > (reader->size - reader->position))
+            print_error(program_parameters,
+                        "Error: directory %s is exceeding header block\n",
+                        entry->name);
+    } else if (entry->flags & ARCHIVE_V3_ENTRY_INLINE) {
+        if (byte_reader_get_varint(reader, &(entry->content_size)) < 0)
+            print_error(program_parameters, "Error: truncated entry header\n");
+        if (entry->content_size > ARCHIVE_V3_MAX_INLINE_SIZE)
+            print_error(program_parameters,
+                        "Error: inline content of %s is too big\n",
+                        entry->name);
+        entry->inline_content =
+          byte_reader_get(reader, (size_t)entry->content_size);
+        if (entry->inline_content == NULL)
+            print_error(program_parameters, "Error: truncated entry header\n");
+        if ((entry->flags & ARCHIVE_V3_ENTRY_HARDLINK) &&
+            (byte_reader_get_u64(reader, &(entry->link_ptr)) < 0))
+            print_error(program_parameters, "Error: truncated entry header\n");
+    } else {
+        if ((byte_reader_get_varint(reader, &(entry->content_offset)) < 0) ||
+            (byte_reader_get_varint(reader, &(entry->content_size)) < 0))
+            print_error(program_parameters, "Error: truncated entry header\n");
+
+        entry->stored_size = entry->content_size;
+        if (entry->flags & ARCHIVE_V3_ENTRY_CODEC) {
+            uint64_t codec;
+            if ((byte_reader_get_varint(reader, &codec) < 0) ||
+                (byte_reader_get_varint(reader, &(entry->stored_size)) < 0))
+                print_error(program_parameters,
+                            "Error: truncated entry header\n");
+            if ((codec > UINT32_MAX) || !is_known_codec((unsigned int)codec))
+                print_error(program_parameters,
+                            "Error: unsupported codec %lu of %s\n",
+                            codec,
+                            entry->name);
+            entry->codec = (unsigned int)codec;
+        }
+        if ((entry->flags & ARCHIVE_V3_ENTRY_CHECKSUM) &&
+            (byte_reader_get_u32(reader, &(entry->content_checksum)) < 0))
+            print_error(program_parameters, "Error: truncated entry header\n");
+        if ((entry->flags & ARCHIVE_V3_ENTRY_HARDLINK) &&
+            (byte_reader_get_u64(reader, &(entry->link_ptr)) < 0))
+            print_error(program_parameters, "Error: truncated entry header\n");
+
+        if ((entry->content_offset > header->content_size) ||
+            (entry->stored_size >
+             header->content_size - entry->content_offset))
+            print_error(program_parameters,
+                        "Error: content of %s is exceeding content region\n",
+                        entry->name);
+    }
+}
+
+struct file_data*
+create_file_data_from_entry_v3(
+  const struct archive_entry_v3* entry,
+  struct file_data* parent,
+  struct arena* arena,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters)
+{
+    struct file_data* const data = create_archive_file_data(
+      entry->name, entry->mode, parent, arena, program_parameters);
+
+    data->archive_position = header->header_block_ptr + entry->header_offset;
+    data->st_atim = entry->st_atim;
+    data->st_mtim = entry->st_mtim;
+    data->st_ctim = entry->st_ctim;
+    if (is_directory(data)) {
+        data->archive_children_size = entry->children_size;
+    } else if (entry->flags & ARCHIVE_V3_ENTRY_INLINE) {
+        // Header block is not kept after decoding, so content is copied
+        data->file_size = (off_t)entry->content_size;
+        data->inline_content = arena_alloc(arena, (size_t)entry->content_size);
+        if (data->inline_content == NULL)
+            print_perror(program_parameters, "arena_alloc() failed");
+        memcpy(data->inline_content,
+               entry->inline_content,
+               (size_t)entry->content_size);
+    } else {
+        data->archive_content_position =
+          header->content_ptr + entry->content_offset;
+        data->file_size = (off_t)entry->content_size;
+        data->content_codec = entry->codec;
+        data->archive_content_size = entry->stored_size;
+        data->has_content_checksum =
+          (entry->flags & ARCHIVE_V3_ENTRY_CHECKSUM) ? 1 : 0;
+        data->content_checksum = entry->content_checksum;
+    }
+
+    return data;
+}
+
+/* Decode children of directory entry from reader (which should be positioned
+ * right after directory entry header) to arena and set them to data.
+ */
+static void
+decode_archive_children_v3(struct byte_reader* reader,
+                           const struct archive_entry_v3* entry,
+                           struct file_data* data,
+                           struct arena* arena,
+                           unsigned int depth,
+                           const struct archive_header_v3* header,
+                           const struct program_parameters* program_parameters)
+{
+    // Reader size is limited to children region, so they can not take
+    // bytes of following entries (positions in reader stay relative to
+    // header block)
+    const size_t size = reader->size;
+    reader->size = reader->position + (size_t)entry->children_size;
+    data->first_child = decode_archive_entries_v3(reader,
+                                                  entry->child_count,
+                                                  data,
+                                                  arena,
+                                                  depth + 1,
+                                                  header,
+                                                  program_parameters);
+    if (reader->position != reader->size)
+        print_file_error(program_parameters,
+                         "Error: invalid children size of directory %s\n",
+                         data);
+    reader->size = size;
+}
+
+/* Regular files decoded from header block which can be originals of hard
+ * links, in order of their header positions.
+ */
+struct link_original_list
+{
+    struct file_data** entries;
+    size_t count;
+    size_t capacity;
+};
+
+/* Append file_data to list (its header position should be greater than
+ * positions of all entries in list).
+ */
+static void
+add_link_original(struct link_original_list* list,
+                  struct file_data* file_data,
+                  const struct program_parameters* program_parameters)
+{
+    if (list->count == list->capacity) {
+        const size_t new_capacity =
+          (list->capacity == 0) ? 64 : list->capacity * 2;
+        struct file_data** const new_entries =
+          realloc(list->entries, sizeof(struct file_data*) * new_capacity);
+        if (new_entries == NULL)
+            print_perror(program_parameters, "realloc() failed");
+        list->entries = new_entries;
+        list->capacity = new_capacity;
+    }
+    list->entries[list->count] = file_data;
+    list->count++;
+}
+
+/* Return entry from list with header at given position in archive, or NULL if
+ * there is no such entry (original of hard link is not decoded).
+ */
+static struct file_data*
+find_link_original(const struct link_original_list* list,
+                   archive_ptr_t position)
+{
+    size_t begin = 0;
+    size_t end = list->count;
+    while (begin < end) {
+        const size_t middle = begin + (end - begin) / 2;
+        const archive_ptr_t middle_position =
+          list->entries[middle]->archive_position;
+        if (middle_position == position)
+            return list->entries[middle];
+        if (middle_position < position)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    return NULL;
+}
+
+/* Decoding state of directory level, which is suspended while children of
+ * its directory are decoded.
+ */
+struct decode_level_v3
+{
+    uint64_t remaining_count; // number of level entries left to decode
+    size_t size;              // end position of level entries in reader
+};
+
+struct file_data*
+decode_archive_entries_v3(struct byte_reader* reader,
+                          uint64_t count,
+                          struct file_data* parent,
+                          struct arena* arena,
+                          unsigned int depth,
+                          const struct archive_header_v3* header,
+                          const struct program_parameters* program_parameters)
+{
+    struct file_data* first_file_data = NULL;
+    // Directory which entries are currently decoded and its last decoded
+    // entry
+    struct file_data* current_parent = parent;
+    struct file_data* current_file_data = NULL;
+
+    if (depth > ARCHIVE_MAX_DEPTH)
+        print_error(program_parameters, "Error: archive tree is too deep\n");
+
+    // Children of directory are decoded right after its header, reader size
+    // is limited to their region meanwhile, so they can not take bytes of
+    // following entries
+    struct decode_level_v3* levels = NULL;
+    size_t level_count = 0;
+    size_t level_capacity = 0;
+    uint64_t remaining_count = count;
+
+    // Hard links refer to earlier entries, so they are resolved at once
+    // (links to entries which are not decoded are extracted as copies)
+    struct link_original_list link_originals;
+    link_originals.entries = NULL;
+    link_originals.count = 0;
+    link_originals.capacity = 0;
+
+    while (1) {
+        if (remaining_count == 0) {
+            if (level_count == 0)
+                break;
+            if (reader->position != reader->size)
+                print_file_error(
+                  program_parameters,
+                  "Error: invalid children size of directory %s\n",
+                  current_parent);
+            level_count--;
+            remaining_count = levels[level_count].remaining_count;
+            reader->size = levels[level_count].size;
+            current_file_data = current_parent;
+            current_parent = current_parent->parent;
+            continue;
+        }
+        remaining_count--;
+
+        struct archive_entry_v3 entry;
+        decode_archive_entry_v3(reader, &entry, header, program_parameters);
+
+        struct file_data* const data = create_file_data_from_entry_v3(
+          &entry, current_parent, arena, header, program_parameters);
+        if ((header->flags & ARCHIVE_V3_HEADER_HARDLINKS) &&
+            ((entry.mode & S_IFMT) == S_IFREG)) {
+            if (entry.flags & ARCHIVE_V3_ENTRY_HARDLINK)
+                data->link_original = find_link_original(
+                  &link_originals, header->header_block_ptr + entry.link_ptr);
+            else
+                add_link_original(&link_originals, data, program_parameters);
+        }
+
+        if (current_file_data != NULL)
+            current_file_data->next = data;
+        else if (current_parent != parent)
+            current_parent->first_child = data;
+        else
+            first_file_data = data;
+        current_file_data = data;
+
+        if (!is_directory(data))
+            continue;
+
+        if (depth + level_count + 1 > ARCHIVE_MAX_DEPTH)
+            print_error(program_parameters,
+                        "Error: archive tree is too deep\n");
+        if (level_count == level_capacity) {
+            const size_t new_capacity =
+              (level_capacity == 0) ? 16 : level_capacity * 2;
+            struct decode_level_v3* const new_levels =
+              realloc(levels, sizeof(struct decode_level_v3) * new_capacity);
+            if (new_levels == NULL)
+                print_perror(program_parameters, "realloc() failed");
+            levels = new_levels;
+            level_capacity = new_capacity;
+        }
+        levels[level_count].remaining_count = remaining_count;
+        levels[level_count].size = reader->size;
+        level_count++;
+
+        // Children size is checked by decode_archive_entry_v3()
+        reader->size = reader->position + (size_t)entry.children_size;
+        remaining_count = entry.child_count;
+        current_parent = data;
+        current_file_data = NULL;
+    }
+
+    free(levels);
+    free(link_originals.entries);
+
+    return first_file_data;
+}
+
+/* Load header block of v3 archive. Pointer to data is returned, buffer which
+ * should be deallocated by caller is stored to value referenced by copy_ptr
+ * (see load_archive_region()).
+ */
+static const void*
+load_header_block_v3(struct file_wrapper* input_file,
+                     const struct archive_header_v3* header,
+                     void** copy_ptr,
+                     const struct program_parameters* program_parameters)
+{
+    // Whole header block is read at once (or used in place if archive is
+    // mapped to memory)
+    const void* const header_block =
+      load_archive_region(input_file,
+                          header->header_block_ptr,
+                          header->header_block_size,
+                          copy_ptr,
+                          program_parameters);
+    check_region_checksum_v3(header,
+                             header_block,
+                             header->header_block_size,
+                             header->header_block_checksum,
+                             "header block",
+                             program_parameters);
+    return header_block;
+}
+
+struct file_data*
+read_full_archive_v3(struct file_wrapper* input_file,
+                     const struct program_parameters* program_parameters)
+{
+    struct archive_header_v3 header;
+    read_archive_header_v3(&header, input_file, program_parameters);
+
+    // Central directory has all entries in one table, so it is used instead
+    // of header block if archive has it (unless it has hard links, which are
+    // not described by central directory)
+    if ((header.central_directory_ptr != 0) &&
+        !(header.flags & ARCHIVE_V3_HEADER_HARDLINKS))
+        return read_central_directory(input_file, &header, program_parameters);
+
+    void* header_block_copy;
+    const void* const header_block = load_header_block_v3(
+      input_file, &header, &header_block_copy, program_parameters);
+
+    struct byte_reader reader;
+    byte_reader_init(&reader, header_block, header.header_block_size);
+
+    uint64_t root_count;
+    if (byte_reader_get_varint(&reader, &root_count) < 0)
+        print_error(program_parameters, "Error: truncated header block\n");
+
+    struct arena* const arena = arena_create();
+    if (arena == NULL)
+        print_perror(program_parameters, "arena_create() failed");
+    struct file_data* const result = decode_archive_entries_v3(
+      &reader, root_count, NULL, arena, 0, &header, program_parameters);
+
+    free(header_block_copy);
+
+    return set_directory_tree_arena(result, arena);
+}
+
+struct file_data*
+find_archive_member_v3(struct file_wrapper* input_file,
+                       const char* path,
+                       const struct program_parameters* program_parameters)
+{
+    struct archive_header_v3 header;
+    read_archive_header_v3(&header, input_file, program_parameters);
+
+    if ((header.central_directory_ptr != 0) && (header.path_index_ptr != 0) &&
+        !(header.flags & ARCHIVE_V3_HEADER_HARDLINKS))
+        return find_central_directory_member(
+          input_file, &header, path, program_parameters);
+
+    void* header_block_copy;
+    const void* const header_block = load_header_block_v3(
+      input_file, &header, &header_block_copy, program_parameters);
+
+    struct byte_reader reader;
+    byte_reader_init(&reader, header_block, header.header_block_size);
+
+    uint64_t count;
+    if (byte_reader_get_varint(&reader, &count) < 0)
+        print_error(program_parameters, "Error: truncated header block\n");
+
+    struct arena* const arena = arena_create();
+    if (arena == NULL)
+        print_perror(program_parameters, "arena_create() failed");
+
+    // Path is resolved component by component, subtrees of other entries are
+    // skipped without decoding
+    struct file_data* result = NULL;
+    const char* component = path;
+    unsigned int depth = 0;
+    while (result == NULL) {
+        while (*component == '/')
+            component++;
+        const size_t component_length = strcspn(component, "/");
+        const char* const next_component = component + component_length;
+        int is_last_component = 1;
+        const char* ptr;
+        for (ptr = next_component; *ptr != '\0'; ptr++) {
+            if (*ptr != '/') {
+                is_last_component = 0;
+                break;
+            }
+        }
+
+        struct archive_entry_v3 entry;
+        int is_found = 0;
+        uint64_t i;
+        for (i = 0; i < count; i++) {
+            decode_archive_entry_v3(
+              &reader, &entry, &header, program_parameters);
+            if ((strlen(entry.name) == component_length) &&
+                (memcmp(entry.name, component, component_length) == 0)) {
+                is_found = 1;
+                break;
+            }
+            reader.position += (size_t)entry.children_size;
+        }
+        if (!is_found)
+            break;
+
+        if (is_last_component) {
+            result = create_file_data_from_entry_v3(
+              &entry, NULL, arena, &header, program_parameters);
+            if (is_directory(result))
+                decode_archive_children_v3(&reader,
+                                           &entry,
+                                           result,
+                                           arena,
+                                           depth,
+                                           &header,
+                                           program_parameters);
+        } else {
+            if ((entry.mode & S_IFMT) != S_IFDIR)
+                break;
+            // Only children of found directory are searched on next level
+            reader.size = reader.position + (size_t)entry.children_size;
+            count = entry.child_count;
+            component = next_component;
+            depth++;
+        }
+    }
+
+    free(header_block_copy);
+
+    return set_directory_tree_arena(result, arena);
+}
@@ -0,0 +1,128 @@
+#include "arena.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Memory block of arena, data follows header.
+ */
+struct arena_block
+{
+    struct arena_block* previous; // previously allocated block (NULL for
+                                  // first one)
+    size_t size;                  // size of data in bytes
+    size_t used;                  // number of used bytes of data
+};
+
+/* Size of block header rounded up to alignment, so block data is aligned.
+ */
+#define ARENA_BLOCK_HEADER_SIZE                                                \
+    ((sizeof(struct arena_block) + ARENA_ALIGNMENT - 1) &                      \
+     ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct arena*
+arena_create(void)
+{
+    struct arena* const arena = malloc(sizeof(struct arena));
+    if (arena == NULL)
+        return NULL;
+    arena->block = NULL;
+    return arena;
+}
+
+void
+arena_free(struct arena* arena)
+{
+    if (arena == NULL)
+        return;
+    struct arena_block* block = arena->block;
+    while (block != NULL) {
+        struct arena_block* const previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    free(arena);
+}
+
+void
+arena_merge(struct arena* arena, struct arena* other)
+{
+    if (other->block != NULL) {
+        // Blocks of other arena are put in front of blocks of arena, so
+        // its current block becomes current one
+        struct arena_block* first_block = other->block;
+        while (first_block->previous != NULL)
+            first_block = first_block->previous;
+        first_block->previous = arena->block;
+        arena->block = other->block;
+    }
+    free(other);
+}
+
+/* Return pointer to data of block.
+ */
+static uint8_t*
+get_block_data(struct arena_block* block)
+{
+    return ((uint8_t*)block) + ARENA_BLOCK_HEADER_SIZE;
+}
+
+/* Allocate size bytes aligned to alignment (power of 2 not exceeding
+ * ARENA_ALIGNMENT) from arena.
+ */
+static void*
+allocate(struct arena* arena, size_t size, size_t alignment)
+{
+    struct arena_block* block = arena->block;
+    if (block != NULL) {
+        const size_t position =
+          (block->used + alignment - 1) & ~(alignment - 1);
+        if ((position <= block->size) && (size <= block->size - position)) {
+            block->used = position + size;
+            return get_block_data(block) + position;
+        }
+    }
+
+    if (size > SIZE_MAX - ARENA_BLOCK_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // Big allocations get their own blocks, which are put behind current
+    // block, so its free space is still used
+    const int is_dedicated = size > ARENA_BLOCK_SIZE / 4;
+    const size_t data_size = is_dedicated ? size : ARENA_BLOCK_SIZE;
+    struct arena_block* const new_block =
+      malloc(ARENA_BLOCK_HEADER_SIZE + data_size);
+    if (new_block == NULL)
+        return NULL;
+    new_block->size = data_size;
+    new_block->used = size;
+
+    if (is_dedicated && (block != NULL)) {
+        new_block->previous = block->previous;
+        block->previous = new_block;
+    } else {
+        new_block->previous = block;
+        arena->block = new_block;
+    }
+
+    return get_block_data(new_block);
+}
+
+void*
+arena_alloc(struct arena* arena, size_t size)
+{
+    return allocate(arena, size, ARENA_ALIGNMENT);
+}
+
+char*
+arena_copy_string(struct arena* arena, const char* string)
+{
+    const size_t length = strlen(string) + 1;
+    char* const copy = allocate(arena, length, 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, string, length);
+    return copy;
+}
@@ -0,0 +1,213 @@
+#include "base_archive.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+
+/* Number and total size of files copied from base archive.
+ */
+struct base_match_stats
+{
+    size_t file_count;
+    archive_ptr_t file_bytes;
+};
+
+/* Entries of created archive to be matched with entries of base archive
+ * having the same parent path.
+ */
+struct base_match_level
+{
+    struct file_data* file_data;       // first entry of level
+    const struct file_data* base_data; // first entry of level in base archive
+};
+
+/* Stack of levels to be matched.
+ */
+struct base_match_level_list
+{
+    struct base_match_level* levels;
+    size_t count;
+    size_t capacity;
+};
+
+/* Push level of file_data and base_data to list.
+ */
+static void
+push_base_match_level(struct base_match_level_list* list,
+                      struct file_data* file_data,
+                      const struct file_data* base_data,
+                      const struct program_parameters* program_parameters)
+{
+    if (list->count == list->capacity) {
+        const size_t new_capacity =
+          (list->capacity == 0) ? 64 : list->capacity * 2;
+        struct base_match_level* const new_levels = realloc(
+          list->levels, sizeof(struct base_match_level) * new_capacity);
+        if (new_levels == NULL)
+            print_perror(program_parameters, "realloc() failed");
+        list->levels = new_levels;
+        list->capacity = new_capacity;
+    }
+    list->levels[list->count].file_data = file_data;
+    list->levels[list->count].base_data = base_data;
+    list->count++;
+}
+
+/* Comparison function for qsort() and bsearch(), orders pointers to entries
+ * by name.
+ */
+static int
+compare_by_name(const void* ptr1, const void* ptr2)
+{
+    const struct file_data* const* const file_data1 = ptr1;
+    const struct file_data* const* const file_data2 = ptr2;
+    return strcmp((*file_data1)->file_name, (*file_data2)->file_name);
+}
+
+/* Return 1 if times are equal, 0 otherwise.
+ */
+static int
+is_same_time(const struct timespec* time1, const struct timespec* time2)
+{
+    return (time1->tv_sec == time2->tv_sec) &&
+           (time1->tv_nsec == time2->tv_nsec);
+}
+
+/* Return 1 if regular file_data is unchanged since base_data entry of base
+ * archive in base_file was created, and its stored content can be copied.
+ */
+static int
+is_unchanged_file(const struct file_data* file_data,
+                  const struct file_data* base_data,
+                  const struct file_wrapper* base_file)
+{
+    if (((base_data->file_mode & S_IFMT) != S_IFREG) ||
+        (file_data->file_size == 0) ||
+        (file_data->file_size != base_data->file_size) ||
+        !is_same_time(&(file_data->st_mtim), &(base_data->st_mtim)) ||
+        !is_same_time(&(file_data->st_ctim), &(base_data->st_ctim)))
+        return 0;
+
+    // Inline content of base entry is not stored in content region, so it
+    // can not be referenced
+    if ((file_data->content_codec != base_data->content_codec) ||
+        (file_data->content_codec == CODEC_CHUNKED) ||
+        (base_data->inline_content != NULL))
+        return 0;
+
+    // Content of corrupted base archive is not used, file is read instead
+    return (base_data->archive_content_position <=
+            (archive_ptr_t)base_file->size) &&
+           (base_data->archive_content_size <=
+            (archive_ptr_t)base_file->size -
+              base_data->archive_content_position);
+}
+
+/* Match file_data and following entries with base_data and following entries
+ * (siblings in base archive) by name. Children of matched directories are
+ * pushed to pending list to be matched later.
+ */
+static void
+match_base_entries(struct file_data* file_data,
+                   const struct file_data* base_data,
+                   struct file_wrapper* base_file,
+                   struct base_match_level_list* pending,
+                   struct base_match_stats* stats,
+                   const struct program_parameters* program_parameters)
+{
+    size_t base_count = 0;
+    const struct file_data* current_base_data;
+    for (current_base_data = base_data; current_base_data != NULL;
+         current_base_data = current_base_data->next)
+        base_count++;
+    if (base_count == 0)
+        return;
+
+    // Siblings of base archive are sorted by name for binary search
+    const struct file_data** const base_entries =
+      malloc(sizeof(struct file_data*) * base_count);
+    if (base_entries == NULL)
+        print_perror(program_parameters, "malloc() failed");
+    size_t i = 0;
+    for (current_base_data = base_data; current_base_data != NULL;
+         current_base_data = current_base_data->next) {
+        base_entries[i] = current_base_data;
+        i++;
+    }
+    qsort(base_entries, base_count, sizeof(struct file_data*), compare_by_name);
+
+    struct file_data* current_file_data;
+    for (current_file_data = file_data; current_file_data != NULL;
+         current_file_data = current_file_data->next) {
+        const struct file_data* const* const found =
+          bsearch(&current_file_data,
+                  base_entries,
+                  base_count,
+                  sizeof(struct file_data*),
+                  compare_by_name);
+        if (found == NULL)
+            continue;
+
+        const struct file_data* const found_data = *found;
+        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR) {
+            if (((found_data->file_mode & S_IFMT) == S_IFDIR) &&
+                (current_file_data->first_child != NULL) &&
+                (found_data->first_child != NULL))
+                push_base_match_level(pending,
+                                      current_file_data->first_child,
+                                      found_data->first_child,
+                                      program_parameters);
+        } else if (((current_file_data->file_mode & S_IFMT) == S_IFREG) &&
+                   is_unchanged_file(
+                     current_file_data, found_data, base_file)) {
+            current_file_data->base_archive = base_file;
+            current_file_data->base_content_position =
+              found_data->archive_content_position;
+            current_file_data->base_content_size =
+              found_data->archive_content_size;
+            stats->file_count++;
+            stats->file_bytes += (archive_ptr_t)current_file_data->file_size;
+        }
+    }
+
+    free(base_entries);
+}
+
+void
+match_base_archive(struct file_data* file_data,
+                   const struct file_data* base_data,
+                   struct file_wrapper* base_file,
+                   const struct program_parameters* program_parameters)
+{
+    struct base_match_stats stats;
+    stats.file_count = 0;
+    stats.file_bytes = 0;
+
+    // Levels are matched from stack instead of recursion, so deep trees do
+    // not exhaust stack
+    struct base_match_level_list pending;
+    pending.levels = NULL;
+    pending.count = 0;
+    pending.capacity = 0;
+    push_base_match_level(&pending, file_data, base_data, program_parameters);
+    while (pending.count > 0) {
+        pending.count--;
+        const struct base_match_level level = pending.levels[pending.count];
+        match_base_entries(level.file_data,
+                           level.base_data,
+                           base_file,
+                           &pending,
+                           &stats,
+                           program_parameters);
+    }
+    free(pending.levels);
+
+    print_info(program_parameters,
+               "Copying %lu unchanged files (%lu bytes) from base archive\n",
+               stats.file_count,
+               stats.file_bytes);
+}
@@ -0,0 +1,743 @@
+#include "central_directory.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "codec.h"
+
+/* Central directory being encoded.
+ */
+struct central_directory_builder
+{
+    struct byte_buffer records;     // encoded records
+    struct byte_buffer string_pool; // names of entries
+    uint32_t entry_count;           // number of added records
+    archive_ptr_t content_ptr;      // address of content region
+};
+
+/* Append 64-bit time and 32-bit nanoseconds to buffer. Return 0 on success, -1
+ * on error.
+ */
+static int
+put_fixed_time(struct byte_buffer* buffer, const struct timespec* time)
+{
+    if (byte_buffer_put_u64(buffer, (uint64_t)(int64_t)time->tv_sec) < 0)
+        return -1;
+    return byte_buffer_put_u32(buffer, (uint32_t)time->tv_nsec);
+}
+
+/* Add records of file_data, following entries and all their descendants to
+ * builder.
+ */
+static void
+add_central_directory_entries(
+  const struct file_data* file_data,
+  struct central_directory_builder* builder,
+  const struct program_parameters* program_parameters)
+{
+    // Record indices of directories on path to current entry, so records of
+    // their children can refer to them
+    uint32_t* parent_indices = NULL;
+    size_t parent_capacity = 0;
+
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        const struct file_data* const current_file_data = walk.file_data;
+        const uint32_t parent_index = (walk.depth == 0)
+                                        ? ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT
+                                        : parent_indices[walk.depth - 1];
+        const size_t name_length = strlen(current_file_data->file_name);
+        if ((builder->entry_count == ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT) ||
+            (builder->string_pool.size + name_length > UINT32_MAX))
+            print_error(program_parameters,
+                        "Error: too many entries for central directory\n");
+
+        archive_ptr_t content_offset = 0;
+        archive_ptr_t content_size = 0;
+        uint32_t codec = CODEC_NONE;
+        archive_ptr_t stored_size = 0;
+        uint32_t flags = 0;
+        uint32_t content_checksum = 0;
+        // Records can refer only to content region
+        if (current_file_data->inline_content != NULL)
+            print_file_error(program_parameters,
+                             "Error: inline content of %s can not be stored "
+                             "in central directory\n",
+                             current_file_data);
+        if ((current_file_data->file_mode & S_IFMT) != S_IFDIR) {
+            content_offset =
+              current_file_data->archive_content_position - builder->content_ptr;
+            content_size = (archive_ptr_t)current_file_data->file_size;
+            codec = current_file_data->content_codec;
+            stored_size = current_file_data->archive_content_size;
+            if (current_file_data->has_content_checksum) {
+                flags |= ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM;
+                content_checksum = current_file_data->content_checksum;
+            }
+        }
+
+        struct byte_buffer* const records = &(builder->records);
+        if ((byte_buffer_put_u32(records, parent_index) < 0) ||
+            (byte_buffer_put_u32(records, current_file_data->file_mode) < 0) ||
+            (byte_buffer_put_u32(records,
+                                 (uint32_t)builder->string_pool.size) < 0) ||
+            (byte_buffer_put_u32(records, (uint32_t)name_length) < 0) ||
+            (byte_buffer_put_u64(records, content_offset) < 0) ||
+            (byte_buffer_put_u64(records, content_size) < 0) ||
+            (put_fixed_time(records, &(current_file_data->st_atim)) < 0) ||
+            (put_fixed_time(records, &(current_file_data->st_mtim)) < 0) ||
+            (put_fixed_time(records, &(current_file_data->st_ctim)) < 0) ||
+            (byte_buffer_put_u32(records, flags) < 0) ||
+            (byte_buffer_put_u32(records, codec) < 0) ||
+            (byte_buffer_put_u32(records, content_checksum) < 0) ||
+            (byte_buffer_put_u64(records, stored_size) < 0) ||
+            (byte_buffer_put(&(builder->string_pool),
+                             current_file_data->file_name,
+                             name_length) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+
+        const uint32_t index = builder->entry_count;
+        builder->entry_count++;
+
+        if (current_file_data->first_child != NULL) {
+            if (walk.depth == parent_capacity) {
+                const size_t new_capacity =
+                  (parent_capacity == 0) ? 16 : parent_capacity * 2;
+                uint32_t* const new_indices =
+                  realloc(parent_indices, sizeof(uint32_t) * new_capacity);
+                if (new_indices == NULL)
+                    print_perror(program_parameters, "realloc() failed");
+                parent_indices = new_indices;
+                parent_capacity = new_capacity;
+            }
+            parent_indices[walk.depth] = index;
+        }
+    }
+
+    free(parent_indices);
+}
+
+void
+encode_central_directory(const struct file_data* file_data,
+                         archive_ptr_t content_ptr,
+                         struct byte_buffer* buffer,
+                         const struct program_parameters* program_parameters)
+{
+    struct central_directory_builder builder;
+    byte_buffer_init(&(builder.records));
+    byte_buffer_init(&(builder.string_pool));
+    builder.entry_count = 0;
+    builder.content_ptr = content_ptr;
+
+    add_central_directory_entries(file_data, &builder, program_parameters);
+
+    if ((byte_buffer_reserve(buffer,
+                             ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE +
+                               builder.records.size +
+                               builder.string_pool.size) < 0) ||
+        (byte_buffer_put_u64(buffer, builder.entry_count) < 0) ||
+        (byte_buffer_put_u64(buffer, builder.string_pool.size) < 0) ||
+        (byte_buffer_put(buffer, builder.records.data, builder.records.size) <
+         0) ||
+        (byte_buffer_put(
+           buffer, builder.string_pool.data, builder.string_pool.size) < 0))
+        print_perror(program_parameters, "byte_buffer_put() failed");
+
+    byte_buffer_free(&(builder.records));
+    byte_buffer_free(&(builder.string_pool));
+}
+
+/* Load 64-bit time and 32-bit nanoseconds from data. Return 0 on success, -1
+ * on error.
+ */
+static int
+load_fixed_time(const uint8_t* data, struct timespec* time)
+{
+    const uint32_t nanoseconds = load_u32(data + 8);
+    if (nanoseconds >= 1000000000) {
+        errno = EIO;
+        return -1;
+    }
+    time->tv_sec = (time_t)(int64_t)load_u64(data);
+    time->tv_nsec = (long)nanoseconds;
+    return 0;
+}
+
+/* Central directory record, decoded.
+ */
+struct central_directory_record
+{
+    uint32_t parent_index;   // index of parent directory record
+    uint32_t mode;           // file mode
+    uint32_t name_offset;    // offset of name in string pool
+    uint32_t name_length;    // length of name
+    uint64_t content_offset; // offset of content relative to content_ptr
+    uint64_t content_size;   // size of content
+    uint32_t flags;          // record flags
+    uint32_t codec;          // content codec
+    uint32_t content_checksum; // checksum of content stored in archive
+    uint64_t stored_size;    // size of content stored in archive
+};
+
+/* Decode record from data (of size ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE).
+ */
+static void
+load_central_directory_record(const uint8_t* data,
+                              struct central_directory_record* record)
+{
+    record->parent_index = load_u32(data);
+    record->mode = load_u32(data + 4);
+    record->name_offset = load_u32(data + 8);
+    record->name_length = load_u32(data + 12);
+    record->content_offset = load_u64(data + 16);
+    record->content_size = load_u64(data + 24);
+    record->flags = load_u32(data + 68);
+    record->codec = load_u32(data + 72);
+    record->content_checksum = load_u32(data + 76);
+    record->stored_size = load_u64(data + 80);
+}
+
+/* Check name from record and copy it to name buffer (it should have size at
+ * least ARCHIVE_V3_MAX_NAME_LENGTH + 1).
+ */
+static void
+load_central_directory_name(const struct central_directory_record* record,
+                            const char* string_pool,
+                            uint64_t string_pool_size,
+                            char* name,
+                            const struct program_parameters* program_parameters)
+{
+    if ((record->name_length == 0) ||
+        (record->name_length > ARCHIVE_V3_MAX_NAME_LENGTH) ||
+        (record->name_offset > string_pool_size) ||
+        (record->name_length > string_pool_size - record->name_offset))
+        print_error(program_parameters, "Error: invalid file name\n");
+
+    memcpy(name, string_pool + record->name_offset, record->name_length);
+    name[record->name_length] = '\0';
+    if ((strlen(name) != record->name_length) ||
+        (check_file_name(name, ARCHIVE_V3_MAX_NAME_LENGTH + 1) < 0))
+        print_error(program_parameters, "Error: invalid file name %s\n", name);
+}
+
+/* Create file_data (without children) from record data and its name in
+ * arena.
+ */
+static struct file_data*
+create_file_data_from_record(
+  const uint8_t* data,
+  const struct central_directory_record* record,
+  const char* name,
+  struct file_data* parent,
+  struct arena* arena,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters)
+{
+    if (((record->flags & ~ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM) != 0) ||
+        ((record->flags & ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM) &&
+         ((record->mode & S_IFMT) == S_IFDIR)))
+        print_error(program_parameters,
+                    "Error: unsupported entry flags %x\n",
+                    record->flags);
+    if (check_file_mode((mode_t)record->mode) < 0)
+        print_error(
+          program_parameters, "Error: invalid file mode %x\n", record->mode);
+
+    struct file_data* const file_data = create_archive_file_data(
+      name, (mode_t)record->mode, parent, arena, program_parameters);
+
+    if ((load_fixed_time(data + 32, &(file_data->st_atim)) < 0) ||
+        (load_fixed_time(data + 44, &(file_data->st_mtim)) < 0) ||
+        (load_fixed_time(data + 56, &(file_data->st_ctim)) < 0))
+        print_error(program_parameters, "Error: invalid entry times\n");
+
+    if ((file_data->file_mode & S_IFMT) != S_IFDIR) {
+        if ((record->codec != CODEC_NONE) &&
+            (((file_data->file_mode & S_IFMT) != S_IFREG) ||
+             !is_known_codec(record->codec))) {
+            char path[FILE_PATH_BUFFER_SIZE];
+            get_file_path(file_data, NULL, path, sizeof(path));
+            print_error(program_parameters,
+                        "Error: unsupported codec %u of %s\n",
+                        record->codec,
+                        path);
+        }
+        if ((record->codec == CODEC_NONE) &&
+            (record->stored_size != record->content_size))
+            print_file_error(program_parameters,
+                             "Error: invalid stored size of %s\n",
+                             file_data);
+        if ((record->content_offset > header->content_size) ||
+            (record->stored_size >
+             header->content_size - record->content_offset))
+            print_file_error(
+              program_parameters,
+              "Error: content of %s is exceeding content region\n",
+              file_data);
+        file_data->archive_content_position =
+          header->content_ptr + record->content_offset;
+        file_data->file_size = (off_t)record->content_size;
+        file_data->content_codec = record->codec;
+        file_data->archive_content_size = record->stored_size;
+        file_data->has_content_checksum =
+          (record->flags & ARCHIVE_CENTRAL_DIRECTORY_CHECKSUM) ? 1 : 0;
+        file_data->content_checksum = record->content_checksum;
+    }
+
+    return file_data;
+}
+
+/* Decoded central directory header with pointers to its parts.
+ */
+struct central_directory_view
+{
+    uint64_t entry_count;      // number of records
+    uint64_t string_pool_size; // size of string pool
+    const uint8_t* records;    // records data
+    const char* string_pool;   // string pool data
+};
+
+/* Check central directory header in data of given size and fill view.
+ */
+static void
+load_central_directory_view(
+  const void* data,
+  archive_ptr_t size,
+  struct central_directory_view* view,
+  const struct program_parameters* program_parameters)
+{
+    if (size < ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE)
+        print_error(program_parameters, "Error: truncated central directory\n");
+
+    const uint8_t* const bytes = data;
+    view->entry_count = load_u64(bytes);
+    view->string_pool_size = load_u64(bytes + 8);
+
+    const archive_ptr_t records_size_limit =
+      (size - ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE) /
+      ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE;
+    if ((view->entry_count > records_size_limit) ||
+        (view->entry_count > ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT))
+        print_error(program_parameters, "Error: truncated central directory\n");
+    const archive_ptr_t records_size =
+      view->entry_count * ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE;
+    if (view->string_pool_size !=
+        size - ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE - records_size)
+        print_error(program_parameters,
+                    "Error: invalid central directory size\n");
+
+    view->records = bytes + ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE;
+    view->string_pool = (const char*)(view->records + records_size);
+}
+
+/* Decode records of central directory starting from first_index and return
+ * directory tree. If subtree_only is 0, all records are decoded (first_index
+ * should be 0). Otherwise record first_index is decoded as only root entry
+ * (with path relative to itself) with all its descendants.
+ */
+static struct file_data*
+decode_central_directory_records(
+  const struct central_directory_view* view,
+  uint64_t first_index,
+  int subtree_only,
+  const struct archive_header_v3* header,
+  const struct program_parameters* program_parameters)
+{
+    const uint64_t max_count = view->entry_count - first_index;
+
+    // Entries are linked by parent index, so last child of every directory is
+    // remembered to append next children in order
+    struct file_data** const entries =
+      malloc(sizeof(struct file_data*) * max_count);
+    struct file_data** const last_children =
+      malloc(sizeof(struct file_data*) * max_count);
+    if ((max_count > 0) && ((entries == NULL) || (last_children == NULL)))
+        print_perror(program_parameters, "malloc() failed");
+
+    struct arena* const arena = arena_create();
+    if (arena == NULL)
+        print_perror(program_parameters, "arena_create() failed");
+
+    struct file_data* first_root = NULL;
+    struct file_data* last_root = NULL;
+
+    uint64_t i;
+    for (i = first_index; i < view->entry_count; i++) {
+        const uint8_t* const data =
+          view->records + i * ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE;
+        struct central_directory_record record;
+        load_central_directory_record(data, &record);
+
+        int is_root = (record.parent_index ==
+                       ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT) ||
+                      (record.parent_index < first_index);
+        if (subtree_only) {
+            // Descendants are stored right after subtree root, so subtree
+            // ends at first entry which is not descendant
+            if ((i > first_index) && is_root)
+                break;
+            is_root = (i == first_index);
+        }
+
+        struct file_data* parent = NULL;
+        if (!is_root) {
+            // Parent should be already decoded, so there can not be cycles
+            if (record.parent_index >= i)
+                print_error(program_parameters,
+                            "Error: invalid parent index %u\n",
+                            record.parent_index);
+            parent = entries[record.parent_index - first_index];
+            if ((parent->file_mode & S_IFMT) != S_IFDIR)
+                print_error(program_parameters,
+                            "Error: parent of record %lu is not directory\n",
+                            i);
+        }
+
+        char name[ARCHIVE_V3_MAX_NAME_LENGTH + 1];
+        load_central_directory_name(&record,
+                                    view->string_pool,
+                                    view->string_pool_size,
+                                    name,
+                                    program_parameters);
+
+        struct file_data* const file_data = create_file_data_from_record(
+          data, &record, name, parent, arena, header, program_parameters);
+
+        if (parent == NULL) {
+            if (last_root == NULL)
+                first_root = file_data;
+            else
+                last_root->next = file_data;
+            last_root = file_data;
+        } else {
+            const uint64_t parent_index = record.parent_index - first_index;
+            if (last_children[parent_index] == NULL)
+                parent->first_child = file_data;
+            else
+                last_children[parent_index]->next = file_data;
+            last_children[parent_index] = file_data;
+        }
+
+        entries[i - first_index] = file_data;
+        last_children[i - first_index] = NULL;
+    }
+
+    free(entries);
+    free(last_children);
+
+    return set_directory_tree_arena(first_root, arena);
+}
+
+struct file_data*
+decode_central_directory(const void* data,
+                         archive_ptr_t size,
+                         const struct archive_header_v3* header,
+                         const struct program_parameters* program_parameters)
+{
+    struct central_directory_view view;
+    load_central_directory_view(data, size, &view, program_parameters);
+
+    return decode_central_directory_records(
+      &view, 0, 0, header, program_parameters);
+}
+
+struct file_data*
+read_central_directory(struct file_wrapper* input_file,
+                       const struct archive_header_v3* header,
+                       const struct program_parameters* program_parameters)
+{
+    void* central_directory_copy;
+    const void* const central_directory =
+      load_archive_region(input_file,
+                          header->central_directory_ptr,
+                          header->central_directory_size,
+                          &central_directory_copy,
+                          program_parameters);
+    check_region_checksum_v3(header,
+                             central_directory,
+                             header->central_directory_size,
+                             header->central_directory_checksum,
+                             "central directory",
+                             program_parameters);
+
+    struct file_data* const result =
+      decode_central_directory(central_directory,
+                               header->central_directory_size,
+                               header,
+                               program_parameters);
+
+    free(central_directory_copy);
+
+    return result;
+}
+
+/* Return hash of path component with given parent record index and name.
+ */
+static uint64_t
+hash_path_component(uint32_t parent_index,
+                    const char* name,
+                    size_t name_length)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    uint8_t parent_index_data[4];
+    store_u32(parent_index_data, parent_index);
+    size_t i;
+    for (i = 0; i < 4; i++) {
+        hash ^= parent_index_data[i];
+        hash *= 1099511628211ULL;
+    }
+    for (i = 0; i < name_length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void
+encode_path_index(const void* central_directory,
+                  archive_ptr_t central_directory_size,
+                  struct byte_buffer* buffer,
+                  const struct program_parameters* program_parameters)
+{
+    struct central_directory_view view;
+    load_central_directory_view(
+      central_directory, central_directory_size, &view, program_parameters);
+
+    uint64_t bucket_count = 1;
+    while (bucket_count < view.entry_count)
+        bucket_count *= 2;
+
+    uint32_t* const buckets = malloc(sizeof(uint32_t) * bucket_count);
+    uint32_t* const chain = malloc(sizeof(uint32_t) * (view.entry_count + 1));
+    if ((buckets == NULL) || (chain == NULL))
+        print_perror(program_parameters, "malloc() failed");
+
+    uint64_t i;
+    for (i = 0; i < bucket_count; i++)
+        buckets[i] = ARCHIVE_PATH_INDEX_NONE;
+
+    // Records are inserted in reverse order, so chains are sorted by index
+    for (i = view.entry_count; i > 0; i--) {
+        struct central_directory_record record;
+        load_central_directory_record(
+          view.records + (i - 1) * ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE,
+          &record);
+        const uint64_t bucket =
+          hash_path_component(record.parent_index,
+                              view.string_pool + record.name_offset,
+                              record.name_length) &
+          (bucket_count - 1);
+        chain[i - 1] = buckets[bucket];
+        buckets[bucket] = (uint32_t)(i - 1);
+    }
+
+    if ((byte_buffer_reserve(buffer,
+                             8 + (bucket_count + view.entry_count) * 4) < 0) ||
+        (byte_buffer_put_u64(buffer, bucket_count) < 0))
+        print_perror(program_parameters, "byte_buffer_put() failed");
+    for (i = 0; i < bucket_count; i++)
+        byte_buffer_put_u32(buffer, buckets[i]);
+    for (i = 0; i < view.entry_count; i++)
+        byte_buffer_put_u32(buffer, chain[i]);
+
+    free(buckets);
+    free(chain);
+}
+
+/* Read 32-bit value at position of input_file.
+ */
+static uint32_t
+read_u32_at(struct file_wrapper* input_file,
+            archive_ptr_t position,
+            const struct program_parameters* program_parameters)
+{
+    uint8_t data[4];
+    if (file_pread(input_file, data, 4, (off_t)position) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+    return load_u32(data);
+}
+
+struct file_data*
+find_central_directory_member(
+  struct file_wrapper* input_file,
+  const struct archive_header_v3* header,
+  const char* path,
+  const struct program_parameters* program_parameters)
+{
+    // Only central directory header, path index header and records on lookup
+    // path are read, so lookup takes O(depth) reads
+    uint8_t central_directory_header[ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE];
+    if (header->central_directory_size < ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE)
+        print_error(program_parameters, "Error: truncated central directory\n");
+    if (file_pread(input_file,
+                   central_directory_header,
+                   ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE,
+                   (off_t)header->central_directory_ptr) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+    const uint64_t entry_count = load_u64(central_directory_header);
+    const uint64_t string_pool_size = load_u64(central_directory_header + 8);
+    if ((entry_count > ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT) ||
+        (entry_count * ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE +
+           string_pool_size !=
+         header->central_directory_size -
+           ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE))
+        print_error(program_parameters,
+                    "Error: invalid central directory size\n");
+    const archive_ptr_t records_ptr =
+      header->central_directory_ptr + ARCHIVE_CENTRAL_DIRECTORY_HEADER_SIZE;
+    const archive_ptr_t string_pool_ptr =
+      records_ptr + entry_count * ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE;
+
+    uint8_t bucket_count_data[8];
+    if (header->path_index_size < 8)
+        print_error(program_parameters, "Error: truncated path index\n");
+    if (file_pread(input_file, bucket_count_data, 8, header->path_index_ptr) <
+        0)
+        print_perror(program_parameters, "file_pread() failed");
+    const uint64_t bucket_count = load_u64(bucket_count_data);
+    if ((bucket_count == 0) || ((bucket_count & (bucket_count - 1)) != 0) ||
+        (bucket_count > (header->path_index_size - 8) / 4) ||
+        ((header->path_index_size - 8) / 4 - bucket_count != entry_count))
+        print_error(program_parameters, "Error: invalid path index size\n");
+    const archive_ptr_t buckets_ptr = header->path_index_ptr + 8;
+    const archive_ptr_t chain_ptr = buckets_ptr + bucket_count * 4;
+
+    uint32_t parent_index = ARCHIVE_CENTRAL_DIRECTORY_NO_PARENT;
+    uint8_t record_data[ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE];
+    struct central_directory_record record;
+    char name_data[ARCHIVE_V3_MAX_NAME_LENGTH];
+    const char* component = path;
+    while (1) {
+        while (*component == '/')
+            component++;
+        const size_t component_length = strcspn(component, "/");
+        if ((component_length == 0) ||
+            (component_length > ARCHIVE_V3_MAX_NAME_LENGTH))
+            return NULL;
+
+        const uint64_t bucket =
+          hash_path_component(parent_index, component, component_length) &
+          (bucket_count - 1);
+        uint32_t index =
+          read_u32_at(input_file, buckets_ptr + bucket * 4, program_parameters);
+        uint64_t step_count = 0;
+        while (index != ARCHIVE_PATH_INDEX_NONE) {
+            // Chains are sorted by index, so they can not have cycles
+            if ((index >= entry_count) || (step_count > entry_count))
+                print_error(program_parameters,
+                            "Error: invalid path index entry %u\n",
+                            index);
+            step_count++;
+
+            if (file_pread(input_file,
+                           record_data,
+                           ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE,
+                           (off_t)(records_ptr +
+                                   (archive_ptr_t)index *
+                                     ARCHIVE_CENTRAL_DIRECTORY_RECORD_SIZE)) <
+                0)
+                print_perror(program_parameters, "file_pread() failed");
+            load_central_directory_record(record_data, &record);
+
+            if ((record.parent_index == parent_index) &&
+                (record.name_length == component_length) &&
+                (record.name_offset <= string_pool_size) &&
+                (record.name_length <=
+                 string_pool_size - record.name_offset)) {
+                if (file_pread(input_file,
+                               name_data,
+                               record.name_length,
+                               (off_t)(string_pool_ptr + record.name_offset)) <
+                    0)
+                    print_perror(program_parameters, "file_pread() failed");
+                if (memcmp(name_data, component, component_length) == 0)
+                    break;
+            }
+
+            const uint32_t next_index =
+              read_u32_at(input_file,
+                          chain_ptr + (archive_ptr_t)index * 4,
+                          program_parameters);
+            if ((next_index != ARCHIVE_PATH_INDEX_NONE) &&
+                (next_index <= index))
+                print_error(program_parameters,
+                            "Error: invalid path index entry %u\n",
+                            next_index);
+            index = next_index;
+        }
+        if (index == ARCHIVE_PATH_INDEX_NONE)
+            return NULL;
+
+        component += component_length;
+        while (*component == '/')
+            component++;
+        if (*component == '\0') {
+            parent_index = index;
+            break;
+        }
+        if ((record.mode & S_IFMT) != S_IFDIR)
+            return NULL;
+        parent_index = index;
+    }
+
+    if ((record.mode & S_IFMT) != S_IFDIR) {
+        // Only name of found record was read, so it is checked as string
+        // pool with single name
+        struct central_directory_record name_record = record;
+        name_record.name_offset = 0;
+        char name[ARCHIVE_V3_MAX_NAME_LENGTH + 1];
+        load_central_directory_name(&name_record,
+                                    name_data,
+                                    record.name_length,
+                                    name,
+                                    program_parameters);
+        struct arena* const arena = arena_create();
+        if (arena == NULL)
+            print_perror(program_parameters, "arena_create() failed");
+        return set_directory_tree_arena(
+          create_file_data_from_record(record_data,
+                                       &record,
+                                       name,
+                                       NULL,
+                                       arena,
+                                       header,
+                                       program_parameters),
+          arena);
+    }
+
+    // Directory is decoded with all descendants, which are stored right
+    // after it
+    void* central_directory_copy;
+    const void* const central_directory =
+      load_archive_region(input_file,
+                          header->central_directory_ptr,
+                          header->central_directory_size,
+                          &central_directory_copy,
+                          program_parameters);
+    check_region_checksum_v3(header,
+                             central_directory,
+                             header->central_directory_size,
+                             header->central_directory_checksum,
+                             "central directory",
+                             program_parameters);
+    struct central_directory_view view;
+    load_central_directory_view(central_directory,
+                                header->central_directory_size,
+                                &view,
+                                program_parameters);
+    struct file_data* const result = decode_central_directory_records(
+      &view, parent_index, 1, header, program_parameters);
+    free(central_directory_copy);
+
+    return result;
+}
@@ -0,0 +1,212 @@
+#include "checksum.h"
+
+#include <pthread.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/* Reflected CRC32C polynomial.
+ */
+#define CRC32C_POLYNOMIAL 0x82f63b78U
+
+/* Large data is processed by hardware in three interleaved stripes of this
+ * size, so latency of crc32 instruction is hidden, and stripe checksums are
+ * combined with carry-less multiplication.
+ */
+#define CRC32C_STRIPE_SIZE 4096
+
+#define CHECKSUM_BUFFER_SIZE (1 << 20)
+
+/* Tables for slicing-by-8 software implementation and constants for stripe
+ * combining. They are initialized once by init_crc32c().
+ */
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_stripe_shift;  // x^(8 * CRC32C_STRIPE_SIZE) mod P
+static uint32_t crc32c_double_shift;  // x^(16 * CRC32C_STRIPE_SIZE) mod P
+static int crc32c_use_hardware;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* Multiply a and b modulo CRC32C polynomial (in reflected bit order).
+ */
+static uint32_t
+multiply_mod_polynomial(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+    uint32_t mask;
+    for (mask = 1U << 31; mask != 0; mask >>= 1) {
+        if (a & mask)
+            product ^= b;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+    }
+    return product;
+}
+
+/* Update raw CRC32C register (without inversion) with data using tables.
+ */
+static uint32_t
+crc32c_software(uint32_t crc, const uint8_t* data, size_t size)
+{
+    while (size >= 8) {
+        crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+               ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+        crc = crc32c_table[7][crc & 0xff] ^
+              crc32c_table[6][(crc >> 8) & 0xff] ^
+              crc32c_table[5][(crc >> 16) & 0xff] ^
+              crc32c_table[4][crc >> 24] ^ crc32c_table[3][data[4]] ^
+              crc32c_table[2][data[5]] ^ crc32c_table[1][data[6]] ^
+              crc32c_table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        data++;
+        size--;
+    }
+    return crc;
+}
+
+static void
+init_crc32c(void)
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        int bit;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        int slice;
+        for (slice = 1; slice < 8; slice++)
+            crc32c_table[slice][i] =
+              crc32c_table[0][crc32c_table[slice - 1][i] & 0xff] ^
+              (crc32c_table[slice - 1][i] >> 8);
+    }
+
+    // Appending zero bytes to x^0 (highest bit in reflected order) gives
+    // powers of x used for shifting stripe checksums
+    uint8_t zeros[CRC32C_STRIPE_SIZE];
+    memset(zeros, 0, CRC32C_STRIPE_SIZE);
+    crc32c_stripe_shift =
+      crc32c_software(1U << 31, zeros, CRC32C_STRIPE_SIZE);
+    crc32c_double_shift =
+      multiply_mod_polynomial(crc32c_stripe_shift, crc32c_stripe_shift);
+
+#if defined(__x86_64__)
+    crc32c_use_hardware = __builtin_cpu_supports("sse4.2");
+#else
+    crc32c_use_hardware = 0;
+#endif
+}
+
+#if defined(__x86_64__)
+/* Update raw CRC32C register with size bytes of data using crc32 instruction
+ * for one stream.
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hardware_stream(uint32_t crc, const uint8_t* data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(uint64_t));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size > 0) {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        size--;
+    }
+    return crc;
+}
+
+/* Update raw CRC32C register with data using crc32 instruction.
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hardware(uint32_t crc, const uint8_t* data, size_t size)
+{
+    while (size >= 3 * CRC32C_STRIPE_SIZE) {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        size_t i;
+        for (i = 0; i < CRC32C_STRIPE_SIZE; i += 8) {
+            uint64_t word0;
+            uint64_t word1;
+            uint64_t word2;
+            memcpy(&word0, data + i, sizeof(uint64_t));
+            memcpy(&word1, data + CRC32C_STRIPE_SIZE + i, sizeof(uint64_t));
+            memcpy(
+              &word2, data + 2 * CRC32C_STRIPE_SIZE + i, sizeof(uint64_t));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = multiply_mod_polynomial(crc32c_double_shift, (uint32_t)crc0) ^
+              multiply_mod_polynomial(crc32c_stripe_shift, (uint32_t)crc1) ^
+              (uint32_t)crc2;
+        data += 3 * CRC32C_STRIPE_SIZE;
+        size -= 3 * CRC32C_STRIPE_SIZE;
+    }
+    return crc32c_hardware_stream(crc, data, size);
+}
+#endif
+
+uint32_t
+crc32c_update(uint32_t checksum, const void* data, size_t size)
+{
+    pthread_once(&crc32c_once, init_crc32c);
+
+    const uint32_t crc = ~checksum;
+#if defined(__x86_64__)
+    if (crc32c_use_hardware)
+        return ~crc32c_hardware(crc, data, size);
+#endif
+    return ~crc32c_software(crc, data, size);
+}
+
+int
+file_checksum_at(struct file_wrapper* file,
+                 off_t position,
+                 archive_ptr_t size,
+                 uint32_t* checksum)
+{
+    *checksum = 0;
+
+    const void* const data = file_get_data(file, position, size);
+    if (data != NULL) {
+        *checksum = crc32c_update(0, data, size);
+        return 0;
+    }
+    if (file->mapping != NULL) {
+        errno = EIO;
+        return -1;
+    }
+
+    uint8_t* const buffer = malloc(CHECKSUM_BUFFER_SIZE);
+    if (buffer == NULL)
+        return -1;
+    while (size > 0) {
+        const size_t portion_size =
+          (size < CHECKSUM_BUFFER_SIZE) ? size : CHECKSUM_BUFFER_SIZE;
+        if (file_pread(file, buffer, portion_size, position) < 0) {
+            free(buffer);
+            return -1;
+        }
+        *checksum = crc32c_update(*checksum, buffer, portion_size);
+        position += (off_t)portion_size;
+        size -= portion_size;
+    }
+    free(buffer);
+    return 0;
+}
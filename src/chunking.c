@@ -0,0 +1,640 @@
+#include "chunking.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "dedup.h"
+#include "encoding.h"
+#include "stats.h"
+
+#define CHUNK_READ_BUFFER_SIZE (CHUNK_MAX_SIZE * 4)
+
+/* Masks of gear hash bits which should be zero at chunk boundary. Boundary is
+ * harder to find before chunk reaches CHUNK_AVERAGE_SIZE and easier after
+ * that, so chunk sizes are concentrated around average. Highest bits are used
+ * because they depend on the longest window of preceding bytes.
+ */
+#define CHUNK_MASK_SMALL 0xffffc00000000000ULL
+#define CHUNK_MASK_LARGE 0xfffc000000000000ULL
+
+#define CHUNK_INDEX_INITIAL_SLOT_COUNT 1024
+
+void
+chunk_index_init(struct chunk_index* index,
+                 unsigned int codec,
+                 const struct program_parameters* program_parameters)
+{
+    // Gear values are generated with splitmix64, so chunk boundaries are the
+    // same in every run
+    uint64_t state = 0;
+    size_t i;
+    for (i = 0; i < 256; i++) {
+        state += 0x9e3779b97f4a7c15ULL;
+        uint64_t value = state;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        index->gear[i] = value ^ (value >> 31);
+    }
+
+    index->records = NULL;
+    index->record_count = 0;
+    index->record_capacity = 0;
+    index->slot_count = CHUNK_INDEX_INITIAL_SLOT_COUNT;
+    index->slots = calloc(index->slot_count, sizeof(size_t));
+    index->file_chunks = NULL;
+    index->file_chunk_capacity = 0;
+    index->read_buffer = malloc(CHUNK_READ_BUFFER_SIZE);
+    index->compare_buffer = malloc(CHUNK_MAX_SIZE);
+    if ((index->slots == NULL) || (index->read_buffer == NULL) ||
+        (index->compare_buffer == NULL))
+        print_perror(program_parameters, "malloc() failed");
+
+    index->codec = codec;
+    if ((codec != CODEC_NONE) &&
+        (codec_encoder_init(&(index->encoder), codec) < 0))
+        print_perror(program_parameters, "codec_encoder_init() failed");
+
+    index->chunk_count = 0;
+    index->chunk_bytes = 0;
+    index->unique_bytes = 0;
+}
+
+void
+chunk_index_free(struct chunk_index* index)
+{
+    free(index->records);
+    free(index->slots);
+    free(index->file_chunks);
+    free(index->read_buffer);
+    free(index->compare_buffer);
+    if (index->codec != CODEC_NONE)
+        codec_encoder_free(&(index->encoder));
+    index->records = NULL;
+    index->slots = NULL;
+    index->file_chunks = NULL;
+    index->read_buffer = NULL;
+    index->compare_buffer = NULL;
+}
+
+/* Return size of chunk beginning at data, where size bytes are available
+ * (all remaining content of file if it is less than CHUNK_MAX_SIZE).
+ */
+static size_t
+find_chunk_boundary(const uint64_t* gear, const uint8_t* data, size_t size)
+{
+    if (size <= CHUNK_MIN_SIZE)
+        return size;
+
+    const size_t limit = (size < CHUNK_MAX_SIZE) ? size : CHUNK_MAX_SIZE;
+    const size_t normal_limit =
+      (limit < CHUNK_AVERAGE_SIZE) ? limit : CHUNK_AVERAGE_SIZE;
+
+    // Bytes before CHUNK_MIN_SIZE can not be at boundary, so they are skipped
+    uint64_t hash = 0;
+    size_t i;
+    for (i = CHUNK_MIN_SIZE; i < normal_limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_SMALL) == 0)
+            return i + 1;
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_LARGE) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+/* Return 1 if size bytes of data are equal to chunk of record, 0 otherwise.
+ * current_file is used to read chunks of file_data itself.
+ */
+static int
+is_same_chunk(const struct chunk_record* record,
+              const uint8_t* data,
+              size_t size,
+              const struct file_data* file_data,
+              struct file_wrapper* current_file,
+              struct chunk_index* index,
+              const struct program_parameters* program_parameters)
+{
+    if (record->size != size)
+        return 0;
+
+    struct file_wrapper* source_file = current_file;
+    if (record->source != file_data) {
+        source_file = open_file_data(record->source, O_RDONLY);
+        if (source_file == NULL)
+            print_perror(program_parameters, "open_file_data() failed");
+    }
+
+    if (file_pread(
+          source_file, index->compare_buffer, size, record->source_offset) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+
+    if ((source_file != current_file) && (file_close(source_file) < 0))
+        print_perror(program_parameters, "file_close() failed");
+
+    return memcmp(index->compare_buffer, data, size) == 0;
+}
+
+/* Find chunk with given hash and data in index. Return slot of found chunk,
+ * or empty slot where it should be inserted.
+ */
+static size_t
+find_chunk_slot(uint64_t hash,
+                const uint8_t* data,
+                size_t size,
+                const struct file_data* file_data,
+                struct file_wrapper* current_file,
+                struct chunk_index* index,
+                const struct program_parameters* program_parameters)
+{
+    const size_t mask = index->slot_count - 1;
+    size_t slot = (size_t)hash & mask;
+    while (index->slots[slot] != 0) {
+        const struct chunk_record* const record =
+          index->records + index->slots[slot] - 1;
+        if ((record->hash == hash) && is_same_chunk(record,
+                                                    data,
+                                                    size,
+                                                    file_data,
+                                                    current_file,
+                                                    index,
+                                                    program_parameters))
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double number of hash table slots of index and reinsert all records.
+ */
+static void
+grow_chunk_slots(struct chunk_index* index,
+                 const struct program_parameters* program_parameters)
+{
+    const size_t new_slot_count = index->slot_count * 2;
+    size_t* const new_slots = calloc(new_slot_count, sizeof(size_t));
+    if (new_slots == NULL)
+        print_perror(program_parameters, "calloc() failed");
+
+    size_t i;
+    for (i = 0; i < index->record_count; i++) {
+        size_t slot = (size_t)index->records[i].hash & (new_slot_count - 1);
+        while (new_slots[slot] != 0)
+            slot = (slot + 1) & (new_slot_count - 1);
+        new_slots[slot] = i + 1;
+    }
+
+    free(index->slots);
+    index->slots = new_slots;
+    index->slot_count = new_slot_count;
+}
+
+/* Write size bytes of chunk data to output_file at position (which is
+ * updated) and add its record to index at slot. Return index of record.
+ */
+static size_t
+add_chunk(uint64_t hash,
+          const uint8_t* data,
+          size_t size,
+          const struct file_data* file_data,
+          off_t source_offset,
+          size_t slot,
+          struct file_wrapper* output_file,
+          archive_ptr_t* position,
+          struct chunk_index* index,
+          const struct program_parameters* program_parameters)
+{
+    if (index->record_count == index->record_capacity) {
+        const size_t new_capacity =
+          (index->record_capacity == 0) ? 256 : index->record_capacity * 2;
+        struct chunk_record* const new_records =
+          realloc(index->records, sizeof(struct chunk_record) * new_capacity);
+        if (new_records == NULL)
+            print_perror(program_parameters, "realloc() failed");
+        index->records = new_records;
+        index->record_capacity = new_capacity;
+    }
+
+    struct chunk_record* const record = index->records + index->record_count;
+    record->hash = hash;
+    record->position = *position;
+    record->size = (uint32_t)size;
+    record->source = file_data;
+    record->source_offset = source_offset;
+    record->codec = index->codec;
+    if (index->codec != CODEC_NONE) {
+        index->encoder.output_checksum = 0;
+        if (codec_encode_data(&(index->encoder),
+                              data,
+                              size,
+                              output_file,
+                              &(record->stored_size)) < 0)
+            print_perror(program_parameters, "codec_encode_data() failed");
+        record->checksum = index->encoder.output_checksum;
+    } else {
+        record->stored_size = size;
+        record->checksum = crc32c_update(0, data, size);
+        if (file_write(output_file, data, size) < 0)
+            print_perror(program_parameters, "file_write() failed");
+    }
+    *position += record->stored_size;
+    index->unique_bytes += size;
+
+    index->slots[slot] = index->record_count + 1;
+    index->record_count++;
+    if (index->record_count * 2 > index->slot_count)
+        grow_chunk_slots(index, program_parameters);
+
+    return index->record_count - 1;
+}
+
+/* Append record index to chunk list of current file in index. Position is
+ * number of chunks already in list.
+ */
+static void
+append_file_chunk(size_t record_index,
+                  size_t position,
+                  struct chunk_index* index,
+                  const struct program_parameters* program_parameters)
+{
+    if (position == index->file_chunk_capacity) {
+        const size_t new_capacity = (index->file_chunk_capacity == 0)
+                                      ? 64
+                                      : index->file_chunk_capacity * 2;
+        size_t* const new_chunks =
+          realloc(index->file_chunks, sizeof(size_t) * new_capacity);
+        if (new_chunks == NULL)
+            print_perror(program_parameters, "realloc() failed");
+        index->file_chunks = new_chunks;
+        index->file_chunk_capacity = new_capacity;
+    }
+    index->file_chunks[position] = record_index;
+}
+
+/* Write chunk list of file with chunk_count chunks from index to output_file
+ * at position (which is updated) and assign it to file_data.
+ */
+static void
+write_chunk_list(struct file_data* file_data,
+                 size_t chunk_count,
+                 struct file_wrapper* output_file,
+                 archive_ptr_t* position,
+                 const struct chunk_index* index,
+                 const struct program_parameters* program_parameters)
+{
+    struct byte_buffer list;
+    byte_buffer_init(&list);
+    if (byte_buffer_put_varint(&list, chunk_count) < 0)
+        print_perror(program_parameters, "byte_buffer_put_varint() failed");
+
+    size_t i;
+    for (i = 0; i < chunk_count; i++) {
+        const struct chunk_record* const record =
+          index->records + index->file_chunks[i];
+        if ((byte_buffer_put_varint(&list, *position - record->position) <
+             0) ||
+            (byte_buffer_put_varint(&list, record->size) < 0) ||
+            (byte_buffer_put_varint(&list, record->codec) < 0) ||
+            (byte_buffer_put_varint(&list, record->stored_size) < 0) ||
+            (byte_buffer_put_u32(&list, record->checksum) < 0))
+            print_perror(program_parameters, "byte_buffer_put() failed");
+    }
+
+    if (file_write(output_file, list.data, list.size) < 0)
+        print_perror(program_parameters, "file_write() failed");
+
+    file_data->archive_content_position = *position;
+    file_data->archive_content_size = list.size;
+    *position += list.size;
+    byte_buffer_free(&list);
+}
+
+void
+write_chunked_content(struct file_data* file_data,
+                      struct file_wrapper* output_file,
+                      archive_ptr_t* position,
+                      struct chunk_index* index,
+                      const struct program_parameters* program_parameters)
+{
+    const uint64_t start_time = stats_start_file();
+    struct file_wrapper* const current_file =
+      open_file_data(file_data, O_RDONLY);
+    if (current_file == NULL)
+        print_perror(program_parameters, "open_file_data() failed");
+
+    // Buffer always holds at least CHUNK_MAX_SIZE bytes (unless file ends),
+    // so every chunk is found in it in one piece
+    uint8_t* const buffer = index->read_buffer;
+    size_t buffer_begin = 0;
+    size_t buffer_end = 0;
+    size_t remaining_size = (size_t)file_data->file_size;
+    off_t chunk_offset = 0;
+    size_t chunk_count = 0;
+    while ((buffer_end > buffer_begin) || (remaining_size > 0)) {
+        if ((buffer_end - buffer_begin < CHUNK_MAX_SIZE) &&
+            (remaining_size > 0)) {
+            memmove(buffer, buffer + buffer_begin, buffer_end - buffer_begin);
+            buffer_end -= buffer_begin;
+            buffer_begin = 0;
+
+            size_t read_size = CHUNK_READ_BUFFER_SIZE - buffer_end;
+            if (read_size > remaining_size)
+                read_size = remaining_size;
+            if (file_read(current_file, buffer + buffer_end, read_size) < 0)
+                print_perror(program_parameters, "file_read() failed");
+            buffer_end += read_size;
+            remaining_size -= read_size;
+        }
+
+        const uint8_t* const chunk = buffer + buffer_begin;
+        const size_t chunk_size = find_chunk_boundary(
+          index->gear, chunk, buffer_end - buffer_begin);
+        const uint64_t hash =
+          update_content_hash(CONTENT_HASH_SEED, chunk, chunk_size);
+
+        const size_t slot = find_chunk_slot(hash,
+                                            chunk,
+                                            chunk_size,
+                                            file_data,
+                                            current_file,
+                                            index,
+                                            program_parameters);
+        size_t record_index;
+        if (index->slots[slot] != 0)
+            record_index = index->slots[slot] - 1;
+        else
+            record_index = add_chunk(hash,
+                                     chunk,
+                                     chunk_size,
+                                     file_data,
+                                     chunk_offset,
+                                     slot,
+                                     output_file,
+                                     position,
+                                     index,
+                                     program_parameters);
+        append_file_chunk(record_index, chunk_count, index, program_parameters);
+        chunk_count++;
+
+        index->chunk_count++;
+        index->chunk_bytes += chunk_size;
+        buffer_begin += chunk_size;
+        chunk_offset += (off_t)chunk_size;
+    }
+
+    if (file_close(current_file) < 0)
+        print_perror(program_parameters, "file_close() failed");
+
+    write_chunk_list(
+      file_data, chunk_count, output_file, position, index, program_parameters);
+    stats_finish_file(start_time, file_data);
+}
+
+/* Write size bytes of chunk stored as is at input_position in input_file to
+ * output_file. Buffer of CHUNK_MAX_SIZE bytes is used if input_file is not
+ * mapped to memory.
+ */
+static int
+copy_stored_chunk(struct file_wrapper* input_file,
+                  off_t input_position,
+                  size_t size,
+                  struct file_wrapper* output_file,
+                  uint8_t* buffer)
+{
+    const void* data = file_get_data(input_file, input_position, size);
+    if (data == NULL) {
+        if (input_file->mapping != NULL) {
+            errno = EIO;
+            return -1;
+        }
+        if (file_pread(input_file, buffer, size, input_position) < 0)
+            return -1;
+        data = buffer;
+    }
+    return file_write(output_file, data, size);
+}
+
+/* Chunk list record, decoded.
+ */
+struct chunk_list_entry
+{
+    off_t position;       // position of stored chunk data in archive
+    uint64_t size;        // size of chunk
+    uint64_t codec;       // block codec of chunk
+    uint64_t stored_size; // size of stored chunk data
+    uint32_t checksum;    // checksum of stored chunk data
+};
+
+/* Decode and check next record of chunk list at list_position from reader.
+ * remaining_size is content size not covered by previous chunks. Return 0 on
+ * success, -1 with errno set to EIO if record is invalid.
+ */
+static int
+get_chunk_list_entry(struct byte_reader* reader,
+                     off_t list_position,
+                     size_t remaining_size,
+                     struct chunk_list_entry* entry)
+{
+    uint64_t distance;
+    if ((byte_reader_get_varint(reader, &distance) < 0) ||
+        (byte_reader_get_varint(reader, &(entry->size)) < 0) ||
+        (byte_reader_get_varint(reader, &(entry->codec)) < 0) ||
+        (byte_reader_get_varint(reader, &(entry->stored_size)) < 0) ||
+        (byte_reader_get_u32(reader, &(entry->checksum)) < 0)) {
+        errno = EIO;
+        return -1;
+    }
+
+    // Chunk should be stored before chunk list
+    if ((distance > (uint64_t)list_position) ||
+        (entry->stored_size > distance) || (entry->size == 0) ||
+        (entry->size > CHUNK_MAX_SIZE) || (entry->size > remaining_size) ||
+        ((entry->codec == CODEC_NONE) &&
+         (entry->stored_size != entry->size)) ||
+        ((entry->codec != CODEC_NONE) && (get_codec(entry->codec) == NULL))) {
+        errno = EIO;
+        return -1;
+    }
+
+    entry->position = list_position - (off_t)distance;
+    return 0;
+}
+
+/* Decode chunk count from reader and check it against content size. Return 0
+ * on success, -1 with errno set to EIO if count is invalid.
+ */
+static int
+get_chunk_count(struct byte_reader* reader, size_t size, uint64_t* count)
+{
+    if ((byte_reader_get_varint(reader, count) < 0) || (*count > size)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Reassemble content from chunk list in reader for read_chunked_content().
+ */
+static int
+read_chunks(struct file_wrapper* input_file,
+            off_t list_position,
+            struct byte_reader* reader,
+            struct file_wrapper* output_file,
+            size_t size,
+            uint8_t* buffer)
+{
+    uint64_t chunk_count;
+    if (get_chunk_count(reader, size, &chunk_count) < 0)
+        return -1;
+
+    uint64_t i;
+    for (i = 0; i < chunk_count; i++) {
+        struct chunk_list_entry entry;
+        if (get_chunk_list_entry(reader, list_position, size, &entry) < 0)
+            return -1;
+
+        int result;
+        if (entry.codec == CODEC_NONE)
+            result = copy_stored_chunk(
+              input_file, entry.position, entry.size, output_file, buffer);
+        else
+            result = codec_read_content(input_file,
+                                        entry.position,
+                                        entry.stored_size,
+                                        output_file,
+                                        entry.size,
+                                        entry.codec);
+        if (result < 0)
+            return -1;
+        size -= entry.size;
+    }
+
+    if ((size != 0) || (reader->position != reader->size)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return pointer to chunk list of list_size bytes at list_position in
+ * input_file. If file is not mapped to memory, list is read to dynamically
+ * allocated buffer, which is also stored to value referenced by buffer_ptr
+ * and should be deallocated by caller. Return NULL on error.
+ */
+static const void*
+load_chunk_list(struct file_wrapper* input_file,
+                off_t list_position,
+                archive_ptr_t list_size,
+                uint8_t** buffer_ptr)
+{
+    *buffer_ptr = NULL;
+    const void* const list_data =
+      file_get_data(input_file, list_position, list_size);
+    if (list_data != NULL)
+        return list_data;
+    if (input_file->mapping != NULL) {
+        errno = EIO;
+        return NULL;
+    }
+
+    uint8_t* const buffer = malloc(list_size);
+    if (buffer == NULL)
+        return NULL;
+    if (file_pread(input_file, buffer, list_size, list_position) < 0) {
+        free(buffer);
+        return NULL;
+    }
+    *buffer_ptr = buffer;
+    return buffer;
+}
+
+int
+read_chunked_content(struct file_wrapper* input_file,
+                     off_t list_position,
+                     archive_ptr_t list_size,
+                     struct file_wrapper* output_file,
+                     size_t size)
+{
+    uint8_t* list_buffer;
+    const void* const list_data =
+      load_chunk_list(input_file, list_position, list_size, &list_buffer);
+    if (list_data == NULL)
+        return -1;
+
+    uint8_t* buffer = NULL;
+    if (input_file->mapping == NULL)
+        buffer = malloc(CHUNK_MAX_SIZE);
+
+    int result = -1;
+    if ((input_file->mapping != NULL) || (buffer != NULL)) {
+        struct byte_reader reader;
+        byte_reader_init(&reader, list_data, list_size);
+        result = read_chunks(
+          input_file, list_position, &reader, output_file, size, buffer);
+    }
+
+    free(buffer);
+    free(list_buffer);
+    return result;
+}
+
+/* Check chunks from chunk list in reader for verify_chunked_content().
+ */
+static int
+verify_chunks(struct file_wrapper* input_file,
+              off_t list_position,
+              struct byte_reader* reader,
+              size_t size)
+{
+    uint64_t chunk_count;
+    if (get_chunk_count(reader, size, &chunk_count) < 0)
+        return -1;
+
+    uint64_t i;
+    for (i = 0; i < chunk_count; i++) {
+        struct chunk_list_entry entry;
+        if (get_chunk_list_entry(reader, list_position, size, &entry) < 0)
+            return -1;
+
+        uint32_t checksum;
+        if (file_checksum_at(
+              input_file, entry.position, entry.stored_size, &checksum) < 0)
+            return -1;
+        if (checksum != entry.checksum) {
+            errno = EIO;
+            return -1;
+        }
+        size -= entry.size;
+    }
+
+    if ((size != 0) || (reader->position != reader->size)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int
+verify_chunked_content(struct file_wrapper* input_file,
+                       off_t list_position,
+                       archive_ptr_t list_size,
+                       size_t size)
+{
+    uint8_t* list_buffer;
+    const void* const list_data =
+      load_chunk_list(input_file, list_position, list_size, &list_buffer);
+    if (list_data == NULL)
+        return -1;
+
+    struct byte_reader reader;
+    byte_reader_init(&reader, list_data, list_size);
+    const int result = verify_chunks(input_file, list_position, &reader, size);
+
+    free(list_buffer);
+    return result;
+}
@@ -0,0 +1,290 @@
+#include "codec.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "chunking.h"
+#include "codec_lz.h"
+#include "encoding.h"
+#include "sparse.h"
+
+static const struct codec_ops CODECS[CODEC_COUNT] = {
+    { "none", 0, NULL, NULL, NULL },
+    { "lz", LZ_WORK_MEMORY_SIZE, lz_compress_bound, lz_compress, lz_decompress }
+};
+
+const struct codec_ops*
+get_codec(unsigned int codec)
+{
+    if ((codec == CODEC_NONE) || (codec >= CODEC_COUNT))
+        return NULL;
+    return &(CODECS[codec]);
+}
+
+int
+is_known_codec(unsigned int codec)
+{
+    return (get_codec(codec) != NULL) || (codec == CODEC_CHUNKED) ||
+           (codec == CODEC_SPARSE);
+}
+
+int
+find_codec(const char* name)
+{
+    int i;
+    for (i = 0; i < CODEC_COUNT; i++) {
+        if (strcmp(CODECS[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int
+codec_encoder_init(struct codec_encoder* encoder, unsigned int codec)
+{
+    encoder->ops = get_codec(codec);
+    encoder->output_buffer = NULL;
+    encoder->work_memory = NULL;
+    encoder->output_checksum = 0;
+    if (encoder->ops == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    encoder->output_buffer = malloc(
+      CODEC_BLOCK_HEADER_SIZE + encoder->ops->compress_bound(CODEC_BLOCK_SIZE));
+    encoder->work_memory = malloc(encoder->ops->work_memory_size);
+    if ((encoder->output_buffer == NULL) || (encoder->work_memory == NULL)) {
+        codec_encoder_free(encoder);
+        return -1;
+    }
+    return 0;
+}
+
+void
+codec_encoder_free(struct codec_encoder* encoder)
+{
+    free(encoder->output_buffer);
+    free(encoder->work_memory);
+    encoder->output_buffer = NULL;
+    encoder->work_memory = NULL;
+}
+
+int
+codec_encode_data(struct codec_encoder* encoder,
+                  const uint8_t* data,
+                  size_t size,
+                  struct file_wrapper* output_file,
+                  archive_ptr_t* stored_size)
+{
+    uint8_t* const output_buffer = encoder->output_buffer;
+    uint8_t* const block_data = output_buffer + CODEC_BLOCK_HEADER_SIZE;
+
+    *stored_size = 0;
+    while (size > 0) {
+        const size_t block_size =
+          (size < CODEC_BLOCK_SIZE) ? size : CODEC_BLOCK_SIZE;
+
+        size_t data_size = encoder->ops->compress(
+          data, block_size, block_data, encoder->work_memory);
+        if (data_size < block_size) {
+            store_u32(output_buffer, (uint32_t)data_size);
+        } else {
+            // Incompressible block is stored as is
+            data_size = block_size;
+            store_u32(output_buffer, (uint32_t)data_size | CODEC_BLOCK_RAW);
+            memcpy(block_data, data, block_size);
+        }
+
+        if (file_write(output_file,
+                       output_buffer,
+                       CODEC_BLOCK_HEADER_SIZE + data_size) < 0)
+            return -1;
+        encoder->output_checksum =
+          crc32c_update(encoder->output_checksum,
+                        output_buffer,
+                        CODEC_BLOCK_HEADER_SIZE + data_size);
+        *stored_size += CODEC_BLOCK_HEADER_SIZE + data_size;
+        data += block_size;
+        size -= block_size;
+    }
+
+    return 0;
+}
+
+/* Encode blocks for codec_write_content() using preallocated input_buffer of
+ * CODEC_BLOCK_SIZE bytes.
+ */
+static int
+write_encoded_blocks(struct file_wrapper* input_file,
+                     struct file_wrapper* output_file,
+                     size_t size,
+                     struct codec_encoder* encoder,
+                     uint8_t* input_buffer,
+                     archive_ptr_t* stored_size)
+{
+    *stored_size = 0;
+    while (size > 0) {
+        const size_t block_size =
+          (size < CODEC_BLOCK_SIZE) ? size : CODEC_BLOCK_SIZE;
+        if (file_read(input_file, input_buffer, block_size) < 0)
+            return -1;
+
+        archive_ptr_t block_stored_size;
+        if (codec_encode_data(encoder,
+                              input_buffer,
+                              block_size,
+                              output_file,
+                              &block_stored_size) < 0)
+            return -1;
+        *stored_size += block_stored_size;
+        size -= block_size;
+    }
+
+    return 0;
+}
+
+int
+codec_write_content(struct file_wrapper* input_file,
+                    struct file_wrapper* output_file,
+                    size_t size,
+                    unsigned int codec,
+                    archive_ptr_t* stored_size)
+{
+    if (codec == CODEC_SPARSE)
+        return write_sparse_content(
+          input_file, output_file, size, stored_size);
+
+    struct codec_encoder encoder;
+    if (codec_encoder_init(&encoder, codec) < 0)
+        return -1;
+
+    uint8_t* const input_buffer = malloc(CODEC_BLOCK_SIZE);
+    int result = -1;
+    if (input_buffer != NULL)
+        result = write_encoded_blocks(
+          input_file, output_file, size, &encoder, input_buffer, stored_size);
+
+    free(input_buffer);
+    codec_encoder_free(&encoder);
+    return result;
+}
+
+/* Decode blocks for codec_read_content() using preallocated buffers
+ * (input_buffer is used only if input_file is not mapped to memory).
+ */
+static int
+read_encoded_blocks(struct file_wrapper* input_file,
+                    off_t input_position,
+                    archive_ptr_t stored_size,
+                    struct file_wrapper* output_file,
+                    size_t size,
+                    const struct codec_ops* ops,
+                    uint8_t* input_buffer,
+                    uint8_t* output_buffer)
+{
+    while (size > 0) {
+        const size_t block_size =
+          (size < CODEC_BLOCK_SIZE) ? size : CODEC_BLOCK_SIZE;
+
+        uint8_t block_header[CODEC_BLOCK_HEADER_SIZE];
+        if (stored_size < CODEC_BLOCK_HEADER_SIZE) {
+            errno = EIO;
+            return -1;
+        }
+        if (file_pread(input_file,
+                       block_header,
+                       CODEC_BLOCK_HEADER_SIZE,
+                       input_position) < 0)
+            return -1;
+        input_position += CODEC_BLOCK_HEADER_SIZE;
+        stored_size -= CODEC_BLOCK_HEADER_SIZE;
+
+        const uint32_t header_value = load_u32(block_header);
+        const size_t data_size = header_value & ~CODEC_BLOCK_RAW;
+        if ((data_size > stored_size) ||
+            (data_size > ops->compress_bound(block_size)) ||
+            ((header_value & CODEC_BLOCK_RAW) && (data_size != block_size))) {
+            errno = EIO;
+            return -1;
+        }
+
+        // Stored data is used in place if archive is mapped to memory
+        const uint8_t* data =
+          file_get_data(input_file, input_position, data_size);
+        if (data == NULL) {
+            if (input_buffer == NULL) {
+                errno = EIO;
+                return -1;
+            }
+            if (file_pread(
+                  input_file, input_buffer, data_size, input_position) < 0)
+                return -1;
+            data = input_buffer;
+        }
+        input_position += data_size;
+        stored_size -= data_size;
+
+        if ((header_value & CODEC_BLOCK_RAW) == 0) {
+            if (ops->decompress(data, data_size, output_buffer, block_size) <
+                0)
+                return -1;
+            data = output_buffer;
+        }
+
+        if (file_write(output_file, data, block_size) < 0)
+            return -1;
+        size -= block_size;
+    }
+
+    if (stored_size != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int
+codec_read_content(struct file_wrapper* input_file,
+                   off_t input_position,
+                   archive_ptr_t stored_size,
+                   struct file_wrapper* output_file,
+                   size_t size,
+                   unsigned int codec)
+{
+    if (codec == CODEC_CHUNKED)
+        return read_chunked_content(
+          input_file, input_position, stored_size, output_file, size);
+    if (codec == CODEC_SPARSE)
+        return read_sparse_content(
+          input_file, input_position, stored_size, output_file, size);
+
+    const struct codec_ops* const ops = get_codec(codec);
+    if (ops == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint8_t* const output_buffer = malloc(CODEC_BLOCK_SIZE);
+    uint8_t* input_buffer = NULL;
+    if (input_file->mapping == NULL)
+        input_buffer = malloc(ops->compress_bound(CODEC_BLOCK_SIZE));
+
+    int result = -1;
+    if ((output_buffer != NULL) &&
+        ((input_file->mapping != NULL) || (input_buffer != NULL)))
+        result = read_encoded_blocks(input_file,
+                                     input_position,
+                                     stored_size,
+                                     output_file,
+                                     size,
+                                     ops,
+                                     input_buffer,
+                                     output_buffer);
+
+    free(input_buffer);
+    free(output_buffer);
+    return result;
+}
@@ -0,0 +1,213 @@
+#include "codec_lz.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* Load 32-bit value from unaligned pointer.
+ */
+static uint32_t
+load_word(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(uint32_t));
+    return value;
+}
+
+/* Return hash table slot of 4 bytes at ptr.
+ */
+static uint32_t
+get_hash(const uint8_t* ptr)
+{
+    return (load_word(ptr) * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Append length extra bytes for value (which should be at least 15) to
+ * output. Return new output position.
+ */
+static uint8_t*
+put_length(uint8_t* output, size_t value)
+{
+    value -= 15;
+    while (value >= 255) {
+        *output = 255;
+        output++;
+        value -= 255;
+    }
+    *output = (uint8_t)value;
+    return output + 1;
+}
+
+/* Append sequence with literals and match (match_length is 0 for last
+ * sequence) to output. Return new output position.
+ */
+static uint8_t*
+put_sequence(uint8_t* output,
+             const uint8_t* literals,
+             size_t literal_count,
+             size_t match_offset,
+             size_t match_length)
+{
+    uint8_t* const token = output;
+    output++;
+
+    if (literal_count >= 15) {
+        *token = 15 << 4;
+        output = put_length(output, literal_count);
+    } else
+        *token = (uint8_t)(literal_count << 4);
+    memcpy(output, literals, literal_count);
+    output += literal_count;
+
+    if (match_length == 0)
+        return output;
+
+    output[0] = (uint8_t)match_offset;
+    output[1] = (uint8_t)(match_offset >> 8);
+    output += 2;
+
+    const size_t match_code = match_length - LZ_MIN_MATCH;
+    if (match_code >= 15) {
+        *token |= 15;
+        output = put_length(output, match_code);
+    } else
+        *token |= (uint8_t)match_code;
+
+    return output;
+}
+
+size_t
+lz_compress_bound(size_t size)
+{
+    return size + (size / 255) + 16;
+}
+
+size_t
+lz_compress(const uint8_t* input,
+            size_t size,
+            uint8_t* output,
+            void* work_memory)
+{
+    uint32_t* const table = work_memory;
+    memset(table, 0, LZ_WORK_MEMORY_SIZE);
+
+    uint8_t* output_ptr = output;
+    size_t anchor = 0;
+    size_t position = 0;
+
+    if (size > LZ_MIN_MATCH) {
+        const size_t limit = size - LZ_MIN_MATCH;
+        while (position <= limit) {
+            const uint32_t hash = get_hash(input + position);
+            const size_t candidate = table[hash];
+            table[hash] = (uint32_t)position;
+
+            if ((candidate < position) &&
+                (position - candidate <= LZ_MAX_OFFSET) &&
+                (load_word(input + candidate) == load_word(input + position))) {
+                size_t match_length = LZ_MIN_MATCH;
+                while ((position + match_length < size) &&
+                       (input[candidate + match_length] ==
+                        input[position + match_length]))
+                    match_length++;
+
+                output_ptr = put_sequence(output_ptr,
+                                          input + anchor,
+                                          position - anchor,
+                                          position - candidate,
+                                          match_length);
+                position += match_length;
+                anchor = position;
+                continue;
+            }
+
+            // Step grows while there are no matches, so incompressible data
+            // is skipped quickly
+            position += 1 + ((position - anchor) >> 6);
+        }
+    }
+
+    output_ptr =
+      put_sequence(output_ptr, input + anchor, size - anchor, 0, 0);
+
+    return (size_t)(output_ptr - output);
+}
+
+/* Read length extra bytes from input and add them to value. Return 0 on
+ * success, -1 if input ends.
+ */
+static int
+get_length(const uint8_t** input, const uint8_t* input_end, size_t* value)
+{
+    while (1) {
+        if (*input >= input_end)
+            return -1;
+        const uint8_t byte = **input;
+        (*input)++;
+        *value += byte;
+        if (byte != 255)
+            return 0;
+    }
+}
+
+int
+lz_decompress(const uint8_t* input,
+              size_t input_size,
+              uint8_t* output,
+              size_t output_size)
+{
+    const uint8_t* const input_end = input + input_size;
+    size_t position = 0;
+
+    while (1) {
+        if (input >= input_end)
+            break;
+        const uint8_t token = *input;
+        input++;
+
+        size_t literal_count = token >> 4;
+        if ((literal_count == 15) &&
+            (get_length(&input, input_end, &literal_count) < 0))
+            break;
+        if ((literal_count > (size_t)(input_end - input)) ||
+            (literal_count > output_size - position))
+            break;
+        memcpy(output + position, input, literal_count);
+        input += literal_count;
+        position += literal_count;
+
+        if (input == input_end) {
+            if (position != output_size)
+                break;
+            return 0;
+        }
+
+        if (input_end - input < 2)
+            break;
+        const size_t match_offset = input[0] | (((size_t)input[1]) << 8);
+        input += 2;
+        size_t match_length = token & 15;
+        if ((match_length == 15) &&
+            (get_length(&input, input_end, &match_length) < 0))
+            break;
+        match_length += LZ_MIN_MATCH;
+        if ((match_offset == 0) || (match_offset > position) ||
+            (match_length > output_size - position))
+            break;
+
+        // Match can overlap with its own output (for repeated patterns)
+        const uint8_t* source = output + position - match_offset;
+        if (match_offset >= match_length) {
+            memcpy(output + position, source, match_length);
+            position += match_length;
+        } else {
+            size_t i;
+            for (i = 0; i < match_length; i++) {
+                output[position] = source[i];
+                position++;
+            }
+        }
+    }
+
+    errno = EIO;
+    return -1;
+}
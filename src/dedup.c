@@ -0,0 +1,262 @@
+#include "dedup.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_wrapper.h"
+
+#define DEDUP_BUFFER_SIZE (1 << 16)
+
+/* Regular file which can have duplicates.
+ */
+struct dedup_candidate
+{
+    struct file_data* file_data; // file entry
+    size_t index;                // index of entry in depth-first order
+    uint64_t hash; // content hash (calculated only for files with non-unique
+                   // size)
+};
+
+/* Growable array of deduplication candidates.
+ */
+struct dedup_candidate_list
+{
+    struct dedup_candidate* candidates;
+    size_t count;
+    size_t capacity;
+};
+
+/* Append non-empty regular files from file_data, following entries and all
+ * their descendants to list (except hard links, which already share content
+ * with their originals).
+ */
+static void
+collect_dedup_candidates(struct file_data* file_data,
+                         struct dedup_candidate_list* list,
+                         const struct program_parameters* program_parameters)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if (((current_file_data->file_mode & S_IFMT) != S_IFREG) ||
+            (current_file_data->file_size == 0) ||
+            (current_file_data->link_original != NULL))
+            continue;
+
+        if (list->count == list->capacity) {
+            const size_t new_capacity =
+              (list->capacity == 0) ? 64 : list->capacity * 2;
+            struct dedup_candidate* const new_candidates = realloc(
+              list->candidates, sizeof(struct dedup_candidate) * new_capacity);
+            if (new_candidates == NULL)
+                print_perror(program_parameters, "realloc() failed");
+            list->candidates = new_candidates;
+            list->capacity = new_capacity;
+        }
+        list->candidates[list->count].file_data = current_file_data;
+        list->candidates[list->count].index = list->count;
+        list->candidates[list->count].hash = 0;
+        list->count++;
+    }
+}
+
+/* Comparison function for qsort(), orders candidates by size and then by
+ * depth-first order.
+ */
+static int
+compare_by_size(const void* ptr1, const void* ptr2)
+{
+    const struct dedup_candidate* const candidate1 = ptr1;
+    const struct dedup_candidate* const candidate2 = ptr2;
+    if (candidate1->file_data->file_size != candidate2->file_data->file_size)
+        return (candidate1->file_data->file_size <
+                candidate2->file_data->file_size)
+                 ? -1
+                 : 1;
+    if (candidate1->index != candidate2->index)
+        return (candidate1->index < candidate2->index) ? -1 : 1;
+    return 0;
+}
+
+/* Comparison function for qsort(), orders candidates by hash and then by
+ * depth-first order.
+ */
+static int
+compare_by_hash(const void* ptr1, const void* ptr2)
+{
+    const struct dedup_candidate* const candidate1 = ptr1;
+    const struct dedup_candidate* const candidate2 = ptr2;
+    if (candidate1->hash != candidate2->hash)
+        return (candidate1->hash < candidate2->hash) ? -1 : 1;
+    if (candidate1->index != candidate2->index)
+        return (candidate1->index < candidate2->index) ? -1 : 1;
+    return 0;
+}
+
+uint64_t
+update_content_hash(uint64_t hash, const uint8_t* data, size_t size)
+{
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+        data += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    while (size > 0) {
+        hash = (hash ^ *data) * 0x100000001b3ULL;
+        data++;
+        size--;
+    }
+    return hash;
+}
+
+/* Calculate hash of content of file_data using buffer of DEDUP_BUFFER_SIZE
+ * bytes.
+ */
+static uint64_t
+hash_file_content(const struct file_data* file_data,
+                  uint8_t* buffer,
+                  const struct program_parameters* program_parameters)
+{
+    struct file_wrapper* const file = open_file_data(file_data, O_RDONLY);
+    if (file == NULL)
+        print_perror(program_parameters, "open_file_data() failed");
+
+    uint64_t hash = CONTENT_HASH_SEED;
+    size_t size = (size_t)file_data->file_size;
+    while (size > 0) {
+        const size_t portion_size =
+          (size < DEDUP_BUFFER_SIZE) ? size : DEDUP_BUFFER_SIZE;
+        if (file_read(file, buffer, portion_size) < 0)
+            print_perror(program_parameters, "file_read() failed");
+        hash = update_content_hash(hash, buffer, portion_size);
+        size -= portion_size;
+    }
+
+    if (file_close(file) < 0)
+        print_perror(program_parameters, "file_close() failed");
+
+    return hash;
+}
+
+/* Return 1 if contents of file_data1 and file_data2 (which should have the
+ * same size) are equal, 0 otherwise. Buffers should have DEDUP_BUFFER_SIZE
+ * bytes.
+ */
+static int
+compare_file_contents(const struct file_data* file_data1,
+                      const struct file_data* file_data2,
+                      uint8_t* buffer1,
+                      uint8_t* buffer2,
+                      const struct program_parameters* program_parameters)
+{
+    struct file_wrapper* const file1 = open_file_data(file_data1, O_RDONLY);
+    if (file1 == NULL)
+        print_perror(program_parameters, "open_file_data() failed");
+    struct file_wrapper* const file2 = open_file_data(file_data2, O_RDONLY);
+    if (file2 == NULL)
+        print_perror(program_parameters, "open_file_data() failed");
+
+    int result = 1;
+    size_t size = (size_t)file_data1->file_size;
+    while ((size > 0) && result) {
+        const size_t portion_size =
+          (size < DEDUP_BUFFER_SIZE) ? size : DEDUP_BUFFER_SIZE;
+        if ((file_read(file1, buffer1, portion_size) < 0) ||
+            (file_read(file2, buffer2, portion_size) < 0))
+            print_perror(program_parameters, "file_read() failed");
+        if (memcmp(buffer1, buffer2, portion_size) != 0)
+            result = 0;
+        size -= portion_size;
+    }
+
+    if ((file_close(file1) < 0) || (file_close(file2) < 0))
+        print_perror(program_parameters, "file_close() failed");
+
+    return result;
+}
+
+void
+deduplicate_content(struct file_data* file_data,
+                    const struct program_parameters* program_parameters)
+{
+    struct dedup_candidate_list list;
+    list.candidates = NULL;
+    list.count = 0;
+    list.capacity = 0;
+    collect_dedup_candidates(file_data, &list, program_parameters);
+
+    uint8_t* const buffer1 = malloc(DEDUP_BUFFER_SIZE);
+    uint8_t* const buffer2 = malloc(DEDUP_BUFFER_SIZE);
+    if ((buffer1 == NULL) || (buffer2 == NULL))
+        print_perror(program_parameters, "malloc() failed");
+
+    // Files with unique size can not have duplicates, so only files from
+    // groups of equal size are hashed
+    if (list.count > 0)
+        qsort(list.candidates,
+              list.count,
+              sizeof(struct dedup_candidate),
+              compare_by_size);
+
+    size_t duplicate_count = 0;
+    archive_ptr_t duplicate_size = 0;
+    size_t group_begin = 0;
+    while (group_begin < list.count) {
+        size_t group_end = group_begin + 1;
+        while ((group_end < list.count) &&
+               (list.candidates[group_end].file_data->file_size ==
+                list.candidates[group_begin].file_data->file_size))
+            group_end++;
+
+        struct dedup_candidate* const group = list.candidates + group_begin;
+        const size_t group_size = group_end - group_begin;
+        group_begin = group_end;
+        if (group_size < 2)
+            continue;
+
+        size_t i;
+        for (i = 0; i < group_size; i++)
+            group[i].hash = hash_file_content(
+              group[i].file_data, buffer1, program_parameters);
+        qsort(
+          group, group_size, sizeof(struct dedup_candidate), compare_by_hash);
+
+        // First entry (in depth-first order) with every hash keeps its
+        // content, so it is written before its duplicates
+        size_t original_index = 0;
+        for (i = 1; i < group_size; i++) {
+            if (group[i].hash != group[original_index].hash) {
+                original_index = i;
+                continue;
+            }
+            if (compare_file_contents(group[original_index].file_data,
+                                      group[i].file_data,
+                                      buffer1,
+                                      buffer2,
+                                      program_parameters)) {
+                group[i].file_data->content_original =
+                  group[original_index].file_data;
+                duplicate_count++;
+                duplicate_size += (archive_ptr_t)group[i].file_data->file_size;
+            }
+        }
+    }
+
+    print_info(program_parameters,
+               "Found %lu duplicate files (%lu bytes)\n",
+               duplicate_count,
+               duplicate_size);
+
+    free(buffer1);
+    free(buffer2);
+    free(list.candidates);
+}
@@ -0,0 +1,232 @@
+#include "encoding.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+byte_buffer_init(struct byte_buffer* buffer)
+{
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+void
+byte_buffer_free(struct byte_buffer* buffer)
+{
+    free(buffer->data);
+    byte_buffer_init(buffer);
+}
+
+int
+byte_buffer_reserve(struct byte_buffer* buffer, size_t size)
+{
+    if (size <= (buffer->capacity - buffer->size))
+        return 0;
+
+    size_t new_capacity = (buffer->capacity == 0) ? 256 : buffer->capacity;
+    while (new_capacity - buffer->size < size) {
+        if (new_capacity > (SIZE_MAX / 2)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        new_capacity *= 2;
+    }
+
+    uint8_t* const new_data = realloc(buffer->data, new_capacity);
+    if (new_data == NULL)
+        return -1;
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+
+    return 0;
+}
+
+int
+byte_buffer_put(struct byte_buffer* buffer, const void* data, size_t size)
+{
+    if (byte_buffer_reserve(buffer, size) < 0)
+        return -1;
+    if (size > 0)
+        memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
+}
+
+int
+byte_buffer_put_u8(struct byte_buffer* buffer, uint8_t value)
+{
+    return byte_buffer_put(buffer, &value, 1);
+}
+
+int
+byte_buffer_put_u32(struct byte_buffer* buffer, uint32_t value)
+{
+    uint8_t data[4];
+    store_u32(data, value);
+    return byte_buffer_put(buffer, data, 4);
+}
+
+int
+byte_buffer_put_u64(struct byte_buffer* buffer, uint64_t value)
+{
+    uint8_t data[8];
+    store_u64(data, value);
+    return byte_buffer_put(buffer, data, 8);
+}
+
+int
+byte_buffer_put_varint(struct byte_buffer* buffer, uint64_t value)
+{
+    uint8_t data[VARINT_MAX_SIZE];
+    size_t size = 0;
+    while (value >= 0x80) {
+        data[size] = (uint8_t)(value | 0x80);
+        value >>= 7;
+        size++;
+    }
+    data[size] = (uint8_t)value;
+    size++;
+    return byte_buffer_put(buffer, data, size);
+}
+
+int
+byte_buffer_put_svarint(struct byte_buffer* buffer, int64_t value)
+{
+    const uint64_t zigzag_value =
+      (((uint64_t)value) << 1) ^ ((value < 0) ? UINT64_MAX : 0);
+    return byte_buffer_put_varint(buffer, zigzag_value);
+}
+
+size_t
+varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+void
+store_u32(void* ptr, uint32_t value)
+{
+    uint8_t* const data = ptr;
+    unsigned int i;
+    for (i = 0; i < 4; i++)
+        data[i] = (uint8_t)(value >> (8 * i));
+}
+
+void
+store_u64(void* ptr, uint64_t value)
+{
+    uint8_t* const data = ptr;
+    unsigned int i;
+    for (i = 0; i < 8; i++)
+        data[i] = (uint8_t)(value >> (8 * i));
+}
+
+uint32_t
+load_u32(const void* ptr)
+{
+    const uint8_t* const data = ptr;
+    uint32_t value = 0;
+    unsigned int i;
+    for (i = 0; i < 4; i++)
+        value |= ((uint32_t)data[i]) << (8 * i);
+    return value;
+}
+
+uint64_t
+load_u64(const void* ptr)
+{
+    const uint8_t* const data = ptr;
+    uint64_t value = 0;
+    unsigned int i;
+    for (i = 0; i < 8; i++)
+        value |= ((uint64_t)data[i]) << (8 * i);
+    return value;
+}
+
+void
+byte_reader_init(struct byte_reader* reader, const void* data, size_t size)
+{
+    reader->data = data;
+    reader->size = size;
+    reader->position = 0;
+}
+
+const void*
+byte_reader_get(struct byte_reader* reader, size_t size)
+{
+    if (size > (reader->size - reader->position)) {
+        errno = EIO;
+        return NULL;
+    }
+    const void* const result = reader->data + reader->position;
+    reader->position += size;
+    return result;
+}
+
+int
+byte_reader_get_u8(struct byte_reader* reader, uint8_t* value)
+{
+    const uint8_t* const data = byte_reader_get(reader, 1);
+    if (data == NULL)
+        return -1;
+    *value = *data;
+    return 0;
+}
+
+int
+byte_reader_get_u32(struct byte_reader* reader, uint32_t* value)
+{
+    const void* const data = byte_reader_get(reader, 4);
+    if (data == NULL)
+        return -1;
+    *value = load_u32(data);
+    return 0;
+}
+
+int
+byte_reader_get_u64(struct byte_reader* reader, uint64_t* value)
+{
+    const void* const data = byte_reader_get(reader, 8);
+    if (data == NULL)
+        return -1;
+    *value = load_u64(data);
+    return 0;
+}
+
+int
+byte_reader_get_varint(struct byte_reader* reader, uint64_t* value)
+{
+    uint64_t result = 0;
+    unsigned int i;
+    for (i = 0; i < VARINT_MAX_SIZE; i++) {
+        if (reader->position >= reader->size)
+            break;
+        const uint8_t byte = reader->data[reader->position];
+        reader->position++;
+        result |= ((uint64_t)(byte & 0x7f)) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return 0;
+        }
+    }
+
+    errno = EIO;
+    return -1;
+}
+
+int
+byte_reader_get_svarint(struct byte_reader* reader, int64_t* value)
+{
+    uint64_t zigzag_value;
+    if (byte_reader_get_varint(reader, &zigzag_value) < 0)
+        return -1;
+    *value = (int64_t)((zigzag_value >> 1) ^ (~(zigzag_value & 1) + 1));
+    return 0;
+}
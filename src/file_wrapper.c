@@ -1,16 +1,24 @@
+#define _GNU_SOURCE
+
 #include "file_wrapper.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
 
 struct file_wrapper*
 file_open(const char* pathname, int flags)
 {
     const int fd = open(pathname, flags);
+    stats_add(STATS_OPEN_CALLS, 1);
     if (fd < 0)
         return NULL;
     struct file_wrapper* const result = malloc(sizeof(struct file_wrapper));
@@ -18,8 +26,17 @@ file_open(const char* pathname, int flags)
         return NULL;
     result->fd = fd;
     result->flags = flags;
+    result->mapping = NULL;
+    result->write_buffer = NULL;
+    result->write_buffer_capacity = 0;
+    result->write_buffer_size = 0;
+    result->read_buffer = NULL;
+    result->read_buffer_capacity = 0;
+    result->read_buffer_size = 0;
+    result->read_buffer_position = 0;
 
     struct stat stat_result;
+    stats_add(STATS_OTHER_CALLS, 1);
     if (fstat(result->fd, &stat_result) < 0) {
         free(result);
         return NULL;
@@ -27,6 +44,7 @@ file_open(const char* pathname, int flags)
     result->size = stat_result.st_size;
 
     const off_t position = lseek(result->fd, 0, SEEK_SET);
+    stats_add(STATS_OTHER_CALLS, 1);
     if (position < 0) {
         free(result);
         return NULL;
@@ -40,6 +58,7 @@ struct file_wrapper*
 file_open_with_mode(const char* pathname, int flags, mode_t mode)
 {
     const int fd = open(pathname, flags, mode);
+    stats_add(STATS_OPEN_CALLS, 1);
     if (fd < 0)
         return NULL;
     struct file_wrapper* const result = malloc(sizeof(struct file_wrapper));
@@ -47,8 +66,17 @@ file_open_with_mode(const char* pathname, int flags, mode_t mode)
         return NULL;
     result->fd = fd;
     result->flags = flags;
+    result->mapping = NULL;
+    result->write_buffer = NULL;
+    result->write_buffer_capacity = 0;
+    result->write_buffer_size = 0;
+    result->read_buffer = NULL;
+    result->read_buffer_capacity = 0;
+    result->read_buffer_size = 0;
+    result->read_buffer_position = 0;
 
     struct stat stat_result;
+    stats_add(STATS_OTHER_CALLS, 1);
     if (fstat(result->fd, &stat_result) < 0) {
         free(result);
         return NULL;
@@ -63,17 +91,200 @@ file_open_with_mode(const char* pathname, int flags, mode_t mode)
     return result;
 }
 
+struct file_wrapper*
+file_from_fd(int fd, int flags)
+{
+    struct file_wrapper* const result = malloc(sizeof(struct file_wrapper));
+    if (result == NULL)
+        return NULL;
+    result->fd = fd;
+    result->flags = flags;
+    result->mapping = NULL;
+    result->write_buffer = NULL;
+    result->write_buffer_capacity = 0;
+    result->write_buffer_size = 0;
+    result->read_buffer = NULL;
+    result->read_buffer_capacity = 0;
+    result->read_buffer_size = 0;
+    result->read_buffer_position = 0;
+
+    struct stat stat_result;
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (fstat(result->fd, &stat_result) < 0) {
+        free(result);
+        return NULL;
+    }
+    result->size = stat_result.st_size;
+
+    // Pipes and terminals do not have position
+    const off_t position = lseek(result->fd, 0, SEEK_CUR);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (position >= 0) {
+        result->position = position;
+    } else if (errno == ESPIPE) {
+        result->size = 0;
+        result->position = 0;
+    } else {
+        free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
 struct file_wrapper*
 file_creat(const char* pathname, mode_t mode)
 {
     return file_open_with_mode(pathname, O_WRONLY | O_CREAT | O_TRUNC, mode);
 }
 
+/* Write segments to file descriptor with writev() until all of them are
+ * written (segments are modified). First buffered_size bytes are data of
+ * write buffer, which is counted in STATS_WRITE_BYTES when it is buffered (so
+ * bytes are counted in phase which produced them). Return 0 on success, -1
+ * on error.
+ */
+static int
+write_segments(int fd, struct iovec* segments, int count, size_t buffered_size)
+{
+    while (count > 0) {
+        const ssize_t result = writev(fd, segments, count);
+        stats_add(STATS_WRITE_CALLS, 1);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        const size_t counted_size = ((size_t)result < buffered_size)
+                                      ? (size_t)result
+                                      : buffered_size;
+        buffered_size -= counted_size;
+        stats_add(STATS_WRITE_BYTES, (uint64_t)result - counted_size);
+
+        // Written segments are skipped, partially written one is advanced
+        size_t written_size = (size_t)result;
+        while ((count > 0) && (written_size >= segments->iov_len)) {
+            written_size -= segments->iov_len;
+            segments++;
+            count--;
+        }
+        if (count > 0) {
+            segments->iov_base = ((char*)segments->iov_base) + written_size;
+            segments->iov_len -= written_size;
+        }
+    }
+
+    return 0;
+}
+
+/* Write data from write buffer of file. Return 0 on success, -1 on error.
+ */
+static int
+flush_write_buffer(struct file_wrapper* file)
+{
+    if (file->write_buffer_size == 0)
+        return 0;
+
+    struct iovec segment;
+    segment.iov_base = file->write_buffer;
+    segment.iov_len = file->write_buffer_size;
+    if (write_segments(file->fd, &segment, 1, file->write_buffer_size) < 0)
+        return -1;
+    file->write_buffer_size = 0;
+
+    return 0;
+}
+
+/* Discard data in read buffer of file, moving file descriptor position back
+ * to current position. Return 0 on success, -1 on error.
+ */
+static int
+discard_read_buffer(struct file_wrapper* file)
+{
+    if (file->read_buffer_size == 0)
+        return 0;
+
+    if (file->position !=
+        file->read_buffer_position + (off_t)file->read_buffer_size) {
+        const off_t result = lseek(file->fd, file->position, SEEK_SET);
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (result < 0)
+            return -1;
+    }
+    file->read_buffer_size = 0;
+
+    return 0;
+}
+
+int
+file_flush(struct file_wrapper* file)
+{
+    if (file == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((flush_write_buffer(file) < 0) || (discard_read_buffer(file) < 0))
+        return -1;
+
+    return 0;
+}
+
+int
+file_set_write_buffer(struct file_wrapper* file, size_t capacity)
+{
+    if (file_flush(file) < 0)
+        return -1;
+
+    char* write_buffer = NULL;
+    if (capacity > 0) {
+        write_buffer = malloc(capacity);
+        if (write_buffer == NULL)
+            return -1;
+    }
+    free(file->write_buffer);
+    file->write_buffer = write_buffer;
+    file->write_buffer_capacity = capacity;
+
+    return 0;
+}
+
+int
+file_set_read_buffer(struct file_wrapper* file, size_t capacity)
+{
+    if (file_flush(file) < 0)
+        return -1;
+
+    char* read_buffer = NULL;
+    if (capacity > 0) {
+        read_buffer = malloc(capacity);
+        if (read_buffer == NULL)
+            return -1;
+    }
+    free(file->read_buffer);
+    file->read_buffer = read_buffer;
+    file->read_buffer_capacity = capacity;
+
+    return 0;
+}
+
 int
 file_close(struct file_wrapper* file)
 {
     if (file == NULL)
         return 0;
+    if (file_flush(file) < 0)
+        return -1;
+    free(file->write_buffer);
+    file->write_buffer = NULL;
+    free(file->read_buffer);
+    file->read_buffer = NULL;
+    if (file->mapping != NULL) {
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (munmap(file->mapping, (size_t)file->size) < 0)
+            return -1;
+        file->mapping = NULL;
+    }
+    stats_add(STATS_OTHER_CALLS, 1);
     const int result = close(file->fd);
     if (result < 0)
         return -1;
@@ -84,29 +295,126 @@ file_close(struct file_wrapper* file)
 int
 file_write(struct file_wrapper* file, const void* buf, size_t size)
 {
-    if (file == NULL) {
+    struct iovec segment;
+    segment.iov_base = (void*)buf;
+    segment.iov_len = size;
+    return file_writev(file, &segment, 1);
+}
+
+int
+file_writev(struct file_wrapper* file,
+            const struct iovec* segments,
+            int count)
+{
+    if ((file == NULL) || (count < 0) || (count > FILE_WRITEV_MAX_SEGMENTS)) {
         errno = EINVAL;
         return -1;
     }
+    if (discard_read_buffer(file) < 0)
+        return -1;
 
-    ssize_t result = 0;
-    while ((size_t)result < size) {
-        buf = (void*)(((char*)buf) + result);
+    size_t size = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        size += segments[i].iov_len;
+
+    if ((file->write_buffer != NULL) &&
+        (size <= file->write_buffer_capacity - file->write_buffer_size)) {
+        for (i = 0; i < count; i++) {
+            if (segments[i].iov_len == 0)
+                continue;
+            memcpy(file->write_buffer + file->write_buffer_size,
+                   segments[i].iov_base,
+                   segments[i].iov_len);
+            file->write_buffer_size += segments[i].iov_len;
+        }
+        stats_add(STATS_WRITE_BYTES, size);
+    } else {
+        // Buffered data goes first in the same writev() call
+        struct iovec all_segments[FILE_WRITEV_MAX_SEGMENTS + 1];
+        int all_count = 0;
+        if (file->write_buffer_size > 0) {
+            all_segments[0].iov_base = file->write_buffer;
+            all_segments[0].iov_len = file->write_buffer_size;
+            all_count++;
+        }
+        for (i = 0; i < count; i++) {
+            all_segments[all_count] = segments[i];
+            all_count++;
+        }
+        if (write_segments(
+              file->fd, all_segments, all_count, file->write_buffer_size) < 0)
+            return -1;
+        file->write_buffer_size = 0;
+    }
 
-        result = write(file->fd, buf, size);
+    file->position += (off_t)size;
+    if (file->position > file->size)
+        file->size = file->position;
 
-        if (result < 0)
-            return -1; // TODO: get file position data
+    return 0;
+}
+
+/* Read size bytes from file descriptor of file to buf at current position.
+ * Return 0 on success, -1 on error.
+ */
+static int
+read_unbuffered(struct file_wrapper* file, void* buf, size_t size)
+{
+    char* ptr = buf;
+    while (size > 0) {
+        const ssize_t result = read(file->fd, ptr, size);
+        stats_add(STATS_READ_CALLS, 1);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        stats_add(STATS_READ_BYTES, (uint64_t)result);
+        if (result == 0) {
+            // File is shorter than expected (probably truncated)
+            errno = EIO;
+            return -1;
+        }
 
+        ptr += result;
         size -= result;
         file->position += result;
-        if (file->position > file->size)
-            file->size = file->position;
     }
 
     return 0;
 }
 
+/* Fill read buffer of file with data from current position. Return 0 on
+ * success, -1 on error (also if there is no data left).
+ */
+static int
+fill_read_buffer(struct file_wrapper* file)
+{
+    if (discard_read_buffer(file) < 0)
+        return -1;
+
+    ssize_t result;
+    do {
+        result = read(file->fd, file->read_buffer, file->read_buffer_capacity);
+        stats_add(STATS_READ_CALLS, 1);
+    } while ((result < 0) && (errno == EINTR));
+    if (result < 0)
+        return -1;
+    stats_add(STATS_READ_BYTES, (uint64_t)result);
+    if (result == 0) {
+        // File is shorter than expected (probably truncated)
+        errno = EIO;
+        return -1;
+    }
+
+    file->read_buffer_position = file->position;
+    file->read_buffer_size = (size_t)result;
+
+    return 0;
+}
+
 int
 file_read(struct file_wrapper* file, void* buf, size_t size)
 {
@@ -115,17 +423,131 @@ file_read(struct file_wrapper* file, void* buf, size_t size)
         return -1;
     }
 
-    ssize_t result = 0;
-    while ((size_t)result < size) {
-        buf = (void*)(((char*)buf) + result);
+    if (file->mapping != NULL) {
+        const void* const data = file_get_data(file, file->position, size);
+        if (data == NULL)
+            return -1;
+        memcpy(buf, data, size);
+        file->position += size;
+        return 0;
+    }
 
-        result = read(file->fd, buf, size);
+    if (flush_write_buffer(file) < 0)
+        return -1;
+    if ((file->read_buffer == NULL) || (size >= file->read_buffer_capacity)) {
+        if (discard_read_buffer(file) < 0)
+            return -1;
+        return read_unbuffered(file, buf, size);
+    }
 
-        if (result < 0)
-            return -1; // TODO: get file position data
+    char* ptr = buf;
+    while (size > 0) {
+        const size_t offset =
+          (size_t)(file->position - file->read_buffer_position);
+        if ((file->read_buffer_size == 0) ||
+            (offset >= file->read_buffer_size)) {
+            if (fill_read_buffer(file) < 0)
+                return -1;
+            continue;
+        }
+
+        size_t portion_size = file->read_buffer_size - offset;
+        if (portion_size > size)
+            portion_size = size;
+        memcpy(ptr, file->read_buffer + offset, portion_size);
+        ptr += portion_size;
+        size -= portion_size;
+        file->position += (off_t)portion_size;
+    }
+
+    return 0;
+}
+
+int
+file_pwrite(struct file_wrapper* file,
+            const void* buf,
+            size_t size,
+            off_t position)
+{
+    if (file == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (file_flush(file) < 0)
+        return -1;
+
+    const char* ptr = buf;
+    while (size > 0) {
+        const ssize_t result = pwrite(file->fd, ptr, size, position);
+        stats_add(STATS_WRITE_CALLS, 1);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        stats_add(STATS_WRITE_BYTES, (uint64_t)result);
 
+        ptr += result;
         size -= result;
-        file->position += result;
+        position += result;
+    }
+
+    return 0;
+}
+
+int
+file_pread(struct file_wrapper* file, void* buf, size_t size, off_t position)
+{
+    if (file == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (file->mapping != NULL) {
+        const void* const data = file_get_data(file, position, size);
+        if (data == NULL)
+            return -1;
+        memcpy(buf, data, size);
+        return 0;
+    }
+
+    if ((file->read_buffer_size > 0) &&
+        (position >= file->read_buffer_position) &&
+        (size <= file->read_buffer_size) &&
+        ((size_t)(position - file->read_buffer_position) <=
+         file->read_buffer_size - size)) {
+        memcpy(buf,
+               file->read_buffer + (position - file->read_buffer_position),
+               size);
+        return 0;
+    }
+
+    // Read buffer stays valid, since file descriptor position is not changed
+    if (flush_write_buffer(file) < 0)
+        return -1;
+
+    char* ptr = buf;
+    while (size > 0) {
+        const ssize_t result = pread(file->fd, ptr, size, position);
+        stats_add(STATS_READ_CALLS, 1);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        stats_add(STATS_READ_BYTES, (uint64_t)result);
+        if (result == 0) {
+            // File is shorter than expected (probably truncated)
+            errno = EIO;
+            return -1;
+        }
+
+        ptr += result;
+        size -= result;
+        position += result;
     }
 
     return 0;
@@ -142,12 +564,26 @@ file_seek(struct file_wrapper* file, off_t position)
         errno = ERANGE;
         return -1;
     }
+    if ((file->read_buffer_size > 0) &&
+        (position >= file->read_buffer_position) &&
+        (position <=
+         file->read_buffer_position + (off_t)file->read_buffer_size)) {
+        file->position = position;
+        return 0;
+    }
+    if (file_flush(file) < 0)
+        return -1;
     if (file->flags & O_APPEND)
         return 0;
     if (position == file->position)
         return 0;
+    if (file->mapping != NULL) {
+        file->position = position;
+        return 0;
+    }
 
     const off_t result = lseek(file->fd, position, SEEK_SET);
+    stats_add(STATS_OTHER_CALLS, 1);
     if (result < 0)
         return -1;
     file->position = result;
@@ -162,7 +598,12 @@ file_fetch_position(struct file_wrapper* file)
         errno = EINVAL;
         return -1;
     }
+    if (file->mapping != NULL)
+        return 0;
+    if (file_flush(file) < 0)
+        return -1;
     const off_t result = lseek(file->fd, 0, SEEK_SET);
+    stats_add(STATS_OTHER_CALLS, 1);
     if (result < 0)
         return -1;
     file->position = result;
@@ -170,29 +611,384 @@ file_fetch_position(struct file_wrapper* file)
     return 0;
 }
 
+int
+file_find_data(struct file_wrapper* file,
+               off_t position,
+               off_t* data_start,
+               off_t* data_end)
+{
+    if ((file == NULL) || (file->mapping != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (file_flush(file) < 0)
+        return -1;
+
+    const off_t start = lseek(file->fd, position, SEEK_DATA);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (start < 0) {
+        // ENXIO means that there is no data after position
+        if (errno == ENXIO) {
+            errno = 0;
+            return 0;
+        }
+        return -1;
+    }
+    // End of file is hole too, so hole is always found
+    const off_t end = lseek(file->fd, start, SEEK_HOLE);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (end < 0)
+        return -1;
+
+    file->position = end;
+    *data_start = start;
+    *data_end = end;
+    return 1;
+}
+
+int
+file_truncate(struct file_wrapper* file, off_t size)
+{
+    if (file == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (file_flush(file) < 0)
+        return -1;
+
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (ftruncate(file->fd, size) < 0)
+        return -1;
+    file->size = size;
+
+    return 0;
+}
+
+int
+file_map(struct file_wrapper* file)
+{
+    if (file == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (file->mapping != NULL)
+        return 0;
+    if ((file->flags & O_ACCMODE) != O_RDONLY) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (file->size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* const mapping =
+      mmap(NULL, (size_t)file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (mapping == MAP_FAILED)
+        return -1;
+    file->mapping = mapping;
+
+    return 0;
+}
+
+const void*
+file_get_data(const struct file_wrapper* file, off_t position, size_t size)
+{
+    if ((file == NULL) || (file->mapping == NULL)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((position < 0) || (position > file->size) ||
+        (size > (size_t)(file->size - position))) {
+        // Reading beyond end of mapping would cause SIGBUS
+        errno = EIO;
+        return NULL;
+    }
+    stats_add(STATS_MAPPED_BYTES, size);
+
+    return ((const char*)file->mapping) + position;
+}
+
+/* Kernel copy engines which are known to be unsupported by running kernel.
+ * They are not tried again after first ENOSYS.
+ */
+static int copy_file_range_unsupported = 0;
+static int splice_unsupported = 0;
+
+/* Return 1 if errno after failed kernel-side copy means that other copy method
+ * should be tried, 0 if it is real I/O error.
+ */
+static int
+is_copy_fallback_error(int error)
+{
+    return (error == ENOSYS) || (error == EXDEV) || (error == EINVAL) ||
+           (error == EOPNOTSUPP) || (error == EBADF) || (error == ESPIPE);
+}
+
+/* Copy data with copy_file_range(). Offsets are used and updated if they are
+ * not NULL, otherwise file descriptor positions are used. Number of copied
+ * bytes is subtracted from value referenced by size_ptr. Return 0 on success,
+ * 1 if copy_file_range() can not be used for these files before anything was
+ * copied, -1 on error.
+ */
+static int
+copy_by_copy_file_range(int input_fd,
+                        off_t* input_offset,
+                        int output_fd,
+                        off_t* output_offset,
+                        size_t* size_ptr)
+{
+    if (__atomic_load_n(&copy_file_range_unsupported, __ATOMIC_RELAXED))
+        return 1;
+
+    int copied_any = 0;
+    while (*size_ptr > 0) {
+        const ssize_t result = copy_file_range(
+          input_fd, input_offset, output_fd, output_offset, *size_ptr, 0);
+        stats_add(STATS_COPY_CALLS, 1);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((!copied_any) && is_copy_fallback_error(errno)) {
+                if (errno == ENOSYS)
+                    __atomic_store_n(
+                      &copy_file_range_unsupported, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            // Input file is shorter than expected (probably truncated)
+            errno = EIO;
+            return -1;
+        }
+        copied_any = 1;
+        stats_add(STATS_COPY_BYTES, (uint64_t)result);
+        *size_ptr -= result;
+    }
+
+    return 0;
+}
+
+/* Copy data with sendfile() using file descriptor positions. Number of copied
+ * bytes is subtracted from value referenced by size_ptr. Return 0 on success,
+ * 1 if sendfile() can not be used for these files before anything was copied,
+ * -1 on error.
+ */
+static int
+copy_by_sendfile(int input_fd, int output_fd, size_t* size_ptr)
+{
+    int copied_any = 0;
+    while (*size_ptr > 0) {
+        const ssize_t result = sendfile(output_fd, input_fd, NULL, *size_ptr);
+        stats_add(STATS_COPY_CALLS, 1);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((!copied_any) && is_copy_fallback_error(errno))
+                return 1;
+            return -1;
+        }
+        if (result == 0) {
+            errno = EIO;
+            return -1;
+        }
+        copied_any = 1;
+        stats_add(STATS_COPY_BYTES, (uint64_t)result);
+        *size_ptr -= result;
+    }
+
+    return 0;
+}
+
+/* Copy data with splice() using file descriptor positions (one of files
+ * should be pipe). Number of copied bytes is subtracted from value referenced
+ * by size_ptr. Return 0 on success, 1 if splice() can not be used for these
+ * files before anything was copied, -1 on error.
+ */
+static int
+copy_by_splice(int input_fd, int output_fd, size_t* size_ptr)
+{
+    if (__atomic_load_n(&splice_unsupported, __ATOMIC_RELAXED))
+        return 1;
+
+    int copied_any = 0;
+    while (*size_ptr > 0) {
+        const ssize_t result =
+          splice(input_fd, NULL, output_fd, NULL, *size_ptr, SPLICE_F_MOVE);
+        stats_add(STATS_COPY_CALLS, 1);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((!copied_any) && is_copy_fallback_error(errno)) {
+                if (errno == ENOSYS)
+                    __atomic_store_n(&splice_unsupported, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            errno = EIO;
+            return -1;
+        }
+        copied_any = 1;
+        stats_add(STATS_COPY_BYTES, (uint64_t)result);
+        *size_ptr -= result;
+    }
+
+    return 0;
+}
+
 int
 file_cat(struct file_wrapper* input_file,
          struct file_wrapper* output_file,
          size_t size,
          size_t buffer_size)
 {
+    if ((input_file == NULL) || (output_file == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (input_file->mapping != NULL) {
+        // Data is written directly from mapping without extra copying
+        const void* const data =
+          file_get_data(input_file, input_file->position, size);
+        if ((data == NULL) || (file_write(output_file, data, size) < 0))
+            return -1;
+        input_file->position += size;
+        return 0;
+    }
+
+    if ((output_file->write_buffer != NULL) &&
+        (size <= output_file->write_buffer_capacity / 2)) {
+        // Small content is read directly to write buffer, so it is written
+        // together with data around it
+        if ((output_file->write_buffer_capacity -
+             output_file->write_buffer_size) < size) {
+            if (file_flush(output_file) < 0)
+                return -1;
+        }
+        if (file_read(input_file,
+                      output_file->write_buffer +
+                        output_file->write_buffer_size,
+                      size) < 0)
+            return -1;
+        output_file->write_buffer_size += size;
+        stats_add(STATS_WRITE_BYTES, size);
+        output_file->position += (off_t)size;
+        if (output_file->position > output_file->size)
+            output_file->size = output_file->position;
+        return 0;
+    }
+
+    if ((file_flush(input_file) < 0) || (file_flush(output_file) < 0))
+        return -1;
+
+    // Kernel-side copy engines are tried first, from fastest to slowest. Each
+    // of them returns 1 only if nothing was copied, so file positions are
+    // updated from size difference.
+    size_t remaining_size = size;
+    int result = copy_by_copy_file_range(
+      input_file->fd, NULL, output_file->fd, NULL, &remaining_size);
+    if (result == 1)
+        result = copy_by_sendfile(
+          input_file->fd, output_file->fd, &remaining_size);
+    if (result == 1)
+        result =
+          copy_by_splice(input_file->fd, output_file->fd, &remaining_size);
+
+    input_file->position += (off_t)(size - remaining_size);
+    output_file->position += (off_t)(size - remaining_size);
+    if (output_file->position > output_file->size)
+        output_file->size = output_file->position;
+
+    if (result <= 0)
+        return result;
+
+    // Buffered copy through user space
     char* const buffer = malloc(buffer_size);
     if (buffer == NULL)
         return -1;
-    unsigned int portion_size = buffer_size;
+    size_t portion_size = buffer_size;
+
+    while (remaining_size > 0) {
+        if (remaining_size < buffer_size) {
+            portion_size = remaining_size;
+        }
+        if ((file_read(input_file, buffer, portion_size) < 0) ||
+            (file_write(output_file, buffer, portion_size) < 0)) {
+            free(buffer);
+            return -1;
+        }
+        remaining_size -= portion_size;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+int
+file_cat_at(struct file_wrapper* input_file,
+            off_t input_position,
+            struct file_wrapper* output_file,
+            off_t output_position,
+            size_t size,
+            size_t buffer_size)
+{
+    if ((input_file == NULL) || (output_file == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (input_file->mapping != NULL) {
+        // Data is written directly from mapping without extra copying
+        const void* const data =
+          file_get_data(input_file, input_position, size);
+        if ((data == NULL) ||
+            (file_pwrite(output_file, data, size, output_position) < 0))
+            return -1;
+        return 0;
+    }
+
+    // Data read ahead from input_file stays valid, since its file descriptor
+    // position is not changed
+    if ((flush_write_buffer(input_file) < 0) || (file_flush(output_file) < 0))
+        return -1;
+
+    // Only copy_file_range() supports explicit offsets for both files, so it
+    // is the only kernel-side engine usable without changing file positions
+    const int result = copy_by_copy_file_range(input_file->fd,
+                                               &input_position,
+                                               output_file->fd,
+                                               &output_position,
+                                               &size);
+    if (result <= 0)
+        return result;
+
+    // Buffered copy through user space
+    char* const buffer = malloc(buffer_size);
+    if (buffer == NULL)
+        return -1;
+    size_t portion_size = buffer_size;
 
     while (size > 0) {
         if (size < buffer_size) {
             portion_size = size;
         }
-        if (file_read(input_file, buffer, portion_size) < 0)
-            return -1;
-        if (file_write(output_file, buffer, portion_size) < 0)
+        if ((file_pread(input_file, buffer, portion_size, input_position) <
+             0) ||
+            (file_pwrite(output_file, buffer, portion_size, output_position) <
+             0)) {
+            free(buffer);
             return -1;
+        }
+        input_position += portion_size;
+        output_position += portion_size;
         size -= portion_size;
     }
 
     free(buffer);
     return 0;
 }
-
@@ -1,8 +1,13 @@
+#define _GNU_SOURCE
+
 #include "listdir.h"
 
+#include <dirent.h>
 #include <fcntl.h>
-#include <fts.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -12,155 +17,902 @@
 #include <string.h>
 
 #include "archive.h"
+#include "codec.h"
+#include "parallel.h"
 #include "program_options.h"
+#include "stats.h"
 #include "util.h"
 
 struct file_data*
-list_directory_by_fts(FTS* ftsp,
-                      const struct program_parameters* program_parameters)
+create_file_data(const char* name,
+                 struct file_data* parent,
+                 struct arena* arena,
+                 const struct program_parameters* program_parameters)
 {
-    struct file_data* first_file_data = NULL;
-    struct file_data* current_file_data = NULL;
+    struct file_data* const data = arena_alloc(arena, sizeof(struct file_data));
+    if (data == NULL)
+        print_perror(program_parameters, "arena_alloc() failed");
 
-    while (1) {
-        FTSENT* const ftsent = fts_read(ftsp);
+    data->file_name = arena_copy_string(arena, name);
+    if (data->file_name == NULL)
+        print_perror(program_parameters, "arena_copy_string() failed");
+    data->root_path = NULL;
+    data->file_mode = 0;
+    data->file_size = 0;
+    data->st_atim.tv_sec = 0;
+    data->st_atim.tv_nsec = 0;
+    data->st_mtim = data->st_atim;
+    data->st_ctim = data->st_atim;
+    data->symlink_target = NULL;
+    data->parent = parent;
+    data->next = NULL;
+    data->first_child = NULL;
+    data->archive_position = 0;
+    data->archive_content_position = 0;
+    data->archive_children_size = 0;
+    data->content_codec = CODEC_NONE;
+    data->archive_content_size = 0;
+    data->content_original = NULL;
+    data->link_original = NULL;
+    data->inline_content = NULL;
+    data->base_archive = NULL;
+    data->base_content_position = 0;
+    data->base_content_size = 0;
+    data->has_content_checksum = 0;
+    data->content_checksum = 0;
+    data->arena = NULL;
 
-        if (ftsent == NULL) {
-            if (errno != 0)
-                print_perror(program_parameters, "fts_read() failed");
-            break;
-        }
+    return data;
+}
+
+struct file_data*
+set_directory_tree_arena(struct file_data* file_data, struct arena* arena)
+{
+    if (file_data == NULL)
+        arena_free(arena);
+    else
+        file_data->arena = arena;
+    return file_data;
+}
 
-        if (ftsent->fts_errno != 0) {
-            errno = ftsent->fts_errno;
-            print_perror(program_parameters, "fts_read() failed");
+size_t
+get_file_path(const struct file_data* file_data,
+              const char* prefix,
+              char* buffer,
+              size_t buffer_size)
+{
+    // Length is calculated first, so path can be written from its end
+    const size_t prefix_length = (prefix != NULL) ? strlen(prefix) + 1 : 0;
+    size_t length = prefix_length;
+    const struct file_data* current_file_data;
+    for (current_file_data = file_data; current_file_data->parent != NULL;
+         current_file_data = current_file_data->parent)
+        length += strlen(current_file_data->file_name) + 1;
+    const char* const root_path = (current_file_data->root_path != NULL)
+                                    ? current_file_data->root_path
+                                    : current_file_data->file_name;
+    const size_t root_path_length = strlen(root_path);
+    length += root_path_length;
+
+    if (length >= buffer_size) {
+        if (buffer_size > 0) {
+            strncpy(buffer, file_data->file_name, buffer_size - 1);
+            buffer[buffer_size - 1] = '\0';
         }
+        return length;
+    }
 
-        if (ftsent->fts_info == FTS_DP) {
-            break;
+    size_t position = length;
+    buffer[position] = '\0';
+    for (current_file_data = file_data; current_file_data->parent != NULL;
+         current_file_data = current_file_data->parent) {
+        const size_t name_length = strlen(current_file_data->file_name);
+        position -= name_length;
+        memcpy(buffer + position, current_file_data->file_name, name_length);
+        position--;
+        buffer[position] = '/';
+    }
+    memcpy(buffer + prefix_length, root_path, root_path_length);
+    if (prefix != NULL) {
+        memcpy(buffer, prefix, prefix_length - 1);
+        buffer[prefix_length - 1] = '/';
+    }
+
+    return length;
+}
+
+struct file_wrapper*
+open_file_data(const struct file_data* file_data, int flags)
+{
+    char path[FILE_PATH_BUFFER_SIZE];
+    if (get_file_path(file_data, NULL, path, sizeof(path)) >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return file_open(path, flags);
+}
+
+void
+print_file_info(const struct program_parameters* program_parameters,
+                const char* message,
+                const struct file_data* file_data)
+{
+    if (program_parameters->verbosity != VERBOSITY_VERBOSE)
+        return;
+    char path[FILE_PATH_BUFFER_SIZE];
+    get_file_path(file_data, NULL, path, sizeof(path));
+    print_info(program_parameters, message, path);
+}
+
+void
+print_file_error(const struct program_parameters* program_parameters,
+                 const char* message,
+                 const struct file_data* file_data)
+{
+    char path[FILE_PATH_BUFFER_SIZE];
+    get_file_path(file_data, NULL, path, sizeof(path));
+    print_error(program_parameters, message, path);
+}
+
+void
+directory_walk_start(struct directory_walk* walk,
+                     const struct file_data* file_data)
+{
+    walk->file_data = (struct file_data*)file_data;
+    walk->depth = 0;
+    walk->is_leaving = 0;
+}
+
+void
+directory_walk_next(struct directory_walk* walk)
+{
+    struct file_data* const current_file_data = walk->file_data;
+    if (((current_file_data->file_mode & S_IFMT) == S_IFDIR) &&
+        !walk->is_leaving) {
+        if (current_file_data->first_child != NULL) {
+            walk->file_data = current_file_data->first_child;
+            walk->depth++;
+        } else {
+            walk->is_leaving = 1;
         }
+        return;
+    }
 
-        if (check_file_mode(ftsent->fts_statp->st_mode) < 0)
-            continue;
-        if ((program_parameters->symlink_mode == SYMLINK_MODE_IGNORE) &&
-            ((ftsent->fts_statp->st_mode & S_IFMT) == S_IFLNK))
-            continue;
+    if (current_file_data->next != NULL) {
+        walk->file_data = current_file_data->next;
+        walk->is_leaving = 0;
+    } else if (walk->depth > 0) {
+        walk->file_data = current_file_data->parent;
+        walk->depth--;
+        walk->is_leaving = 1;
+    } else {
+        walk->file_data = NULL;
+    }
+}
+
+/* Read target of symlink name in directory dirfd (or path related to current
+ * directory if dirfd is AT_FDCWD) to arena and return it.
+ */
+static char*
+read_symlink_target(int dirfd,
+                    const char* name,
+                    struct arena* arena,
+                    const struct program_parameters* program_parameters)
+{
+    // Symlink targets are limited to PATH_MAX bytes with terminating null
+    // character by kernel
+    char buffer[PATH_MAX];
+    const ssize_t length = readlinkat(dirfd, name, buffer, sizeof(buffer));
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (length < 0)
+        print_perror(program_parameters, "readlinkat() failed");
+    if ((size_t)length >= sizeof(buffer)) {
+        errno = ENAMETOOLONG;
+        print_perror(program_parameters, "readlinkat() failed");
+    }
+    buffer[length] = '\0';
+
+    char* const target = arena_copy_string(arena, buffer);
+    if (target == NULL)
+        print_perror(program_parameters, "arena_copy_string() failed");
+    return target;
+}
+
+/* Directory entry returned by getdents64() system call (glibc has no wrapper
+ * for it before version 2.30).
+ */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* Size of buffer for getdents64() results.
+ */
+#define SCAN_BUFFER_SIZE (64 * 1024)
+
+/* Fields of statx() result needed for file_data.
+ */
+#define SCAN_STATX_MASK                                                        \
+    (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_ATIME | STATX_MTIME |        \
+     STATX_CTIME | STATX_BLOCKS | STATX_INO | STATX_NLINK)
+
+/* Maximum number of queued directories opened in advance. Directories are
+ * opened relative to their parents while parents are read, so kernel does not
+ * resolve all components of their paths again, but descriptors are limited,
+ * so directories queued above this number (or above quarter of descriptor
+ * limit of process) are opened by path later.
+ */
+#define SCAN_MAX_OPEN_DIRECTORIES 512
+
+/* Directory queued for reading.
+ */
+struct scan_item
+{
+    struct file_data* directory;
+    int dirfd; // descriptor of directory opened for reading (-1 if it should
+               // be opened by path)
+};
+
+/* Queue of directories to be read by one scanning worker. Owner takes
+ * directories from its end (so it goes deep first and queue stays short),
+ * other workers steal them from its beginning.
+ */
+struct scan_queue
+{
+    pthread_mutex_t mutex;
+    struct scan_item* directories; // array of queued directories
+    size_t begin;    // index of first queued directory
+    size_t end;      // index after last queued directory
+    size_t capacity; // allocated size of directories array
+};
+
+/* Regular file having several hard links, which can be link to other file
+ * of directory tree.
+ */
+struct scan_link
+{
+    uint64_t device;             // device of file (major and minor numbers)
+    uint64_t inode;              // inode number of file
+    struct file_data* file_data; // file entry
+    size_t index;                // index of entry in depth-first order
+};
+
+/* Growable array of files with several hard links.
+ */
+struct scan_link_list
+{
+    struct scan_link* links;
+    size_t count;
+    size_t capacity;
+};
+
+/* Data of one scanning worker.
+ */
+struct scan_worker
+{
+    struct scan_queue queue;
+    struct arena* arena;         // arena for entries read by worker
+    struct scan_link_list links; // files with several hard links read by
+                                 // worker
+};
+
+/* Shared state of scanning workers.
+ */
+struct scan_state
+{
+    struct scan_worker* workers;
+    unsigned int worker_count;
+    size_t pending_count; // number of directories queued or being read
+                          // (updated atomically), scan is finished when it
+                          // drops to 0
+    unsigned int open_count; // number of queued directories opened in
+                             // advance (updated atomically)
+    unsigned int max_open_count; // limit of open_count
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    unsigned int idle_count;   // number of workers looking for directories
+                               // to steal (updated atomically)
+    unsigned int work_version; // incremented (under idle_mutex) when idle
+                               // workers should look for directories again
+    const struct program_parameters* program_parameters;
+};
+
+/* Wake up idle workers (if there are any when force is 0).
+ */
+static void
+wake_scan_workers(struct scan_state* state, int force)
+{
+    if (!force &&
+        (__atomic_load_n(&(state->idle_count), __ATOMIC_SEQ_CST) == 0))
+        return;
+    pthread_mutex_lock(&(state->idle_mutex));
+    state->work_version++;
+    pthread_cond_broadcast(&(state->idle_cond));
+    pthread_mutex_unlock(&(state->idle_mutex));
+}
+
+/* Add directory to queue of worker with worker_index. dirfd is descriptor of
+ * opened directory (-1 if it is not opened).
+ */
+static void
+push_scan_directory(struct scan_state* state,
+                    unsigned int worker_index,
+                    struct file_data* directory,
+                    int dirfd)
+{
+    __atomic_add_fetch(&(state->pending_count), 1, __ATOMIC_SEQ_CST);
 
-        struct file_data* const data = malloc(sizeof(struct file_data));
-        if (data == NULL)
-            print_perror(program_parameters, "malloc() failed");
-
-        data->archive_position = 0;
-        data->archive_content_position = 0;
-        data->first_child = NULL;
-        data->next = NULL;
-        data->symlink_target = NULL;
-        data->st_atim = ftsent->fts_statp->st_atim;
-        data->st_mtim = ftsent->fts_statp->st_mtim;
-        data->st_ctim = ftsent->fts_statp->st_ctim;
-        data->file_name = str_create_copy(ftsent->fts_name);
-        if (data->file_name == NULL)
-            print_perror(program_parameters, "str_create_copy() failed");
-        data->file_mode = ftsent->fts_statp->st_mode;
-        data->file_size = ftsent->fts_statp->st_size;
-        data->file_access_path = str_create_copy(ftsent->fts_path);
-        if (data->file_name == NULL)
-            print_perror(program_parameters, "str_create_copy() failed");
-
-        if (ftsent->fts_info == FTS_D) {
-            data->first_child = list_directory_by_fts(ftsp, program_parameters);
-        } else if (ftsent->fts_info == FTS_SL) {
-            char* symlink_target =
-              do_readlinkat(AT_FDCWD, data->file_access_path);
-            if (symlink_target == NULL)
-                print_perror(program_parameters, "do_readlinkat() failed");
-            data->symlink_target = symlink_target;
-            data->file_size = strlen(symlink_target) + 1;
+    struct scan_queue* const queue = &(state->workers[worker_index].queue);
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->end == queue->capacity) {
+        if (queue->begin > 0) {
+            memmove(queue->directories,
+                    queue->directories + queue->begin,
+                    (queue->end - queue->begin) * sizeof(struct scan_item));
+            queue->end -= queue->begin;
+            queue->begin = 0;
+        } else {
+            const size_t capacity =
+              (queue->capacity > 0) ? queue->capacity * 2 : 64;
+            struct scan_item* const directories = realloc(
+              queue->directories, capacity * sizeof(struct scan_item));
+            if (directories == NULL)
+                print_perror(state->program_parameters, "realloc() failed");
+            queue->directories = directories;
+            queue->capacity = capacity;
         }
+    }
+    queue->directories[queue->end].directory = directory;
+    queue->directories[queue->end].dirfd = dirfd;
+    queue->end++;
+    pthread_mutex_unlock(&(queue->mutex));
 
-        if (first_file_data == NULL) {
-            first_file_data = data;
-            current_file_data = data;
+    wake_scan_workers(state, 0);
+}
+
+/* Take directory from end (if is_owner is 1) or beginning of queue to item.
+ * Return 1 if directory is taken, 0 if queue is empty.
+ */
+static int
+pop_scan_directory(struct scan_queue* queue,
+                   int is_owner,
+                   struct scan_item* item)
+{
+    int is_taken = 0;
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->begin < queue->end) {
+        if (is_owner) {
+            queue->end--;
+            *item = queue->directories[queue->end];
         } else {
-            if (current_file_data != NULL) {
-                current_file_data->next = data;
-            }
-            current_file_data = data;
+            *item = queue->directories[queue->begin];
+            queue->begin++;
+        }
+        is_taken = 1;
+        if (queue->begin == queue->end) {
+            queue->begin = 0;
+            queue->end = 0;
         }
     }
+    pthread_mutex_unlock(&(queue->mutex));
+    return is_taken;
+}
+
+/* Take next directory to read by worker with worker_index to item: from its
+ * own queue or stolen from other workers. Wait if there are none but
+ * directories are still being read. Return 0 when scan is finished, 1
+ * otherwise.
+ */
+static int
+take_scan_directory(struct scan_state* state,
+                    unsigned int worker_index,
+                    struct scan_item* item)
+{
+    int is_taken =
+      pop_scan_directory(&(state->workers[worker_index].queue), 1, item);
 
-    return first_file_data;
+    while (!is_taken) {
+        // Worker is counted as idle before looking at queues, so directory
+        // pushed after it looked at their queue wakes it up
+        pthread_mutex_lock(&(state->idle_mutex));
+        const unsigned int work_version = state->work_version;
+        __atomic_add_fetch(&(state->idle_count), 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(state->idle_mutex));
+
+        unsigned int i;
+        for (i = 1; (i < state->worker_count) && !is_taken; i++)
+            is_taken = pop_scan_directory(
+              &(state->workers[(worker_index + i) % state->worker_count].queue),
+              0,
+              item);
+
+        pthread_mutex_lock(&(state->idle_mutex));
+        if (!is_taken)
+            while (
+              (work_version == state->work_version) &&
+              (__atomic_load_n(&(state->pending_count), __ATOMIC_SEQ_CST) > 0))
+                pthread_cond_wait(&(state->idle_cond), &(state->idle_mutex));
+        __atomic_sub_fetch(&(state->idle_count), 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(state->idle_mutex));
+
+        if (!is_taken &&
+            (__atomic_load_n(&(state->pending_count), __ATOMIC_SEQ_CST) == 0))
+            break;
+    }
+
+    return is_taken;
+}
+
+/* Fill file_data with results of statx() and set content codec for
+ * non-empty regular files (sparse files, which take less blocks than their
+ * size, are stored without holes).
+ */
+static void
+set_file_data_stat(struct file_data* file_data,
+                   const struct statx* stat_buffer,
+                   const struct program_parameters* program_parameters)
+{
+    file_data->file_mode = stat_buffer->stx_mode;
+    file_data->file_size = (off_t)stat_buffer->stx_size;
+    file_data->st_atim.tv_sec = stat_buffer->stx_atime.tv_sec;
+    file_data->st_atim.tv_nsec = stat_buffer->stx_atime.tv_nsec;
+    file_data->st_mtim.tv_sec = stat_buffer->stx_mtime.tv_sec;
+    file_data->st_mtim.tv_nsec = stat_buffer->stx_mtime.tv_nsec;
+    file_data->st_ctim.tv_sec = stat_buffer->stx_ctime.tv_sec;
+    file_data->st_ctim.tv_nsec = stat_buffer->stx_ctime.tv_nsec;
+
+    if (((file_data->file_mode & S_IFMT) == S_IFREG) &&
+        (file_data->file_size > 0)) {
+        if (program_parameters->skip_holes &&
+            (stat_buffer->stx_mask & STATX_BLOCKS) &&
+            (stat_buffer->stx_blocks * 512 < stat_buffer->stx_size))
+            file_data->content_codec = CODEC_SPARSE;
+        else
+            file_data->content_codec = program_parameters->chunk_content
+                                         ? CODEC_CHUNKED
+                                         : program_parameters->content_codec;
+    }
+}
+
+/* Append link to list.
+ */
+static void
+append_scan_link(struct scan_link_list* list,
+                 const struct scan_link* link,
+                 const struct program_parameters* program_parameters)
+{
+    if (list->count == list->capacity) {
+        const size_t new_capacity =
+          (list->capacity == 0) ? 16 : list->capacity * 2;
+        struct scan_link* const new_links =
+          realloc(list->links, sizeof(struct scan_link) * new_capacity);
+        if (new_links == NULL)
+            print_perror(program_parameters, "realloc() failed");
+        list->links = new_links;
+        list->capacity = new_capacity;
+    }
+    list->links[list->count] = *link;
+    list->count++;
+}
+
+/* Add file_data to list if it is regular file with several hard links (and
+ * hard links are preserved).
+ */
+static void
+add_scan_link(struct scan_link_list* list,
+              struct file_data* file_data,
+              const struct statx* stat_buffer,
+              const struct program_parameters* program_parameters)
+{
+    if (!program_parameters->preserve_hardlinks ||
+        ((file_data->file_mode & S_IFMT) != S_IFREG) ||
+        ((stat_buffer->stx_mask & (STATX_INO | STATX_NLINK)) !=
+         (STATX_INO | STATX_NLINK)) ||
+        (stat_buffer->stx_nlink < 2))
+        return;
+
+    struct scan_link link;
+    link.device = (((uint64_t)stat_buffer->stx_dev_major) << 32) |
+                  stat_buffer->stx_dev_minor;
+    link.inode = stat_buffer->stx_ino;
+    link.file_data = file_data;
+    link.index = 0;
+    append_scan_link(list, &link, program_parameters);
+}
+
+/* Comparison function for qsort(), orders links by device, inode and then
+ * by depth-first order.
+ */
+static int
+compare_scan_links(const void* ptr1, const void* ptr2)
+{
+    const struct scan_link* const link1 = ptr1;
+    const struct scan_link* const link2 = ptr2;
+    if (link1->device != link2->device)
+        return (link1->device < link2->device) ? -1 : 1;
+    if (link1->inode != link2->inode)
+        return (link1->inode < link2->inode) ? -1 : 1;
+    if (link1->index != link2->index)
+        return (link1->index < link2->index) ? -1 : 1;
+    return 0;
+}
+
+/* Set link_original and content_original of files from list (read from
+ * directory tree file_data) which are links to the same inode as earlier
+ * (in depth-first order) file.
+ */
+static void
+assign_link_originals(struct file_data* file_data,
+                      struct scan_link_list* list,
+                      const struct program_parameters* program_parameters)
+{
+    if (list->count == 0)
+        return;
+
+    // Workers read directories in any order, so depth-first indexes are
+    // found by walk over tree. Archive positions are not assigned yet, so
+    // they temporarily mark entries from list (by list index + 1).
+    size_t i;
+    for (i = 0; i < list->count; i++)
+        list->links[i].file_data->archive_position = i + 1;
+    size_t index = 0;
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving || (walk.file_data->archive_position == 0))
+            continue;
+        list->links[walk.file_data->archive_position - 1].index = index;
+        walk.file_data->archive_position = 0;
+        index++;
+    }
+
+    qsort(
+      list->links, list->count, sizeof(struct scan_link), compare_scan_links);
+
+    size_t link_count = 0;
+    size_t original_index = 0;
+    for (i = 1; i < list->count; i++) {
+        const struct scan_link* const original = &(list->links[original_index]);
+        if ((list->links[i].device != original->device) ||
+            (list->links[i].inode != original->inode)) {
+            original_index = i;
+            continue;
+        }
+        list->links[i].file_data->link_original = original->file_data;
+        list->links[i].file_data->content_original = original->file_data;
+        link_count++;
+    }
+
+    print_info(program_parameters, "Found %lu hard links\n", link_count);
 }
 
-int
-fts_compare_function(const FTSENT** file1, const FTSENT** file2)
+/* Return 1 if directory entry of given d_type should be skipped without
+ * calling statx(), 0 otherwise.
+ */
+static int
+skip_directory_entry_type(unsigned char type,
+                          const struct program_parameters* program_parameters)
 {
-    if ((file1 == NULL) && (file2 == NULL))
+    if ((type == DT_UNKNOWN) || (type == DT_REG) || (type == DT_DIR))
         return 0;
-    if (file1 == NULL)
-        return 1;
-    if (file2 == NULL)
+    if (type == DT_LNK)
+        return program_parameters->symlink_mode == SYMLINK_MODE_IGNORE;
+    return 1;
+}
+
+/* Open subdirectory name of directory dirfd for reading unless
+ * state->max_open_count queued directories are already opened. Return its
+ * descriptor or -1 if it should be opened by path (errors are reported
+ * then).
+ */
+static int
+open_scan_subdirectory(struct scan_state* state, int dirfd, const char* name)
+{
+    if (__atomic_add_fetch(&(state->open_count), 1, __ATOMIC_SEQ_CST) >
+        state->max_open_count) {
+        __atomic_sub_fetch(&(state->open_count), 1, __ATOMIC_SEQ_CST);
         return -1;
-    if ((*file1)->fts_number == ((*file2)->fts_number))
-        return 0;
-    return ((*file1)->fts_number > ((*file2)->fts_number)) ? 1 : -1;
+    }
+    const int subdirectory_fd =
+      openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    stats_add(STATS_OPEN_CALLS, 1);
+    if (subdirectory_fd < 0)
+        __atomic_sub_fetch(&(state->open_count), 1, __ATOMIC_SEQ_CST);
+    return subdirectory_fd;
 }
 
-struct file_data*
-list_directory(char* const* root_paths,
-               const struct program_parameters* program_parameters)
+/* Read entries of directory of item, add them as its children in order
+ * returned by getdents64() (so tree does not depend on number of workers) and
+ * push its subdirectories to queue of worker with worker_index.
+ */
+static void
+scan_directory(struct scan_state* state,
+               unsigned int worker_index,
+               const struct scan_item* item,
+               char* buffer)
+{
+    const struct program_parameters* const program_parameters =
+      state->program_parameters;
+    struct arena* const arena = state->workers[worker_index].arena;
+    struct file_data* const directory = item->directory;
+
+    int dirfd = item->dirfd;
+    if (dirfd >= 0) {
+        __atomic_sub_fetch(&(state->open_count), 1, __ATOMIC_SEQ_CST);
+    } else {
+        char path[FILE_PATH_BUFFER_SIZE];
+        if (get_file_path(directory, NULL, path, sizeof(path)) >=
+            sizeof(path)) {
+            errno = ENAMETOOLONG;
+            print_perror(program_parameters, "openat() failed");
+        }
+        dirfd = openat(
+          AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        stats_add(STATS_OPEN_CALLS, 1);
+        if (dirfd < 0)
+            print_perror(program_parameters, "openat() failed");
+    }
+
+    struct file_data* last_file_data = NULL;
+    while (1) {
+        const long size =
+          syscall(SYS_getdents64, dirfd, buffer, SCAN_BUFFER_SIZE);
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (size < 0)
+            print_perror(program_parameters, "getdents64() failed");
+        if (size == 0)
+            break;
+
+        long position;
+        for (position = 0; position < size;) {
+            const struct linux_dirent64* const entry =
+              (const struct linux_dirent64*)(buffer + position);
+            position += entry->d_reclen;
+
+            if ((strcmp(entry->d_name, ".") == 0) ||
+                (strcmp(entry->d_name, "..") == 0))
+                continue;
+            if (skip_directory_entry_type(entry->d_type, program_parameters))
+                continue;
+
+            struct statx stat_buffer;
+            if (statx(dirfd,
+                      entry->d_name,
+                      AT_SYMLINK_NOFOLLOW,
+                      SCAN_STATX_MASK,
+                      &stat_buffer) < 0)
+                print_perror(program_parameters, "statx() failed");
+            stats_add(STATS_OTHER_CALLS, 1);
+            // Type is checked again, d_type can be unknown
+            if (check_file_mode(stat_buffer.stx_mode) < 0)
+                continue;
+            if ((program_parameters->symlink_mode == SYMLINK_MODE_IGNORE) &&
+                ((stat_buffer.stx_mode & S_IFMT) == S_IFLNK))
+                continue;
+
+            struct file_data* const data = create_file_data(
+              entry->d_name, directory, arena, program_parameters);
+            set_file_data_stat(data, &stat_buffer, program_parameters);
+            add_scan_link(&(state->workers[worker_index].links),
+                          data,
+                          &stat_buffer,
+                          program_parameters);
+            if ((data->file_mode & S_IFMT) == S_IFLNK) {
+                data->symlink_target = read_symlink_target(
+                  dirfd, entry->d_name, arena, program_parameters);
+                data->file_size = strlen(data->symlink_target) + 1;
+            }
+
+            if (last_file_data != NULL)
+                last_file_data->next = data;
+            else
+                directory->first_child = data;
+            last_file_data = data;
+
+            if ((data->file_mode & S_IFMT) == S_IFDIR)
+                push_scan_directory(
+                  state,
+                  worker_index,
+                  data,
+                  open_scan_subdirectory(state, dirfd, entry->d_name));
+        }
+    }
+
+    if (close(dirfd) < 0)
+        print_perror(program_parameters, "close() failed");
+    stats_add(STATS_OTHER_CALLS, 1);
+}
+
+/* Create root entry for path given by user. Like in fts, its name is last
+ * component of path (without trailing slashes), and path is stored to
+ * root_path if it differs from name.
+ */
+static struct file_data*
+create_root_file_data(const char* path,
+                      struct arena* arena,
+                      const struct program_parameters* program_parameters)
 {
-    FTS* const fts = fts_open(root_paths,
-                              FTS_PHYSICAL,
-                              fts_compare_function); // TODO
+    size_t end = strlen(path);
+    while ((end > 1) && (path[end - 1] == '/'))
+        end--;
+    size_t begin = end;
+    while ((begin > 0) && (path[begin - 1] != '/'))
+        begin--;
+    // Path "/" has no name component, so it is used as name
+    if (begin == end)
+        begin = 0;
 
-    if (fts == NULL) {
-        print_perror(program_parameters, "fts_open() failed");
+    char* const name = arena_alloc(arena, end - begin + 1);
+    if (name == NULL)
+        print_perror(program_parameters, "arena_alloc() failed");
+    memcpy(name, path + begin, end - begin);
+    name[end - begin] = '\0';
+
+    struct file_data* const data =
+      create_file_data(name, NULL, arena, program_parameters);
+    if (strcmp(path, name) != 0) {
+        data->root_path = arena_copy_string(arena, path);
+        if (data->root_path == NULL)
+            print_perror(program_parameters, "arena_copy_string() failed");
     }
+    return data;
+}
 
-    struct file_data* const result =
-      list_directory_by_fts(fts, program_parameters);
+/* Task function for run_parallel(): scanning worker with index task_index.
+ */
+static void
+scan_worker_task(size_t task_index, void* context)
+{
+    struct scan_state* const state = context;
+    const unsigned int worker_index = (unsigned int)task_index;
 
-    if (fts_close(fts) < 0) {
-        print_perror(program_parameters, "fts_close() failed");
+    char* const buffer = malloc(SCAN_BUFFER_SIZE);
+    if (buffer == NULL)
+        print_perror(state->program_parameters, "malloc() failed");
+
+    struct scan_item item;
+    while (take_scan_directory(state, worker_index, &item)) {
+        scan_directory(state, worker_index, &item, buffer);
+        if (__atomic_sub_fetch(&(state->pending_count), 1, __ATOMIC_SEQ_CST) ==
+            0)
+            wake_scan_workers(state, 1);
     }
 
-    return result;
+    free(buffer);
 }
 
-void
-free_directory_tree(struct file_data* data)
+struct file_data*
+list_directory(char* const* root_paths,
+               const struct program_parameters* program_parameters)
 {
-    if (data == NULL)
-        return;
+    struct scan_state state;
+    state.worker_count = program_parameters->thread_count;
+    state.workers = malloc(sizeof(struct scan_worker) * state.worker_count);
+    if (state.workers == NULL)
+        print_perror(program_parameters, "malloc() failed");
+    unsigned int i;
+    for (i = 0; i < state.worker_count; i++) {
+        struct scan_worker* const worker = &(state.workers[i]);
+        pthread_mutex_init(&(worker->queue.mutex), NULL);
+        worker->queue.directories = NULL;
+        worker->queue.begin = 0;
+        worker->queue.end = 0;
+        worker->queue.capacity = 0;
+        worker->arena = arena_create();
+        if (worker->arena == NULL)
+            print_perror(program_parameters, "arena_create() failed");
+        worker->links.links = NULL;
+        worker->links.count = 0;
+        worker->links.capacity = 0;
+    }
+    state.pending_count = 0;
+    state.open_count = 0;
+    struct rlimit file_limit;
+    state.max_open_count = SCAN_MAX_OPEN_DIRECTORIES;
+    if ((getrlimit(RLIMIT_NOFILE, &file_limit) == 0) &&
+        (file_limit.rlim_cur / 4 < state.max_open_count))
+        state.max_open_count = (unsigned int)(file_limit.rlim_cur / 4);
+    pthread_mutex_init(&(state.idle_mutex), NULL);
+    pthread_cond_init(&(state.idle_cond), NULL);
+    state.idle_count = 0;
+    state.work_version = 0;
+    state.program_parameters = program_parameters;
 
-    if (data->file_name != NULL)
-        free(data->file_name);
+    // Root entries are accessed by path given by user, paths of other
+    // entries are built from it when needed
+    struct file_data* first_file_data = NULL;
+    struct file_data* last_file_data = NULL;
+    char* const* root_path;
+    for (root_path = root_paths; *root_path != NULL; root_path++) {
+        struct statx stat_buffer;
+        if (statx(AT_FDCWD,
+                  *root_path,
+                  AT_SYMLINK_NOFOLLOW,
+                  SCAN_STATX_MASK,
+                  &stat_buffer) < 0)
+            print_perror(program_parameters, "statx() failed");
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (check_file_mode(stat_buffer.stx_mode) < 0)
+            continue;
+        if ((program_parameters->symlink_mode == SYMLINK_MODE_IGNORE) &&
+            ((stat_buffer.stx_mode & S_IFMT) == S_IFLNK))
+            continue;
 
-    if (data->file_access_path != NULL)
-        free(data->file_access_path);
+        struct file_data* const data = create_root_file_data(
+          *root_path, state.workers[0].arena, program_parameters);
+        set_file_data_stat(data, &stat_buffer, program_parameters);
+        add_scan_link(
+          &(state.workers[0].links), data, &stat_buffer, program_parameters);
+        if ((data->file_mode & S_IFMT) == S_IFLNK) {
+            data->symlink_target = read_symlink_target(
+              AT_FDCWD, *root_path, state.workers[0].arena, program_parameters);
+            data->file_size = strlen(data->symlink_target) + 1;
+        }
 
-    if (data->symlink_target != NULL)
-        free(data->symlink_target);
+        if (last_file_data != NULL)
+            last_file_data->next = data;
+        else
+            first_file_data = data;
+        last_file_data = data;
 
-    if (data->next != NULL)
-        free_directory_tree(data->next);
+        if ((data->file_mode & S_IFMT) == S_IFDIR)
+            push_scan_directory(&state, 0, data, -1);
+    }
 
-    if (data->first_child != NULL)
-        free_directory_tree(data->first_child);
+    run_parallel(
+      state.worker_count, state.worker_count, scan_worker_task, &state);
 
-    free(data);
+    // Entries read by all workers are owned by one arena
+    struct arena* const arena = state.workers[0].arena;
+    struct scan_link_list links = state.workers[0].links;
+    for (i = 0; i < state.worker_count; i++) {
+        if (i > 0) {
+            arena_merge(arena, state.workers[i].arena);
+            size_t j;
+            for (j = 0; j < state.workers[i].links.count; j++)
+                append_scan_link(&links,
+                                 &(state.workers[i].links.links[j]),
+                                 program_parameters);
+            free(state.workers[i].links.links);
+        }
+        free(state.workers[i].queue.directories);
+        pthread_mutex_destroy(&(state.workers[i].queue.mutex));
+    }
+    free(state.workers);
+    pthread_cond_destroy(&(state.idle_cond));
+    pthread_mutex_destroy(&(state.idle_mutex));
+
+    assign_link_originals(first_file_data, &links, program_parameters);
+    free(links.links);
+
+    return set_directory_tree_arena(first_file_data, arena);
+}
+
+void
+free_directory_tree(struct file_data* ptr)
+{
+    if (ptr != NULL)
+        arena_free(ptr->arena);
 }
 
 void
 print_directory_tree(struct file_data* data, unsigned int identation)
 {
     // TODO
-    struct file_data* current_file_data;
-    for (current_file_data = data; current_file_data != NULL;
-         current_file_data = current_file_data->next) {
+    char path[FILE_PATH_BUFFER_SIZE];
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        const struct file_data* const current_file_data = walk.file_data;
+        get_file_path(current_file_data, NULL, path, sizeof(path));
         unsigned int i;
-        for (i = 0; i < identation; i++)
+        for (i = 0; i < identation + walk.depth * 2; i++)
             putchar(' ');
         printf("%s mode=%02x size=%012ld name=%s path=%s\n",
                ((current_file_data->file_mode & S_IFMT) == S_IFDIR)
@@ -169,12 +921,6 @@ print_directory_tree(struct file_data* data, unsigned int identation)
                current_file_data->file_mode,
                current_file_data->file_size,
                current_file_data->file_name,
-               current_file_data->file_access_path);
-
-        if (current_file_data->first_child != NULL) {
-            print_directory_tree(current_file_data->first_child,
-                                 identation + 2);
-        }
+               path);
     }
 }
-
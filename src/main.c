@@ -1,15 +1,23 @@
 #include <fcntl.h>
+#include <string.h>
 
 #include "archive.h"
+#include "archive_v3.h"
+#include "base_archive.h"
+#include "dedup.h"
 #include "file_wrapper.h"
 #include "listdir.h"
 #include "program_options.h"
+#include "stats.h"
+#include "verify.h"
 
 int
 main(int argc, char* argv[])
 {
     const struct program_parameters program_parameters =
       parse_program_parameters(argc, argv);
+    if (program_parameters.stats_format != STATS_FORMAT_NONE)
+        stats_start();
 
     switch (program_parameters.mode) {
         case MODE_PACK: {
@@ -17,38 +25,140 @@ main(int argc, char* argv[])
             root_paths[0] = program_parameters.input_name;
             root_paths[1] = NULL;
 
+            stats_set_phase(STATS_PHASE_SCAN);
             struct file_data* const input_directory_data =
               list_directory(root_paths, &program_parameters);
+            // Names are checked before output file is truncated
+            check_archive_entry_names(input_directory_data,
+                                      &program_parameters);
 
-            archive_ptr_t current_position = sizeof(struct archive_header);
-            assign_archive_positions(
-              input_directory_data, &current_position, &program_parameters);
-            assign_archive_content_positions(
-              input_directory_data, &current_position, &program_parameters);
+            struct file_wrapper* base_file = NULL;
+            if (program_parameters.base_name != NULL) {
+                stats_set_phase(STATS_PHASE_BASE);
+                base_file = open_archive_file(program_parameters.base_name,
+                                              &program_parameters);
+                struct file_data* const base_data =
+                  read_full_archive(base_file, &program_parameters);
+                match_base_archive(input_directory_data,
+                                   base_data,
+                                   base_file,
+                                   &program_parameters);
+                free_directory_tree(base_data);
+            }
 
-            struct file_wrapper* const output_file = file_creat(
-              program_parameters.output_name, S_IRUSR | S_IWUSR | S_IRGRP);
-            if (output_file == NULL) {
-                print_perror(&program_parameters, "file_creat() failed");
+            if (program_parameters.deduplicate) {
+                stats_set_phase(STATS_PHASE_DEDUP);
+                deduplicate_content(input_directory_data, &program_parameters);
+            }
+
+            stats_set_phase(STATS_PHASE_HEADERS);
+            struct file_wrapper* output_file;
+            if (strcmp(program_parameters.output_name, "-") == 0) {
+                output_file = file_from_fd(STDOUT_FILENO, O_WRONLY);
+                if (output_file == NULL) {
+                    print_perror(&program_parameters, "file_from_fd() failed");
+                }
+            } else if (program_parameters.checksum_content) {
+                // Written content is read back to calculate checksums
+                output_file =
+                  file_open_with_mode(program_parameters.output_name,
+                                      O_RDWR | O_CREAT | O_TRUNC,
+                                      S_IRUSR | S_IWUSR | S_IRGRP);
+                if (output_file == NULL) {
+                    print_perror(&program_parameters,
+                                 "file_open_with_mode() failed");
+                }
+            } else {
+                output_file = file_creat(program_parameters.output_name,
+                                         S_IRUSR | S_IWUSR | S_IRGRP);
+                if (output_file == NULL) {
+                    print_perror(&program_parameters, "file_creat() failed");
+                }
+            }
+            if (file_set_write_buffer(output_file,
+                                      program_parameters.write_buffer_size) <
+                0) {
+                print_perror(&program_parameters,
+                             "file_set_write_buffer() failed");
             }
 
-            write_full_archive(
-              input_directory_data, output_file, &program_parameters);
+            if (program_parameters.archive_format == ARCHIVE_FORMAT_V2) {
+                stats_set_phase(STATS_PHASE_ASSIGN);
+                archive_ptr_t current_position = sizeof(struct archive_header);
+                assign_archive_positions(input_directory_data,
+                                         &current_position);
+                assign_archive_content_positions(input_directory_data,
+                                                 &current_position);
 
+                write_full_archive(
+                  input_directory_data, output_file, &program_parameters);
+            } else if (program_parameters.stream_archive) {
+                write_stream_archive_v3(
+                  input_directory_data, output_file, &program_parameters);
+            } else {
+                write_full_archive_v3(
+                  input_directory_data, output_file, &program_parameters);
+            }
+
+            stats_set_phase(STATS_PHASE_CLEANUP);
             if (file_close(output_file) < 0) {
                 print_perror(&program_parameters, "file_close() failed");
             }
+            if ((base_file != NULL) && (file_close(base_file) < 0)) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
 
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(input_directory_data);
             free_directory_tree(input_directory_data);
 
             break;
         }
-        case MODE_LIST: {
-            struct file_wrapper* const input_file =
-              file_open(program_parameters.input_name, O_RDONLY);
-            if (input_file == NULL) {
+        case MODE_ADD: {
+            char* root_paths[2];
+            root_paths[0] = program_parameters.input_name;
+            root_paths[1] = NULL;
+
+            stats_set_phase(STATS_PHASE_SCAN);
+            struct file_data* const input_directory_data =
+              list_directory(root_paths, &program_parameters);
+            check_archive_entry_names(input_directory_data,
+                                      &program_parameters);
+            if (program_parameters.deduplicate) {
+                stats_set_phase(STATS_PHASE_DEDUP);
+                deduplicate_content(input_directory_data, &program_parameters);
+            }
+
+            struct file_wrapper* const archive_file =
+              file_open(program_parameters.output_name, O_RDWR);
+            if (archive_file == NULL) {
                 print_perror(&program_parameters, "file_open() failed");
             }
+            if (file_set_write_buffer(archive_file,
+                                      program_parameters.write_buffer_size) <
+                0) {
+                print_perror(&program_parameters,
+                             "file_set_write_buffer() failed");
+            }
+
+            append_archive(
+              input_directory_data, archive_file, &program_parameters);
+
+            stats_set_phase(STATS_PHASE_CLEANUP);
+            if (file_close(archive_file) < 0) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
+
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(input_directory_data);
+            free_directory_tree(input_directory_data);
+
+            break;
+        }
+        case MODE_LIST: {
+            stats_set_phase(STATS_PHASE_READ_INDEX);
+            struct file_wrapper* const input_file = open_archive_file(
+              program_parameters.input_name, &program_parameters);
 
             struct file_data* const input_archive_data =
               read_full_archive(input_file, &program_parameters);
@@ -57,35 +167,126 @@ main(int argc, char* argv[])
                 print_perror(&program_parameters, "file_close() failed");
             }
 
+            stats_set_phase(STATS_PHASE_PRINT);
             print_directory_tree(input_archive_data, 0);
 
+            stats_set_phase(STATS_PHASE_CLEANUP);
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(input_archive_data);
             free_directory_tree(input_archive_data);
 
             break;
         }
         case MODE_UNPACK: {
-            struct file_wrapper* const input_file =
-              file_open(program_parameters.input_name, O_RDONLY);
-            if (input_file == NULL) {
-                print_perror(&program_parameters, "file_open() failed");
-            }
+            stats_set_phase(STATS_PHASE_READ_INDEX);
+            struct file_wrapper* const input_file = open_archive_file(
+              program_parameters.input_name, &program_parameters);
 
             struct file_data* const input_archive_data =
               read_full_archive(input_file, &program_parameters);
 
-            read_archive_content(input_archive_data,
-                                 input_file,
-                                 program_parameters.output_name,
-                                 &program_parameters);
+            stats_set_phase(STATS_PHASE_EXTRACT);
+            read_archive_content_by_options(input_archive_data,
+                                            input_file,
+                                            program_parameters.output_name,
+                                            &program_parameters);
 
+            stats_set_phase(STATS_PHASE_CLEANUP);
             if (file_close(input_file) < 0) {
                 print_perror(&program_parameters, "file_close() failed");
             }
 
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(input_archive_data);
             free_directory_tree(input_archive_data);
 
             break;
         }
+        case MODE_EXTRACT: {
+            stats_set_phase(STATS_PHASE_READ_INDEX);
+            struct file_wrapper* const input_file = open_archive_file(
+              program_parameters.input_name, &program_parameters);
+
+            struct file_data* const member_data =
+              find_archive_member(input_file,
+                                  program_parameters.member_path,
+                                  &program_parameters);
+            if (member_data == NULL) {
+                print_error(&program_parameters,
+                            "Error: %s not found in archive\n",
+                            program_parameters.member_path);
+            }
+
+            stats_set_phase(STATS_PHASE_EXTRACT);
+            read_archive_content_by_options(member_data,
+                                            input_file,
+                                            program_parameters.output_name,
+                                            &program_parameters);
+
+            stats_set_phase(STATS_PHASE_CLEANUP);
+            if (file_close(input_file) < 0) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
+
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(member_data);
+            free_directory_tree(member_data);
+
+            break;
+        }
+        case MODE_CAT: {
+            stats_set_phase(STATS_PHASE_READ_INDEX);
+            struct file_wrapper* const input_file = open_archive_file(
+              program_parameters.input_name, &program_parameters);
+
+            struct file_data* const member_data =
+              find_archive_member(input_file,
+                                  program_parameters.member_path,
+                                  &program_parameters);
+            if (member_data == NULL) {
+                print_error(&program_parameters,
+                            "Error: %s not found in archive\n",
+                            program_parameters.member_path);
+            }
+
+            stats_set_phase(STATS_PHASE_EXTRACT);
+            struct file_wrapper* const output_file =
+              file_from_fd(STDOUT_FILENO, O_WRONLY);
+            if (output_file == NULL) {
+                print_perror(&program_parameters, "file_from_fd() failed");
+            }
+
+            write_archive_member_content(
+              member_data, input_file, output_file, &program_parameters);
+
+            stats_set_phase(STATS_PHASE_CLEANUP);
+            if (file_close(output_file) < 0) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
+            if (file_close(input_file) < 0) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
+
+            if (program_parameters.stats_format != STATS_FORMAT_NONE)
+                stats_add_tree(member_data);
+            free_directory_tree(member_data);
+
+            break;
+        }
+        case MODE_VERIFY: {
+            stats_set_phase(STATS_PHASE_VERIFY);
+            struct file_wrapper* const input_file = open_archive_file(
+              program_parameters.input_name, &program_parameters);
+
+            verify_archive(input_file, &program_parameters);
+
+            stats_set_phase(STATS_PHASE_CLEANUP);
+            if (file_close(input_file) < 0) {
+                print_perror(&program_parameters, "file_close() failed");
+            }
+
+            break;
+        }
         default: {
             print_usage(argv[0]);
 
@@ -93,6 +294,9 @@ main(int argc, char* argv[])
         }
     }
 
+    if (program_parameters.stats_format != STATS_FORMAT_NONE)
+        stats_print(&program_parameters);
+
     return 0;
 }
 
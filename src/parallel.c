@@ -0,0 +1,72 @@
+#include "parallel.h"
+
+#include <pthread.h>
+
+#include <stdlib.h>
+
+/* Shared state of worker threads for one run_parallel() call.
+ */
+struct parallel_state
+{
+    size_t task_count; // total number of tasks
+    size_t next_task;  // index of next task to take (updated atomically)
+    parallel_task_function task_function;
+    void* context;
+};
+
+static void*
+parallel_worker(void* arg)
+{
+    struct parallel_state* const state = arg;
+
+    while (1) {
+        const size_t task_index =
+          __atomic_fetch_add(&(state->next_task), 1, __ATOMIC_RELAXED);
+        if (task_index >= state->task_count)
+            break;
+        state->task_function(task_index, state->context);
+    }
+
+    return NULL;
+}
+
+void
+run_parallel(size_t task_count,
+             unsigned int thread_count,
+             parallel_task_function task_function,
+             void* context)
+{
+    struct parallel_state state;
+    state.task_count = task_count;
+    state.next_task = 0;
+    state.task_function = task_function;
+    state.context = context;
+
+    if ((size_t)thread_count > task_count)
+        thread_count = (unsigned int)task_count;
+
+    // Calling thread is worker too, so one thread less is created. If threads
+    // can not be created, remaining tasks are run by calling thread only.
+    pthread_t* threads = NULL;
+    if (thread_count > 1)
+        threads = malloc(sizeof(pthread_t) * (thread_count - 1));
+
+    unsigned int created_count = 0;
+    if (threads != NULL) {
+        for (; created_count < thread_count - 1; created_count++) {
+            if (pthread_create(&(threads[created_count]),
+                               NULL,
+                               parallel_worker,
+                               &state) != 0)
+                break;
+        }
+    }
+
+    parallel_worker(&state);
+
+    unsigned int i;
+    for (i = 0; i < created_count; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
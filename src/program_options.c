@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "archive_format.h"
+#include "codec.h"
+
 void
 print_usage(const char* program_name)
 {
@@ -14,24 +17,93 @@ print_usage(const char* program_name)
     printf("Modes:\n");
     printf(" pack                        create archive OUTPUT and add\n"
            "                             files from INPUT to it\n");
+    printf(" add                         add files from INPUT to existing\n"
+           "                             archive OUTPUT\n");
     printf(" list                        list files in archive INPUT\n");
     printf(" unpack                      extract archive INPUT to\n"
            "                             directory OUTPUT\n");
+    printf(" extract                     extract file or directory PATH from\n"
+           "                             archive INPUT to directory OUTPUT\n");
+    printf(" cat                         write content of file PATH from\n"
+           "                             archive INPUT to standard output\n");
+    printf(" verify                      check structure and checksums of\n"
+           "                             archive INPUT without extracting\n"
+           "                             it\n");
     printf(" help                        print this help message\n");
     printf("Options:\n");
     printf("   -h --help                 print this help message and exit\n");
     printf("   -v --verbose              print informational messages when\n"
            "                             running\n");
     printf("   -i --input NAME           input file or directory name\n");
-    printf("   -o --output NAME          output file or directory name\n");
+    printf("   -o --output NAME          output file or directory name (- for\n"
+           "                             standard output, implies --stream)\n");
+    printf("   -p --path PATH            path of archive entry (like\n"
+           "                             dir/subdir/file) to extract\n");
     printf(
       "      --buffer-size SIZE     use given buffer size for archive\n"
       "                             file reading and writing, can be\n"
       "                             given in bytes (like 512), kilobytes\n"
       "                             (like 256K) and megabytes (like 128M)\n");
+    printf("      --write-buffer SIZE    collect writes to created archive\n"
+           "                             in buffer of given size (default\n"
+           "                             is 1M, 0 writes data at once)\n");
+    printf("      --read-buffer SIZE     read archive which is not mapped to\n"
+           "                             memory by portions of given size\n"
+           "                             (default is 1M, 0 reads only\n"
+           "                             requested data)\n");
     printf(
       "      --use-symlinks         add symlinks to created archive file\n");
     printf("      --ignore-symlinks      ignore symlinks\n");
+    printf("      --format VERSION       create archive in given format\n"
+           "                             version: v3 (default) or v2\n"
+           "                             (readable by versions without v3\n"
+           "                             support)\n");
+    printf("      --central-directory    add central directory (table of all\n"
+           "                             entries) and path index to created\n"
+           "                             v3 archive\n");
+    printf("      --codec NAME           compress file contents in created\n"
+           "                             v3 archive with codec: none\n"
+           "                             (default) or lz\n");
+    printf("      --dedup                store identical file contents in\n"
+           "                             created archive only once\n");
+    printf("      --chunk                split file contents in created v3\n"
+           "                             archive into content-defined\n"
+           "                             chunks and store identical chunks\n"
+           "                             only once\n");
+    printf("      --checksum             store CRC32C checksum of every file\n"
+           "                             content in created v3 archive\n");
+    printf("      --base NAME            copy contents of unchanged files\n"
+           "                             (with the same size and times)\n"
+           "                             from archive NAME instead of\n"
+           "                             reading them\n");
+    printf("      --stream               create streamed v3 archive (entry\n"
+           "                             headers followed by content, index\n"
+           "                             at the end), which can be written\n"
+           "                             to pipe\n");
+    printf("      --no-sparse            store holes of sparse files in\n"
+           "                             created v3 archive as zeros\n");
+    printf("      --no-hardlinks         store hard links to the same file\n"
+           "                             as separate files\n");
+    printf("      --inline-size SIZE     store contents of files and symlinks\n"
+           "                             up to given size (default is 256,\n"
+           "                             at most 4K) in entry headers of\n"
+           "                             created v3 archive without central\n"
+           "                             directory\n");
+    printf("      --io-uring             copy file contents with io_uring\n"
+           "                             requests from one thread, keeping\n"
+           "                             many files in progress (if\n"
+           "                             supported by kernel)\n");
+    printf("      --no-mmap              read archive with read() calls\n"
+           "                             instead of mapping it to memory\n");
+    printf("      --stats                print time, I/O and memory usage\n"
+           "                             by program phases and largest\n"
+           "                             and slowest files to standard\n"
+           "                             error at exit\n");
+    printf("      --stats-json           print the same statistics as JSON\n"
+           "                             object\n");
+    printf("   -j --threads COUNT        scan input directories and read and\n"
+           "                             write file contents using COUNT\n"
+           "                             threads (default is 1)\n");
 }
 
 ssize_t
@@ -71,8 +143,26 @@ parse_program_parameters(int argc, char* const argv[])
     program_parameters.verbosity = VERBOSITY_QUIET;
     program_parameters.input_name = NULL;
     program_parameters.output_name = NULL;
+    program_parameters.member_path = NULL;
+    program_parameters.base_name = NULL;
     program_parameters.file_cat_buffer_size = FILE_CAT_DEFAULT_BUFFER_SIZE;
+    program_parameters.write_buffer_size = FILE_WRITE_DEFAULT_BUFFER_SIZE;
+    program_parameters.read_buffer_size = FILE_READ_DEFAULT_BUFFER_SIZE;
     program_parameters.symlink_mode = SYMLINK_MODE_UNKNOWN;
+    program_parameters.archive_format = ARCHIVE_FORMAT_V3;
+    program_parameters.write_central_directory = 0;
+    program_parameters.content_codec = CODEC_NONE;
+    program_parameters.deduplicate = 0;
+    program_parameters.chunk_content = 0;
+    program_parameters.skip_holes = 1;
+    program_parameters.preserve_hardlinks = 1;
+    program_parameters.inline_size = ARCHIVE_V3_DEFAULT_INLINE_SIZE;
+    program_parameters.checksum_content = 0;
+    program_parameters.stream_archive = 0;
+    program_parameters.thread_count = 1;
+    program_parameters.use_io_uring = 0;
+    program_parameters.use_mmap = 1;
+    program_parameters.stats_format = STATS_FORMAT_NONE;
 
     int i;
     for (i = 1; i < argc; i++) {
@@ -113,6 +203,29 @@ parse_program_parameters(int argc, char* const argv[])
             }
             continue;
         }
+        if ((strcmp(argument, "--path") == 0) ||
+            (strcmp(argument, "-p") == 0)) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr, "Error: Option --path requires path\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                program_parameters.member_path = argv[i];
+            }
+            continue;
+        }
+        if (strcmp(argument, "--base") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr, "Error: Option --base requires name\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                program_parameters.base_name = argv[i];
+            }
+            continue;
+        }
         if (strcmp(argument, "--buffer-size") == 0) {
             if ((i + 1) >= argc) {
                 fprintf(stderr, "Error: Option --buffer-size requires size\n");
@@ -130,6 +243,162 @@ parse_program_parameters(int argc, char* const argv[])
                 continue;
             }
         }
+        if (strcmp(argument, "--write-buffer") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr,
+                        "Error: Option --write-buffer requires size\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                ssize_t size = parse_size(argv[i]);
+                if (size < 0) {
+                    fprintf(stderr, "Error: Invalid size value %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                program_parameters.write_buffer_size = (size_t)size;
+                continue;
+            }
+        }
+        if (strcmp(argument, "--read-buffer") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr,
+                        "Error: Option --read-buffer requires size\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                ssize_t size = parse_size(argv[i]);
+                if (size < 0) {
+                    fprintf(stderr, "Error: Invalid size value %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                program_parameters.read_buffer_size = (size_t)size;
+                continue;
+            }
+        }
+        if (strcmp(argument, "--inline-size") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr,
+                        "Error: Option --inline-size requires size\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                ssize_t size = parse_size(argv[i]);
+                if ((size < 0) || (size > ARCHIVE_V3_MAX_INLINE_SIZE)) {
+                    fprintf(stderr, "Error: Invalid size value %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                program_parameters.inline_size = (size_t)size;
+                continue;
+            }
+        }
+        if ((strcmp(argument, "--threads") == 0) ||
+            (strcmp(argument, "-j") == 0)) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr, "Error: Option --threads requires count\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                char* end_ptr;
+                const long count = strtol(argv[i], &end_ptr, 10);
+                if ((*end_ptr != '\0') || (count < 1) ||
+                    (count > MAX_THREAD_COUNT)) {
+                    fprintf(
+                      stderr, "Error: Invalid thread count %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                program_parameters.thread_count = (unsigned int)count;
+                continue;
+            }
+        }
+        if (strcmp(argument, "--format") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr, "Error: Option --format requires version\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                if (strcmp(argv[i], "v2") == 0) {
+                    program_parameters.archive_format = ARCHIVE_FORMAT_V2;
+                } else if (strcmp(argv[i], "v3") == 0) {
+                    program_parameters.archive_format = ARCHIVE_FORMAT_V3;
+                } else {
+                    fprintf(
+                      stderr, "Error: Invalid format version %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                continue;
+            }
+        }
+        if (strcmp(argument, "--codec") == 0) {
+            if ((i + 1) >= argc) {
+                fprintf(stderr, "Error: Option --codec requires name\n");
+                program_parameters.mode = MODE_UNKNOWN;
+                break;
+            } else {
+                i++;
+                const int codec = find_codec(argv[i]);
+                if (codec < 0) {
+                    fprintf(stderr, "Error: Unknown codec %s\n", argv[i]);
+                    program_parameters.mode = MODE_UNKNOWN;
+                    break;
+                }
+                program_parameters.content_codec = (unsigned int)codec;
+                continue;
+            }
+        }
+        if (strcmp(argument, "--central-directory") == 0) {
+            program_parameters.write_central_directory = 1;
+            continue;
+        }
+        if (strcmp(argument, "--dedup") == 0) {
+            program_parameters.deduplicate = 1;
+            continue;
+        }
+        if (strcmp(argument, "--chunk") == 0) {
+            program_parameters.chunk_content = 1;
+            continue;
+        }
+        if (strcmp(argument, "--checksum") == 0) {
+            program_parameters.checksum_content = 1;
+            continue;
+        }
+        if (strcmp(argument, "--stream") == 0) {
+            program_parameters.stream_archive = 1;
+            continue;
+        }
+        if (strcmp(argument, "--no-sparse") == 0) {
+            program_parameters.skip_holes = 0;
+            continue;
+        }
+        if (strcmp(argument, "--no-hardlinks") == 0) {
+            program_parameters.preserve_hardlinks = 0;
+            continue;
+        }
+        if (strcmp(argument, "--io-uring") == 0) {
+            program_parameters.use_io_uring = 1;
+            continue;
+        }
+        if (strcmp(argument, "--no-mmap") == 0) {
+            program_parameters.use_mmap = 0;
+            continue;
+        }
+        if (strcmp(argument, "--stats") == 0) {
+            program_parameters.stats_format = STATS_FORMAT_TEXT;
+            continue;
+        }
+        if (strcmp(argument, "--stats-json") == 0) {
+            program_parameters.stats_format = STATS_FORMAT_JSON;
+            continue;
+        }
         if (strcmp(argument, "--ignore-symlinks") == 0) {
             program_parameters.symlink_mode = SYMLINK_MODE_IGNORE;
             continue;
@@ -145,6 +414,10 @@ parse_program_parameters(int argc, char* const argv[])
                 program_parameters.mode = MODE_PACK;
                 continue;
             }
+            if (strcmp(argument, "add") == 0) {
+                program_parameters.mode = MODE_ADD;
+                continue;
+            }
             if (strcmp(argument, "list") == 0) {
                 program_parameters.mode = MODE_LIST;
                 continue;
@@ -153,6 +426,18 @@ parse_program_parameters(int argc, char* const argv[])
                 program_parameters.mode = MODE_UNPACK;
                 continue;
             }
+            if (strcmp(argument, "extract") == 0) {
+                program_parameters.mode = MODE_EXTRACT;
+                continue;
+            }
+            if (strcmp(argument, "cat") == 0) {
+                program_parameters.mode = MODE_CAT;
+                continue;
+            }
+            if (strcmp(argument, "verify") == 0) {
+                program_parameters.mode = MODE_VERIFY;
+                continue;
+            }
             if (strcmp(argument, "help") == 0) {
                 program_parameters.mode = MODE_HELP;
                 break;
@@ -166,20 +451,110 @@ parse_program_parameters(int argc, char* const argv[])
     }
 
     if ((program_parameters.mode == MODE_PACK) ||
+        (program_parameters.mode == MODE_ADD) ||
         (program_parameters.mode == MODE_LIST) ||
-        (program_parameters.mode == MODE_UNPACK)) {
+        (program_parameters.mode == MODE_UNPACK) ||
+        (program_parameters.mode == MODE_EXTRACT) ||
+        (program_parameters.mode == MODE_CAT) ||
+        (program_parameters.mode == MODE_VERIFY)) {
         if (program_parameters.input_name == NULL) {
             fprintf(stderr, "Error: INPUT is required, but was not given\n");
             program_parameters.mode = MODE_UNKNOWN;
         }
     }
     if ((program_parameters.mode == MODE_PACK) ||
-        (program_parameters.mode == MODE_UNPACK)) {
+        (program_parameters.mode == MODE_ADD) ||
+        (program_parameters.mode == MODE_UNPACK) ||
+        (program_parameters.mode == MODE_EXTRACT)) {
         if (program_parameters.output_name == NULL) {
             fprintf(stderr, "Error: OUTPUT is required, but was not given\n");
             program_parameters.mode = MODE_UNKNOWN;
         }
     }
+    if ((program_parameters.mode == MODE_ADD) &&
+        program_parameters.stream_archive) {
+        fprintf(stderr, "Error: streamed archive can not be appended to\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+    if ((program_parameters.mode == MODE_ADD) &&
+        (program_parameters.base_name != NULL)) {
+        fprintf(stderr, "Error: base archive can be used in pack mode only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    // Output file is truncated before base archive is read
+    if ((program_parameters.mode == MODE_PACK) &&
+        (program_parameters.base_name != NULL) &&
+        (program_parameters.output_name != NULL) &&
+        (strcmp(program_parameters.base_name,
+                program_parameters.output_name) == 0)) {
+        fprintf(stderr, "Error: base archive can not be OUTPUT\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+    if ((program_parameters.mode == MODE_EXTRACT) ||
+        (program_parameters.mode == MODE_CAT)) {
+        if (program_parameters.member_path == NULL) {
+            fprintf(stderr, "Error: PATH is required, but was not given\n");
+            program_parameters.mode = MODE_UNKNOWN;
+        }
+    }
+
+    if ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) &&
+        program_parameters.write_central_directory) {
+        fprintf(stderr,
+                "Error: central directory is supported in v3 format only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    if ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) &&
+        (program_parameters.content_codec != CODEC_NONE)) {
+        fprintf(stderr, "Error: codecs are supported in v3 format only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    // Standard output can be pipe, so archive is streamed to it
+    if ((program_parameters.mode == MODE_PACK) &&
+        (strcmp(program_parameters.output_name, "-") == 0))
+        program_parameters.stream_archive = 1;
+    if ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) &&
+        program_parameters.stream_archive) {
+        fprintf(stderr,
+                "Error: streamed archive is supported in v3 format only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    // Chunk lists are written after chunks they reference, so their
+    // positions are not known when inline headers are streamed
+    if (program_parameters.chunk_content &&
+        ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) ||
+         program_parameters.stream_archive)) {
+        fprintf(stderr,
+                "Error: chunking is supported in non-streamed v3 format "
+                "only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    // Checksums are calculated by reading written content back, which is
+    // not possible for pipe
+    if (program_parameters.checksum_content &&
+        ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) ||
+         program_parameters.stream_archive)) {
+        fprintf(stderr,
+                "Error: checksums are supported in non-streamed v3 format "
+                "only\n");
+        program_parameters.mode = MODE_UNKNOWN;
+    }
+
+    // v2 format has no codecs, so sparse files are stored with holes
+    if (program_parameters.archive_format == ARCHIVE_FORMAT_V2)
+        program_parameters.skip_holes = 0;
+
+    // Central directory refers to content region only, and content of
+    // streamed archive already follows its entry headers
+    if ((program_parameters.archive_format == ARCHIVE_FORMAT_V2) ||
+        program_parameters.write_central_directory ||
+        program_parameters.stream_archive)
+        program_parameters.inline_size = 0;
 
     if (program_parameters.symlink_mode == SYMLINK_MODE_UNKNOWN)
         program_parameters.symlink_mode = SYMLINK_MODE_PHYSICAL;
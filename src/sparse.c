@@ -0,0 +1,372 @@
+#include "sparse.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoding.h"
+
+/* Size of buffer for copying extents through user space.
+ */
+#define SPARSE_COPY_BUFFER_SIZE (1 << 16)
+
+/* Data extent of sparse file.
+ */
+struct sparse_extent
+{
+    off_t start; // position of first byte of extent
+    off_t end;   // position after last byte of extent
+};
+
+/* Find data extents in size bytes of input_file and store dynamically
+ * allocated array of them to value referenced by extents_ptr (it should be
+ * deallocated by caller) and their number to value referenced by count_ptr.
+ * Return 0 on success, -1 on error.
+ */
+static int
+find_data_extents(struct file_wrapper* input_file,
+                  size_t size,
+                  struct sparse_extent** extents_ptr,
+                  size_t* count_ptr)
+{
+    struct sparse_extent* extents = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    off_t position = 0;
+    while (position < (off_t)size) {
+        off_t start;
+        off_t end;
+        const int result = file_find_data(input_file, position, &start, &end);
+        if (result < 0) {
+            free(extents);
+            return -1;
+        }
+        // File could grow after its size was read, so data after size is
+        // ignored
+        if ((result == 0) || (start >= (off_t)size))
+            break;
+        if (end > (off_t)size)
+            end = (off_t)size;
+
+        if (count == capacity) {
+            const size_t new_capacity = (capacity == 0) ? 16 : capacity * 2;
+            struct sparse_extent* const new_extents =
+              realloc(extents, sizeof(struct sparse_extent) * new_capacity);
+            if (new_extents == NULL) {
+                free(extents);
+                return -1;
+            }
+            extents = new_extents;
+            capacity = new_capacity;
+        }
+        extents[count].start = start;
+        extents[count].end = end;
+        count++;
+        position = end;
+    }
+
+    *extents_ptr = extents;
+    *count_ptr = count;
+    return 0;
+}
+
+/* Write extent list of count extents and their data from input_file to
+ * output_file for write_sparse_content().
+ */
+static int
+write_extents(struct file_wrapper* input_file,
+              struct file_wrapper* output_file,
+              const struct sparse_extent* extents,
+              size_t count,
+              archive_ptr_t* stored_size)
+{
+    struct byte_buffer list;
+    byte_buffer_init(&list);
+    int result = byte_buffer_put_varint(&list, count);
+    off_t previous_end = 0;
+    size_t i;
+    for (i = 0; (i < count) && (result == 0); i++) {
+        if ((byte_buffer_put_varint(
+               &list, (uint64_t)(extents[i].start - previous_end)) < 0) ||
+            (byte_buffer_put_varint(
+               &list, (uint64_t)(extents[i].end - extents[i].start)) < 0))
+            result = -1;
+        previous_end = extents[i].end;
+    }
+    if (result == 0)
+        result = file_write(output_file, list.data, list.size);
+    *stored_size = list.size;
+    byte_buffer_free(&list);
+
+    for (i = 0; (i < count) && (result == 0); i++) {
+        const size_t extent_size = (size_t)(extents[i].end - extents[i].start);
+        if ((file_seek(input_file, extents[i].start) < 0) ||
+            (file_cat(input_file,
+                      output_file,
+                      extent_size,
+                      SPARSE_COPY_BUFFER_SIZE) < 0))
+            result = -1;
+        *stored_size += extent_size;
+    }
+
+    return result;
+}
+
+int
+write_sparse_content(struct file_wrapper* input_file,
+                     struct file_wrapper* output_file,
+                     size_t size,
+                     archive_ptr_t* stored_size)
+{
+    struct sparse_extent* extents;
+    size_t count;
+    if (find_data_extents(input_file, size, &extents, &count) < 0)
+        return -1;
+
+    const int result =
+      write_extents(input_file, output_file, extents, count, stored_size);
+    free(extents);
+    return result;
+}
+
+/* Decode extent count from reader and check it against content size and
+ * stored size (every record takes at least 2 bytes). Return 0 on success, -1
+ * with errno set to EIO if count is invalid.
+ */
+static int
+get_extent_count(struct byte_reader* reader,
+                 size_t size,
+                 archive_ptr_t stored_size,
+                 uint64_t* count)
+{
+    if ((byte_reader_get_varint(reader, count) < 0) || (*count > size) ||
+        (*count > stored_size / 2)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Decode next extent record from reader and check that extent starting after
+ * hole at *position fits into size bytes. Start of extent is stored to
+ * *position and its size to extent_size. Return 0 on success, -1 with errno
+ * set to EIO if record is invalid.
+ */
+static int
+get_extent(struct byte_reader* reader,
+           size_t size,
+           uint64_t* position,
+           uint64_t* extent_size)
+{
+    uint64_t hole_size;
+    if ((byte_reader_get_varint(reader, &hole_size) < 0) ||
+        (byte_reader_get_varint(reader, extent_size) < 0) ||
+        (*extent_size == 0) || (hole_size > size - *position) ||
+        (*extent_size > size - *position - hole_size)) {
+        errno = EIO;
+        return -1;
+    }
+    *position += hole_size;
+    return 0;
+}
+
+/* Check extent list in reader (positioned after extent count) against size
+ * and stored_size. Return 0 if list is correct, -1 with errno set to EIO
+ * otherwise.
+ */
+static int
+check_extents(struct byte_reader* reader,
+              uint64_t count,
+              size_t size,
+              archive_ptr_t stored_size)
+{
+    uint64_t position = 0;
+    archive_ptr_t data_size = 0;
+    uint64_t i;
+    for (i = 0; i < count; i++) {
+        uint64_t extent_size;
+        if (get_extent(reader, size, &position, &extent_size) < 0)
+            return -1;
+        position += extent_size;
+        data_size += extent_size;
+    }
+
+    if (reader->position + data_size != stored_size) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Write size zero bytes to output_file at current position using buffer of
+ * SPARSE_COPY_BUFFER_SIZE bytes.
+ */
+static int
+write_zeros(struct file_wrapper* output_file, uint8_t* buffer, uint64_t size)
+{
+    memset(buffer, 0, SPARSE_COPY_BUFFER_SIZE);
+    while (size > 0) {
+        const size_t portion_size =
+          (size < SPARSE_COPY_BUFFER_SIZE) ? size : SPARSE_COPY_BUFFER_SIZE;
+        if (file_write(output_file, buffer, portion_size) < 0)
+            return -1;
+        size -= portion_size;
+    }
+    return 0;
+}
+
+/* Write extent of extent_size bytes at input_position in input_file to
+ * output_file at current position using buffer of SPARSE_COPY_BUFFER_SIZE
+ * bytes.
+ */
+static int
+copy_extent(struct file_wrapper* input_file,
+            off_t input_position,
+            uint64_t extent_size,
+            struct file_wrapper* output_file,
+            uint8_t* buffer)
+{
+    while (extent_size > 0) {
+        const size_t portion_size = (extent_size < SPARSE_COPY_BUFFER_SIZE)
+                                      ? extent_size
+                                      : SPARSE_COPY_BUFFER_SIZE;
+        if ((file_pread(input_file, buffer, portion_size, input_position) <
+             0) ||
+            (file_write(output_file, buffer, portion_size) < 0))
+            return -1;
+        input_position += portion_size;
+        extent_size -= portion_size;
+    }
+    return 0;
+}
+
+/* Write extents from checked extent list in reader (positioned after extent
+ * count) with data at data_position in input_file to output_file. If
+ * output_file is already extended to its final size, extents are written at
+ * their positions and holes are left, otherwise extents are written
+ * sequentially with zeros for holes.
+ */
+static int
+write_extents_to_file(struct file_wrapper* input_file,
+                      off_t data_position,
+                      struct byte_reader* reader,
+                      uint64_t count,
+                      struct file_wrapper* output_file,
+                      size_t size,
+                      int is_extended)
+{
+    uint8_t* buffer = NULL;
+    if (!is_extended) {
+        buffer = malloc(SPARSE_COPY_BUFFER_SIZE);
+        if (buffer == NULL)
+            return -1;
+    }
+
+    const off_t output_position = output_file->position;
+    uint64_t position = 0;
+    int result = 0;
+    uint64_t i;
+    for (i = 0; (i < count) && (result == 0); i++) {
+        const uint64_t hole_start = position;
+        uint64_t extent_size;
+        // List is already checked, so records are valid
+        get_extent(reader, size, &position, &extent_size);
+        if (is_extended)
+            result = file_cat_at(input_file,
+                                 data_position,
+                                 output_file,
+                                 output_position + (off_t)position,
+                                 extent_size,
+                                 SPARSE_COPY_BUFFER_SIZE);
+        else if (write_zeros(output_file, buffer, position - hole_start) < 0)
+            result = -1;
+        else
+            result = copy_extent(
+              input_file, data_position, extent_size, output_file, buffer);
+        data_position += (off_t)extent_size;
+        position += extent_size;
+    }
+
+    if (result == 0) {
+        if (is_extended)
+            result = file_seek(output_file, output_position + (off_t)size);
+        else
+            result = write_zeros(output_file, buffer, size - position);
+    }
+
+    free(buffer);
+    return result;
+}
+
+int
+read_sparse_content(struct file_wrapper* input_file,
+                    off_t input_position,
+                    archive_ptr_t stored_size,
+                    struct file_wrapper* output_file,
+                    size_t size)
+{
+    // Extent list size is not stored, but it is limited by extent count
+    uint8_t count_data[VARINT_MAX_SIZE];
+    const size_t count_data_size =
+      (stored_size < VARINT_MAX_SIZE) ? stored_size : VARINT_MAX_SIZE;
+    if (file_pread(input_file, count_data, count_data_size, input_position) <
+        0)
+        return -1;
+    struct byte_reader reader;
+    byte_reader_init(&reader, count_data, count_data_size);
+    uint64_t count;
+    if (get_extent_count(&reader, size, stored_size, &count) < 0)
+        return -1;
+
+    size_t list_size = reader.position + count * 2 * VARINT_MAX_SIZE;
+    if (list_size > stored_size)
+        list_size = stored_size;
+    const void* list_data =
+      file_get_data(input_file, input_position, list_size);
+    uint8_t* list_buffer = NULL;
+    if (list_data == NULL) {
+        list_buffer = malloc(list_size);
+        if (list_buffer == NULL)
+            return -1;
+        if (file_pread(input_file, list_buffer, list_size, input_position) <
+            0) {
+            free(list_buffer);
+            return -1;
+        }
+        list_data = list_buffer;
+    }
+
+    byte_reader_init(&reader, list_data, list_size);
+    get_extent_count(&reader, size, stored_size, &count);
+    int result = check_extents(&reader, count, size, stored_size);
+    if (result == 0) {
+        const off_t data_position = input_position + (off_t)reader.position;
+
+        // Holes are made by extending file, which is possible only for
+        // regular file without data after current position
+        int is_extended = 0;
+        if (((output_file->flags & O_APPEND) == 0) &&
+            (output_file->position == output_file->size)) {
+            is_extended =
+              file_truncate(output_file,
+                            output_file->position + (off_t)size) == 0;
+            errno = 0;
+        }
+
+        byte_reader_init(&reader, list_data, list_size);
+        get_extent_count(&reader, size, stored_size, &count);
+        result = write_extents_to_file(input_file,
+                                       data_position,
+                                       &reader,
+                                       count,
+                                       output_file,
+                                       size,
+                                       is_extended);
+    }
+
+    free(list_buffer);
+    return result;
+}
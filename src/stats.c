@@ -0,0 +1,439 @@
+#include "stats.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#define STATS_TOP_FILE_COUNT 10
+#define STATS_NO_PHASE STATS_PHASE_COUNT
+
+static const char* const PHASE_NAMES[STATS_PHASE_COUNT] = {
+    "scan",    "base",     "dedup",   "read-index", "assign", "headers",
+    "content", "checksum", "extract", "verify",     "print",  "cleanup"
+};
+
+static const char* const COUNTER_NAMES[STATS_COUNTER_COUNT] = {
+    "read_calls", "read_bytes",   "write_calls", "write_bytes", "copy_calls",
+    "copy_bytes", "mapped_bytes", "open_calls",  "other_calls"
+};
+
+/* Time and I/O of one phase (times are in nanoseconds).
+ */
+struct phase_stats
+{
+    int is_used;
+    uint64_t wall_time;
+    uint64_t cpu_time;
+    uint64_t counters[STATS_COUNTER_COUNT];
+};
+
+/* File in list of largest or slowest files.
+ */
+struct file_stats
+{
+    char* path;
+    uint64_t size;
+    uint64_t time; // processing time in nanoseconds (0 if not measured)
+    uint64_t rank; // value which list is sorted by
+};
+
+/* List of files with largest rank sorted by decreasing rank.
+ */
+struct top_files
+{
+    struct file_stats files[STATS_TOP_FILE_COUNT];
+    size_t count;
+};
+
+/* Statistics of whole program run.
+ */
+struct program_stats
+{
+    uint64_t counters[STATS_COUNTER_COUNT];
+    int is_started;
+
+    enum stats_phase current_phase; // STATS_NO_PHASE before first phase
+    uint64_t phase_wall_start;
+    uint64_t phase_cpu_start;
+    uint64_t phase_counters_start[STATS_COUNTER_COUNT];
+    struct phase_stats phases[STATS_PHASE_COUNT];
+
+    int has_tree; // 1 if stats_add_tree() was called, 0 otherwise
+    uint64_t directory_count;
+    uint64_t file_count;
+    uint64_t symlink_count;
+    uint64_t file_bytes;
+    struct top_files largest_files;
+
+    struct top_files slowest_files;
+    uint64_t slowest_time_threshold; // time of last file in full list,
+                                     // faster files are skipped without lock
+    pthread_mutex_t slowest_files_mutex;
+};
+
+static struct program_stats stats = {
+    .current_phase = STATS_NO_PHASE,
+    .slowest_files_mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Return time of clock in nanoseconds.
+ */
+static uint64_t
+get_clock_time(clockid_t clock)
+{
+    struct timespec time;
+    if (clock_gettime(clock, &time) < 0)
+        return 0;
+    return (uint64_t)time.tv_sec * 1000000000 + (uint64_t)time.tv_nsec;
+}
+
+/* Return CPU time of all threads of process in nanoseconds.
+ */
+static uint64_t
+get_cpu_time(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return 0;
+    const uint64_t seconds =
+      (uint64_t)usage.ru_utime.tv_sec + (uint64_t)usage.ru_stime.tv_sec;
+    const uint64_t microseconds =
+      (uint64_t)usage.ru_utime.tv_usec + (uint64_t)usage.ru_stime.tv_usec;
+    return seconds * 1000000000 + microseconds * 1000;
+}
+
+void
+stats_add(enum stats_counter counter, uint64_t value)
+{
+    __atomic_fetch_add(&(stats.counters[counter]), value, __ATOMIC_RELAXED);
+}
+
+void
+stats_start(void)
+{
+    stats.is_started = 1;
+}
+
+/* Add time and I/O since start of current phase to it.
+ */
+static void
+finish_phase(void)
+{
+    if (stats.current_phase == STATS_NO_PHASE)
+        return;
+
+    struct phase_stats* const phase = stats.phases + stats.current_phase;
+    phase->is_used = 1;
+    phase->wall_time +=
+      get_clock_time(CLOCK_MONOTONIC) - stats.phase_wall_start;
+    phase->cpu_time += get_cpu_time() - stats.phase_cpu_start;
+    unsigned int i;
+    for (i = 0; i < STATS_COUNTER_COUNT; i++)
+        phase->counters[i] +=
+          __atomic_load_n(&(stats.counters[i]), __ATOMIC_RELAXED) -
+          stats.phase_counters_start[i];
+}
+
+void
+stats_set_phase(enum stats_phase phase)
+{
+    if (!stats.is_started)
+        return;
+
+    finish_phase();
+    stats.current_phase = phase;
+    stats.phase_wall_start = get_clock_time(CLOCK_MONOTONIC);
+    stats.phase_cpu_start = get_cpu_time();
+    unsigned int i;
+    for (i = 0; i < STATS_COUNTER_COUNT; i++)
+        stats.phase_counters_start[i] =
+          __atomic_load_n(&(stats.counters[i]), __ATOMIC_RELAXED);
+}
+
+/* Insert file to top_files if its rank is large enough. Statistics are not
+ * essential, so file is skipped if memory can not be allocated.
+ */
+static void
+insert_top_file(struct top_files* top_files,
+                const struct file_data* file_data,
+                uint64_t time,
+                uint64_t rank)
+{
+    size_t position = top_files->count;
+    while ((position > 0) && (top_files->files[position - 1].rank < rank))
+        position--;
+    if (position >= STATS_TOP_FILE_COUNT)
+        return;
+
+    char path[FILE_PATH_BUFFER_SIZE];
+    get_file_path(file_data, NULL, path, sizeof(path));
+    char* const path_copy = str_create_copy(path);
+    if (path_copy == NULL)
+        return;
+
+    if (top_files->count == STATS_TOP_FILE_COUNT)
+        free(top_files->files[STATS_TOP_FILE_COUNT - 1].path);
+    else
+        top_files->count++;
+    memmove(top_files->files + position + 1,
+            top_files->files + position,
+            (top_files->count - 1 - position) * sizeof(struct file_stats));
+
+    struct file_stats* const file = top_files->files + position;
+    file->path = path_copy;
+    file->size = (uint64_t)file_data->file_size;
+    file->time = time;
+    file->rank = rank;
+}
+
+uint64_t
+stats_start_file(void)
+{
+    if (!stats.is_started)
+        return 0;
+    return get_clock_time(CLOCK_MONOTONIC);
+}
+
+void
+stats_finish_file(uint64_t start_time, const struct file_data* file_data)
+{
+    if (start_time == 0)
+        return;
+
+    const uint64_t time = get_clock_time(CLOCK_MONOTONIC) - start_time;
+    if (time <= __atomic_load_n(&(stats.slowest_time_threshold),
+                                __ATOMIC_RELAXED))
+        return;
+
+    pthread_mutex_lock(&(stats.slowest_files_mutex));
+    insert_top_file(&(stats.slowest_files), file_data, time, time);
+    if (stats.slowest_files.count == STATS_TOP_FILE_COUNT)
+        __atomic_store_n(
+          &(stats.slowest_time_threshold),
+          stats.slowest_files.files[STATS_TOP_FILE_COUNT - 1].rank,
+          __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&(stats.slowest_files_mutex));
+}
+
+void
+stats_add_tree(const struct file_data* file_data)
+{
+    stats.has_tree = 1;
+
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        if (walk.is_leaving)
+            continue;
+        const struct file_data* const current_file_data = walk.file_data;
+        switch (current_file_data->file_mode & S_IFMT) {
+            case S_IFDIR:
+                stats.directory_count++;
+                break;
+            case S_IFREG:
+                stats.file_count++;
+                stats.file_bytes += (uint64_t)current_file_data->file_size;
+                insert_top_file(&(stats.largest_files),
+                                current_file_data,
+                                0,
+                                (uint64_t)current_file_data->file_size);
+                break;
+            case S_IFLNK:
+                stats.symlink_count++;
+                break;
+        }
+    }
+}
+
+/* Print string as JSON string literal. Bytes which are not ASCII are printed
+ * as is.
+ */
+static void
+print_json_string(FILE* output, const char* string)
+{
+    fputc('"', output);
+    const unsigned char* ptr;
+    for (ptr = (const unsigned char*)string; *ptr; ptr++) {
+        if ((*ptr == '"') || (*ptr == '\\'))
+            fprintf(output, "\\%c", *ptr);
+        else if (*ptr < 0x20)
+            fprintf(output, "\\u%04x", *ptr);
+        else
+            fputc(*ptr, output);
+    }
+    fputc('"', output);
+}
+
+static void
+print_phase_json(FILE* output,
+                 const char* name,
+                 const struct phase_stats* phase)
+{
+    fprintf(output, "{\"name\":");
+    print_json_string(output, name);
+    fprintf(output,
+            ",\"wall_s\":%.6f,\"cpu_s\":%.6f",
+            phase->wall_time / 1e9,
+            phase->cpu_time / 1e9);
+    unsigned int i;
+    for (i = 0; i < STATS_COUNTER_COUNT; i++)
+        fprintf(output, ",\"%s\":%lu", COUNTER_NAMES[i], phase->counters[i]);
+    fprintf(output, "}");
+}
+
+static void
+print_top_files_json(FILE* output, const struct top_files* top_files)
+{
+    fprintf(output, "[");
+    size_t i;
+    for (i = 0; i < top_files->count; i++) {
+        const struct file_stats* const file = top_files->files + i;
+        fprintf(output, "%s{\"path\":", (i > 0) ? "," : "");
+        print_json_string(output, file->path);
+        fprintf(output, ",\"size\":%lu", file->size);
+        if (file->time != 0)
+            fprintf(output, ",\"time_s\":%.6f", file->time / 1e9);
+        fprintf(output, "}");
+    }
+    fprintf(output, "]");
+}
+
+static void
+print_stats_json(FILE* output,
+                 const struct phase_stats* total,
+                 long peak_memory)
+{
+    fprintf(output, "{\"phases\":[");
+    int is_first = 1;
+    unsigned int i;
+    for (i = 0; i < STATS_PHASE_COUNT; i++) {
+        if (!stats.phases[i].is_used)
+            continue;
+        if (!is_first)
+            fprintf(output, ",");
+        print_phase_json(output, PHASE_NAMES[i], stats.phases + i);
+        is_first = 0;
+    }
+    fprintf(output, "],\"total\":");
+    print_phase_json(output, "total", total);
+    if (stats.has_tree) {
+        fprintf(output,
+                ",\"directories\":%lu,\"files\":%lu,\"symlinks\":%lu,"
+                "\"file_bytes\":%lu",
+                stats.directory_count,
+                stats.file_count,
+                stats.symlink_count,
+                stats.file_bytes);
+        fprintf(output, ",\"largest_files\":");
+        print_top_files_json(output, &(stats.largest_files));
+    }
+    fprintf(output, ",\"slowest_files\":");
+    print_top_files_json(output, &(stats.slowest_files));
+    fprintf(output, ",\"peak_memory_kb\":%ld}\n", peak_memory);
+}
+
+static void
+print_phase_text(FILE* output,
+                 const char* name,
+                 const struct phase_stats* phase)
+{
+    const uint64_t* const counters = phase->counters;
+    fprintf(output,
+            "%-11s %9.3f %9.3f %10lu %12.1f %12.1f\n",
+            name,
+            phase->wall_time / 1e9,
+            phase->cpu_time / 1e9,
+            counters[STATS_READ_CALLS] + counters[STATS_WRITE_CALLS] +
+              counters[STATS_COPY_CALLS] + counters[STATS_OPEN_CALLS] +
+              counters[STATS_OTHER_CALLS],
+            (counters[STATS_READ_BYTES] + counters[STATS_COPY_BYTES] +
+             counters[STATS_MAPPED_BYTES]) /
+              1e6,
+            (counters[STATS_WRITE_BYTES] + counters[STATS_COPY_BYTES]) / 1e6);
+}
+
+static void
+print_stats_text(FILE* output,
+                 const struct phase_stats* total,
+                 long peak_memory)
+{
+    fprintf(output,
+            "%-11s %9s %9s %10s %12s %12s\n",
+            "Phase",
+            "Wall, s",
+            "CPU, s",
+            "Syscalls",
+            "Read, MB",
+            "Written, MB");
+    unsigned int i;
+    for (i = 0; i < STATS_PHASE_COUNT; i++) {
+        if (stats.phases[i].is_used)
+            print_phase_text(output, PHASE_NAMES[i], stats.phases + i);
+    }
+    print_phase_text(output, "total", total);
+
+    if (stats.has_tree)
+        fprintf(output,
+                "Entries: %lu directories, %lu files, %lu symlinks, %lu bytes "
+                "in files\n",
+                stats.directory_count,
+                stats.file_count,
+                stats.symlink_count,
+                stats.file_bytes);
+    fprintf(output, "Peak memory: %ld KiB\n", peak_memory);
+
+    size_t j;
+    if (stats.largest_files.count > 0) {
+        fprintf(output, "Largest files:\n");
+        for (j = 0; j < stats.largest_files.count; j++)
+            fprintf(output,
+                    "  %14lu  %s\n",
+                    stats.largest_files.files[j].size,
+                    stats.largest_files.files[j].path);
+    }
+    if (stats.slowest_files.count > 0) {
+        fprintf(output, "Slowest files:\n");
+        for (j = 0; j < stats.slowest_files.count; j++)
+            fprintf(output,
+                    "  %10.6f s  %14lu  %s\n",
+                    stats.slowest_files.files[j].time / 1e9,
+                    stats.slowest_files.files[j].size,
+                    stats.slowest_files.files[j].path);
+    }
+}
+
+void
+stats_print(const struct program_parameters* program_parameters)
+{
+    finish_phase();
+    stats.current_phase = STATS_NO_PHASE;
+
+    struct phase_stats total;
+    memset(&total, 0, sizeof(total));
+    unsigned int i;
+    for (i = 0; i < STATS_PHASE_COUNT; i++) {
+        total.wall_time += stats.phases[i].wall_time;
+        total.cpu_time += stats.phases[i].cpu_time;
+        unsigned int j;
+        for (j = 0; j < STATS_COUNTER_COUNT; j++)
+            total.counters[j] += stats.phases[i].counters[j];
+    }
+
+    struct rusage usage;
+    long peak_memory = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        peak_memory = usage.ru_maxrss;
+
+    if (program_parameters->stats_format == STATS_FORMAT_JSON)
+        print_stats_json(stderr, &total, peak_memory);
+    else
+        print_stats_text(stderr, &total, peak_memory);
+}
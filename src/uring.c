@@ -0,0 +1,533 @@
+#include "uring.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/* Maximum size of one write request from memory (requests have 32-bit
+ * length).
+ */
+#define URING_MAX_WRITE_SIZE (1 << 30)
+
+/* io_uring instance with mapped rings.
+ */
+struct uring
+{
+    int fd;              // io_uring file descriptor (-1 if not created)
+    void* sq_ring;       // mapped submission queue ring (NULL if not mapped)
+    size_t sq_ring_size; // size of sq_ring mapping
+    void* cq_ring; // mapped completion queue ring (NULL if not mapped, the
+                   // same as sq_ring if kernel maps both rings together)
+    size_t cq_ring_size;       // size of cq_ring mapping
+    struct io_uring_sqe* sqes; // mapped submission queue entries (NULL if
+                               // not mapped)
+    size_t sqes_size;          // size of sqes mapping
+    unsigned int* sq_head;     // ring fields shared with kernel
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int queued_count; // number of requests added after sq_tail
+};
+
+/* State of slot copying one file.
+ */
+enum uring_slot_state
+{
+    URING_SLOT_FREE,     // slot has no job
+    URING_SLOT_OPENING,  // file is being opened
+    URING_SLOT_READING,  // portion of content is being read to buffer
+    URING_SLOT_WRITING,  // portion of content is being written
+    URING_SLOT_CLOSING   // file is being closed
+};
+
+/* Slot copying one file, it has at most one request in progress.
+ */
+struct uring_slot
+{
+    struct uring_job job;
+    size_t job_index;
+    enum uring_slot_state state;
+    int fd; // opened file descriptor (-1 if file is not opened)
+    const char* source_data; // content in memory (NULL if it is read to
+                             // buffer)
+    char* buffer;            // buffer of URING_BUFFER_SIZE bytes
+    size_t copied_size;      // number of copied bytes of content
+    const char* portion;     // portion of content being written
+    size_t portion_size;     // size of portion in bytes (0 if there is none)
+    size_t portion_written;  // number of written bytes of portion
+};
+
+static void
+uring_unmap(void* mapping, size_t size)
+{
+    if (mapping != NULL)
+        munmap(mapping, size);
+}
+
+/* Map part of io_uring file at offset. Return NULL on error.
+ */
+static void*
+uring_map(int fd, size_t size, off_t offset)
+{
+    void* const mapping = mmap(NULL,
+                               size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE,
+                               fd,
+                               offset);
+    stats_add(STATS_OTHER_CALLS, 1);
+    return (mapping == MAP_FAILED) ? NULL : mapping;
+}
+
+/* Check that requests used for copying are supported by io_uring with given
+ * file descriptor. Return 0 if they are, -1 otherwise.
+ */
+static int
+check_uring_requests(int fd)
+{
+    const unsigned int probe_op_count = 256;
+    struct io_uring_probe* const probe =
+      calloc(1,
+             sizeof(struct io_uring_probe) +
+               sizeof(struct io_uring_probe_op) * probe_op_count);
+    if (probe == NULL)
+        return -1;
+
+    int result =
+      (int)syscall(SYS_io_uring_register,
+                   fd,
+                   IORING_REGISTER_PROBE,
+                   probe,
+                   probe_op_count);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if (result >= 0) {
+        static const unsigned char opcodes[] = {
+            IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE
+        };
+        size_t i;
+        for (i = 0; i < sizeof(opcodes); i++) {
+            if ((opcodes[i] > probe->last_op) ||
+                !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED)) {
+                errno = EOPNOTSUPP;
+                result = -1;
+            }
+        }
+    }
+
+    free(probe);
+    return (result < 0) ? -1 : 0;
+}
+
+struct uring*
+uring_create(void)
+{
+    struct uring* const ring = malloc(sizeof(struct uring));
+    if (ring == NULL)
+        return NULL;
+    ring->sq_ring = NULL;
+    ring->cq_ring = NULL;
+    ring->sqes = NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(SYS_io_uring_setup, URING_SLOT_COUNT, &params);
+    stats_add(STATS_OTHER_CALLS, 1);
+    if ((ring->fd < 0) || (check_uring_requests(ring->fd) < 0)) {
+        uring_free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->sq_ring =
+          uring_map(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->sq_ring =
+          uring_map(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+        ring->cq_ring =
+          uring_map(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = uring_map(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if ((ring->sq_ring == NULL) || (ring->cq_ring == NULL) ||
+        (ring->sqes == NULL)) {
+        uring_free(ring);
+        return NULL;
+    }
+
+    char* const sq_ring = ring->sq_ring;
+    char* const cq_ring = ring->cq_ring;
+    ring->sq_head = (unsigned int*)(sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)(sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned int*)(cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+    ring->queued_count = 0;
+
+    return ring;
+}
+
+void
+uring_free(struct uring* ring)
+{
+    if (ring == NULL)
+        return;
+    uring_unmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring)
+        uring_unmap(ring->cq_ring, ring->cq_ring_size);
+    uring_unmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        stats_add(STATS_OTHER_CALLS, 1);
+    }
+    free(ring);
+}
+
+/* Add empty request to submission queue and return it. Queue is never full,
+ * because every slot has at most one request in progress.
+ */
+static struct io_uring_sqe*
+queue_request(struct uring* ring, size_t index)
+{
+    const unsigned int position =
+      (*(ring->sq_tail) + ring->queued_count) & *(ring->sq_mask);
+    struct io_uring_sqe* const sqe = &(ring->sqes[position]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = index;
+    ring->sq_array[position] = position;
+    ring->queued_count++;
+    return sqe;
+}
+
+/* Submit queued requests and wait for at least one completion. Return 0 on
+ * success, -1 on error.
+ */
+static int
+submit_requests(struct uring* ring)
+{
+    // Kernel reads queued entries after it sees new tail
+    __atomic_store_n(ring->sq_tail,
+                     *(ring->sq_tail) + ring->queued_count,
+                     __ATOMIC_RELEASE);
+    ring->queued_count = 0;
+
+    while (1) {
+        const unsigned int submit_count =
+          *(ring->sq_tail) - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        const long result = syscall(SYS_io_uring_enter,
+                                    ring->fd,
+                                    submit_count,
+                                    1,
+                                    IORING_ENTER_GETEVENTS,
+                                    NULL,
+                                    0);
+        stats_add(STATS_OTHER_CALLS, 1);
+        if (result >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+/* Queue next request of slot with index after its previous request is
+ * completed. Return 1 if request is queued, 0 if job is finished.
+ */
+static int
+queue_next_request(struct uring* ring,
+                   struct uring_slot* slot,
+                   size_t index,
+                   const struct file_wrapper* archive_file)
+{
+    const struct uring_job* const job = &(slot->job);
+    const int to_archive = (job->flags & O_ACCMODE) == O_RDONLY;
+    struct io_uring_sqe* sqe;
+
+    if (slot->state == URING_SLOT_OPENING) {
+        sqe = queue_request(ring, index);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)job->path;
+        sqe->len = job->mode;
+        sqe->open_flags = (uint32_t)job->flags;
+        return 1;
+    }
+
+    if ((slot->portion_size == 0) && (slot->copied_size == job->size)) {
+        if (slot->fd < 0)
+            return 0;
+        slot->state = URING_SLOT_CLOSING;
+        sqe = queue_request(ring, index);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot->fd;
+        return 1;
+    }
+
+    const size_t remaining_size = job->size - slot->copied_size;
+    if ((slot->portion_size == 0) && (slot->source_data == NULL)) {
+        slot->state = URING_SLOT_READING;
+        sqe = queue_request(ring, index);
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = (uint64_t)(uintptr_t)slot->buffer;
+        sqe->len = (remaining_size < URING_BUFFER_SIZE) ? remaining_size
+                                                         : URING_BUFFER_SIZE;
+        if (to_archive) {
+            sqe->fd = slot->fd;
+            sqe->off = slot->copied_size;
+        } else {
+            sqe->fd = (int)archive_file->fd;
+            sqe->off = (uint64_t)job->archive_position + slot->copied_size;
+        }
+        return 1;
+    }
+
+    if (slot->portion_size == 0) {
+        slot->portion = slot->source_data + slot->copied_size;
+        slot->portion_size = (remaining_size < URING_MAX_WRITE_SIZE)
+                               ? remaining_size
+                               : URING_MAX_WRITE_SIZE;
+        slot->portion_written = 0;
+    }
+    slot->state = URING_SLOT_WRITING;
+    sqe = queue_request(ring, index);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->portion + slot->portion_written);
+    sqe->len = slot->portion_size - slot->portion_written;
+    if (to_archive) {
+        sqe->fd = (int)archive_file->fd;
+        sqe->off = (uint64_t)job->archive_position + slot->copied_size +
+                   slot->portion_written;
+    } else {
+        sqe->fd = slot->fd;
+        sqe->off = slot->copied_size + slot->portion_written;
+    }
+    return 1;
+}
+
+/* Start job of slot with index. Return 1 if request is queued, 0 if job is
+ * already finished, -1 on error.
+ */
+static int
+start_job(struct uring* ring,
+          struct uring_slot* slot,
+          size_t index,
+          const struct file_wrapper* archive_file)
+{
+    const struct uring_job* const job = &(slot->job);
+    slot->fd = -1;
+    slot->copied_size = 0;
+    slot->portion_size = 0;
+    slot->source_data = job->data;
+    if (((job->flags & O_ACCMODE) != O_RDONLY) && (job->data == NULL) &&
+        (archive_file->mapping != NULL)) {
+        // Content is written directly from archive mapping
+        slot->source_data =
+          file_get_data(archive_file, job->archive_position, job->size);
+        if (slot->source_data == NULL)
+            return -1;
+    }
+
+    if (job->flags & O_CREAT) {
+        // io_uring always hands creating opens off to its worker threads,
+        // which costs more than opening file from this thread
+        slot->fd = openat(AT_FDCWD, job->path, job->flags, job->mode);
+        stats_add(STATS_OPEN_CALLS, 1);
+        if (slot->fd < 0)
+            return -1;
+        slot->state = URING_SLOT_READING;
+        return queue_next_request(ring, slot, index, archive_file);
+    }
+    slot->state =
+      (job->data == NULL) ? URING_SLOT_OPENING : URING_SLOT_WRITING;
+    return queue_next_request(ring, slot, index, archive_file);
+}
+
+/* Process result of completed request of slot with index. Return 1 if next
+ * request is queued, 0 if job is finished, -1 on error (errno is set).
+ */
+static int
+complete_request(struct uring* ring,
+                 struct uring_slot* slot,
+                 size_t index,
+                 int result,
+                 const struct file_wrapper* archive_file)
+{
+    if (((result == -EINTR) || (result == -EAGAIN)) &&
+        (slot->state != URING_SLOT_CLOSING))
+        return queue_next_request(ring, slot, index, archive_file);
+
+    switch (slot->state) {
+        case URING_SLOT_OPENING:
+            stats_add(STATS_OPEN_CALLS, 1);
+            if (result < 0)
+                break;
+            slot->fd = result;
+            slot->state = URING_SLOT_READING;
+            return queue_next_request(ring, slot, index, archive_file);
+        case URING_SLOT_READING:
+            stats_add(STATS_READ_CALLS, 1);
+            if (result < 0)
+                break;
+            if (result == 0) {
+                // File is shorter than expected (probably truncated)
+                result = -EIO;
+                break;
+            }
+            stats_add(STATS_READ_BYTES, (uint64_t)result);
+            slot->portion = slot->buffer;
+            slot->portion_size = (size_t)result;
+            slot->portion_written = 0;
+            return queue_next_request(ring, slot, index, archive_file);
+        case URING_SLOT_WRITING:
+            stats_add(STATS_WRITE_CALLS, 1);
+            if (result <= 0) {
+                result = (result < 0) ? result : -EIO;
+                break;
+            }
+            stats_add(STATS_WRITE_BYTES, (uint64_t)result);
+            slot->portion_written += (size_t)result;
+            if (slot->portion_written == slot->portion_size) {
+                slot->copied_size += slot->portion_size;
+                slot->portion_size = 0;
+            }
+            return queue_next_request(ring, slot, index, archive_file);
+        case URING_SLOT_CLOSING:
+            stats_add(STATS_OTHER_CALLS, 1);
+            // File descriptor is released even if close fails
+            slot->fd = -1;
+            if ((result < 0) && (result != -EINTR))
+                break;
+            return 0;
+        case URING_SLOT_FREE:
+            break;
+    }
+
+    errno = -result;
+    return -1;
+}
+
+int
+uring_copy_files(struct uring* ring,
+                 struct file_wrapper* archive_file,
+                 size_t job_count,
+                 uring_prepare_function prepare_function,
+                 uring_finish_function finish_function,
+                 void* context)
+{
+    struct uring_slot* const slots =
+      malloc(sizeof(struct uring_slot) * URING_SLOT_COUNT);
+    char* const buffers = malloc((size_t)URING_BUFFER_SIZE * URING_SLOT_COUNT);
+    if ((slots == NULL) || (buffers == NULL)) {
+        free(slots);
+        free(buffers);
+        return -1;
+    }
+    size_t i;
+    for (i = 0; i < URING_SLOT_COUNT; i++) {
+        slots[i].state = URING_SLOT_FREE;
+        slots[i].fd = -1;
+        slots[i].buffer = buffers + i * URING_BUFFER_SIZE;
+    }
+
+    size_t next_job_index = 0;
+    unsigned int active_count = 0;
+    int error = 0; // errno of first error (0 if there is none)
+    while (1) {
+        // Free slots take next jobs, jobs which do not need requests are
+        // finished at once
+        for (i = 0; (i < URING_SLOT_COUNT) && (error == 0); i++) {
+            struct uring_slot* const slot = &(slots[i]);
+            while ((slot->state == URING_SLOT_FREE) &&
+                   (next_job_index < job_count) && (error == 0)) {
+                slot->job_index = next_job_index;
+                next_job_index++;
+                if (!prepare_function(slot->job_index, context, &(slot->job)))
+                    continue;
+                const int result = start_job(ring, slot, i, archive_file);
+                if (result < 0) {
+                    error = errno;
+                    slot->state = URING_SLOT_FREE;
+                } else if (result == 0) {
+                    slot->state = URING_SLOT_FREE;
+                    finish_function(slot->job_index, context, &(slot->job));
+                } else {
+                    active_count++;
+                }
+            }
+        }
+        if (active_count == 0)
+            break;
+
+        if (submit_requests(ring) < 0) {
+            // Requests in progress can not be waited for, so buffers are
+            // not deallocated
+            return -1;
+        }
+
+        unsigned int head = *(ring->cq_head);
+        const unsigned int tail =
+          __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe* const cqe =
+              &(ring->cqes[head & *(ring->cq_mask)]);
+            const size_t index = (size_t)cqe->user_data;
+            struct uring_slot* const slot = &(slots[index]);
+
+            int result;
+            if (error == 0) {
+                result =
+                  complete_request(ring, slot, index, cqe->res, archive_file);
+                if (result < 0)
+                    error = errno;
+            } else {
+                // After error, jobs in progress are abandoned
+                result = -1;
+                if ((slot->state == URING_SLOT_OPENING) && (cqe->res >= 0))
+                    slot->fd = cqe->res;
+                else if (slot->state == URING_SLOT_CLOSING)
+                    slot->fd = -1;
+            }
+
+            if (result <= 0) {
+                if (slot->fd >= 0) {
+                    close(slot->fd);
+                    stats_add(STATS_OTHER_CALLS, 1);
+                    slot->fd = -1;
+                }
+                slot->state = URING_SLOT_FREE;
+                active_count--;
+                if (result == 0)
+                    finish_function(slot->job_index, context, &(slot->job));
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(slots);
+    free(buffers);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,277 @@
+#include "verify.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "archive_v3.h"
+#include "checksum.h"
+#include "chunking.h"
+#include "codec.h"
+#include "parallel.h"
+
+/* Result of checking content of one entry.
+ */
+enum verify_status
+{
+    VERIFY_NOT_CHECKED,  // entry does not have checksum
+    VERIFY_OK,           // content is correct
+    VERIFY_OUT_OF_FILE,  // content is exceeding archive file
+    VERIFY_MISMATCH,     // content checksum does not match
+    VERIFY_BAD_CHUNKS    // chunk list or chunks are corrupted
+};
+
+/* Files and symlinks of archive with results of their checks.
+ */
+struct verify_context
+{
+    struct file_data** entries;
+    enum verify_status* statuses;
+    size_t count;
+    size_t capacity;
+    struct file_wrapper* input_file;
+    const struct program_parameters* program_parameters;
+};
+
+/* Append files and symlinks from file_data, following entries and all their
+ * descendants to context.
+ */
+static void
+collect_verified_entries(struct file_data* file_data,
+                         struct verify_context* context)
+{
+    struct directory_walk walk;
+    for (directory_walk_start(&walk, file_data); walk.file_data != NULL;
+         directory_walk_next(&walk)) {
+        struct file_data* const current_file_data = walk.file_data;
+        if ((current_file_data->file_mode & S_IFMT) == S_IFDIR)
+            continue;
+
+        if (context->count == context->capacity) {
+            const size_t new_capacity =
+              (context->capacity == 0) ? 64 : context->capacity * 2;
+            struct file_data** const new_entries = realloc(
+              context->entries, sizeof(struct file_data*) * new_capacity);
+            if (new_entries == NULL)
+                print_perror(context->program_parameters, "realloc() failed");
+            context->entries = new_entries;
+            context->capacity = new_capacity;
+        }
+        context->entries[context->count] = current_file_data;
+        context->count++;
+    }
+}
+
+/* Check content of one file or symlink.
+ */
+static void
+verify_entry_task(size_t task_index, void* context)
+{
+    struct verify_context* const verify_context = context;
+    const struct program_parameters* const program_parameters =
+      verify_context->program_parameters;
+    struct file_wrapper* const input_file = verify_context->input_file;
+    const struct file_data* const current_file_data =
+      verify_context->entries[task_index];
+    enum verify_status* const status = verify_context->statuses + task_index;
+
+    // Inline content is part of header block, which is checked by
+    // verify_index_v3()
+    if (current_file_data->inline_content != NULL) {
+        *status = VERIFY_NOT_CHECKED;
+        return;
+    }
+
+    const archive_ptr_t file_size = (archive_ptr_t)input_file->size;
+    if ((current_file_data->archive_content_position > file_size) ||
+        (current_file_data->archive_content_size >
+         file_size - current_file_data->archive_content_position)) {
+        *status = VERIFY_OUT_OF_FILE;
+        return;
+    }
+
+    *status = VERIFY_NOT_CHECKED;
+    if (current_file_data->has_content_checksum) {
+        uint32_t checksum;
+        if (file_checksum_at(input_file,
+                             (off_t)current_file_data->archive_content_position,
+                             current_file_data->archive_content_size,
+                             &checksum) < 0)
+            print_perror(program_parameters, "file_checksum_at() failed");
+        if (checksum != current_file_data->content_checksum) {
+            *status = VERIFY_MISMATCH;
+            return;
+        }
+        *status = VERIFY_OK;
+    }
+
+    // Chunks are shared between files, so they have their own checksums in
+    // chunk lists
+    if (current_file_data->content_codec == CODEC_CHUNKED) {
+        if (verify_chunked_content(
+              input_file,
+              (off_t)current_file_data->archive_content_position,
+              current_file_data->archive_content_size,
+              (size_t)current_file_data->file_size) < 0) {
+            if (errno != EIO)
+                print_perror(program_parameters,
+                             "verify_chunked_content() failed");
+            *status = VERIFY_BAD_CHUNKS;
+            return;
+        }
+        *status = VERIFY_OK;
+    }
+}
+
+/* Check checksum of index region of v3 archive at position (region is
+ * skipped if it is not present).
+ */
+static void
+verify_region_v3(struct file_wrapper* input_file,
+                 const struct archive_header_v3* header,
+                 archive_ptr_t position,
+                 archive_ptr_t size,
+                 uint32_t checksum,
+                 const char* region_name,
+                 const struct program_parameters* program_parameters)
+{
+    if (position == 0)
+        return;
+
+    void* region_copy;
+    const void* const region = load_archive_region(
+      input_file, position, size, &region_copy, program_parameters);
+    check_region_checksum_v3(
+      header, region, size, checksum, region_name, program_parameters);
+    free(region_copy);
+}
+
+/* Check main header and index regions of v3 archive in input_file.
+ */
+static void
+verify_index_v3(struct file_wrapper* input_file,
+                const struct program_parameters* program_parameters)
+{
+    struct archive_header_v3 header;
+    read_archive_header_v3(&header, input_file, program_parameters);
+    if (file_seek(input_file, 0) < 0)
+        print_perror(program_parameters, "file_seek() failed");
+
+    if ((header.flags & ARCHIVE_V3_HEADER_CHECKSUMS) == 0) {
+        print_info(program_parameters,
+                   "Archive does not have checksums, checking structure "
+                   "only\n");
+        return;
+    }
+
+    // Central directory is used instead of header block for reading, so
+    // header block is checked separately
+    verify_region_v3(input_file,
+                     &header,
+                     header.header_block_ptr,
+                     header.header_block_size,
+                     header.header_block_checksum,
+                     "header block",
+                     program_parameters);
+    verify_region_v3(input_file,
+                     &header,
+                     header.central_directory_ptr,
+                     header.central_directory_size,
+                     header.central_directory_checksum,
+                     "central directory",
+                     program_parameters);
+    verify_region_v3(input_file,
+                     &header,
+                     header.path_index_ptr,
+                     header.path_index_size,
+                     header.path_index_checksum,
+                     "path index",
+                     program_parameters);
+}
+
+void
+verify_archive(struct file_wrapper* input_file,
+               const struct program_parameters* program_parameters)
+{
+    uint8_t header_sign[ARCHIVE_HEADER_SIGN_SIZE];
+    if (file_pread(input_file, header_sign, ARCHIVE_HEADER_SIGN_SIZE, 0) < 0)
+        print_perror(program_parameters, "file_pread() failed");
+    if ((memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0) ||
+        (memcmp(header_sign,
+                ARCHIVE_HEADER_SIGN_V3_STREAM,
+                ARCHIVE_HEADER_SIGN_SIZE) == 0))
+        verify_index_v3(input_file, program_parameters);
+
+    // Headers are checked while directory tree is read
+    struct file_data* const archive_data =
+      read_full_archive(input_file, program_parameters);
+
+    struct verify_context context;
+    context.entries = NULL;
+    context.count = 0;
+    context.capacity = 0;
+    context.input_file = input_file;
+    context.program_parameters = program_parameters;
+    collect_verified_entries(archive_data, &context);
+
+    context.statuses = malloc(sizeof(enum verify_status) * context.count);
+    if ((context.statuses == NULL) && (context.count > 0))
+        print_perror(program_parameters, "malloc() failed");
+
+    run_parallel(context.count,
+                 program_parameters->thread_count,
+                 verify_entry_task,
+                 &context);
+
+    // Results are reported in archive order, not in order of completion
+    size_t error_count = 0;
+    size_t checked_count = 0;
+    char path[FILE_PATH_BUFFER_SIZE];
+    size_t i;
+    for (i = 0; i < context.count; i++) {
+        get_file_path(context.entries[i], NULL, path, sizeof(path));
+        switch (context.statuses[i]) {
+            case VERIFY_NOT_CHECKED:
+                break;
+            case VERIFY_OK:
+                checked_count++;
+                break;
+            case VERIFY_OUT_OF_FILE:
+                fprintf(stderr,
+                        "Error: content of %s is exceeding archive file\n",
+                        path);
+                error_count++;
+                break;
+            case VERIFY_MISMATCH:
+                fprintf(stderr, "Error: content checksum mismatch: %s\n", path);
+                error_count++;
+                break;
+            case VERIFY_BAD_CHUNKS:
+                fprintf(stderr, "Error: corrupted chunks: %s\n", path);
+                error_count++;
+                break;
+        }
+    }
+
+    print_info(program_parameters,
+               "Checked %lu files and symlinks, %lu of them by checksums\n",
+               context.count,
+               checked_count);
+
+    free(context.statuses);
+    free(context.entries);
+    free_directory_tree(archive_data);
+
+    if (error_count > 0)
+        print_error(program_parameters,
+                    "Error: %lu corrupted entries found\n",
+                    error_count);
+}